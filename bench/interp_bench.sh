@@ -0,0 +1,61 @@
+#!/usr/bin/env bash
+# Interpretation overhead benchmark.
+#
+# Generates large scripts made only of builtins and arithmetic (no forks), so
+# the measured time is spent lexing, parsing and walking the AST.
+#
+# Usage: bench/interp_bench.sh [shell] [scale]
+
+SHELL_BIN=${1:-build/mini-shell}
+SCALE=${2:-1}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+if [ ! -x "$SHELL_BIN" ]; then
+    echo "interp_bench: $SHELL_BIN not found (run make first)" >&2
+    exit 1
+fi
+
+# One long loop: the same small tree is executed many times
+gen_loop() {
+    echo "i=0; while ((i < $((200000 * SCALE)))); do ((i++)); : \$i; done"
+}
+
+# Nested compound commands executed many times
+gen_nested() {
+    printf 'for a in 1 2 3 4 5 6 7 8 9 10; do i=0; while ((i < %d)); do ' $((2000 * SCALE))
+    printf 'if ((i %% 2)); then case $i in *1) x=one;; *3|*5) x=odd;; *) x=other;; esac; '
+    printf 'elif ((i %% 3 == 0)); then true && x=three || x=none; else x=even; fi; '
+    printf '((i++)); done; done\n'
+}
+
+# Function calls
+gen_func() {
+    echo "inc() { ((n++)); }; n=0; while ((n < $((100000 * SCALE)))); do inc; done"
+}
+
+# A single very long command list: one large tree executed once
+gen_list() {
+    local n=$((20000 * SCALE))
+    for ((k = 0; k < n; ++k)); do printf 'x=%d; ' "$k"; done
+    echo ':'
+}
+
+# Many short lines: per-line parse overhead
+gen_lines() {
+    local n=$((50000 * SCALE))
+    for ((k = 0; k < n; ++k)); do echo "if true; then x=$k; fi"; done
+}
+
+run() {
+    local name=$1
+    "gen_$name" > "$TMP/$name.sh"
+    local start end
+    start=$(date +%s%N)
+    "$SHELL_BIN" < "$TMP/$name.sh" > /dev/null
+    end=$(date +%s%N)
+    printf '%-8s %8d ms\n' "$name" $(((end - start) / 1000000))
+}
+
+echo "shell: $SHELL_BIN (scale $SCALE)"
+for b in loop nested func list lines; do run "$b"; done
@@ -0,0 +1,47 @@
+#!/usr/bin/env bash
+# Startup benchmark: time from exec to exit for a shell reading an empty input,
+# without an rc file, with a generated rc file sourced on every launch, and
+# with the same rc file replayed from its snapshot.
+#
+# Usage: bench/startup_bench.sh [shell] [runs]
+
+SHELL_BIN=${1:-build/mini-shell}
+RUNS=${2:-200}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+if [ ! -x "$SHELL_BIN" ]; then
+    echo "startup_bench: $SHELL_BIN not found (run make first)" >&2
+    exit 1
+fi
+
+# 100 functions and 200 variables: declarative, so it can be snapshotted
+for ((i = 0; i < 100; ++i)); do
+    echo "f$i() { if ((\$1 > $i)); then echo \"big \$1\"; else echo small; fi; }"
+    echo "V$i=\"value $i\"; export E$i=e$i"
+done > "$TMP/rc"
+
+# Same file plus one command, so it is sourced every time
+{ cat "$TMP/rc"; echo ": sourced"; } > "$TMP/rc_src"
+
+# Average wall time of one launch in microseconds
+run() {
+    local rc=$1 start end
+    MINISHELLRC=$rc "$SHELL_BIN" < /dev/null > /dev/null 2>&1 # warm up / build the snapshot
+    start=$(date +%s%N)
+    for ((k = 0; k < RUNS; ++k)); do
+        MINISHELLRC=$rc "$SHELL_BIN" < /dev/null > /dev/null 2>&1
+    done
+    end=$(date +%s%N)
+    echo $(((end - start) / RUNS / 1000))
+}
+
+# Time from main() to the first prompt, as reported by the shell
+inproc() {
+    MINISHELLRC=$1 MINISHELL_STARTUP_TIME=1 "$SHELL_BIN" < /dev/null 2>&1 >/dev/null | sed -n 's/^startup: //p'
+}
+
+echo "shell: $SHELL_BIN ($RUNS runs)"
+printf '%-10s %8s us/launch   main->prompt %s\n' "no rc" "$(run /nonexistent)" "$(inproc /nonexistent)"
+printf '%-10s %8s us/launch   main->prompt %s\n' "sourced" "$(run "$TMP/rc_src")" "$(inproc "$TMP/rc_src")"
+printf '%-10s %8s us/launch   main->prompt %s\n' "snapshot" "$(run "$TMP/rc")" "$(inproc "$TMP/rc")"
@@ -0,0 +1,105 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Arithmetic expression node type.
+ */
+typedef enum arith_op {
+    ARITH_NUM, ///< integer constant
+    ARITH_VAR, ///< variable reference
+    ARITH_NEG, ///< unary '-'
+    ARITH_POS, ///< unary '+'
+    ARITH_NOT, ///< '!'
+    ARITH_BNOT, ///< '~'
+    ARITH_PREINC, ///< '++name'
+    ARITH_PREDEC, ///< '--name'
+    ARITH_POSTINC, ///< 'name++'
+    ARITH_POSTDEC, ///< 'name--'
+    ARITH_POW, ///< '**'
+    ARITH_MUL, ///< '*'
+    ARITH_DIV, ///< '/'
+    ARITH_MOD, ///< '%'
+    ARITH_ADD, ///< '+'
+    ARITH_SUB, ///< '-'
+    ARITH_SHL, ///< '<<'
+    ARITH_SHR, ///< '>>'
+    ARITH_LT, ///< '<'
+    ARITH_LE, ///< '<='
+    ARITH_GT, ///< '>'
+    ARITH_GE, ///< '>='
+    ARITH_EQ, ///< '=='
+    ARITH_NE, ///< '!='
+    ARITH_BAND, ///< '&'
+    ARITH_BXOR, ///< '^'
+    ARITH_BOR, ///< '|'
+    ARITH_LAND, ///< '&&'
+    ARITH_LOR, ///< '||'
+    ARITH_COND, ///< 'c ? a : b'
+    ARITH_ASSIGN, ///< '=' and compound assignments
+    ARITH_COMMA ///< ','
+} arith_op;
+
+/**
+ * @brief One node of a compiled arithmetic expression.
+ */
+typedef struct arith_node {
+    arith_op op; ///< Node type
+    arith_op aop; ///< Combining operator of a compound assignment (ARITH_ASSIGN for '=')
+    int a; ///< First operand index (-1 if unused)
+    int b; ///< Second operand index (-1 if unused)
+    int c; ///< Condition index for ARITH_COND (-1 if unused)
+    int64_t num; ///< Value for ARITH_NUM
+    char *name; ///< Heap-allocated variable name, or NULL
+} arith_node;
+
+/**
+ * @brief Compiled arithmetic expression: a flat node array.
+ */
+typedef struct arith_expr {
+    arith_node *nodes; ///< Heap-allocated node array.
+    size_t len; ///< Number of nodes.
+    size_t cap; ///< Allocated capacity of nodes.
+    int root; ///< Index of the root node.
+} arith_expr;
+
+/**
+ * @brief Compile an arithmetic expression.
+ *
+ * @param src Expression text (no '$' expansions left).
+ * @param len Number of characters of src to compile.
+ * @param out Output compiled expression.
+ * @return non-zero if failed (syntax error is reported on stderr).
+ */
+int arith_compile(const char *src, size_t len, arith_expr *out);
+
+/**
+ * @brief Free a compiled expression (the struct itself is not freed).
+ */
+void arith_free(arith_expr *expr);
+
+/**
+ * @brief Evaluate a compiled expression with 64-bit integer semantics.
+ *
+ * Variables are read from and assigned to the shell variable table.
+ *
+ * @param expr Compiled expression.
+ * @param out Result.
+ * @return non-zero if failed (error is reported on stderr).
+ */
+int arith_eval(const arith_expr *expr, int64_t *out);
+
+/**
+ * @brief Compile (or reuse a cached compilation of) and evaluate an expression.
+ *
+ * @param src Expression text.
+ * @param len Number of characters of src.
+ * @param out Result.
+ * @return non-zero if failed.
+ */
+int arith_eval_str(const char *src, size_t len, int64_t *out);
+
+/**
+ * @brief Drop every cached compiled expression.
+ */
+void arith_cache_cleanup(void);
@@ -16,8 +16,30 @@ typedef int (*builtin_fn)(cmd_node *node, int *status);
 typedef struct builtin_cmd {
     const char *name;
     builtin_fn fn;
+    int pure; ///< Nonzero if it leaves shell state untouched (safe to run in a substitution).
 } builtin_cmd;
 
+/**
+ * @brief Version of the loadable builtin interface (cmd_node and builtin_cmd layout).
+ */
+#define BUILTIN_MODULE_ABI 1
+
+/**
+ * @brief Name of the builtin_module object a module exports.
+ */
+#define BUILTIN_MODULE_SYMBOL "minishell_module"
+
+/**
+ * @brief Registration exported by a module loaded with "enable -f".
+ *
+ * A module is a shared object built against these headers that defines
+ * `const builtin_module minishell_module = {BUILTIN_MODULE_ABI, table};`.
+ */
+typedef struct builtin_module {
+    int abi; ///< BUILTIN_MODULE_ABI the module was built with
+    const builtin_cmd *builtins; ///< Builtins provided, terminated by {NULL, NULL, 0}
+} builtin_module;
+
 /**
  * @brief bg builtin implementation.
  */
@@ -28,6 +50,11 @@ int bg_fn(cmd_node *node, int *status);
  */
 int fg_fn(cmd_node *node, int *status);
 
+/**
+ * @brief wait builtin implementation.
+ */
+int wait_fn(cmd_node *node, int *status);
+
 /**
  * @brief jobs builtin implementation.
  */
@@ -39,10 +66,122 @@ int jobs_fn(cmd_node *node, int *status);
 int exit_fn(cmd_node *node, int *_);
 
 /**
- * @brief cd builtin implementation.
+ * @brief cd builtin implementation ("cd [-L|-P] [dir]").
+ *
+ * By default the new $PWD is computed lexically from the old one, keeping
+ * symlinks, without a getcwd call; -P (or a logical path that cannot be
+ * entered) resolves it physically instead.
  */
 int cd_fn(cmd_node *node, int *status);
 
+/**
+ * @brief Set $PWD at startup: the inherited value if it names the working
+ * directory, getcwd otherwise.
+ */
+void pwd_init(void);
+
+/**
+ * @brief export builtin implementation.
+ */
+int export_fn(cmd_node *node, int *status);
+
+/**
+ * @brief unset builtin implementation.
+ */
+int unset_fn(cmd_node *node, int *status);
+
+/**
+ * @brief echo builtin implementation.
+ */
+int echo_fn(cmd_node *node, int *status);
+
+/**
+ * @brief pwd builtin implementation ("pwd [-P]", $PWD unless -P).
+ */
+int pwd_fn(cmd_node *node, int *status);
+
+/**
+ * @brief true / ':' builtin implementation.
+ */
+int true_fn(cmd_node *node, int *status);
+
+/**
+ * @brief false builtin implementation.
+ */
+int false_fn(cmd_node *node, int *status);
+
+/**
+ * @brief break builtin implementation.
+ */
+int break_fn(cmd_node *node, int *status);
+
+/**
+ * @brief continue builtin implementation.
+ */
+int continue_fn(cmd_node *node, int *status);
+
+/**
+ * @brief return builtin implementation.
+ */
+int return_fn(cmd_node *node, int *status);
+
+/**
+ * @brief shift builtin implementation.
+ */
+int shift_fn(cmd_node *node, int *status);
+
+/**
+ * @brief timeout builtin implementation.
+ */
+int timeout_fn(cmd_node *node, int *status);
+
+/**
+ * @brief ulimit builtin implementation.
+ */
+int ulimit_fn(cmd_node *node, int *status);
+
+/**
+ * @brief shellstats builtin implementation.
+ */
+int shellstats_fn(cmd_node *node, int *status);
+
+/**
+ * @brief memstats builtin implementation.
+ */
+int memstats_fn(cmd_node *node, int *status);
+
+/**
+ * @brief enable builtin implementation (load builtins from modules).
+ */
+int enable_fn(cmd_node *node, int *status);
+
+/**
+ * @brief hash builtin implementation ("hash -r" forgets cached command paths).
+ */
+int hash_fn(cmd_node *node, int *status);
+
+/**
+ * @brief Unload every builtin loaded with enable.
+ */
+void builtin_cleanup(void);
+
+/**
+ * @brief Get the builtin dispatch table (loaded builtins included).
+ *
+ * @return Builtin table terminated by {NULL, NULL, 0}; it changes when
+ *         builtins are loaded or removed.
+ */
+const builtin_cmd *get_builtins(void);
+
+/**
+ * @brief Find a builtin by name (loaded ones first, then a perfect hash of
+ * the compiled-in ones).
+ *
+ * @param name Command name.
+ * @return Builtin entry, or NULL.
+ */
+const builtin_cmd *builtin_lookup(const char *name);
+
 /**
  * @brief Check whether a command node is a builtin.
  *
@@ -51,6 +190,14 @@ int cd_fn(cmd_node *node, int *status);
  */
 int is_builtin(cmd_node *node);
 
+/**
+ * @brief Check whether a name is a builtin without side effects on the shell.
+ *
+ * @param name Command name.
+ * @return 1 if it is a pure builtin, 0 otherwise.
+ */
+int is_pure_builtin(const char *name);
+
 /**
  * @brief Execute a builtin and apply temporary redirections if needed.
  *
@@ -59,3 +206,13 @@ int is_builtin(cmd_node *node);
  * @return 0 on success, non-zero on error.
  */
 int run_builtin(cmd_node *node, int *status);
+
+/**
+ * @brief Execute a builtin already looked up (see run_builtin).
+ *
+ * @param b Builtin entry.
+ * @param node Command node to execute.
+ * @param status Optional output status pointer.
+ * @return 0 on success, non-zero on error.
+ */
+int run_builtin_cmd(const builtin_cmd *b, cmd_node *node, int *status);
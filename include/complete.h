@@ -0,0 +1,38 @@
+#pragma once
+#include <stddef.h>
+
+/**
+ * @brief Completion candidate kind, derived from the word position.
+ */
+typedef enum complete_kind {
+    COMPLETE_COMMAND, ///< first word of a command: builtins and PATH executables
+    COMPLETE_FILE, ///< argument or redirection target: file names
+    COMPLETE_JOB ///< word starting with '%': job ids from the job table
+} complete_kind;
+
+/**
+ * @brief Find the completion candidates for the word ending at cursor.
+ *
+ * The executable index is built on first use, kept up to date through
+ * inotify, and rebuilt only when PATH changes.
+ *
+ * @param line   Input line being edited.
+ * @param cursor Cursor offset in line (end of the word being completed).
+ * @param start  Output: offset where the word being completed starts.
+ * @return Heap-allocated, sorted, NULL-terminated candidate list (or NULL on error).
+ */
+char **complete_line(const char *line, size_t cursor, size_t *start);
+
+/**
+ * @brief Collect candidates of a given kind that start with prefix.
+ *
+ * @param kind   Completion kind.
+ * @param prefix Prefix to match.
+ * @return Heap-allocated, sorted, NULL-terminated candidate list (or NULL on error).
+ */
+char **complete_word(complete_kind kind, const char *prefix);
+
+/**
+ * @brief Release the executable index and its inotify watches.
+ */
+void complete_cleanup(void);
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdint.h>
+
+#include "flat.h"
 #include "parse.h"
 #include "job.h"
 
@@ -7,67 +10,188 @@
 /**
  * @brief Executes a NODE_CMD and returns its exit code.
  *
- * @param node NODE_CMD to be run.
+ * @param f Flat AST.
+ * @param node Index of the NODE_CMD to be run.
  * @param status shell-style exit code if successfully executed.
  * @param isbg whether the node should be run in background.
  * @return non-zero if failed (internal error).
  */
-int execute_cmd(ast_node *node, int *status, int isbg);
+int execute_cmd(flat_ast *f, uint32_t node, int *status, int isbg);
+
+/**
+ * @brief Runs an external command as a foreground job under a deadline.
+ *
+ * The command keeps the shell's job control (its own process group, the
+ * terminal, Ctrl+Z); no helper process is involved.
+ *
+ * @param cmd Expanded command node.
+ * @param spec Deadline and signals.
+ * @param status Output: 124 if it timed out, 137 if it was killed, else the command status.
+ * @return non-zero if failed.
+ */
+int exec_timeout(cmd_node *cmd, const timeout_spec *spec, int *status);
 
 /**
  * @brief Executes a NODE_PIPE and returns its exit code.
  *
- * @param node NODE_PIPE to be run.
+ * @param f Flat AST.
+ * @param node Index of the NODE_PIPE to be run.
  * @param status shell-style exit code if successfully executed.
  * @param isbg whether the node should be run in background.
  * @return non-zero if failed (internal error).
  */
-int execute_pipe(ast_node *node, int *status, int isbg);
+int execute_pipe(flat_ast *f, uint32_t node, int *status, int isbg);
 
 /**
  * @brief Executes a NODE_SEQ and returns the last command's exit code.
  *
  * Commands are executed in order. Non-zero exit codes do not stop the sequence.
  *
- * @param node NODE_SEQ to be run.
+ * @param f Flat AST.
+ * @param node Index of the NODE_SEQ to be run.
  * @param status shell-style exit code of the last command if successfully executed.
  * @return non-zero if failed (internal error).
  */
-int execute_seq(ast_node *node, int *status);
+int execute_seq(flat_ast *f, uint32_t node, int *status);
 
 /**
  * @brief Executes a NODE_AND and returns the exit code of the last executed child.
  *
  * Right child executes only if left child returns exit status 0.
  *
- * @param node NODE_AND to be run.
+ * @param f Flat AST.
+ * @param node Index of the NODE_AND to be run.
  * @param status shell-style exit code if successfully executed.
  * @return non-zero if failed (internal error).
  */
-int execute_and(ast_node *node, int *status);
+int execute_and(flat_ast *f, uint32_t node, int *status);
 
 /**
  * @brief Executes a NODE_OR and returns the exit code of the last executed child.
  *
  * Right child executes only if left child returns a non-zero exit status.
  *
- * @param node NODE_OR to be run.
+ * @param f Flat AST.
+ * @param node Index of the NODE_OR to be run.
  * @param status shell-style exit code if successfully executed.
  * @return non-zero if failed (internal error).
  */
-int execute_or(ast_node *node, int *status);
+int execute_or(flat_ast *f, uint32_t node, int *status);
 
 /**
  * @brief Executes a NODE_BG as a background process and returns zero if succesfully executed.
  *
- * @param node NODE_BG to be run
+ * @param f Flat AST.
+ * @param node Index of the NODE_BG to be run
  * @param status shell-style exit code if successfully executed.
  * @return non-zero if failed (internal error).
  */
-int execute_bg(ast_node *node, int *status);
+int execute_bg(flat_ast *f, uint32_t node, int *status);
+
+/**
+ * @brief Executes a NODE_ARITH.
+ *
+ * The exit code is 0 if the expression is non-zero, 1 otherwise (or on error).
+ *
+ * @param f Flat AST.
+ * @param node Index of the NODE_ARITH to be run.
+ * @param status shell-style exit code if successfully executed.
+ * @return non-zero if failed (internal error).
+ */
+int execute_arith(flat_ast *f, uint32_t node, int *status);
+
+/**
+ * @brief Executes a NODE_IF (elif chains are nested NODE_IFs).
+ *
+ * @param f Flat AST.
+ * @param node Index of the NODE_IF to be run.
+ * @param status exit code of the branch that ran, 0 if none did.
+ * @return non-zero if failed (internal error).
+ */
+int execute_if(flat_ast *f, uint32_t node, int *status);
+
+/**
+ * @brief Executes a NODE_WHILE or NODE_UNTIL.
+ *
+ * The body AST is reused on every iteration.
+ *
+ * @param f Flat AST.
+ * @param node Index of the NODE_WHILE / NODE_UNTIL to be run.
+ * @param status exit code of the last body run, 0 if it never ran.
+ * @return non-zero if failed (internal error).
+ */
+int execute_while(flat_ast *f, uint32_t node, int *status);
+
+/**
+ * @brief Executes a NODE_FOR: the body runs once per expanded word,
+ * with the loop variable set to it.
+ *
+ * @param f Flat AST.
+ * @param node Index of the NODE_FOR to be run.
+ * @param status exit code of the last body run, 0 if it never ran.
+ * @return non-zero if failed (internal error).
+ */
+int execute_for(flat_ast *f, uint32_t node, int *status);
+
+/**
+ * @brief Executes a NODE_CASE: the first item with a matching pattern runs.
+ *
+ * @param f Flat AST.
+ * @param node Index of the NODE_CASE to be run.
+ * @param status exit code of the item that ran, 0 if none did.
+ * @return non-zero if failed (internal error).
+ */
+int execute_case(flat_ast *f, uint32_t node, int *status);
+
+/**
+ * @brief Executes a NODE_FUNC: stores its (already parsed) body in the function table.
+ *
+ * @param f Flat AST.
+ * @param node Index of the NODE_FUNC to be run.
+ * @param status 0 if defined, 1 otherwise.
+ * @return non-zero if failed (internal error).
+ */
+int execute_func(flat_ast *f, uint32_t node, int *status);
+
+/**
+ * @brief Request a return from the function being executed.
+ *
+ * @param status Exit code of the function call.
+ * @return non-zero if no function is being executed.
+ */
+int exec_return(int status);
+
+/**
+ * @brief Request a break (or continue) out of the enclosing loops.
+ *
+ * @param levels Number of enclosing loops (clamped to the loop depth).
+ * @param cont Nonzero to continue the outermost of those loops instead.
+ * @return non-zero if not inside a loop.
+ */
+int exec_loop_control(int levels, int cont);
+
+/**
+ * @brief Dispatches execution of a flat node based on its type.
+ *
+ * @param f Flat AST.
+ * @param node Index of the node to be run.
+ * @param status shell-style exit code (0-255) if successfully executed.
+ * @param isbg whether the node should be run in background.
+ * @return non-zero if failed (internal error).
+ */
+int execute_node(flat_ast *f, uint32_t node, int *status, int isbg);
+
+/**
+ * @brief Executes a whole flat AST from its root.
+ *
+ * @param f Flat AST.
+ * @param status shell-style exit code (0-255) if successfully executed.
+ * @return non-zero if failed (internal error).
+ */
+int execute_flat(flat_ast *f, int *status);
 
 /**
- * @brief Dispatches execution based on node type.
+ * @brief Flattens a tree and executes it.
  *
  * @param node AST node to be run.
  * @param status shell-style exit code (0-255) if successfully executed.
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "parse.h"
+
+/**
+ * @brief Expand a word list into fields.
+ *
+ * Performs parameter expansion ($NAME, ${NAME}, $?, $$), command
+ * substitution ($(...)), field splitting
+ * of unquoted expansion results on IFS, and quote removal.
+ *
+ * @param words NULL-terminated list of lexer words.
+ * @return Heap-allocated, NULL-terminated field list (or NULL on error).
+ */
+char **expand_words(char **words);
+
+/**
+ * @brief Expand a single word without field splitting.
+ *
+ * Used for redirection targets and assignment values.
+ *
+ * @param word Lexer word.
+ * @return Heap-allocated expanded string (or NULL on error).
+ */
+char *expand_word(const char *word);
+
+/**
+ * @brief Expand a single word as a pattern (case items).
+ *
+ * Like expand_word, but quoted characters stay escaped with LEX_CTLESC so the
+ * result can be passed to wc_compile.
+ *
+ * @param word Lexer word.
+ * @return Heap-allocated pattern field (or NULL on error).
+ */
+char *expand_pattern(const char *word);
+
+/**
+ * @brief Expand every word of a command node.
+ *
+ * @param cmd Parsed command node.
+ * @param out Output command node holding expanded argv, io (NULL without
+ *            redirections) and assigns.
+ * @return non-zero if failed (internal error).
+ */
+int expand_cmd(const cmd_node *cmd, cmd_node *out);
+
+/**
+ * @brief Free a command node built by expand_cmd.
+ *
+ * @param cmd Expanded command node (the struct itself is not freed).
+ */
+void free_expanded_cmd(cmd_node *cmd);
@@ -0,0 +1,195 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arith.h"
+#include "parse.h"
+
+/**
+ * @brief Marks a missing child (e.g. an if without else).
+ */
+#define FLAT_NONE UINT32_MAX
+
+/**
+ * @brief Loop variable and word list of a NODE_FOR.
+ */
+typedef struct flat_for {
+    const char *name; ///< Loop variable name (points into the pool).
+    char **words; ///< NULL-terminated word list (points into ptrs).
+} flat_for;
+
+/**
+ * @brief One item of a NODE_CASE.
+ */
+typedef struct flat_case_item {
+    char **patterns; ///< NULL-terminated pattern list (points into ptrs).
+    uint32_t body; ///< Body node index.
+} flat_case_item;
+
+/**
+ * @brief Subject and items of a NODE_CASE.
+ */
+typedef struct flat_case {
+    const char *word; ///< Subject word (points into the pool).
+    flat_case_item *items; ///< Items (points into items).
+    uint32_t nitems; ///< Number of items.
+} flat_case;
+
+/**
+ * @brief Expression of a NODE_ARITH, compiled on first run.
+ */
+typedef struct flat_arith {
+    const char *src; ///< Expression text (points into the pool).
+    arith_expr expr; ///< Compiled expression (root -1 until compiled).
+} flat_arith;
+
+typedef struct flat_ast flat_ast;
+struct cmd_resolution;
+
+/**
+ * @brief Element counts of every flat array (and the pool size in bytes).
+ */
+typedef struct flat_sizes {
+    size_t nodes;
+    size_t kids;
+    size_t cmds;
+    size_t fors;
+    size_t cases;
+    size_t items;
+    size_t ariths;
+    size_t funcs;
+    size_t ptrs;
+    size_t redirs;
+    size_t rptrs;
+    size_t pool;
+} flat_sizes;
+
+/**
+ * @brief Name and body of a NODE_FUNC.
+ */
+typedef struct flat_func {
+    const char *name; ///< Function name (points into the pool).
+    flat_ast *body; ///< Separately flattened body (shared with the function table).
+} flat_func;
+
+/**
+ * @brief Flattened AST.
+ *
+ * Nodes are stored in postorder (children before parents) as a struct of
+ * arrays. Child lists, command views, strings and the other per-type payloads
+ * live in contiguous arrays carved out of a single allocation.
+ *
+ * Per node type:
+ *  - NODE_SEQ, NODE_PIPE: kids are the children.
+ *  - NODE_BG: kids = {child}.
+ *  - NODE_AND, NODE_OR: kids = {left, right}.
+ *  - NODE_IF: kids = {cond, then, else or FLAT_NONE}.
+ *  - NODE_WHILE, NODE_UNTIL: kids = {cond, body}.
+ *  - NODE_FOR: kids = {body}, data indexes fors.
+ *  - NODE_CASE: no kids, data indexes cases (item bodies are in items).
+ *  - NODE_CMD: data indexes cmds.
+ *  - NODE_ARITH: data indexes ariths.
+ *  - NODE_FUNC: no kids, data indexes funcs.
+ *
+ * Function bodies are flattened on their own and reference counted, so a
+ * defined function keeps its body after the defining line is freed.
+ */
+typedef struct flat_ast {
+    uint8_t *types; ///< node_type of each node.
+    uint32_t *kid_start; ///< Index of the first child slot in kids.
+    uint32_t *kid_count; ///< Number of child slots.
+    uint32_t *data; ///< Index into the per-type payload array, or FLAT_NONE.
+    uint32_t nnodes; ///< Number of nodes.
+    uint32_t root; ///< Root node index (the last node).
+
+    uint32_t *kids; ///< Child node indices, grouped per node.
+    cmd_node *cmds; ///< Command views; argv/io/assigns point into ptrs/rptrs.
+    flat_for *fors; ///< NODE_FOR payloads.
+    flat_case *cases; ///< NODE_CASE payloads.
+    flat_case_item *items; ///< Case items of every NODE_CASE.
+    flat_arith *ariths; ///< NODE_ARITH payloads.
+    uint32_t nariths; ///< Number of ariths.
+    flat_func *funcs; ///< NODE_FUNC payloads.
+    uint32_t nfuncs; ///< Number of funcs.
+    char **ptrs; ///< NULL-terminated string vectors pointing into the pool.
+    redir *redirs; ///< Redirection records (paths point into the pool).
+    redir **rptrs; ///< NULL-terminated redirection vectors pointing into redirs.
+    char *pool; ///< String pool.
+
+    void *block; ///< The single allocation backing every array above.
+    flat_sizes sizes; ///< Element counts the block was laid out for.
+    size_t size; ///< Block size in bytes.
+    unsigned refs; ///< Reference count.
+    uint32_t line_first; ///< First source line (0: unknown), see flat_set_lines.
+    uint32_t line_last; ///< Last source line.
+    uint32_t line_body; ///< 0 for the lines themselves, N for the Nth function body defined there.
+    struct cmd_resolution *resolved; ///< Cached name resolution per command (see resolve.h), or NULL.
+} flat_ast;
+
+/**
+ * @brief Build the flattened form of a parsed tree.
+ *
+ * The result does not reference the tree, which can be freed right away.
+ *
+ * @param root Parsed AST.
+ * @return Heap-allocated flat AST (or NULL on error).
+ */
+flat_ast *flatten_ast(const ast_node *root);
+
+/**
+ * @brief Parse a line straight to its flattened form.
+ *
+ * @param line line of input
+ * @return Heap-allocated flat AST (or NULL on parse error).
+ */
+flat_ast *parse_line_flat(const char *line);
+
+/**
+ * @brief Parse a lexed command straight to its flattened form.
+ *
+ * @param tokens NULL-terminated token list (still owned by the caller)
+ * @return Heap-allocated flat AST (or NULL on parse error).
+ */
+flat_ast *parse_tokens_flat(lex_token **tokens);
+
+/**
+ * @brief Tag a flat AST and the bodies of the functions it defines with the
+ * source lines they were parsed from (used by the profiler).
+ */
+void flat_set_lines(flat_ast *f, uint32_t first, uint32_t last);
+
+/**
+ * @brief Take another reference to a flat AST.
+ *
+ * @return f
+ */
+flat_ast *flat_ref(flat_ast *f);
+
+/**
+ * @brief Drop a reference to a flat AST, freeing it (including compiled
+ * arithmetic expressions and function bodies) with the last one.
+ */
+void free_flat_ast(flat_ast *f);
+
+/**
+ * @brief Write a relocatable image of a flat AST (and its function bodies).
+ *
+ * Internal pointers are stored as offsets from the block start, so loading an
+ * image is a copy and a relocation pass, without lexing or parsing.
+ *
+ * @param f Flat AST.
+ * @param out Output stream.
+ * @return non-zero if failed.
+ */
+int flat_write_image(const flat_ast *f, FILE *out);
+
+/**
+ * @brief Load an image written by flat_write_image.
+ *
+ * @param data Image bytes (e.g. part of a mapped file).
+ * @param len Number of bytes available at data.
+ * @param used Optional output: number of bytes the image takes.
+ * @return Heap-allocated flat AST (or NULL if the image is invalid or stale).
+ */
+flat_ast *flat_read_image(const void *data, size_t len, size_t *used);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "flat.h"
+
+/**
+ * @brief Define (or redefine) a shell function.
+ *
+ * The table takes its own reference to the body.
+ *
+ * @param name Function name.
+ * @param body Flattened, already parsed body.
+ * @return non-zero if failed (internal error).
+ */
+int func_define(const char *name, flat_ast *body);
+
+/**
+ * @brief Look up a shell function.
+ *
+ * @param name Function name.
+ * @return Body owned by the table (take a reference to keep it across a
+ *         redefinition), or NULL if not defined.
+ */
+flat_ast *func_lookup(const char *name);
+
+/**
+ * @brief Remove a shell function.
+ *
+ * @param name Function name.
+ * @return non-zero if it was not defined.
+ */
+int func_unset(const char *name);
+
+/**
+ * @brief Drop every function.
+ */
+void funcs_cleanup(void);
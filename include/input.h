@@ -0,0 +1,14 @@
+#pragma once
+
+/**
+ * @brief Print a prompt and read one line of input.
+ *
+ * On a terminal, the line is edited in raw mode with Tab completion
+ * (see complete.h). Otherwise it is read with getline.
+ *
+ * @param prompt Prompt printed before reading.
+ * @return Heap-allocated line including the trailing newline, or NULL
+ *         on end of input (errno == 0), Ctrl-C (errno == ECANCELED) or
+ *         error (errno set, EINTR included).
+ */
+char *read_line(const char *prompt);
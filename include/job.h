@@ -1,5 +1,6 @@
 #pragma once
 
+#include <time.h>
 #include <unistd.h>
 
 #define MAX_JOBS (1 << 15)
@@ -31,6 +32,7 @@ typedef struct process {
     proc_state state; ///< process current state;
     int exit_code; ///< valid if state == PROC_DONE and exited normally
     int term_sig; ///< valid if state == PROC_DONE and signaled
+    unsigned limits; ///< rlimit_class bits of the limits set by a limit prefix
 } process;
 
 // Declaration for recursive node
@@ -48,9 +50,19 @@ typedef struct job {
     job_state state; ///< Current job state
     int isbg; ///< Is background? (1: true, 0: false)
     int isupd; ///< Is updated recently? (1: true, 0: false)
+    int isqos; ///< Runs under the background QoS policy? (1: true, 0: false)
     job *next; ///< Next job in linked list
 } job;
 
+/**
+ * @brief Deadline of a timed foreground job (timeout builtin).
+ */
+typedef struct timeout_spec {
+    struct timespec after; ///< Time before the first signal (zero: no deadline)
+    int sig; ///< First signal sent to the job's process group
+    struct timespec kill_after; ///< Delay before SIGKILL once signaled (zero: never)
+} timeout_spec;
+
 /**
  * @brief generates an ID for job being created
  * @return current job ID
@@ -97,14 +109,100 @@ void remove_zombies(void);
 /**
  * @brief Used to gracefully terminate remaining jobs,
  * and kill them if they don't.
+ *
+ * Every job gets SIGTERM (and SIGCONT if stopped), then the shell sleeps on
+ * pidfds of their processes and returns as soon as the last one exits. Jobs
+ * still running after the grace period (MINISHELL_KILL_GRACE seconds,
+ * default 0.5) get SIGKILL, and the wait ends at most a second later.
  */
 void kill_jobs(void);
 
+/**
+ * @brief Unlink a job from the list and free it (no "Done" message).
+ * @param j Job to remove.
+ */
+void remove_job(job *j);
+
+/**
+ * @brief Find the job owning a process.
+ * @param pid Process ID.
+ * @param idx Optional output: index of the process in the job.
+ * @return job pointer (NULL if not found)
+ */
+job *find_job_pid(pid_t pid, int *idx);
+
+/**
+ * @brief Shell-style status of a process (128 + signal if killed or stopped).
+ */
+int proc_status(const process *p);
+
+/**
+ * @brief Shell-style status of a job (the status of its last process).
+ */
+int job_status(const job *j);
+
+/**
+ * @brief Block until one process of a job terminates or stops.
+ *
+ * Only that child is waited for (targeted waitpid).
+ *
+ * @param j Job owning the process.
+ * @param i Process index.
+ * @return non-zero if failed (internal error).
+ */
+int wait_proc(job *j, int i);
+
+/**
+ * @brief Block until every process of a job terminates (or the job stops).
+ * @param j Job to wait for.
+ * @return non-zero if failed (internal error).
+ */
+int wait_job(job *j);
+
+/**
+ * @brief Block until a job terminates (or stops), signaling it on a deadline.
+ *
+ * The wait sleeps in poll() on a timerfd and a SIGCHLD signalfd. When the
+ * timer expires, spec->sig (then SIGCONT) goes to the job's process group
+ * (to its own pids in a subshell, which shares the group of its pipeline);
+ * with a kill_after delay, SIGKILL follows if the job is still running.
+ *
+ * The deadline is wall-clock: it keeps running while the job is stopped. In
+ * the shell itself a stop (Ctrl+Z) ends the wait and the job, now in the job
+ * table, loses its deadline; a subshell keeps waiting.
+ *
+ * @param j Job to wait for.
+ * @param spec Deadline.
+ * @param expired Output: 0 if no signal was sent, 1 if spec->sig was, 2 if SIGKILL was.
+ * @return non-zero if failed (internal error).
+ */
+int wait_job_timed(job *j, const timeout_spec *spec, int *expired);
+
+/**
+ * @brief Block until any background job is done.
+ *
+ * A background job that is already done is returned right away.
+ *
+ * @return The done job (still in the table), or NULL if no background job is running.
+ */
+job *wait_any_job(void);
+
+/**
+ * @brief Drop every job from the table without signaling it.
+ * Used in forked subshells, which must not touch the parent's jobs.
+ */
+void forget_jobs(void);
+
 /**
  * @brief Used to print active jobs table. called by 'jobs' command
  */
 void print_jobs(void);
 
+/**
+ * @brief Number of jobs in the table.
+ */
+int count_jobs(void);
+
 /**
  * @brief get job description based on the id
  * @param id Job id
@@ -1,5 +1,22 @@
 #pragma once
 #include <stddef.h>
+#include <stdint.h>
+
+// Word Markers
+
+/**
+ * @brief Marks the next character of a word as literal (quoted or escaped).
+ *
+ * TK_DEFAULT data keeps quoting information for the expansion stage:
+ * characters that are special to expansion are prefixed with LEX_CTLESC
+ * when they were quoted, and quoted regions are wrapped in LEX_CTLQUOTE.
+ */
+#define LEX_CTLESC '\001'
+
+/**
+ * @brief Opens or closes a quoted region of a word.
+ */
+#define LEX_CTLQUOTE '\002'
 
 // Lexer Structures
 
@@ -26,6 +43,11 @@ typedef enum lex_token_type {
     TK_REDIR_APPEND, ///< append redirection token '>>'
     TK_AND, ///< and token '&&'
     TK_OR, ///< or token '||'
+    TK_ARITH, ///< arithmetic command '((...))', data holds the expression
+    TK_NEWLINE, ///< newline, a command separator like ';'
+    TK_DSEMI, ///< case item terminator ';;'
+    TK_LPAREN, ///< '('
+    TK_RPAREN, ///< ')'
 } lex_token_type;
 
 /**
@@ -33,7 +55,7 @@ typedef enum lex_token_type {
  */
 typedef struct lex_token {
     lex_token_type type; ///< Token classification
-    char *data; ///< Heap-allocated token Cstring for TK_DEFAULT, otherwise NULL.
+    char *data; ///< Heap-allocated token Cstring for TK_DEFAULT and TK_ARITH, otherwise NULL.
     int next_adj; ///< Nonzero when adjacent to the next token (no whitespace).
 } lex_token;
 
@@ -55,6 +77,26 @@ typedef struct lex_token_list {
     size_t cap; ///< Allocated capacity of tokens.
 } lex_token_list;
 
+/**
+ * @brief Incremental lexer fed one line at a time.
+ *
+ * The state at the end of a line (open quote or escape, partial word,
+ * trailing operator, open compound commands) is kept, so every byte of a
+ * multi-line command is lexed once.
+ */
+typedef struct lex_stream {
+    lex_token_list list; ///< Tokens so far.
+    lex_token_buf buf; ///< Word being built.
+    lex_state state; ///< State at the end of the last chunk.
+    lex_state esc_from; ///< State to return to after an escape.
+    char *pending; ///< Unclosed "$(...)" or "((...))", lexed again with the next chunk (or NULL).
+    int joined; ///< Nonzero if the last chunk ended with a backslash-newline.
+    int cmd_pos; ///< Nonzero if the next word is in command position.
+    int skip_word; ///< Nonzero if the next word is a redirection target.
+    int depth; ///< Compound commands and subshells still open.
+    int case_depth; ///< Case commands still open.
+} lex_stream;
+
 // API Functions
 
 /**
@@ -73,6 +115,46 @@ void free_lex_token(lex_token *token);
  */
 void free_lex_token_adapter(void *p);
 
+/**
+ * @brief Find the end of a "$(...)" command substitution.
+ *
+ * Quotes, escapes and nested parentheses inside the substitution are skipped.
+ *
+ * @param s string just after the opening "$("
+ * @return pointer to the matching ')', or NULL if unterminated.
+ */
+const char *lex_subst_end(const char *s);
+
+/**
+ * @brief Initialize an empty lexer stream.
+ */
+void lex_stream_init(lex_stream *s);
+
+/**
+ * @brief Release everything held by a lexer stream and make it empty again.
+ */
+void lex_stream_free(lex_stream *s);
+
+/**
+ * @brief Lex a chunk of input (usually a line, newline included), resuming
+ * where the previous one stopped.
+ *
+ * @param s lexer stream
+ * @param chunk input
+ * @return 0 if the input so far is a complete command, 1 if more input is
+ * needed, -1 on error (the stream is emptied).
+ */
+int lex_feed(lex_stream *s, const char *chunk);
+
+/**
+ * @brief Take the tokens lexed so far and empty the stream.
+ *
+ * @param s lexer stream
+ * @return Heap-allocated, NULL-terminated lex_token list, or NULL if the
+ * input ends inside a quote, escape or substitution.
+ */
+lex_token **lex_take(lex_stream *s);
+
 /**
  * @brief Tokenizes the string to be parsed.
  *
@@ -81,6 +163,34 @@ void free_lex_token_adapter(void *p);
  */
 lex_token **lex_line(const char *str);
 
+/**
+ * @brief Source of input lines for lex_read_command.
+ *
+ * @param ctx Caller data.
+ * @param more 0 for the first line of a command, 1 for a continuation line.
+ * @return Heap-allocated line (newline included), or NULL at end of input
+ *         (errno == 0), when interrupted (EINTR, ECANCELED) or on error.
+ */
+typedef char *(*lex_line_fn)(void *ctx, int more);
+
+/**
+ * @brief Read lines until the lexer has a complete command.
+ *
+ * Every line is fed to the stream as it arrives, so a command may span
+ * lines (quotes, backslash-newline, trailing operators, open compound
+ * commands). EINTR on a continuation line keeps the partial command.
+ *
+ * @param ls Lexer stream (empty on return).
+ * @param next Line source.
+ * @param ctx Data passed to next.
+ * @param lineno Line counter, advanced for every line read.
+ * @param tokens Output tokens, NULL if the command could not be lexed.
+ * @return 0 if a command was read (or failed to lex, or ended with the
+ *         input), 1 if interrupted before it was complete (errno kept),
+ *         -1 at end of input (errno == 0) or on error.
+ */
+int lex_read_command(lex_stream *ls, lex_line_fn next, void *ctx, uint32_t *lineno, lex_token ***tokens);
+
 /**
  * @brief Debugging function to print token.
  * @param tok token being printed
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * @brief Subsystem an allocation is accounted to.
+ */
+typedef enum mem_tag {
+    MEM_LEX, ///< Tokens and token buffers
+    MEM_PARSE, ///< AST nodes and their strings
+    MEM_EXEC, ///< Executor scratch (pipes, saved assignments)
+    MEM_JOB, ///< Job table entries
+    MEM_REDIR, ///< Saved descriptors of temporary redirections
+    MEM_NTAGS, ///< Number of tags
+} mem_tag;
+
+/**
+ * @brief Accounted malloc.
+ *
+ * Blocks carry a small header with their tag and size, so they must be
+ * released with mem_free (or resized with mem_realloc), never with free.
+ *
+ * @param tag Subsystem.
+ * @param size Bytes.
+ * @return Block, or NULL (errno set).
+ */
+void *mem_malloc(mem_tag tag, size_t size);
+
+/**
+ * @brief Accounted calloc (see mem_malloc).
+ */
+void *mem_calloc(mem_tag tag, size_t n, size_t size);
+
+/**
+ * @brief Accounted realloc (see mem_malloc).
+ *
+ * A block keeps the tag it was allocated with.
+ *
+ * @param tag Subsystem, used when p is NULL.
+ * @param p Block from mem_malloc/mem_calloc/mem_realloc, or NULL.
+ * @param size New size in bytes.
+ * @return Resized block, or NULL (p is left untouched).
+ */
+void *mem_realloc(mem_tag tag, void *p, size_t size);
+
+/**
+ * @brief Accounted strdup (see mem_malloc).
+ */
+char *mem_strdup(mem_tag tag, const char *s);
+
+/**
+ * @brief Accounted strndup (see mem_malloc).
+ */
+char *mem_strndup(mem_tag tag, const char *s, size_t n);
+
+/**
+ * @brief Release an accounted block (NULL is ignored).
+ *
+ * Takes void * so it can be used as a destructor callback.
+ */
+void mem_free(void *p);
+
+/**
+ * @brief free_ptrv for an accounted NULL-terminated array.
+ *
+ * @param arr Array from the accounted allocator.
+ * @param destroy Destructor for one element (e.g. mem_free), or NULL.
+ */
+void mem_free_ptrv(void **arr, void (*destroy)(void *));
+
+/**
+ * @brief Print live bytes, peak bytes and allocation counts per subsystem.
+ */
+void mem_print(FILE *out);
+
+/**
+ * @brief Print the accounting at exit if MINISHELL_MEMSTATS is set.
+ */
+void mem_init(void);
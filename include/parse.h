@@ -1,5 +1,7 @@
 #pragma once
 
+#include "lex.h"
+
 // Abstract Syntax Tree Structures
 
 /**
@@ -12,6 +14,13 @@ typedef enum node_type {
     NODE_CMD, ///< Command (leaves of the tree)
     NODE_AND, ///< AND operator, separated by '&&'
     NODE_OR, ///< OR operator, separated by '||'
+    NODE_ARITH, ///< Arithmetic command '((...))'
+    NODE_IF, ///< if / elif / else
+    NODE_WHILE, ///< while loop
+    NODE_UNTIL, ///< until loop
+    NODE_FOR, ///< for-in loop
+    NODE_CASE, ///< case statement
+    NODE_FUNC, ///< function definition 'name() { ...; }'
 } node_type;
 
 typedef struct ast_node ast_node; // declaration for recursive structure
@@ -63,9 +72,68 @@ typedef struct redir {
  */
 typedef struct cmd_node {
     char **argv; ///< Heap-allocated, NULL-terminated argument list.
-    redir **io;
+    redir **io; ///< Heap-allocated, NULL-terminated redirection list.
+    char **assigns; ///< Heap-allocated, NULL-terminated "NAME=VALUE" prefix assignments.
 } cmd_node;
 
+/**
+ * @brief Used for NODE_IF. An elif chain is a nested NODE_IF in else_part.
+ */
+typedef struct if_node {
+    ast_node *cond; ///< condition list
+    ast_node *then_part; ///< list run when cond succeeds
+    ast_node *else_part; ///< list run otherwise (or NULL)
+} if_node;
+
+/**
+ * @brief Used for NODE_WHILE and NODE_UNTIL as
+ * both have the same structure.
+ */
+typedef struct loop_node {
+    ast_node *cond; ///< condition list, run before every iteration
+    ast_node *body; ///< loop body
+} loop_node;
+
+/**
+ * @brief Used for NODE_FOR
+ */
+typedef struct for_node {
+    char *name; ///< Heap-allocated loop variable name
+    char **words; ///< Heap-allocated, NULL-terminated word list (unexpanded)
+    ast_node *body; ///< loop body
+} for_node;
+
+/**
+ * @brief One "pattern | pattern) list ;;" item of a case statement.
+ */
+typedef struct case_item {
+    char **patterns; ///< Heap-allocated, NULL-terminated pattern words (unexpanded)
+    ast_node *body; ///< list run on match
+} case_item;
+
+/**
+ * @brief Used for NODE_CASE
+ */
+typedef struct case_node {
+    char *word; ///< Heap-allocated subject word (unexpanded)
+    case_item **items; ///< Heap-allocated, NULL-terminated items
+} case_node;
+
+/**
+ * @brief used for NODE_ARITH
+ */
+typedef struct arith_cmd_node {
+    char *src; ///< Heap-allocated expression text between "((" and "))".
+} arith_cmd_node;
+
+/**
+ * @brief Used for NODE_FUNC
+ */
+typedef struct func_node {
+    char *name; ///< Heap-allocated function name
+    ast_node *body; ///< compound command run on every call
+} func_node;
+
 /**
  * @brief Abstract Syntax Tree Node.
  */
@@ -77,6 +145,12 @@ typedef struct ast_node {
         list_node list;
         bg_node bg;
         cmd_node cmd;
+        arith_cmd_node arith;
+        if_node cond;
+        loop_node loop;
+        for_node loop_for;
+        case_node cases;
+        func_node func;
     } as; ///< An abstraction to node information based on type
 } ast_node;
 
@@ -98,6 +172,21 @@ void free_redir(redir *io);
  */
 void free_redir_adapter(void *p);
 
+/**
+ * @brief Free a case_item struct
+ *
+ * @param item Pointer to a case_item struct
+ */
+void free_case_item(case_item *item);
+
+/**
+ * @brief Adapter for free_case_item to match void* destructor callbacks.
+ * Used when freeing generic pointer vectors.
+ *
+ * @param p Pointer to a case_item struct
+ */
+void free_case_item_adapter(void *p);
+
 /**
  * @brief Free an AST Node.
  *
@@ -113,6 +202,14 @@ void free_ast_node(ast_node *node);
  */
 void free_ast_node_adapter(void *p);
 
+/**
+ * @brief Parses a lexed command to an AST
+ *
+ * @param tokens NULL-terminated token list (still owned by the caller)
+ * @return Heap-allocated parsed AST (or NULL on parse error)
+ */
+ast_node *parse_tokens(lex_token **tokens);
+
 /**
  * @brief Parses a line of input to an AST
  *
@@ -0,0 +1,36 @@
+#pragma once
+
+/**
+ * @brief CPU (and NUMA memory) placement of the stages of one pipeline.
+ *
+ * Configured through shell variables:
+ *  - MINISHELL_PIPE_CPUS: "auto" packs the stages on distinct cores of one
+ *    last-level-cache domain (from /sys/devices/system/cpu), or an explicit
+ *    colon-separated CPU list per stage ("0-1:2:3,7"), reused cyclically.
+ *  - MINISHELL_PIPE_NUMA: "preferred" or "bind" sets the memory policy of each
+ *    stage to the NUMA node of its CPUs.
+ */
+typedef struct place_plan place_plan;
+
+/**
+ * @brief Compute the placement of a pipeline before forking its stages.
+ *
+ * @param nstages Number of stages.
+ * @return Heap-allocated plan, or NULL if placement is off (or misconfigured,
+ *         which is reported on stderr).
+ */
+place_plan *place_plan_new(int nstages);
+
+/**
+ * @brief Apply the placement of one stage to the calling (child) process.
+ *
+ * @param plan Plan (NULL: nothing to do).
+ * @param stage Stage index.
+ * @return non-zero if failed (the stage still runs, unplaced).
+ */
+int place_apply(const place_plan *plan, int stage);
+
+/**
+ * @brief Free a plan.
+ */
+void place_plan_free(place_plan *plan);
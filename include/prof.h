@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Check whether the profiler is on.
+ */
+int prof_on(void);
+
+/**
+ * @brief Start the profiler if MINISHELL_PROFILE is set.
+ *
+ * Every top-level command of an input line (and of a function body, under
+ * the lines that defined it) gets an entry with its call count, wall time
+ * split into time in the shell and time waiting for children, and the user
+ * and system CPU time of the children reaped meanwhile. A report sorted by
+ * wall time is printed at exit, to stderr or to MINISHELL_PROFILE_OUT.
+ *
+ * @return non-zero if failed (profiling stays off).
+ */
+int prof_init(void);
+
+/**
+ * @brief Remember the text of an input line, used as the label of its entries.
+ *
+ * @param line Line number (from 1).
+ * @param text Line text.
+ */
+void prof_source(uint32_t line, const char *text);
+
+/**
+ * @brief Start timing a top-level command.
+ *
+ * @param first First source line.
+ * @param last Last source line.
+ * @param body 0 for the lines themselves, N for the Nth function body defined there.
+ * @param idx Index of the command among the top-level commands of the lines or body.
+ */
+void prof_enter(uint32_t first, uint32_t last, uint32_t body, uint32_t idx);
+
+/**
+ * @brief Stop timing the innermost command started with prof_enter.
+ */
+void prof_leave(void);
+
+/**
+ * @brief Account time spent waiting for children (foreground jobs, wait,
+ * command substitutions).
+ *
+ * @param start stats_now() timestamp of the start of the wait.
+ */
+void prof_wait(uint64_t start);
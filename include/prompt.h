@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Expand PS1 into the prompt of the next command.
+ *
+ * Without PS1 the prompt is "$PWD> ". Escapes:
+ *   \w  $PWD, with a leading $HOME shown as ~    \W  last component of \w
+ *   \u  user name                                 \h  host name up to the first '.'
+ *   \$  '#' for root, '$' otherwise               \?  exit status of the last command
+ *   \j  number of jobs                            \D  duration of the last command
+ *   \t  time (HH:MM:SS)                           \g  VCS (git) branch, empty outside a repository
+ *   \n  newline   \e  escape   \a  bell   \\  backslash
+ *
+ * No escape touches the file system in the shell thread: the directory comes
+ * from the logical $PWD and \g is looked up by a worker thread. Until the
+ * worker is done with a directory, \g shows its last result for it (empty
+ * for a new one), and prompt_event_fd becomes readable when it changes.
+ *
+ * @return Prompt, owned by this module and valid until the next call to
+ *         prompt_render or prompt_refresh, or NULL if failed.
+ */
+const char *prompt_render(void);
+
+/**
+ * @brief Expand PS1 again after an update from the worker.
+ *
+ * Clears the pending event.
+ *
+ * @param shown Prompt on the screen.
+ * @return New prompt (shown is released), or NULL if it is unchanged, shown
+ *         is not the last rendered prompt or the expansion failed (shown
+ *         stays valid).
+ */
+const char *prompt_refresh(const char *shown);
+
+/**
+ * @brief Descriptor readable when a background segment changed.
+ *
+ * @return Event descriptor, or -1 if no background segment is in use.
+ */
+int prompt_event_fd(void);
+
+/**
+ * @brief Set the duration shown by \D.
+ *
+ * @param ns Duration in nanoseconds.
+ */
+void prompt_set_duration(uint64_t ns);
+
+/**
+ * @brief Stop the worker and release the prompt.
+ */
+void prompt_cleanup(void);
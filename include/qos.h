@@ -0,0 +1,46 @@
+#pragma once
+
+#include "job.h"
+
+/**
+ * @brief Scheduling policy of background jobs.
+ *
+ * Configured through MINISHELL_BG_QOS, a list of space- or comma-separated
+ * settings (empty or unset: off):
+ *  - nice=N: nice value (0-19)
+ *  - batch: SCHED_BATCH
+ *  - ioprio=idle or ioprio=be:N: I/O priority (best-effort level 0-7)
+ */
+typedef struct qos_policy {
+    int nice; ///< Nice value (-1: unchanged)
+    int batch; ///< Nonzero for SCHED_BATCH
+    int ioprio; ///< ioprio value (-1: unchanged)
+} qos_policy;
+
+/**
+ * @brief Read the background policy from MINISHELL_BG_QOS.
+ *
+ * @param out Output policy.
+ * @return Nonzero if a policy is configured.
+ */
+int qos_policy_get(qos_policy *out);
+
+/**
+ * @brief Apply the background policy to the calling process (a child about to
+ * run a background job).
+ *
+ * @return non-zero if a setting failed (the child still runs).
+ */
+int qos_background_self(const qos_policy *policy);
+
+/**
+ * @brief Move every thread of a running job to the background policy, or
+ * back to the shell's own priorities.
+ *
+ * Raising the nice value back needs CAP_SYS_NICE or a matching RLIMIT_NICE;
+ * the scheduling class and I/O priority are restored regardless.
+ *
+ * @param j Job.
+ * @param background 1: apply the policy, 0: restore the shell's priorities.
+ */
+void qos_set_job(job *j, int background);
@@ -0,0 +1,14 @@
+#pragma once
+
+/**
+ * @brief Load the startup file (~/.minishellrc, or $MINISHELLRC if set).
+ *
+ * If the file only defines functions and sets or exports literal values, its
+ * effects are saved to a snapshot next to it ("<rc>.snap"). Later launches map
+ * the snapshot and replay it without lexing or parsing, as long as the rc file
+ * is unchanged (same inode, size and mtime). Any other rc file is sourced
+ * command by command (commands may span lines) on every launch.
+ *
+ * @return non-zero if failed (internal error); a missing rc file is not an error.
+ */
+int rc_load(void);
@@ -11,6 +11,9 @@ typedef enum apply_redir_mode {
  * @brief Apply I/O redirections for a command node.
  *
  * @param node Command node whose redirections should be applied.
+ * A node without redirections (NULL io) is a no-op that pushes nothing, so
+ * callers only call undo_redir when node->io is set.
+ *
  * @param mode REDIR_TEMPORARY to save/restore with undo_redir, or
  *             REDIR_PERMANENTLY for child processes before exec.
  * @return non-zero on error.
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "builtin.h"
+#include "flat.h"
+
+/**
+ * @brief What a command name resolved to.
+ */
+typedef enum resolve_kind {
+    RESOLVE_EXTERNAL, ///< Program run with exec (path set if found in PATH)
+    RESOLVE_FUNC, ///< Shell function
+    RESOLVE_BUILTIN, ///< Builtin (compiled-in or loaded)
+} resolve_kind;
+
+/**
+ * @brief Cached resolution of the name of one command of a flat AST.
+ *
+ * An entry is valid while the resolution generation is unchanged (PATH,
+ * the function table and the builtin table bump it) and the expanded name
+ * is the one it was resolved for.
+ */
+typedef struct cmd_resolution {
+    uint64_t gen; ///< Generation it was resolved at (0: empty)
+    char *name; ///< Name it was resolved for (heap-allocated)
+    resolve_kind kind; ///< Result
+    flat_ast *func; ///< Function body (RESOLVE_FUNC, not referenced)
+    const builtin_cmd *builtin; ///< Builtin entry (RESOLVE_BUILTIN)
+    char *path; ///< Absolute path found in PATH (RESOLVE_EXTERNAL, heap-allocated or NULL)
+} cmd_resolution;
+
+/**
+ * @brief Invalidate every cached resolution (PATH, functions or builtins changed).
+ */
+void resolve_invalidate(void);
+
+/**
+ * @brief Resolve a command name, reusing the cached entry when still valid.
+ *
+ * Functions come first, then builtins, then PATH. A PATH with relative
+ * entries, a name with a '/' and a name not found are never cached, so the
+ * lookup is left to execvp.
+ *
+ * @param r Cache entry (filled or refreshed).
+ * @param name Expanded command name.
+ * @return r.
+ */
+const cmd_resolution *resolve_cmd(cmd_resolution *r, const char *name);
+
+/**
+ * @brief Resolve command cmd of a flat AST, cached next to its command view
+ * (the cache array is created on first use).
+ *
+ * @param f Flat AST.
+ * @param cmd Index in f->cmds.
+ * @param name Expanded command name.
+ * @return The resolution, valid until the next resolve call on the same entry.
+ */
+const cmd_resolution *resolve_flat_cmd(flat_ast *f, uint32_t cmd, const char *name);
+
+/**
+ * @brief Release what a cache entry holds and empty it.
+ */
+void resolve_clear(cmd_resolution *r);
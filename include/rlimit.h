@@ -0,0 +1,107 @@
+#pragma once
+
+#include <sys/resource.h>
+
+/**
+ * @brief Maximum number of limits a single limit prefix can set.
+ */
+#define RLIMIT_SET_MAX 16
+
+/**
+ * @brief Resource classes recorded on a process, used to explain its termination.
+ */
+typedef enum rlimit_class {
+    LIMIT_CPU = 1 << 0, ///< CPU time (-t)
+    LIMIT_MEM = 1 << 1, ///< Address space, data or stack size (-v, -d, -s)
+    LIMIT_FSIZE = 1 << 2, ///< File size (-f)
+    LIMIT_OTHER = 1 << 3 ///< Anything else (-n, -u, -c)
+} rlimit_class;
+
+/**
+ * @brief Supported resource, shared by ulimit and the limit prefix.
+ */
+typedef struct rlimit_info {
+    char opt; ///< Option letter (e.g. 'v')
+    int resource; ///< RLIMIT_* constant
+    rlim_t unit; ///< ulimit unit in bytes or counts (e.g. 1024 for KiB)
+    unsigned cls; ///< rlimit_class bit
+    const char *desc; ///< Description printed by ulimit -a
+} rlimit_info;
+
+/**
+ * @brief Soft limits parsed from a limit prefix.
+ */
+typedef struct rlimit_set {
+    int n; ///< Number of entries
+    const rlimit_info *info[RLIMIT_SET_MAX]; ///< Resources
+    rlim_t value[RLIMIT_SET_MAX]; ///< Soft limit of each resource
+} rlimit_set;
+
+/**
+ * @brief Supported resources, terminated by an entry with opt == 0.
+ */
+const rlimit_info *rlimit_table(void);
+
+/**
+ * @brief Find a resource by option letter.
+ * @return info (or NULL if unsupported)
+ */
+const rlimit_info *rlimit_find(char opt);
+
+/**
+ * @brief Parse a limit value.
+ *
+ * "unlimited", or a number with an optional K/M/G/T (powers of 1024) suffix.
+ * A number without suffix is multiplied by unit.
+ *
+ * @param str Value text.
+ * @param unit Multiplier for a bare number.
+ * @param out Output value.
+ * @return non-zero if invalid.
+ */
+int rlimit_parse_value(const char *str, rlim_t unit, rlim_t *out);
+
+/**
+ * @brief Parse a "limit -v 2G -n 4096 -t 60 cmd..." prefix.
+ *
+ * Sizes are in bytes (with an optional suffix), -t in seconds, counts as is.
+ *
+ * @param argv Command words starting with "limit".
+ * @param set Output limits.
+ * @param cmd Output: first word of the limited command.
+ * @return non-zero if invalid (error is reported on stderr).
+ */
+int rlimit_parse_prefix(char **argv, rlimit_set *set, char ***cmd);
+
+/**
+ * @brief Check whether a command starts with a limit prefix.
+ */
+int rlimit_is_prefix(char **argv);
+
+/**
+ * @brief Classes (rlimit_class bits) of the limits named by a limit prefix.
+ *
+ * Only scans option letters, without validating values or reporting errors.
+ *
+ * @param argv Command words (0 is returned without a limit prefix).
+ */
+unsigned rlimit_prefix_classes(char **argv);
+
+/**
+ * @brief Lower the soft limits of the calling process (hard limits are kept).
+ * @return non-zero if failed.
+ */
+int rlimit_apply(const rlimit_set *set);
+
+/**
+ * @brief Explain a termination caused by a resource limit.
+ *
+ * SIGXCPU and SIGXFSZ are always limit violations; SIGKILL counts when a CPU
+ * limit was set (hard limit), a crash (SIGSEGV, SIGBUS, SIGABRT) when a memory
+ * limit was.
+ *
+ * @param classes rlimit_class bits set on the process (0 if unknown).
+ * @param term_sig Terminating signal (-1 if exited).
+ * @return Reason text, or NULL if not a limit violation.
+ */
+const char *rlimit_reason(unsigned classes, int term_sig);
@@ -0,0 +1,26 @@
+#pragma once
+
+/*
+ * Frames exchanged on a --serve connection: a type byte, the payload length
+ * (4 bytes, big-endian) and the payload.
+ */
+#define SERVE_CMD 'C' ///< Client: command text (one or more lines)
+#define SERVE_OUT 'O' ///< Server: bytes written to stdout
+#define SERVE_ERR 'E' ///< Server: bytes written to stderr
+#define SERVE_STATUS 'S' ///< Server: exit status (4 bytes, big-endian), ends the reply to a command
+#define SERVE_MAX_CMD (1u << 20) ///< Largest command payload accepted
+
+/**
+ * @brief Serve shell sessions on a Unix domain socket until SIGTERM or SIGINT.
+ *
+ * Every connection gets its own forked copy of the initialized shell, so it
+ * has its own working directory, variables, functions and job table. Each
+ * SERVE_CMD frame is run like an input line; the output of the command (and
+ * of its background jobs) is streamed back in SERVE_OUT and SERVE_ERR frames,
+ * followed by a SERVE_STATUS frame. Commands read /dev/null as stdin; exit
+ * closes the connection.
+ *
+ * @param path Socket path (a stale socket there is replaced).
+ * @return non-zero if failed.
+ */
+int serve_run(const char *path);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Event counters.
+ *
+ * Counters live in a shared mapping, so events in forked children (execs,
+ * redirections and builtins of pipeline stages) are counted too.
+ */
+typedef enum stat_counter {
+    STAT_FORKS, ///< Successful fork() calls
+    STAT_EXECS, ///< Successful execs (counted in the child)
+    STAT_BUILTINS, ///< Builtins run
+    STAT_PIPES, ///< Pipes created for pipelines and command substitutions
+    STAT_REDIRS, ///< Redirections applied
+    STAT_REAPED, ///< Finished jobs removed from the job table
+    STAT_NCOUNTERS, ///< Number of counters
+} stat_counter;
+
+/**
+ * @brief Phases with a latency histogram (recorded by the shell process only).
+ */
+typedef enum stat_phase {
+    PHASE_LEX, ///< lex_line
+    PHASE_PARSE, ///< Parsing a token list
+    PHASE_SPAWN, ///< A fork() call, as seen by the parent
+    PHASE_FG_WAIT, ///< Waiting for a foreground job
+    PHASE_PROMPT, ///< From reading a line to printing the next prompt
+    PHASE_COUNT, ///< Number of phases
+} stat_phase;
+
+/**
+ * @brief Move the counters to a shared mapping (call before the first fork).
+ *
+ * Calling it again moves them to a new mapping, so a forked process stops
+ * sharing them with its parent (and the children it forked before).
+ *
+ * @return non-zero if failed (counters stay process-local).
+ */
+int stats_init(void);
+
+/**
+ * @brief Add to a counter.
+ */
+void stats_count(stat_counter c, uint64_t n);
+
+/**
+ * @brief Current timestamp in nanoseconds, for stats_record.
+ */
+uint64_t stats_now(void);
+
+/**
+ * @brief Record the latency of a phase that started at a stats_now() timestamp.
+ */
+void stats_record(stat_phase p, uint64_t start);
+
+/**
+ * @brief Zero every counter and histogram.
+ */
+void stats_reset(void);
+
+/**
+ * @brief Print counters and latency percentiles.
+ *
+ * @param out Output stream.
+ * @param json Nonzero for a single-line JSON object, otherwise a table.
+ */
+void stats_print(FILE *out, int json);
@@ -0,0 +1,20 @@
+#pragma once
+
+/**
+ * @brief Run a command substitution and capture its standard output.
+ *
+ * Lists made only of pure builtins run inside the shell with stdout captured
+ * to memory; anything else runs in a forked subshell read over a pipe.
+ * $? is set to the exit status of the substituted command.
+ *
+ * @param src Command text between "$(" and ")".
+ * @return Heap-allocated output without trailing newlines (or NULL on error).
+ */
+char *command_subst(const char *src);
+
+/**
+ * @brief Number of command substitutions run so far.
+ *
+ * Lets callers tell whether expanding a command ran any substitution.
+ */
+unsigned long subst_runs(void);
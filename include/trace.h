@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * @brief Check whether tracing is on.
+ */
+int trace_on(void);
+
+/**
+ * @brief Start the tracer if MINISHELL_TRACE names an output file.
+ *
+ * Events go to an in-memory ring buffer of MINISHELL_TRACE_EVENTS entries
+ * (default 65536, the oldest are overwritten) written as Chrome trace JSON
+ * (chrome://tracing, Perfetto) at exit.
+ *
+ * @return non-zero if failed (tracing stays off).
+ */
+int trace_init(void);
+
+/**
+ * @brief Current timestamp in nanoseconds (0 while tracing is off).
+ */
+uint64_t trace_now(void);
+
+/**
+ * @brief Record a span that started at a trace_now() timestamp and ends now.
+ *
+ * @param name Static event name.
+ * @param start Start timestamp (0: nothing is recorded).
+ * @param pid Process the span is about (0: the shell), shown as its own track.
+ * @param detail Static detail text, or NULL.
+ * @param value Numeric argument.
+ */
+void trace_span(const char *name, uint64_t start, pid_t pid, const char *detail, long value);
+
+/**
+ * @brief Record an instant event.
+ *
+ * @param name Static event name.
+ * @param pid Process the event is about (0: the shell).
+ * @param detail Static detail text, or NULL.
+ * @param value Numeric argument.
+ */
+void trace_instant(const char *name, pid_t pid, const char *detail, long value);
+
+/**
+ * @brief Create the pipe a child closes when it execs (or starts running a
+ * builtin stage), so the parent can time the fork-to-exec gap.
+ *
+ * @param fds Output pipe ({-1, -1} while tracing is off).
+ */
+void trace_spawn_pipe(int fds[2]);
+
+/**
+ * @brief Child side: keep the write end (closed on exec) and drop the read end.
+ */
+void trace_spawn_child(int fds[2]);
+
+/**
+ * @brief Child side: signal the parent now (for stages that do not exec).
+ */
+void trace_spawn_ready(void);
+
+/**
+ * @brief Parent side: wait until every child closed its pipe and record one
+ * "spawn" span per child, from its fork to its exec.
+ *
+ * @param fds Read ends (-1 entries are skipped); every entry is closed.
+ * @param pids Child of each entry.
+ * @param starts fork() timestamp of each entry.
+ * @param n Number of entries.
+ */
+void trace_spawn_wait(int *fds, const pid_t *pids, const uint64_t *starts, int n);
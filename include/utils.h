@@ -14,3 +14,29 @@ void free_ptrv(void **arr, void (*destroy)(void *));
  * @brief Restore default signal handling for child processes.
  */
 void reset_signals(void);
+
+/**
+ * @brief Mark the current process as a forked subshell (pipeline stage or
+ * command substitution) that keeps running shell code.
+ */
+void set_subshell(void);
+
+/**
+ * @brief Check whether the current process is a forked subshell.
+ *
+ * Subshells run their commands without job control (no process groups of
+ * their own, no terminal handoff).
+ *
+ * @return 1 if subshell, 0 otherwise.
+ */
+int is_subshell(void);
+
+/**
+ * @brief Exit the shell, or only the current subshell.
+ *
+ * Subshells exit with _exit after flushing stdout/stderr so the parent's
+ * input offset and jobs are left alone.
+ *
+ * @param code Exit status.
+ */
+_Noreturn void shell_exit(int code);
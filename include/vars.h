@@ -0,0 +1,134 @@
+#pragma once
+#include <stddef.h>
+
+/**
+ * @brief Variable flags.
+ */
+typedef enum var_flags {
+    VAR_LOCAL = 0, ///< Shell-local variable (not passed to children)
+    VAR_EXPORT = 1 << 0, ///< Exported variable (part of the child environment)
+} var_flags;
+
+/**
+ * @brief Import the process environment as exported variables.
+ *
+ * @param envp NULL-terminated "NAME=VALUE" list (usually environ).
+ * @return non-zero if failed (internal error).
+ */
+int vars_init(char **envp);
+
+/**
+ * @brief Free every variable and the cached environment vector.
+ */
+void vars_cleanup(void);
+
+/**
+ * @brief Look up a variable.
+ *
+ * @param name Variable name.
+ * @return Variable value (owned by the table), or NULL if unset.
+ */
+const char *var_get(const char *name);
+
+/**
+ * @brief Set a variable, creating it if needed.
+ *
+ * An existing export flag is kept; VAR_EXPORT in flags adds it.
+ *
+ * @param name  Variable name (must be valid, see var_valid_name).
+ * @param value New value.
+ * @param flags VAR_LOCAL or VAR_EXPORT.
+ * @return non-zero if failed (internal error).
+ */
+int var_set(const char *name, const char *value, int flags);
+
+/**
+ * @brief Mark a variable as exported, creating it empty if unset.
+ *
+ * @param name Variable name.
+ * @return non-zero if failed (internal error).
+ */
+int var_export(const char *name);
+
+/**
+ * @brief Remove a variable (no-op if unset).
+ *
+ * @param name Variable name.
+ */
+void var_unset(const char *name);
+
+/**
+ * @brief Flags of a variable.
+ *
+ * @param name Variable name.
+ * @return var_flags of the variable, or -1 if unset.
+ */
+int var_flags_of(const char *name);
+
+/**
+ * @brief Apply a "NAME=VALUE" assignment word.
+ *
+ * @param assign Assignment string (already expanded).
+ * @param flags  VAR_LOCAL or VAR_EXPORT.
+ * @return non-zero if failed (internal error).
+ */
+int var_assign(const char *assign, int flags);
+
+/**
+ * @brief Check whether the first n characters of s form a valid name.
+ *
+ * @param s String to check.
+ * @param n Number of characters to check.
+ * @return 1 if valid, 0 otherwise.
+ */
+int var_valid_name(const char *s, size_t n);
+
+/**
+ * @brief Environment vector of every exported variable.
+ *
+ * The vector is cached and only rebuilt after an exported variable changes.
+ *
+ * @return NULL-terminated "NAME=VALUE" list owned by the table.
+ */
+char **var_envp(void);
+
+/**
+ * @brief Print exported variables as "export NAME=VALUE" lines.
+ */
+void print_exports(void);
+
+/**
+ * @brief Record the exit status of the last command ($?).
+ *
+ * @param status shell-style exit code.
+ */
+void set_last_status(int status);
+
+/**
+ * @brief Exit status of the last command ($?).
+ */
+int get_last_status(void);
+
+/**
+ * @brief Positional parameters ($1, $2, ...).
+ *
+ * @return NULL-terminated list (never NULL, empty outside functions).
+ */
+char **var_positional(void);
+
+/**
+ * @brief Replace the positional parameters.
+ *
+ * The list is not copied; it must outlive its use (e.g. a function call).
+ *
+ * @param params NULL-terminated list, or NULL for none.
+ * @return Previous list, to be restored by the caller.
+ */
+char **var_swap_positional(char **params);
+
+/**
+ * @brief Drop the first n positional parameters.
+ *
+ * @return non-zero if there are fewer than n.
+ */
+int var_shift(size_t n);
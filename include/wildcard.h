@@ -0,0 +1,79 @@
+#pragma once
+#include <stddef.h>
+
+/**
+ * @brief Pattern operation type.
+ */
+typedef enum wc_op_type {
+    WC_LIT, ///< literal character
+    WC_ANY, ///< '?': any single character
+    WC_STAR, ///< '*': any string
+    WC_CLASS ///< '[...]': character class
+} wc_op_type;
+
+/**
+ * @brief One compiled pattern operation.
+ */
+typedef struct wc_op {
+    wc_op_type type; ///< Operation type
+    char c; ///< Character for WC_LIT
+    unsigned char set[32]; ///< Bitmap of accepted bytes for WC_CLASS
+} wc_op;
+
+/**
+ * @brief Compiled single-component pattern (no '/').
+ */
+typedef struct wc_pattern {
+    wc_op *ops; ///< Heap-allocated operation list.
+    size_t nops; ///< Number of operations.
+    int wild; ///< Nonzero if the pattern has any wildcard operation.
+} wc_pattern;
+
+/**
+ * @brief Compile a pattern from a field (LEX_CTLESC escapes are literal).
+ *
+ * @param s   Pattern text.
+ * @param len Number of characters of s to compile.
+ * @param out Output compiled pattern.
+ * @return non-zero if failed (internal error).
+ */
+int wc_compile(const char *s, size_t len, wc_pattern *out);
+
+/**
+ * @brief Free a compiled pattern (the struct itself is not freed).
+ */
+void wc_free(wc_pattern *pat);
+
+/**
+ * @brief Match a whole string against a compiled pattern.
+ *
+ * @return 1 on match, 0 otherwise.
+ */
+int wc_match(const wc_pattern *pat, const char *s);
+
+/**
+ * @brief Check whether a field contains unescaped wildcard characters.
+ *
+ * @param field Field with LEX_CTLESC escapes.
+ * @return 1 if it should be expanded as a pathname pattern, 0 otherwise.
+ */
+int has_wildcards(const char *field);
+
+/**
+ * @brief Expand a field as a pathname pattern.
+ *
+ * Directory listings are read with getdents64 and cached until the next
+ * glob_cache_flush, validated against the directory mtime on every use.
+ *
+ * @param field Field with LEX_CTLESC escapes.
+ * @return Heap-allocated, sorted, NULL-terminated matches; empty if nothing
+ *         matched (or NULL on error).
+ */
+char **glob_field(const char *field);
+
+/**
+ * @brief Drop cached directory listings and compiled patterns.
+ *
+ * Called once per prompt / script iteration.
+ */
+void glob_cache_flush(void);
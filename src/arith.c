@@ -0,0 +1,545 @@
+#include "arith.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vars.h"
+
+#define ARITH_CACHE_SIZE 64
+#define ARITH_MAX_DEPTH 32
+
+/**
+ * @brief Parser state for one expression.
+ */
+typedef struct arith_parser {
+    const char *s; ///< Expression text.
+    size_t len; ///< Text length.
+    size_t pos; ///< Current position.
+    arith_expr *e; ///< Expression being built.
+    const char *err; ///< First error message, or NULL.
+} arith_parser;
+
+/**
+ * @brief Cached compiled expression, keyed by its text.
+ */
+typedef struct arith_cache_entry {
+    char *src; ///< Heap-allocated expression text, or NULL if empty.
+    size_t len; ///< Text length.
+    arith_expr expr; ///< Compiled expression.
+} arith_cache_entry;
+
+static arith_cache_entry cache[ARITH_CACHE_SIZE];
+static int eval_depth = 0;
+
+// Parser Helpers
+
+static int is_name_start(char c) {
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static int is_name_char(char c) {
+    return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+static void skip_ws(arith_parser *p) {
+    while (p->pos < p->len && strchr(" \t\n", p->s[p->pos])) ++p->pos;
+}
+
+/**
+ * @brief Consume an operator unless it is followed by one of notnext.
+ *
+ * @return 1 if consumed, 0 otherwise.
+ */
+static int accept(arith_parser *p, const char *op, const char *notnext) {
+    skip_ws(p);
+    size_t n = strlen(op);
+    if (p->pos + n > p->len || strncmp(p->s + p->pos, op, n) != 0) return 0;
+    if (notnext && p->pos + n < p->len && strchr(notnext, p->s[p->pos + n])) return 0;
+    p->pos += n;
+    return 1;
+}
+
+static int fail(arith_parser *p, const char *msg) {
+    if (!p->err) p->err = msg;
+    return -1;
+}
+
+/**
+ * @brief Append a node.
+ *
+ * @return node index, or -1 if failed.
+ */
+static int node_new(arith_parser *p, arith_op op, int a, int b) {
+    arith_expr *e = p->e;
+    if (e->len == e->cap) {
+        size_t cap = e->cap ? e->cap << 1 : 8;
+        arith_node *temp = realloc(e->nodes, cap * sizeof(arith_node));
+        if (!temp) {
+            perror("arith_compile: realloc");
+            return fail(p, "out of memory");
+        }
+        e->nodes = temp;
+        e->cap = cap;
+    }
+    e->nodes[e->len] = (arith_node){ .op = op, .aop = ARITH_ASSIGN, .a = a, .b = b, .c = -1, .num = 0, .name = NULL };
+    return (int) e->len++;
+}
+
+static char *read_name(arith_parser *p) {
+    skip_ws(p);
+    size_t start = p->pos;
+    if (p->pos >= p->len || !is_name_start(p->s[p->pos])) return NULL;
+    while (p->pos < p->len && is_name_char(p->s[p->pos])) ++p->pos;
+    char *name = strndup(p->s + start, p->pos - start);
+    if (!name) {
+        perror("arith_compile: strndup");
+        fail(p, "out of memory");
+    }
+    return name;
+}
+
+/**
+ * @brief Node referring to a variable (takes ownership of name).
+ */
+static int name_node(arith_parser *p, arith_op op, char *name, int a) {
+    int i = node_new(p, op, a, -1);
+    if (i == -1) {
+        free(name);
+        return -1;
+    }
+    p->e->nodes[i].name = name;
+    return i;
+}
+
+// Recursive Descent Parser
+
+static int parse_comma(arith_parser *p);
+static int parse_assign(arith_parser *p);
+static int parse_unary(arith_parser *p);
+
+static int parse_number(arith_parser *p) {
+    const char *s = p->s;
+    size_t i = p->pos;
+    int base = 10;
+    if (s[i] == '0' && i + 1 < p->len && (s[i + 1] == 'x' || s[i + 1] == 'X')) {
+        base = 16;
+        i += 2;
+    } else if (s[i] == '0') {
+        base = 8;
+    }
+
+    uint64_t v = 0;
+    size_t start = i;
+    for (; i < p->len && is_name_char(s[i]); ++i) {
+        int d;
+        if (s[i] >= '0' && s[i] <= '9') d = s[i] - '0';
+        else if (s[i] >= 'a' && s[i] <= 'f') d = s[i] - 'a' + 10;
+        else if (s[i] >= 'A' && s[i] <= 'F') d = s[i] - 'A' + 10;
+        else d = 64;
+        if (d >= base) return fail(p, "value too great for base");
+        v = v * (uint64_t) base + (uint64_t) d;
+    }
+    if (i == start) return fail(p, "invalid number");
+    p->pos = i;
+
+    int n = node_new(p, ARITH_NUM, -1, -1);
+    if (n != -1) p->e->nodes[n].num = (int64_t) v;
+    return n;
+}
+
+static int parse_primary(arith_parser *p) {
+    skip_ws(p);
+    if (p->pos >= p->len) return fail(p, "operand expected");
+
+    if (accept(p, "(", NULL)) {
+        int n = parse_comma(p);
+        if (n == -1) return -1;
+        if (!accept(p, ")", NULL)) return fail(p, "missing ')'");
+        return n;
+    }
+
+    char c = p->s[p->pos];
+    if (c >= '0' && c <= '9') return parse_number(p);
+    if (!is_name_start(c)) return fail(p, "syntax error: operand expected");
+
+    char *name = read_name(p);
+    if (!name) return -1;
+
+    // Postfix increment / decrement
+    if (accept(p, "++", NULL)) return name_node(p, ARITH_POSTINC, name, -1);
+    if (accept(p, "--", NULL)) return name_node(p, ARITH_POSTDEC, name, -1);
+    return name_node(p, ARITH_VAR, name, -1);
+}
+
+static int parse_unary(arith_parser *p) {
+    if (accept(p, "++", NULL) || accept(p, "--", NULL)) {
+        arith_op op = p->s[p->pos - 1] == '+' ? ARITH_PREINC : ARITH_PREDEC;
+        char *name = read_name(p);
+        if (!name) return fail(p, "syntax error: variable expected");
+        return name_node(p, op, name, -1);
+    }
+
+    arith_op op;
+    if (accept(p, "-", "=")) op = ARITH_NEG;
+    else if (accept(p, "+", "=")) op = ARITH_POS;
+    else if (accept(p, "!", "=")) op = ARITH_NOT;
+    else if (accept(p, "~", NULL)) op = ARITH_BNOT;
+    else return parse_primary(p);
+
+    int a = parse_unary(p);
+    if (a == -1) return -1;
+    return node_new(p, op, a, -1);
+}
+
+static int parse_pow(arith_parser *p) {
+    int a = parse_unary(p);
+    if (a == -1) return -1;
+    if (!accept(p, "**", "=")) return a;
+
+    // Right associative
+    int b = parse_pow(p);
+    if (b == -1) return -1;
+    return node_new(p, ARITH_POW, a, b);
+}
+
+/**
+ * @brief Binary operator table, one row per precedence level (lowest first).
+ */
+static const struct {
+    const char *text; ///< Operator text
+    const char *notnext; ///< Characters that must not follow it
+    arith_op op; ///< Node type
+    int level; ///< Precedence level
+} binops[] = {
+    {"||", NULL, ARITH_LOR, 0},
+    {"&&", NULL, ARITH_LAND, 1},
+    {"|", "|=", ARITH_BOR, 2},
+    {"^", "=", ARITH_BXOR, 3},
+    {"&", "&=", ARITH_BAND, 4},
+    {"==", NULL, ARITH_EQ, 5},
+    {"!=", NULL, ARITH_NE, 5},
+    {"<=", NULL, ARITH_LE, 6},
+    {">=", NULL, ARITH_GE, 6},
+    {"<", "<=", ARITH_LT, 6},
+    {">", ">=", ARITH_GT, 6},
+    {"<<", "=", ARITH_SHL, 7},
+    {">>", "=", ARITH_SHR, 7},
+    {"+", "+=", ARITH_ADD, 8},
+    {"-", "-=", ARITH_SUB, 8},
+    {"*", "*=", ARITH_MUL, 9},
+    {"/", "=", ARITH_DIV, 9},
+    {"%", "=", ARITH_MOD, 9},
+};
+
+#define ARITH_LEVELS 10
+
+static int parse_binary(arith_parser *p, int level) {
+    if (level == ARITH_LEVELS) return parse_pow(p);
+
+    int a = parse_binary(p, level + 1);
+    if (a == -1) return -1;
+
+    while (1) {
+        size_t k = 0;
+        for (; k < sizeof(binops) / sizeof(binops[0]); ++k)
+            if (binops[k].level == level && accept(p, binops[k].text, binops[k].notnext)) break;
+        if (k == sizeof(binops) / sizeof(binops[0])) return a;
+
+        int b = parse_binary(p, level + 1);
+        if (b == -1) return -1;
+        a = node_new(p, binops[k].op, a, b);
+        if (a == -1) return -1;
+    }
+}
+
+static int parse_cond(arith_parser *p) {
+    int c = parse_binary(p, 0);
+    if (c == -1 || !accept(p, "?", NULL)) return c;
+
+    int a = parse_comma(p);
+    if (a == -1) return -1;
+    if (!accept(p, ":", NULL)) return fail(p, "syntax error: ':' expected");
+    int b = parse_cond(p);
+    if (b == -1) return -1;
+
+    int n = node_new(p, ARITH_COND, a, b);
+    if (n != -1) p->e->nodes[n].c = c;
+    return n;
+}
+
+/**
+ * @brief Assignment operators and the operation they combine with.
+ */
+static const struct {
+    const char *text; ///< Operator text
+    arith_op op; ///< Combining operator (ARITH_ASSIGN for '=')
+} assignops[] = {
+    {"=", ARITH_ASSIGN}, {"+=", ARITH_ADD}, {"-=", ARITH_SUB}, {"*=", ARITH_MUL},
+    {"/=", ARITH_DIV}, {"%=", ARITH_MOD}, {"<<=", ARITH_SHL}, {">>=", ARITH_SHR},
+    {"&=", ARITH_BAND}, {"^=", ARITH_BXOR}, {"|=", ARITH_BOR},
+};
+
+static int parse_assign(arith_parser *p) {
+    size_t save = p->pos;
+    skip_ws(p);
+
+    if (p->pos < p->len && is_name_start(p->s[p->pos])) {
+        char *name = read_name(p);
+        if (!name) return -1;
+        for (size_t k = 0; k < sizeof(assignops) / sizeof(assignops[0]); ++k) {
+            if (!accept(p, assignops[k].text, k == 0 ? "=" : NULL)) continue;
+            int a = parse_assign(p);
+            if (a == -1) {
+                free(name);
+                return -1;
+            }
+            int n = name_node(p, ARITH_ASSIGN, name, a);
+            if (n != -1) p->e->nodes[n].aop = assignops[k].op;
+            return n;
+        }
+        free(name);
+    }
+
+    p->pos = save;
+    return parse_cond(p);
+}
+
+static int parse_comma(arith_parser *p) {
+    int a = parse_assign(p);
+    while (a != -1 && accept(p, ",", NULL)) {
+        int b = parse_assign(p);
+        if (b == -1) return -1;
+        a = node_new(p, ARITH_COMMA, a, b);
+    }
+    return a;
+}
+
+// Evaluation
+
+static int eval_error(const char *msg, const char *name) {
+    if (name) fprintf(stderr, "arith: %s: %s\n", name, msg);
+    else fprintf(stderr, "arith: %s\n", msg);
+    return -1;
+}
+
+/**
+ * @brief Integer value of a variable; non-numeric values are evaluated as expressions.
+ */
+static int var_value(const char *name, int64_t *out) {
+    const char *v = var_get(name);
+    *out = 0;
+    if (!v) return 0;
+    while (*v == ' ' || *v == '\t' || *v == '\n') ++v;
+    if (*v == 0x00) return 0;
+
+    char *end = NULL;
+    errno = 0;
+    long long n = strtoll(v, &end, 0);
+    while (end && (*end == ' ' || *end == '\t' || *end == '\n')) ++end;
+    if (errno == 0 && end && *end == 0x00) {
+        *out = (int64_t) n;
+        return 0;
+    }
+
+    if (eval_depth >= ARITH_MAX_DEPTH) return eval_error("expression recursion level exceeded", name);
+    return arith_eval_str(v, strlen(v), out);
+}
+
+static int store(const char *name, int64_t v) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%" PRId64, v);
+    return var_set(name, buf, VAR_LOCAL);
+}
+
+static int apply_binary(arith_op op, int64_t a, int64_t b, int64_t *out) {
+    uint64_t ua = (uint64_t) a;
+    uint64_t ub = (uint64_t) b;
+    switch (op) {
+        case ARITH_ADD: *out = (int64_t) (ua + ub); break;
+        case ARITH_SUB: *out = (int64_t) (ua - ub); break;
+        case ARITH_MUL: *out = (int64_t) (ua * ub); break;
+        case ARITH_DIV:
+        case ARITH_MOD:
+            if (b == 0) return eval_error("division by 0", NULL);
+            if (b == -1) *out = op == ARITH_DIV ? (int64_t) (0 - ua) : 0;
+            else *out = op == ARITH_DIV ? a / b : a % b;
+            break;
+        case ARITH_POW: {
+            if (b < 0) return eval_error("exponent less than 0", NULL);
+            uint64_t r = 1;
+            for (; ub; ub >>= 1, ua *= ua)
+                if (ub & 1) r *= ua;
+            *out = (int64_t) r;
+            break;
+        }
+        case ARITH_SHL: *out = (int64_t) (ua << (ub & 63)); break;
+        case ARITH_SHR: *out = a >> (ub & 63); break;
+        case ARITH_LT: *out = a < b; break;
+        case ARITH_LE: *out = a <= b; break;
+        case ARITH_GT: *out = a > b; break;
+        case ARITH_GE: *out = a >= b; break;
+        case ARITH_EQ: *out = a == b; break;
+        case ARITH_NE: *out = a != b; break;
+        case ARITH_BAND: *out = (int64_t) (ua & ub); break;
+        case ARITH_BXOR: *out = (int64_t) (ua ^ ub); break;
+        case ARITH_BOR: *out = (int64_t) (ua | ub); break;
+        default:
+            return eval_error("invalid operator", NULL);
+    }
+    return 0;
+}
+
+static int eval_node(const arith_expr *e, int i, int64_t *out) {
+    const arith_node *n = &e->nodes[i];
+    int64_t a = 0;
+    int64_t b = 0;
+
+    switch (n->op) {
+        case ARITH_NUM:
+            *out = n->num;
+            return 0;
+        case ARITH_VAR:
+            return var_value(n->name, out);
+        case ARITH_NEG:
+        case ARITH_POS:
+        case ARITH_NOT:
+        case ARITH_BNOT:
+            if (eval_node(e, n->a, &a)) return -1;
+            if (n->op == ARITH_NEG) *out = (int64_t) (0 - (uint64_t) a);
+            else if (n->op == ARITH_POS) *out = a;
+            else if (n->op == ARITH_NOT) *out = !a;
+            else *out = ~a;
+            return 0;
+        case ARITH_PREINC:
+        case ARITH_PREDEC:
+        case ARITH_POSTINC:
+        case ARITH_POSTDEC: {
+            if (var_value(n->name, &a)) return -1;
+            int inc = n->op == ARITH_PREINC || n->op == ARITH_POSTINC;
+            b = (int64_t) ((uint64_t) a + (inc ? 1 : (uint64_t) -1));
+            if (store(n->name, b)) return -1;
+            *out = n->op == ARITH_PREINC || n->op == ARITH_PREDEC ? b : a;
+            return 0;
+        }
+        case ARITH_LAND:
+        case ARITH_LOR:
+            // Short circuit
+            if (eval_node(e, n->a, &a)) return -1;
+            if ((n->op == ARITH_LAND) == !a) {
+                *out = n->op == ARITH_LOR;
+                return 0;
+            }
+            if (eval_node(e, n->b, &b)) return -1;
+            *out = b != 0;
+            return 0;
+        case ARITH_COND:
+            if (eval_node(e, n->c, &a)) return -1;
+            return eval_node(e, a ? n->a : n->b, out);
+        case ARITH_COMMA:
+            if (eval_node(e, n->a, &a)) return -1;
+            return eval_node(e, n->b, out);
+        case ARITH_ASSIGN:
+            if (eval_node(e, n->a, &b)) return -1;
+            if (n->aop != ARITH_ASSIGN) {
+                if (var_value(n->name, &a) || apply_binary(n->aop, a, b, &b)) return -1;
+            }
+            if (store(n->name, b)) return -1;
+            *out = b;
+            return 0;
+        default:
+            if (eval_node(e, n->a, &a) || eval_node(e, n->b, &b)) return -1;
+            return apply_binary(n->op, a, b, out);
+    }
+}
+
+// API Functions
+
+int arith_compile(const char *src, size_t len, arith_expr *out) {
+    out->nodes = NULL;
+    out->len = 0;
+    out->cap = 0;
+    out->root = -1;
+
+    arith_parser p = { .s = src, .len = len, .pos = 0, .e = out, .err = NULL };
+    skip_ws(&p);
+
+    // Empty expression evaluates to 0
+    if (p.pos == len) {
+        out->root = node_new(&p, ARITH_NUM, -1, -1);
+        if (out->root == -1) goto cleanup;
+        return 0;
+    }
+
+    out->root = parse_comma(&p);
+    skip_ws(&p);
+    if (out->root != -1 && p.pos != len) fail(&p, "syntax error: invalid arithmetic operator");
+    if (out->root == -1 || p.err) goto cleanup;
+    return 0;
+
+cleanup:
+    fprintf(stderr, "arith: %s (error token is \"%.*s\")\n",
+            p.err ? p.err : "syntax error", (int) (len - (p.pos < len ? p.pos : len)),
+            src + (p.pos < len ? p.pos : len));
+    arith_free(out);
+    return -1;
+}
+
+void arith_free(arith_expr *expr) {
+    if (!expr) return;
+    for (size_t i = 0; i < expr->len; ++i) free(expr->nodes[i].name);
+    free(expr->nodes);
+    expr->nodes = NULL;
+    expr->len = 0;
+    expr->cap = 0;
+    expr->root = -1;
+}
+
+int arith_eval(const arith_expr *expr, int64_t *out) {
+    if (!expr || expr->root < 0) return -1;
+    ++eval_depth;
+    int ret = eval_node(expr, expr->root, out);
+    --eval_depth;
+    return ret;
+}
+
+int arith_eval_str(const char *src, size_t len, int64_t *out) {
+    // Nested evaluation (variable values) must not evict an expression in use
+    if (eval_depth > 0) {
+        arith_expr expr;
+        if (arith_compile(src, len, &expr)) return -1;
+        int ret = arith_eval(&expr, out);
+        arith_free(&expr);
+        return ret;
+    }
+
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) h = (h ^ (unsigned char) src[i]) * 16777619u;
+    arith_cache_entry *ent = &cache[h & (ARITH_CACHE_SIZE - 1)];
+
+    if (!ent->src || ent->len != len || memcmp(ent->src, src, len) != 0) {
+        free(ent->src);
+        arith_free(&ent->expr);
+        ent->src = NULL;
+
+        if (arith_compile(src, len, &ent->expr)) return -1;
+        ent->src = strndup(src, len);
+        if (!ent->src) {
+            perror("arith_eval_str: strndup");
+            arith_free(&ent->expr);
+            return -1;
+        }
+        ent->len = len;
+    }
+    return arith_eval(&ent->expr, out);
+}
+
+void arith_cache_cleanup(void) {
+    for (size_t i = 0; i < ARITH_CACHE_SIZE; ++i) {
+        free(cache[i].src);
+        cache[i].src = NULL;
+        arith_free(&cache[i].expr);
+    }
+}
@@ -1,30 +1,227 @@
 #include "builtin.h"
 
+#include <dlfcn.h>
 #include <errno.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 
+#include "exec.h"
+#include "func.h"
+#include "mem.h"
 #include "parse.h"
+#include "prof.h"
+#include "qos.h"
 #include "redir.h"
+#include "resolve.h"
+#include "rlimit.h"
 #include "job.h"
+#include "stats.h"
+#include "trace.h"
+#include "utils.h"
+#include "vars.h"
 
 /**
- * @brief builtin commands list terminated by {NULL, NULL}
+ * @brief builtin commands list terminated by {NULL, NULL, 0}
  */
 static builtin_cmd builtins[] = {
-    {"exit", exit_fn},
-    {"cd", cd_fn},
-    {"jobs", jobs_fn},
-    {"fg", fg_fn},
-    {"bg", bg_fn},
-    {NULL, NULL}
+    {"exit", exit_fn, 0},
+    {"cd", cd_fn, 0},
+    {"jobs", jobs_fn, 1},
+    {"fg", fg_fn, 0},
+    {"bg", bg_fn, 0},
+    {"export", export_fn, 0},
+    {"unset", unset_fn, 0},
+    {"echo", echo_fn, 1},
+    {"pwd", pwd_fn, 1},
+    {"true", true_fn, 1},
+    {":", true_fn, 1},
+    {"false", false_fn, 1},
+    {"break", break_fn, 0},
+    {"continue", continue_fn, 0},
+    {"return", return_fn, 0},
+    {"shift", shift_fn, 0},
+    {"wait", wait_fn, 0},
+    {"timeout", timeout_fn, 0},
+    {"ulimit", ulimit_fn, 0},
+    {"shellstats", shellstats_fn, 0},
+    {"memstats", memstats_fn, 1},
+    {"enable", enable_fn, 0},
+    {"hash", hash_fn, 0},
+    {NULL, NULL, 0}
 };
 
+/**
+ * @brief Perfect hash of the compiled-in builtin names: slot of a name is
+ * (LEN * len + FIRST * name[0] + LAST * name[len - 1] + name[1]) % BUILTIN_SLOTS.
+ *
+ * The slot table holds builtins[] index + 1 (0: empty). Run
+ * tools/gen_builtin_hash.sh after changing builtins[] ("make check" verifies
+ * it, and a stale table falls back to a linear search at run time).
+ */
+// BEGIN builtin hash (generated by tools/gen_builtin_hash.sh, do not edit)
+#define BUILTIN_SLOTS 32
+#define BUILTIN_HASH_LEN 15
+#define BUILTIN_HASH_FIRST 31
+#define BUILTIN_HASH_LAST 8
+
+static const uint8_t builtin_slots[BUILTIN_SLOTS] = {
+    16, 0, 10, 20, 7, 11, 17, 0, 21, 0, 0, 22, 14, 6, 12, 1,
+    0, 19, 8, 13, 9, 23, 0, 4, 0, 3, 0, 5, 0, 15, 18, 2,
+};
+// END builtin hash
+
+static unsigned builtin_slot(const char *name, size_t len) {
+    const unsigned char *s = (const unsigned char *) name;
+    return (BUILTIN_HASH_LEN * (unsigned) len + BUILTIN_HASH_FIRST * (unsigned) s[0] +
+            BUILTIN_HASH_LAST * (unsigned) s[len - 1] + (len > 1 ? s[1] : 0u)) % BUILTIN_SLOTS;
+}
+
+/**
+ * @brief A builtin loaded from a module with "enable -f".
+ */
+typedef struct loaded_builtin {
+    builtin_cmd cmd; ///< Entry (heap-allocated name)
+    void *handle; ///< Module handle (one dlopen reference per builtin)
+    char *path; ///< Module path as given to enable
+} loaded_builtin;
+
+static loaded_builtin *loaded = NULL;
+static size_t nloaded = 0;
+
+/**
+ * @brief Lookup table: loaded builtins, then the compiled-in ones they do not
+ * shadow, terminated by {NULL, NULL, 0}.
+ */
+static builtin_cmd *table = builtins;
+
+
+/**
+ * @brief Rebuild the lookup table after loading or removing builtins.
+ * @return non-zero if failed (the old table stays).
+ */
+static int rebuild_table(void) {
+    if (nloaded == 0) {
+        if (table != builtins) free(table);
+        table = builtins;
+        return 0;
+    }
+
+    size_t nstatic = sizeof(builtins) / sizeof(builtins[0]) - 1;
+    builtin_cmd *tab = malloc((nloaded + nstatic + 1) * sizeof(builtin_cmd));
+    if (!tab) {
+        perror("enable: malloc");
+        return -1;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < nloaded; ++i) tab[n++] = loaded[i].cmd;
+    for (size_t i = 0; i < nstatic; ++i) {
+        size_t k = 0;
+        while (k < nloaded && strcmp(loaded[k].cmd.name, builtins[i].name) != 0) ++k;
+        if (k == nloaded) tab[n++] = builtins[i];
+    }
+    tab[n] = (builtin_cmd) {NULL, NULL, 0};
+
+    if (table != builtins) free(table);
+    table = tab;
+    return 0;
+}
+
+/**
+ * @brief Check once that every compiled-in builtin sits in its own hash slot.
+ *
+ * @return 1 if the slot table is usable, 0 if it is stale (lookups scan builtins[]).
+ */
+static int check_slots(void) {
+    static int valid = -1;
+    if (valid != -1) return valid;
+    valid = 1;
+    for (size_t i = 0; builtins[i].name != NULL; ++i)
+        if (i >= UINT8_MAX || builtin_slots[builtin_slot(builtins[i].name, strlen(builtins[i].name))] != i + 1)
+            valid = 0;
+    if (!valid) fprintf(stderr, "builtin: Hash table out of date (run tools/gen_builtin_hash.sh)!\n");
+    return valid;
+}
+
+/**
+ * @brief Release a loaded builtin (the caller removes it from the array).
+ */
+static void unload(loaded_builtin *b) {
+    free((char *) b->cmd.name);
+    free(b->path);
+    if (b->handle) dlclose(b->handle);
+}
+
+/**
+ * @brief Load one builtin (or all, if name is NULL) from a module.
+ * @return non-zero if failed.
+ */
+static int load_builtins(const char *path, const char *name) {
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        fprintf(stderr, "enable: %s\n", dlerror());
+        return -1;
+    }
+    const builtin_module *mod = dlsym(handle, BUILTIN_MODULE_SYMBOL);
+    if (!mod || mod->abi != BUILTIN_MODULE_ABI || !mod->builtins) {
+        fprintf(stderr, "enable: %s: Not a builtin module (or built for another version)!\n", path);
+        dlclose(handle);
+        return -1;
+    }
+
+    int found = 0;
+    for (const builtin_cmd *it = mod->builtins; it->name != NULL; ++it) {
+        if (!it->fn || (name && strcmp(it->name, name) != 0)) continue;
+        found = 1;
+
+        // Every entry holds its own reference, so entries are removed independently
+        void *ref = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        loaded_builtin b = {.cmd = *it, .handle = ref, .path = strdup(path)};
+        b.cmd.name = strdup(it->name);
+        if (!ref || !b.path || !b.cmd.name) {
+            fprintf(stderr, "enable: %s: Cannot load '%s'!\n", path, it->name);
+            unload(&b);
+            dlclose(handle);
+            return -1;
+        }
+
+        // Loading a name again replaces the previous entry
+        size_t k = 0;
+        while (k < nloaded && strcmp(loaded[k].cmd.name, it->name) != 0) ++k;
+        if (k < nloaded) {
+            unload(&loaded[k]);
+            loaded[k] = b;
+            continue;
+        }
+        loaded_builtin *tmp = realloc(loaded, (nloaded + 1) * sizeof(loaded_builtin));
+        if (!tmp) {
+            perror("enable: realloc");
+            unload(&b);
+            dlclose(handle);
+            return -1;
+        }
+        loaded = tmp;
+        loaded[nloaded++] = b;
+    }
+    dlclose(handle);
+
+    if (!found && name) {
+        fprintf(stderr, "enable: %s: No builtin named '%s'!\n", path, name);
+        return -1;
+    }
+    if (!found) {
+        fprintf(stderr, "enable: %s: Module defines no builtins!\n", path);
+        return -1;
+    }
+    return 0;
+}
+
 int bg_fn(cmd_node *node, int *status) {
     if (!node || !node->argv || !node->argv[0]) return -1;
 
@@ -52,6 +249,7 @@ int bg_fn(cmd_node *node, int *status) {
     }
 
     j->isbg = 1;
+    qos_set_job(j, 1);
     kill(-j->pgid, SIGCONT);
 
     j->state = JOB_RUNNING;
@@ -91,10 +289,13 @@ int fg_fn(cmd_node *node, int *status) {
     }
 
     j->isbg = 0;
+    qos_set_job(j, 0);
     kill(-j->pgid, SIGCONT);
 
+    uint64_t t0 = trace_now();
     if (isatty(STDIN_FILENO) && tcsetpgrp(STDIN_FILENO, j->pgid) == -1)
         perror("execute_cmd: tcsetpgrp");
+    trace_span("tcsetpgrp", t0, j->pgid, NULL, 0);
 
     j->state = JOB_RUNNING;
     for (int i = 0; i < j->nproc; ++i) {
@@ -103,6 +304,7 @@ int fg_fn(cmd_node *node, int *status) {
         }
     }
 
+    uint64_t fg_ts = stats_now();
     while (1) {
         pid_t pid = 0;
         int wstat;
@@ -120,6 +322,8 @@ int fg_fn(cmd_node *node, int *status) {
             break;
         }
     }
+    stats_record(PHASE_FG_WAIT, fg_ts);
+    prof_wait(fg_ts);
 
     process *last_proc = j->procs + j->nproc - 1;
     if (status) {
@@ -128,12 +332,83 @@ int fg_fn(cmd_node *node, int *status) {
     }
 
     // Reclaim the terminal
+    t0 = trace_now();
     if (isatty(STDIN_FILENO) && tcsetpgrp(STDIN_FILENO, getpgrp()) == -1)
         perror("execute_cmd: tcsetpgrp");
+    trace_span("tcsetpgrp", t0, 0, NULL, 0);
 
     return 0;
 }
 
+int wait_fn(cmd_node *node, int *status) {
+    if (!node || !node->argv || !node->argv[0]) return -1;
+
+    int st = 0;
+
+    // wait -n: the first background job to finish
+    if (node->argv[1] && strcmp(node->argv[1], "-n") == 0) {
+        if (node->argv[2]) {
+            fprintf(stderr, "wait: Usage: \"wait -n\"\n");
+            if (status) *status = 2;
+            return 1;
+        }
+        job *j = wait_any_job();
+        st = j ? job_status(j) : 127;
+        remove_job(j);
+        if (status) *status = st;
+        return 0;
+    }
+
+    // wait: every running background job
+    if (node->argv[1] == NULL) {
+        job *j;
+        while ((j = get_job(-1)) != NULL) {
+            // Waited jobs are removed, so restart from the head each time
+            job *target = NULL;
+            for (job *it = j; it; it = it->next)
+                if (it->isbg && it->state != JOB_STOPPED) target = it;
+            if (!target) break;
+            if (wait_job(target)) break;
+            if (target->state == JOB_DONE) remove_job(target);
+            else break;
+        }
+        if (status) *status = 0;
+        return 0;
+    }
+
+    // wait %N / wait PID...
+    for (char **it = node->argv + 1; *it != NULL; ++it) {
+        char *endptr = NULL;
+        int isjob = (*it)[0] == '%';
+        long long id = strtoll(*it + isjob, &endptr, 10);
+        if (*endptr != 0x00 || endptr == *it + isjob || id < 0) {
+            fprintf(stderr, "wait: Invalid job or process ID: %s\n", *it);
+            st = 2;
+            continue;
+        }
+
+        int idx = 0;
+        job *j = isjob ? get_job((int) id) : find_job_pid((pid_t) id, &idx);
+        if (!j) {
+            fprintf(stderr, "wait: %s: Not a child of this shell!\n", *it);
+            st = 127;
+            continue;
+        }
+
+        if (isjob) {
+            if (wait_job(j)) return -1;
+            st = job_status(j);
+        } else {
+            if (wait_proc(j, idx)) return -1;
+            st = proc_status(j->procs + idx);
+        }
+        if (j->state == JOB_DONE) remove_job(j);
+    }
+
+    if (status) *status = st;
+    return 0;
+}
+
 int jobs_fn(cmd_node *node, int *status) {
     if (!node || !node->argv || !node->argv[0]) return -1;
     print_jobs();
@@ -144,7 +419,7 @@ int jobs_fn(cmd_node *node, int *status) {
 int exit_fn(cmd_node *node, int *status) {
     if (!node || !node->argv || !node->argv[0]) return -1;
 
-    if (node->argv[1] == NULL) exit(0);
+    if (node->argv[1] == NULL) shell_exit(0);
     if (node->argv[2]) {
         fprintf(stderr, "exit: Too many arguments!\n");
         if (status)*status = 1;
@@ -159,68 +434,637 @@ int exit_fn(cmd_node *node, int *status) {
         return 1; // user mistake
     }
 
-    exit((int) (code & 0xff));
+    shell_exit((int) (code & 0xff));
+}
+
+/**
+ * @brief Lexically resolve path against the absolute directory base:
+ * "." and empty components are dropped and ".." removes the component
+ * before it, so symlinks in base are kept (cd -L).
+ *
+ * @return Heap-allocated absolute path, or NULL if failed.
+ */
+static char *join_path(const char *base, const char *path) {
+    size_t blen = *path == '/' ? 0 : strlen(base);
+    char *out = malloc(blen + strlen(path) + 2);
+    if (!out) {
+        perror("join_path: malloc");
+        return NULL;
+    }
+
+    size_t len = 0;
+    const char *parts[2] = {*path == '/' ? "" : base, path};
+    for (int k = 0; k < 2; ++k) {
+        for (const char *c = parts[k]; *c;) {
+            while (*c == '/') ++c;
+            size_t n = strcspn(c, "/");
+            if (n == 0 || (n == 1 && c[0] == '.')) {
+                c += n;
+                continue;
+            }
+            if (n == 2 && c[0] == '.' && c[1] == '.') {
+                while (len > 0 && out[--len] != '/');
+            } else {
+                out[len++] = '/';
+                memcpy(out + len, c, n);
+                len += n;
+            }
+            c += n;
+        }
+    }
+    if (len == 0) out[len++] = '/';
+    out[len] = 0x00;
+    return out;
+}
+
+/**
+ * @brief Current logical directory: $PWD if absolute, getcwd otherwise.
+ *
+ * @return Heap-allocated path, or NULL if failed.
+ */
+static char *logical_pwd(void) {
+    const char *pwd = var_get("PWD");
+    char *out = pwd && *pwd == '/' ? strdup(pwd) : getcwd(NULL, 0);
+    if (!out) perror("cd: getcwd");
+    return out;
 }
 
 int cd_fn(cmd_node *node, int *status) {
     if (!node || !node->argv || !node->argv[0]) return -1;
-    if (node->argv[1] && node->argv[2]) {
+    int physical = 0, idx = 1;
+    for (; node->argv[idx]; ++idx) {
+        if (strcmp(node->argv[idx], "-P") == 0) physical = 1;
+        else if (strcmp(node->argv[idx], "-L") == 0) physical = 0;
+        else break;
+    }
+    if (node->argv[idx] && node->argv[idx + 1]) {
         fprintf(stderr, "cd: Too many arguments!\n");
         if (status) *status = 1;
         return 1; // user mistake
     }
 
-    char *target;
-    char oldpwd[PATH_MAX];
-    if (!getcwd(oldpwd, sizeof(oldpwd))) {
-        perror("cd: getcwd");
-        if (status)*status = 1;
-        return -1;
-    }
-
-    if (node->argv[1] == NULL || strcmp(node->argv[1], "~") == 0) {
-        target = getenv("HOME");
+    const char *target;
+    if (node->argv[idx] == NULL || strcmp(node->argv[idx], "~") == 0) {
+        target = var_get("HOME");
         if (!target) {
             fprintf(stderr, "cd: HOME not set!\n");
             if (status)*status = 1;
             return 1;
         }
-    } else if (strcmp(node->argv[1], "-") == 0) {
-        target = getenv("OLDPWD");
+    } else if (strcmp(node->argv[idx], "-") == 0) {
+        target = var_get("OLDPWD");
         if (!target) {
             fprintf(stderr, "cd: OLDPWD not set!\n");
             if (status)*status = 1;
             return 1;
         }
     } else {
-        target = node->argv[1];
+        target = node->argv[idx];
     }
 
-    if (chdir(target)) {
-        perror("cd: chdir");
-        if (status)*status = 1;
+    int ret = -1;
+    char *newpwd = NULL;
+    char *oldpwd = logical_pwd();
+    if (!oldpwd) goto cleanup;
+
+    // Logical first (symlinks kept in $PWD), physical if that path does not work
+    if (!physical && (newpwd = join_path(oldpwd, target)) && chdir(newpwd)) {
+        free(newpwd);
+        newpwd = NULL;
+    }
+    if (!newpwd) {
+        if (chdir(target)) {
+            perror("cd: chdir");
+            ret = 1;
+            goto cleanup;
+        }
+        if (!(newpwd = getcwd(NULL, 0))) {
+            perror("cd: getcwd");
+            goto cleanup;
+        }
+    }
+
+    var_set("OLDPWD", oldpwd, VAR_EXPORT);
+    var_set("PWD", newpwd, VAR_EXPORT);
+    ret = 0;
+
+cleanup:
+    free(oldpwd);
+    free(newpwd);
+    if (status) *status = ret ? 1 : 0;
+    return ret;
+}
+
+void pwd_init(void) {
+    // An inherited $PWD is kept if it is canonical and names the working directory
+    const char *pwd = var_get("PWD");
+    char *norm = pwd && *pwd == '/' ? join_path("/", pwd) : NULL;
+    struct stat a, b;
+    int keep = norm && strcmp(norm, pwd) == 0 && stat(pwd, &a) == 0 && stat(".", &b) == 0 &&
+               a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+    free(norm);
+    if (keep) {
+        var_export("PWD");
+        return;
+    }
+
+    char *cwd = getcwd(NULL, 0);
+    if (!cwd) {
+        perror("pwd_init: getcwd");
+        return;
+    }
+    var_set("PWD", cwd, VAR_EXPORT);
+    free(cwd);
+}
+
+int export_fn(cmd_node *node, int *status) {
+    if (!node || !node->argv || !node->argv[0]) return -1;
+
+    if (node->argv[1] == NULL) {
+        print_exports();
+        if (status) *status = 0;
+        return 0;
+    }
+
+    int st = 0;
+    for (char **it = node->argv + 1; *it != NULL; ++it) {
+        const char *eq = strchr(*it, '=');
+        size_t n = eq ? (size_t) (eq - *it) : strlen(*it);
+        if (!var_valid_name(*it, n)) {
+            fprintf(stderr, "export: Invalid variable name: %s\n", *it);
+            st = 1;
+            continue;
+        }
+        if ((eq ? var_assign(*it, VAR_EXPORT) : var_export(*it)) != 0) {
+            if (status) *status = 1;
+            return -1;
+        }
+    }
+
+    if (status) *status = st;
+    return st;
+}
+
+int unset_fn(cmd_node *node, int *status) {
+    if (!node || !node->argv || !node->argv[0]) return -1;
+
+    int st = 0;
+    char **it = node->argv + 1;
+    if (*it && strcmp(*it, "-f") == 0) {
+        for (++it; *it != NULL; ++it) func_unset(*it);
+        if (status) *status = 0;
+        return 0;
+    }
+    if (*it && strcmp(*it, "-v") == 0) ++it;
+
+    for (; *it != NULL; ++it) {
+        if (!var_valid_name(*it, strlen(*it))) {
+            fprintf(stderr, "unset: Invalid variable name: %s\n", *it);
+            st = 1;
+            continue;
+        }
+        var_unset(*it);
+    }
+
+    if (status) *status = st;
+    return st;
+}
+
+int echo_fn(cmd_node *node, int *status) {
+    if (!node || !node->argv || !node->argv[0]) return -1;
+
+    int newline = 1;
+    char **it = node->argv + 1;
+    if (*it && strcmp(*it, "-n") == 0) {
+        newline = 0;
+        ++it;
+    }
+    for (; *it != NULL; ++it) {
+        fputs(*it, stdout);
+        if (it[1]) putchar(' ');
+    }
+    if (newline) putchar('\n');
+    fflush(stdout);
+
+    if (status) *status = 0;
+    return 0;
+}
+
+int pwd_fn(cmd_node *node, int *status) {
+    if (!node || !node->argv || !node->argv[0]) return -1;
+
+    int physical = node->argv[1] && strcmp(node->argv[1], "-P") == 0;
+    const char *pwd = var_get("PWD");
+    char *cwd = NULL;
+    if (physical || !pwd || *pwd != '/') {
+        if (!(cwd = getcwd(NULL, 0))) {
+            perror("pwd: getcwd");
+            if (status) *status = 1;
+            return 1;
+        }
+        pwd = cwd;
+    }
+    printf("%s\n", pwd);
+    fflush(stdout);
+    free(cwd);
+
+    if (status) *status = 0;
+    return 0;
+}
+
+int true_fn(cmd_node *node, int *status) {
+    (void) node;
+    if (status) *status = 0;
+    return 0;
+}
+
+int false_fn(cmd_node *node, int *status) {
+    (void) node;
+    if (status) *status = 1;
+    return 0;
+}
+
+/**
+ * @brief Shared implementation of break / continue.
+ */
+static int loop_control(cmd_node *node, int *status, int cont) {
+    if (!node || !node->argv || !node->argv[0]) return -1;
+
+    long long levels = 1;
+    if (node->argv[1]) {
+        char *endptr = NULL;
+        levels = strtoll(node->argv[1], &endptr, 10);
+        if (*endptr != 0x00 || levels < 1 || node->argv[2]) {
+            fprintf(stderr, "%s: Usage: \"%s [N]\" with N >= 1\n", node->argv[0], node->argv[0]);
+            if (status) *status = 1;
+            return 1;
+        }
+    }
+
+    if (exec_loop_control(levels > INT_MAX ? INT_MAX : (int) levels, cont)) {
+        fprintf(stderr, "%s: Only meaningful in a loop!\n", node->argv[0]);
+        if (status) *status = 1;
         return 1;
     }
+    if (status) *status = 0;
+    return 0;
+}
 
-    setenv("OLDPWD", oldpwd, 1);
-    char newpwd[PATH_MAX];
-    if (getcwd(newpwd, sizeof(newpwd))) setenv("PWD", newpwd, 1);
+int break_fn(cmd_node *node, int *status) {
+    return loop_control(node, status, 0);
+}
+
+int continue_fn(cmd_node *node, int *status) {
+    return loop_control(node, status, 1);
+}
 
-    if (status)*status = 0;
+int return_fn(cmd_node *node, int *status) {
+    if (!node || !node->argv || !node->argv[0]) return -1;
+
+    long long code = get_last_status();
+    if (node->argv[1]) {
+        char *endptr = NULL;
+        code = strtoll(node->argv[1], &endptr, 10);
+        if (*endptr != 0x00 || node->argv[2]) {
+            fprintf(stderr, "return: Usage: \"return [N]\"\n");
+            if (status) *status = 2;
+            return 1;
+        }
+    }
+
+    if (exec_return((int) (code & 0xff))) {
+        fprintf(stderr, "return: Only meaningful in a function!\n");
+        if (status) *status = 1;
+        return 1;
+    }
+    if (status) *status = (int) (code & 0xff);
     return 0;
 }
 
-int is_builtin(cmd_node *node) {
-    if (!node || !node->argv || node->argv[0] == NULL)
+int shift_fn(cmd_node *node, int *status) {
+    if (!node || !node->argv || !node->argv[0]) return -1;
+
+    long long n = 1;
+    if (node->argv[1]) {
+        char *endptr = NULL;
+        n = strtoll(node->argv[1], &endptr, 10);
+        if (*endptr != 0x00 || n < 0 || node->argv[2]) {
+            fprintf(stderr, "shift: Usage: \"shift [N]\" with N >= 0\n");
+            if (status) *status = 1;
+            return 1;
+        }
+    }
+
+    int st = var_shift((size_t) n) ? 1 : 0;
+    if (status) *status = st;
+    return 0;
+}
+
+/**
+ * @brief Parse a duration: a decimal number of seconds with an optional
+ * s/m/h/d suffix.
+ * @return non-zero if invalid.
+ */
+static int parse_duration(const char *str, struct timespec *out) {
+    char *endptr = NULL;
+    errno = 0;
+    double sec = strtod(str, &endptr);
+    if (errno || endptr == str || sec < 0) return -1;
+
+    switch (*endptr) {
+        case 0x00:
+        case 's': break;
+        case 'm': sec *= 60; break;
+        case 'h': sec *= 60 * 60; break;
+        case 'd': sec *= 24 * 60 * 60; break;
+        default: return -1;
+    }
+    if (*endptr != 0x00 && endptr[1] != 0x00) return -1;
+    if (sec > (double) INT_MAX) sec = (double) INT_MAX;
+
+    out->tv_sec = (time_t) sec;
+    out->tv_nsec = (long) ((sec - (double) out->tv_sec) * 1e9);
+    // Round a tiny non-zero duration up so it still arms the timer
+    if (sec > 0 && out->tv_sec == 0 && out->tv_nsec == 0) out->tv_nsec = 1;
+    return 0;
+}
+
+/**
+ * @brief Parse a signal given by number or name (with or without "SIG").
+ * @return signal number, or -1 if unknown.
+ */
+static int parse_signal(const char *str) {
+    static const struct {
+        const char *name;
+        int sig;
+    } names[] = {
+        {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+        {"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM},
+        {"TERM", SIGTERM}, {"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP},
+        {NULL, 0}
+    };
+
+    char *endptr = NULL;
+    long n = strtol(str, &endptr, 10);
+    if (endptr != str && *endptr == 0x00) return (n > 0 && n <= SIGRTMAX) ? (int) n : -1;
+
+    if (strncmp(str, "SIG", 3) == 0) str += 3;
+    for (int i = 0; names[i].name; ++i)
+        if (strcmp(names[i].name, str) == 0) return names[i].sig;
+    return -1;
+}
+
+int timeout_fn(cmd_node *node, int *status) {
+    if (!node || !node->argv || !node->argv[0]) return -1;
+
+    timeout_spec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.sig = SIGTERM;
+
+    // Options may come before or after the duration
+    int have_duration = 0;
+    char **it = node->argv + 1;
+    for (; *it != NULL; ++it) {
+        if (strcmp(*it, "--") == 0 && !have_duration) continue;
+        if (strcmp(*it, "-s") == 0 && it[1]) {
+            spec.sig = parse_signal(*++it);
+            if (spec.sig == -1) {
+                fprintf(stderr, "timeout: Invalid signal: %s\n", *it);
+                goto usage;
+            }
+        } else if (strcmp(*it, "-k") == 0 && it[1]) {
+            if (parse_duration(*++it, &spec.kill_after)) {
+                fprintf(stderr, "timeout: Invalid duration: %s\n", *it);
+                goto usage;
+            }
+        } else if (!have_duration) {
+            if (parse_duration(*it, &spec.after)) {
+                fprintf(stderr, "timeout: Invalid duration: %s\n", *it);
+                goto usage;
+            }
+            have_duration = 1;
+        } else break;
+    }
+    if (!have_duration || *it == NULL) goto usage;
+
+    // Redirections and prefix assignments are already applied to the shell
+    cmd_node timed = {.argv = it, .io = NULL, .assigns = NULL};
+    exec_timeout(&timed, &spec, status);
+    return 0;
+
+usage:
+    fprintf(stderr, "timeout: Usage: \"timeout DURATION [-s SIG] [-k DURATION] command...\"\n");
+    if (status) *status = 125;
+    return 1;
+}
+
+/**
+ * @brief Print a limit in ulimit units.
+ */
+static void print_limit(rlim_t value, rlim_t unit) {
+    if (value == RLIM_INFINITY) printf("unlimited\n");
+    else printf("%llu\n", (unsigned long long) (value / unit));
+}
+
+int ulimit_fn(cmd_node *node, int *status) {
+    if (!node || !node->argv || !node->argv[0]) return -1;
+
+    int soft = 0, hard = 0, all = 0;
+    const rlimit_info *info = NULL;
+    char **it = node->argv + 1;
+    for (; *it != NULL && (*it)[0] == '-' && (*it)[1] != 0x00; ++it) {
+        for (const char *c = *it + 1; *c; ++c) {
+            if (*c == 'S') soft = 1;
+            else if (*c == 'H') hard = 1;
+            else if (*c == 'a') all = 1;
+            else if ((info = rlimit_find(*c)) == NULL) goto usage;
+        }
+    }
+    if (!info) info = rlimit_find('f');
+
+    struct rlimit rl;
+    if (all) {
+        if (*it != NULL) goto usage;
+        for (const rlimit_info *t = rlimit_table(); t->opt; ++t) {
+            if (getrlimit(t->resource, &rl) == -1) {
+                perror("ulimit: getrlimit");
+                if (status) *status = 1;
+                return 1;
+            }
+            printf("%-28s ", t->desc);
+            print_limit(hard ? rl.rlim_max : rl.rlim_cur, t->unit);
+        }
+        if (status) *status = 0;
         return 0;
-    for (builtin_cmd *it = builtins; it->name != NULL; ++it) {
-        if (strcmp(it->name, node->argv[0]) == 0) return 1;
     }
+
+    if (getrlimit(info->resource, &rl) == -1) {
+        perror("ulimit: getrlimit");
+        if (status) *status = 1;
+        return 1;
+    }
+
+    // Query
+    if (*it == NULL) {
+        print_limit(hard && !soft ? rl.rlim_max : rl.rlim_cur, info->unit);
+        if (status) *status = 0;
+        return 0;
+    }
+
+    // Set both limits unless -S or -H is given
+    rlim_t value;
+    if (it[1] != NULL || rlimit_parse_value(*it, info->unit, &value)) goto usage;
+    if (hard || !soft) rl.rlim_max = value;
+    if (soft || !hard) rl.rlim_cur = value;
+    if (setrlimit(info->resource, &rl) == -1) {
+        perror("ulimit: setrlimit");
+        if (status) *status = 1;
+        return 1;
+    }
+    if (status) *status = 0;
     return 0;
+
+usage:
+    fprintf(stderr, "ulimit: Usage: \"ulimit [-SH] [-a | -cdfnstuv [VALUE | unlimited]]\"\n");
+    if (status) *status = 2;
+    return 1;
 }
 
-int run_builtin(cmd_node *node, int *status) {
-    if (!node || !node->argv || node->argv[0] == NULL) {
+int shellstats_fn(cmd_node *node, int *status) {
+    if (!node || !node->argv || !node->argv[0]) return -1;
+
+    int reset = 0, json = 0;
+    for (char **it = node->argv + 1; *it != NULL; ++it) {
+        if (strcmp(*it, "-r") == 0) reset = 1;
+        else if (strcmp(*it, "--json") == 0) json = 1;
+        else {
+            fprintf(stderr, "shellstats: Usage: \"shellstats [-r] [--json]\"\n");
+            if (status) *status = 2;
+            return 1;
+        }
+    }
+
+    // -r alone only resets, with --json the snapshot is printed first
+    if (!reset || json) stats_print(stdout, json);
+    if (reset) stats_reset();
+    if (status) *status = 0;
+    return 0;
+}
+
+int memstats_fn(cmd_node *node, int *status) {
+    if (!node || !node->argv || !node->argv[0]) return -1;
+    if (node->argv[1]) {
+        fprintf(stderr, "memstats: Usage: \"memstats\"\n");
+        if (status) *status = 2;
+        return 1;
+    }
+    mem_print(stdout);
+    if (status) *status = 0;
+    return 0;
+}
+
+int enable_fn(cmd_node *node, int *status) {
+    if (!node || !node->argv || !node->argv[0]) return -1;
+
+    const char *path = NULL;
+    int del = 0;
+    char **it = node->argv + 1;
+    for (; *it && (*it)[0] == '-' && (*it)[1] != 0x00; ++it) {
+        if (strcmp(*it, "-f") == 0 && it[1]) path = *++it;
+        else if (strcmp(*it, "-d") == 0) del = 1;
+        else break;
+    }
+    if ((*it && (*it)[0] == '-') || (del && (path || !*it)) || (!path && !del && *it)) {
+        fprintf(stderr, "enable: Usage: \"enable [-f module.so [name...]] [-d name...]\"\n");
+        if (status) *status = 2;
+        return 1;
+    }
+
+    // No arguments: list the loaded builtins
+    if (!path && !del) {
+        for (size_t i = 0; i < nloaded; ++i) printf("enable -f %s %s\n", loaded[i].path, loaded[i].cmd.name);
+        if (status) *status = 0;
+        return 0;
+    }
+
+    int ret = 0;
+    if (path && !*it) ret |= load_builtins(path, NULL);
+    for (; *it; ++it) {
+        if (path) {
+            ret |= load_builtins(path, *it);
+            continue;
+        }
+        size_t k = 0;
+        while (k < nloaded && strcmp(loaded[k].cmd.name, *it) != 0) ++k;
+        if (k == nloaded) {
+            fprintf(stderr, "enable: %s: Not a loaded builtin!\n", *it);
+            ret = -1;
+            continue;
+        }
+        unload(&loaded[k]);
+        memmove(loaded + k, loaded + k + 1, (nloaded - k - 1) * sizeof(loaded_builtin));
+        --nloaded;
+    }
+    if (rebuild_table()) ret = -1;
+    resolve_invalidate();
+
+    if (status) *status = ret ? 1 : 0;
+    return ret ? 1 : 0;
+}
+
+int hash_fn(cmd_node *node, int *status) {
+    if (!node || !node->argv || !node->argv[0]) return -1;
+    if (!node->argv[1] || strcmp(node->argv[1], "-r") != 0 || node->argv[2]) {
+        fprintf(stderr, "hash: Usage: \"hash -r\"\n");
+        if (status) *status = 2;
+        return 1;
+    }
+    resolve_invalidate();
+    if (status) *status = 0;
+    return 0;
+}
+
+void builtin_cleanup(void) {
+    for (size_t i = 0; i < nloaded; ++i) unload(&loaded[i]);
+    free(loaded);
+    loaded = NULL;
+    nloaded = 0;
+    rebuild_table();
+}
+
+const builtin_cmd *get_builtins(void) {
+    return table;
+}
+
+const builtin_cmd *builtin_lookup(const char *name) {
+    if (!name || !*name) return NULL;
+    for (size_t i = 0; i < nloaded; ++i)
+        if (strcmp(loaded[i].cmd.name, name) == 0) return &loaded[i].cmd;
+
+    if (!check_slots()) {
+        for (builtin_cmd *it = builtins; it->name != NULL; ++it)
+            if (strcmp(it->name, name) == 0) return it;
+        return NULL;
+    }
+    uint8_t idx = builtin_slots[builtin_slot(name, strlen(name))];
+    if (idx && strcmp(builtins[idx - 1].name, name) == 0) return &builtins[idx - 1];
+    return NULL;
+}
+
+int is_builtin(cmd_node *node) {
+    if (!node || !node->argv || node->argv[0] == NULL)
+        return 0;
+    return builtin_lookup(node->argv[0]) != NULL;
+}
+
+int is_pure_builtin(const char *name) {
+    if (!name) return 0;
+    const builtin_cmd *b = builtin_lookup(name);
+    return b ? b->pure : 0;
+}
+
+int run_builtin_cmd(const builtin_cmd *b, cmd_node *node, int *status) {
+    if (!b || !node || !node->argv || node->argv[0] == NULL) {
         fprintf(stderr, "run_builtin: Invalid command!\n");
         return -1;
     }
@@ -228,15 +1072,28 @@ int run_builtin(cmd_node *node, int *status) {
     if (node->io && apply_redir(node, REDIR_TEMPORARY) == -1)
         return -1;
 
-    for (builtin_cmd *it = builtins; it->name != NULL; ++it) {
-        if (strcmp(it->name, node->argv[0]) == 0) {
-            int ret = it->fn(node, status);
-            if (node->io) undo_redir();
-            return ret;
-        }
+    stats_count(STAT_BUILTINS, 1);
+    int ret = b->fn(node, status);
+
+    // Output still buffered belongs to the redirection target
+    if (node->io) {
+        fflush(stdout);
+        fflush(stderr);
+        undo_redir();
     }
+    return ret;
+}
 
-    fprintf(stderr, "run_builtin: builtin command not found!\n");
-    if (node->io) undo_redir();
-    return -1;
+int run_builtin(cmd_node *node, int *status) {
+    if (!node || !node->argv || node->argv[0] == NULL) {
+        fprintf(stderr, "run_builtin: Invalid command!\n");
+        return -1;
+    }
+
+    const builtin_cmd *b = builtin_lookup(node->argv[0]);
+    if (!b) {
+        fprintf(stderr, "run_builtin: builtin command not found!\n");
+        return -1;
+    }
+    return run_builtin_cmd(b, node, status);
 }
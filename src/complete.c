@@ -0,0 +1,575 @@
+#include "complete.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "builtin.h"
+#include "job.h"
+#include "vars.h"
+
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+#define UNWATCHED_RESCAN_SEC 5 ///< Longest age of an unchanged unwatched listing
+
+// Characters that end a word when scanning back from the cursor.
+static const char complete_breaks[] = " \t\n;|&<>()";
+
+/**
+ * @brief Sorted executable names found in one PATH directory.
+ */
+typedef struct exe_dir {
+    char *path; ///< Heap-allocated directory path as listed in PATH.
+    int wd; ///< inotify watch descriptor (-1 if not watched).
+    int retry_watch; ///< Nonzero if a watch may still be added (the directory was missing).
+    int stale; ///< Nonzero when the listing has to be read again.
+    struct timespec mtime; ///< Modification time at the last scan, if unwatched ({0, 0}: missing).
+    time_t scanned; ///< Monotonic second of the last scan, if unwatched.
+    char **names; ///< Heap-allocated, sorted names (not NULL-terminated).
+    size_t len; ///< Number of names stored.
+    size_t cap; ///< Allocated capacity of names.
+} exe_dir;
+
+/**
+ * @brief In-memory index of executables across every PATH directory.
+ */
+typedef struct exe_index {
+    char *path_env; ///< PATH value the index was built from (NULL if not built).
+    int ifd; ///< inotify instance (-1 if unavailable).
+    exe_dir *dirs; ///< Heap-allocated directory list, in PATH order.
+    size_t ndirs; ///< Number of directories.
+} exe_index;
+
+/**
+ * @brief Growable, NULL-terminated list of heap-allocated strings.
+ */
+typedef struct str_list {
+    char **data; ///< Heap-allocated, NULL-terminated list.
+    size_t len; ///< Number of strings (excluding the NULL terminator).
+    size_t cap; ///< Allocated capacity of data.
+} str_list;
+
+static exe_index idx = {
+    .path_env = NULL,
+    .ifd = -1,
+    .dirs = NULL,
+    .ndirs = 0
+};
+
+// Small Helpers
+
+/**
+ * @brief Appends a heap-allocated string to the list, taking ownership.
+ *
+ * @param list list being built.
+ * @param s string being pushed (freed on error).
+ * @return non-zero if failed.
+ */
+static int list_push(str_list *list, char *s) {
+    if (!s) {
+        perror("list_push: strdup");
+        return -1;
+    }
+    if (list->len + 2 > list->cap) {
+        size_t cap = list->cap ? list->cap << 1 : 8;
+        char **temp = realloc(list->data, cap * sizeof(char *));
+        if (!temp) {
+            perror("list_push: realloc");
+            free(s);
+            return -1;
+        }
+        list->data = temp;
+        list->cap = cap;
+    }
+    list->data[list->len++] = s;
+    list->data[list->len] = NULL;
+    return 0;
+}
+
+static int cmp_str(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/**
+ * @brief Sort the list and drop duplicate entries.
+ *
+ * @param list list to finalize.
+ * @return Heap-allocated, NULL-terminated list (never NULL on success).
+ */
+static char **list_finish(str_list *list) {
+    if (!list->data) {
+        list->data = calloc(1, sizeof(char *));
+        if (!list->data) perror("list_finish: calloc");
+        return list->data;
+    }
+
+    qsort(list->data, list->len, sizeof(char *), cmp_str);
+    size_t out = 0;
+    for (size_t i = 0; i < list->len; ++i) {
+        if (out > 0 && strcmp(list->data[out - 1], list->data[i]) == 0) {
+            free(list->data[i]);
+            continue;
+        }
+        list->data[out++] = list->data[i];
+    }
+    list->data[out] = NULL;
+    list->len = out;
+    return list->data;
+}
+
+/**
+ * @brief Index of the first name not less than key (binary search).
+ */
+static size_t lower_bound(char **names, size_t len, const char *key) {
+    size_t lo = 0, hi = len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(names[mid], key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * @brief Checks whether name inside directory dfd is a regular executable file.
+ *
+ * @return 1 if executable, 0 otherwise
+ */
+static int is_exec_at(int dfd, const char *name) {
+    struct stat st;
+    if (fstatat(dfd, name, &st, 0) == -1) return 0;
+    if (!S_ISREG(st.st_mode)) return 0;
+    return faccessat(dfd, name, X_OK, 0) == 0;
+}
+
+// Executable Index
+
+/**
+ * @brief Insert a name into a directory listing, keeping it sorted.
+ *
+ * @return non-zero if failed.
+ */
+static int dir_insert(exe_dir *d, const char *name) {
+    size_t pos = lower_bound(d->names, d->len, name);
+    if (pos < d->len && strcmp(d->names[pos], name) == 0) return 0;
+
+    if (d->len + 1 > d->cap) {
+        size_t cap = d->cap ? d->cap << 1 : 16;
+        char **temp = realloc(d->names, cap * sizeof(char *));
+        if (!temp) {
+            perror("dir_insert: realloc");
+            return -1;
+        }
+        d->names = temp;
+        d->cap = cap;
+    }
+
+    char *copy = strdup(name);
+    if (!copy) {
+        perror("dir_insert: strdup");
+        return -1;
+    }
+    memmove(d->names + pos + 1, d->names + pos, (d->len - pos) * sizeof(char *));
+    d->names[pos] = copy;
+    ++d->len;
+    return 0;
+}
+
+/**
+ * @brief Remove a name from a directory listing (no-op if absent).
+ */
+static void dir_remove(exe_dir *d, const char *name) {
+    size_t pos = lower_bound(d->names, d->len, name);
+    if (pos >= d->len || strcmp(d->names[pos], name) != 0) return;
+    free(d->names[pos]);
+    memmove(d->names + pos, d->names + pos + 1, (d->len - pos - 1) * sizeof(char *));
+    --d->len;
+}
+
+static void dir_clear(exe_dir *d) {
+    for (size_t i = 0; i < d->len; ++i) free(d->names[i]);
+    d->len = 0;
+}
+
+/**
+ * @brief Modification time of a directory ({0, 0} if it is missing).
+ */
+static struct timespec dir_mtime(const char *path) {
+    struct stat st;
+    if (stat(path, &st) == -1) return (struct timespec) {0, 0};
+    return st.st_mtim;
+}
+
+static time_t monotonic_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+/**
+ * @brief Read the whole directory again and rebuild its sorted listing.
+ *
+ * Also installs the inotify watch if it is missing and may be retried. A
+ * directory left unwatched records its modification time for index_sync.
+ */
+static void dir_scan(exe_dir *d) {
+    dir_clear(d);
+    d->stale = 0;
+
+    if (idx.ifd != -1 && d->wd == -1 && d->retry_watch) {
+        d->wd = inotify_add_watch(idx.ifd, d->path,
+                                  IN_CREATE | IN_DELETE | IN_ATTRIB |
+                                  IN_MOVED_FROM | IN_MOVED_TO |
+                                  IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+        // Only a missing directory can be watched later (not EACCES, ENOSPC, ...)
+        d->retry_watch = d->wd == -1 && errno == ENOENT;
+    }
+    if (d->wd == -1) {
+        d->mtime = dir_mtime(d->path);
+        d->scanned = monotonic_sec();
+    }
+
+    DIR *dp = opendir(d->path);
+    if (!dp) return; // missing PATH entries are common, not an error
+
+    struct dirent *ent;
+    while ((ent = readdir(dp)) != NULL) {
+        if (ent->d_name[0] == '.' &&
+            (ent->d_name[1] == 0x00 || (ent->d_name[1] == '.' && ent->d_name[2] == 0x00)))
+            continue;
+        if (!is_exec_at(dirfd(dp), ent->d_name)) continue;
+
+        if (d->len + 1 > d->cap) {
+            size_t cap = d->cap ? d->cap << 1 : 64;
+            char **temp = realloc(d->names, cap * sizeof(char *));
+            if (!temp) {
+                perror("dir_scan: realloc");
+                break;
+            }
+            d->names = temp;
+            d->cap = cap;
+        }
+        d->names[d->len] = strdup(ent->d_name);
+        if (!d->names[d->len]) {
+            perror("dir_scan: strdup");
+            break;
+        }
+        ++d->len;
+    }
+    closedir(dp);
+
+    qsort(d->names, d->len, sizeof(char *), cmp_str);
+}
+
+static void index_free(void) {
+    for (size_t i = 0; i < idx.ndirs; ++i) {
+        dir_clear(&idx.dirs[i]);
+        free(idx.dirs[i].names);
+        free(idx.dirs[i].path);
+    }
+    free(idx.dirs);
+    free(idx.path_env);
+    if (idx.ifd != -1) close(idx.ifd);
+
+    idx.dirs = NULL;
+    idx.ndirs = 0;
+    idx.path_env = NULL;
+    idx.ifd = -1;
+}
+
+/**
+ * @brief Build the index from scratch for a PATH value.
+ *
+ * @param path_env PATH value.
+ * @return non-zero if failed.
+ */
+static int index_build(const char *path_env) {
+    index_free();
+
+    idx.path_env = strdup(path_env);
+    if (!idx.path_env) {
+        perror("index_build: strdup");
+        return -1;
+    }
+
+    size_t cnt = 1;
+    for (const char *c = path_env; *c; ++c) cnt += *c == ':';
+
+    idx.dirs = calloc(cnt, sizeof(exe_dir));
+    if (!idx.dirs) {
+        perror("index_build: calloc");
+        index_free();
+        return -1;
+    }
+
+    // Watch failures are not fatal: unwatched directories are checked on every query.
+    idx.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    const char *l = path_env;
+    for (const char *r = path_env; 1; ++r) {
+        if (*r != ':' && *r != 0x00) continue;
+
+        // Empty PATH entry means the current directory.
+        size_t n = (size_t) (r - l);
+        char *dir = n ? strndup(l, n) : strdup(".");
+        if (!dir) {
+            perror("index_build: strdup");
+            index_free();
+            return -1;
+        }
+
+        int dup = 0;
+        for (size_t i = 0; i < idx.ndirs; ++i)
+            dup |= strcmp(idx.dirs[i].path, dir) == 0;
+
+        if (dup) {
+            free(dir);
+        } else {
+            exe_dir *d = &idx.dirs[idx.ndirs++];
+            d->path = dir;
+            d->wd = -1;
+            d->retry_watch = 1;
+            dir_scan(d);
+        }
+
+        l = r + 1;
+        if (*r == 0x00) break;
+    }
+    return 0;
+}
+
+/**
+ * @brief Apply one inotify event to the directory it belongs to.
+ */
+static void index_apply(const struct inotify_event *ev) {
+    if (ev->mask & IN_Q_OVERFLOW) {
+        for (size_t i = 0; i < idx.ndirs; ++i) idx.dirs[i].stale = 1;
+        return;
+    }
+
+    exe_dir *d = NULL;
+    for (size_t i = 0; i < idx.ndirs && !d; ++i)
+        if (idx.dirs[i].wd == ev->wd) d = &idx.dirs[i];
+    if (!d) return;
+
+    if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        if (ev->mask & IN_IGNORED) {
+            d->wd = -1;
+            d->retry_watch = 1;
+        }
+        d->stale = 1;
+        return;
+    }
+    if (ev->len == 0 || d->stale) return;
+
+    if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        dir_remove(d, ev->name);
+        return;
+    }
+
+    // IN_CREATE, IN_MOVED_TO or IN_ATTRIB: the exec bit may have changed.
+    int dfd = open(d->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd == -1) {
+        d->stale = 1;
+        return;
+    }
+    if (is_exec_at(dfd, ev->name)) {
+        if (dir_insert(d, ev->name)) d->stale = 1;
+    } else {
+        dir_remove(d, ev->name);
+    }
+    close(dfd);
+}
+
+/**
+ * @brief Bring the index up to date before a query.
+ *
+ * Rebuilds only when PATH changed, otherwise drains pending inotify events.
+ * Directories without a watch (missing, not watchable, or no inotify) are
+ * scanned again only when their modification time changed (a directory
+ * created later appears, which also retries its watch) or their listing is
+ * UNWATCHED_RESCAN_SEC old (a chmod does not touch the directory).
+ *
+ * @return non-zero if failed.
+ */
+static int index_sync(void) {
+    const char *path_env = var_get("PATH");
+    if (!path_env) path_env = DEFAULT_PATH;
+
+    if (!idx.path_env || strcmp(idx.path_env, path_env) != 0)
+        return index_build(path_env);
+
+    if (idx.ifd != -1) {
+        union {
+            struct inotify_event ev;
+            char buf[16 * 1024];
+        } u;
+        ssize_t n;
+        while ((n = read(idx.ifd, u.buf, sizeof(u.buf))) > 0) {
+            for (char *p = u.buf; p < u.buf + n;) {
+                struct inotify_event *ev = (struct inotify_event *) p;
+                index_apply(ev);
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+    }
+
+    time_t now = monotonic_sec();
+    for (size_t i = 0; i < idx.ndirs; ++i) {
+        exe_dir *d = &idx.dirs[i];
+        if (d->wd == -1 && !d->stale) {
+            struct timespec m = dir_mtime(d->path);
+            d->stale = m.tv_sec != d->mtime.tv_sec || m.tv_nsec != d->mtime.tv_nsec ||
+                       now - d->scanned >= UNWATCHED_RESCAN_SEC;
+        }
+        if (d->stale) dir_scan(d);
+    }
+    return 0;
+}
+
+// Candidate Collectors
+
+static int collect_commands(str_list *out, const char *prefix) {
+    size_t plen = strlen(prefix);
+
+    for (const builtin_cmd *it = get_builtins(); it->name != NULL; ++it)
+        if (strncmp(it->name, prefix, plen) == 0 && list_push(out, strdup(it->name)))
+            return -1;
+
+    if (index_sync()) return -1;
+
+    for (size_t i = 0; i < idx.ndirs; ++i) {
+        exe_dir *d = &idx.dirs[i];
+        for (size_t k = lower_bound(d->names, d->len, prefix); k < d->len; ++k) {
+            if (strncmp(d->names[k], prefix, plen) != 0) break;
+            if (list_push(out, strdup(d->names[k]))) return -1;
+        }
+    }
+    return 0;
+}
+
+static int collect_files(str_list *out, const char *prefix) {
+    const char *slash = strrchr(prefix, '/');
+    const char *base = slash ? slash + 1 : prefix;
+    size_t dlen = slash ? (size_t) (slash - prefix) + 1 : 0;
+    size_t blen = strlen(base);
+
+    char *dir = slash ? strndup(prefix, dlen) : strdup(".");
+    if (!dir) {
+        perror("collect_files: strdup");
+        return -1;
+    }
+
+    DIR *dp = opendir(dir);
+    free(dir);
+    if (!dp) return 0;
+
+    int ret = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dp)) != NULL) {
+        const char *name = ent->d_name;
+        if (name[0] == '.' && base[0] != '.') continue;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+        if (strncmp(name, base, blen) != 0) continue;
+
+        struct stat st;
+        int isdir = fstatat(dirfd(dp), name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+
+        size_t n = dlen + strlen(name) + 2;
+        char *cand = malloc(n);
+        if (!cand) {
+            perror("collect_files: malloc");
+            ret = -1;
+            break;
+        }
+        snprintf(cand, n, "%.*s%s%s", (int) dlen, prefix, name, isdir ? "/" : "");
+        if (list_push(out, cand)) {
+            ret = -1;
+            break;
+        }
+    }
+    closedir(dp);
+    return ret;
+}
+
+static int collect_jobs(str_list *out, const char *prefix) {
+    size_t plen = strlen(prefix);
+    for (job *it = get_job(-1); it != NULL; it = it->next) {
+        char cand[16];
+        snprintf(cand, sizeof(cand), "%%%d", it->id);
+        if (strncmp(cand, prefix, plen) == 0 && list_push(out, strdup(cand)))
+            return -1;
+    }
+    return 0;
+}
+
+// API Functions
+
+char **complete_word(complete_kind kind, const char *prefix) {
+    str_list out = { .data = NULL, .len = 0, .cap = 0 };
+    int ret = 0;
+
+    switch (kind) {
+        case COMPLETE_COMMAND:
+            ret = collect_commands(&out, prefix);
+            break;
+        case COMPLETE_FILE:
+            ret = collect_files(&out, prefix);
+            break;
+        case COMPLETE_JOB:
+            ret = collect_jobs(&out, prefix);
+            break;
+    }
+
+    if (ret) {
+        for (size_t i = 0; i < out.len; ++i) free(out.data[i]);
+        free(out.data);
+        return NULL;
+    }
+    return list_finish(&out);
+}
+
+char **complete_line(const char *line, size_t cursor, size_t *start) {
+    // Find the word start, honoring backslash-escaped separators.
+    size_t s = cursor;
+    while (s > 0 && (!strchr(complete_breaks, line[s - 1]) || (s > 1 && line[s - 2] == '\\')))
+        --s;
+    *start = s;
+
+    // Unescape the partial word (quotes and backslashes).
+    char *word = malloc(cursor - s + 1);
+    if (!word) {
+        perror("complete_line: malloc");
+        return NULL;
+    }
+    size_t n = 0;
+    for (size_t i = s; i < cursor; ++i) {
+        if (line[i] == '\'' || line[i] == '\"') continue;
+        if (line[i] == '\\' && i + 1 < cursor) ++i;
+        word[n++] = line[i];
+    }
+    word[n] = 0x00;
+
+    // Command position: nothing but whitespace since the last command separator.
+    size_t p = s;
+    while (p > 0 && (line[p - 1] == ' ' || line[p - 1] == '\t')) --p;
+    int cmdpos = p == 0 || strchr(";|&(", line[p - 1]) != NULL;
+
+    complete_kind kind = COMPLETE_FILE;
+    if (word[0] == '%') kind = COMPLETE_JOB;
+    else if (cmdpos && !strchr(word, '/')) kind = COMPLETE_COMMAND;
+
+    char **res = complete_word(kind, word);
+    free(word);
+    return res;
+}
+
+void complete_cleanup(void) {
+    index_free();
+}
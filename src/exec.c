@@ -4,14 +4,89 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
 
+#include "arith.h"
+#include "flat.h"
 #include "parse.h"
+#include "mem.h"
+#include "place.h"
+#include "prof.h"
+#include "qos.h"
 #include "redir.h"
+#include "resolve.h"
+#include "rlimit.h"
+#include "stats.h"
 #include "builtin.h"
+#include "expand.h"
+#include "func.h"
+#include "subst.h"
+#include "trace.h"
 #include "utils.h"
+#include "vars.h"
+#include "wildcard.h"
+
+extern char **environ;
+
+static int loop_depth = 0; ///< Number of loops being executed.
+static int loop_skip = 0; ///< Pending break/continue levels.
+static int loop_continue = 0; ///< Nonzero if the pending levels end with a continue.
+static int func_depth = 0; ///< Number of function calls being executed.
+static int func_returning = 0; ///< Nonzero while a return unwinds the current function.
+static int func_status = 0; ///< Status given to return.
+
+/**
+ * @brief Child node index of a flat node.
+ */
+static uint32_t kid(const flat_ast *f, uint32_t node, uint32_t i) {
+    return f->kids[f->kid_start[node] + i];
+}
+
+/**
+ * @brief Whether a flat node index is valid and of the given type.
+ */
+static int node_is(const flat_ast *f, uint32_t node, node_type type) {
+    return f && node < f->nnodes && f->types[node] == type;
+}
+
+/**
+ * @brief Whether a break/continue is unwinding the current list.
+ */
+static int exec_unwinding(void) {
+    return loop_skip > 0 || func_returning;
+}
+
+/**
+ * @brief Export prefix assignments into the current (child) process' variables.
+ *
+ * @param cmd Expanded command node.
+ * @return non-zero if failed.
+ */
+static int export_assigns(cmd_node *cmd) {
+    for (char **it = cmd->assigns; it && *it != NULL; ++it)
+        if (var_assign(*it, VAR_EXPORT)) return -1;
+    return 0;
+}
 
-static void exec_child(cmd_node *cmd) {
+/**
+ * @brief Path to exec from a resolution, unless prefix assignments change PATH.
+ */
+static const char *exec_path(const cmd_resolution *res, const cmd_node *cmd) {
+    if (res->kind != RESOLVE_EXTERNAL || !res->path) return NULL;
+    for (char **it = cmd->assigns; it && *it != NULL; ++it)
+        if (strncmp(*it, "PATH=", 5) == 0) return NULL;
+    return res->path;
+}
+
+/**
+ * @brief Exec a command in the current (child) process.
+ *
+ * @param cmd Expanded command node.
+ * @param path Resolved path of argv[0] (skips the PATH search), or NULL.
+ * @param envp Environment vector built by the parent before fork (see var_envp).
+ */
+static void exec_child(cmd_node *cmd, const char *path, char **envp) {
     // Reset signals
     reset_signals();
 
@@ -21,82 +96,240 @@ static void exec_child(cmd_node *cmd) {
         goto cleanup;
     }
 
+    // Prefix assignments only affect the child environment, rebuilt for them
+    if (cmd->assigns && cmd->assigns[0]) {
+        if (export_assigns(cmd)) goto cleanup;
+        envp = var_envp();
+    }
+
     // Apply redirections
     if (cmd->io && apply_redir(cmd, REDIR_PERMANENTLY))
         goto cleanup;
 
-    // Execute
-    execvp(cmd->argv[0], cmd->argv);
+    // Execute with the environment vector
+    if (envp) environ = envp;
+
+    // A limit prefix lowers the child's own soft limits right before exec
+    char **argv = cmd->argv;
+    if (rlimit_is_prefix(argv)) {
+        rlimit_set set;
+        if (rlimit_parse_prefix(cmd->argv, &set, &argv) || rlimit_apply(&set))
+            goto cleanup;
+    }
+    stats_count(STAT_EXECS, 1);
+
+    // A stale cached path (program moved or removed) falls back to the PATH search
+    if (path && argv == cmd->argv) execv(path, argv);
+    execvp(argv[0], argv);
+    stats_count(STAT_EXECS, (uint64_t) -1);
     perror("execvp");
 cleanup:
     _exit(127);
 }
 
-int execute_cmd(ast_node *node, int *status, int isbg) {
-    // Invalid node
-    if (!node || node->type != NODE_CMD) {
-        fprintf(stderr, "execute_cmd: Wrong node type!\n");
+/**
+ * @brief Run a shell function with the command's arguments as positional parameters.
+ *
+ * Redirections apply to the whole call. The body keeps a reference while it
+ * runs, so a function may redefine itself. Loops of the caller are not
+ * visible to break/continue inside the body.
+ *
+ * @param fn Function body (see func_lookup).
+ * @param cmd Expanded command node (argv[0] is the function name).
+ * @param status Optional output status pointer.
+ * @return non-zero on error.
+ */
+static int run_function(flat_ast *fn, cmd_node *cmd, int *status) {
+    flat_ast *body = flat_ref(fn);
+    if (!body) {
+        fprintf(stderr, "run_function: Function not found!\n");
         return -1;
     }
 
-    // Empty command
-    if (node->as.cmd.argv == NULL
-        || node->as.cmd.argv[0] == NULL) {
-        if (status) *status = 0;
-        return 0;
+    if (cmd->io && apply_redir(cmd, REDIR_TEMPORARY) == -1) {
+        free_flat_ast(body);
+        if (status) *status = 1;
+        return 1;
     }
 
-    // Run if builtin function
-    if (is_builtin(&node->as.cmd))
-        return run_builtin(&node->as.cmd, status);
+    char **params = var_swap_positional(cmd->argv + 1);
+    int depth = loop_depth;
+    loop_depth = 0;
+    ++func_depth;
+
+    int st = 0;
+    int ret = execute_flat(body, &st);
+    if (func_returning) {
+        st = func_status;
+        func_returning = 0;
+    }
+
+    --func_depth;
+    loop_depth = depth;
+    var_swap_positional(params);
+    if (cmd->io) undo_redir();
+    free_flat_ast(body);
 
+    if (status) *status = st;
+    return ret;
+}
+
+static int call_builtin(const void *b, cmd_node *cmd, int *status) {
+    return run_builtin_cmd(b, cmd, status);
+}
+
+static int call_function(const void *body, cmd_node *cmd, int *status) {
+    return run_function((flat_ast *) body, cmd, status);
+}
+
+/**
+ * @brief Run a builtin or function with its prefix assignments applied temporarily.
+ *
+ * Previous values (and export flags) are restored once it returns.
+ *
+ * @param cmd Expanded command node.
+ * @param status Optional output status pointer.
+ * @param fn call_builtin or call_function.
+ * @param target Builtin entry or function body passed to fn.
+ * @return non-zero on error.
+ */
+static int run_assigned(cmd_node *cmd, int *status, int (*fn)(const void *, cmd_node *, int *),
+                        const void *target) {
+    int n = 0;
+    while (cmd->assigns && cmd->assigns[n]) ++n;
+    if (n == 0) return fn(target, cmd, status);
+
+    int ret = -1;
+    char **names = mem_calloc(MEM_EXEC, n + 1, sizeof(char *));
+    char **olds = mem_calloc(MEM_EXEC, n + 1, sizeof(char *));
+    int *flags = mem_calloc(MEM_EXEC, n, sizeof(int));
+    if (!names || !olds || !flags) {
+        perror("run_assigned: calloc");
+        goto cleanup;
+    }
+
+    // Save previous values
+    for (int i = 0; i < n; ++i) {
+        const char *eq = strchr(cmd->assigns[i], '=');
+        names[i] = mem_strndup(MEM_EXEC, cmd->assigns[i], (size_t) (eq - cmd->assigns[i]));
+        if (!names[i]) {
+            perror("run_assigned: strndup");
+            goto cleanup;
+        }
+        flags[i] = var_flags_of(names[i]);
+        if (flags[i] == -1) continue;
+
+        const char *old = var_get(names[i]);
+        size_t sz = strlen(names[i]) + strlen(old) + 2;
+        olds[i] = mem_malloc(MEM_EXEC, sz);
+        if (!olds[i]) {
+            perror("run_assigned: malloc");
+            goto cleanup;
+        }
+        snprintf(olds[i], sz, "%s=%s", names[i], old);
+    }
+
+    if (export_assigns(cmd)) goto restore;
+    ret = fn(target, cmd, status);
+
+restore:
+    for (int i = n - 1; i >= 0; --i) {
+        var_unset(names[i]);
+        if (olds[i]) var_assign(olds[i], flags[i]);
+    }
+
+cleanup:
+    if (names) for (int i = 0; i < n; ++i) mem_free(names[i]);
+    if (olds) for (int i = 0; i < n; ++i) mem_free(olds[i]);
+    mem_free(names);
+    mem_free(olds);
+    mem_free(flags);
+    return ret;
+}
+
+/**
+ * @brief Give the terminal to a process group (a no-op without job control).
+ *
+ * @param pgid Process group.
+ * @param who perror prefix.
+ */
+static void set_terminal(pid_t pgid, const char *who) {
+    if (is_subshell() || !isatty(STDIN_FILENO)) return;
+    uint64_t t0 = trace_now();
+    if (tcsetpgrp(STDIN_FILENO, pgid) == -1) perror(who);
+    trace_span("tcsetpgrp", t0, pgid, NULL, 0);
+}
+
+/**
+ * @brief Fork an external command as a new job and add it to the job table.
+ *
+ * @param cmd Expanded command node.
+ * @param path Resolved path of the program (see exec_child), or NULL.
+ * @param isbg Is background? (1: true, 0: false)
+ * @param spawn Optional output for the tracer: read end of the pipe the child
+ *              closes when it execs (-1 while tracing is off), see trace_spawn_wait.
+ * @param spawn_ts Optional output: timestamp of the fork's return.
+ * @return The running job (owned by the job table), or NULL if failed.
+ */
+static job *fork_job(cmd_node *cmd, const char *path, int isbg, int *spawn, uint64_t *spawn_ts) {
     pid_t pid = -1;
     job *j = NULL;
 
+    qos_policy qos;
+    int isqos = isbg && qos_policy_get(&qos);
+
+    int fds[2] = {-1, -1};
+    if (spawn) trace_spawn_pipe(fds);
+
+    // Only rebuilt after an exported variable changed
+    char **envp = var_envp();
+
+    uint64_t t0 = trace_now();
+    uint64_t fork_ts = stats_now();
     pid = fork();
     switch (pid) {
         case -1: // Error
             perror("fork");
-            return -1;
+            if (fds[0] != -1) close(fds[0]);
+            if (fds[1] != -1) close(fds[1]);
+            return NULL;
 
         case 0: // Child Process
-            if (setpgid(0, 0) == -1 && errno != EACCES && errno != EINTR) {
-                perror("execute_cmd: setpgid");
+            trace_spawn_child(fds);
+            if (!is_subshell() && setpgid(0, 0) == -1 && errno != EACCES && errno != EINTR) {
+                perror("fork_job: setpgid");
                 _exit(127);
             }
-            exec_child(&node->as.cmd);
+            if (isqos) qos_background_self(&qos);
+            exec_child(cmd, path, envp);
             _exit(127); // unreachable technically
 
         default:
             break;
     }
-
-    // Parent process
-
-    // Set process group ID
-    if (setpgid(pid, pid) == -1 && errno != EACCES && errno != EINTR) {
-        perror("execute_cmd: setpgid");
-        kill(pid, SIGKILL);
-        waitpid(pid, NULL, 0);
-        return -1;
+    stats_record(PHASE_SPAWN, fork_ts);
+    stats_count(STAT_FORKS, 1);
+    trace_span("fork", t0, pid, NULL, 0);
+    if (spawn_ts) *spawn_ts = trace_now();
+    if (fds[1] != -1) close(fds[1]);
+
+    // Set process group ID (subshells keep their own group, without job control)
+    if (!is_subshell() && setpgid(pid, pid) == -1 && errno != EACCES && errno != EINTR) {
+        perror("fork_job: setpgid");
+        goto fail;
     }
 
     // Allocate a job
-    j = calloc(1, sizeof(job));
+    j = mem_calloc(MEM_JOB, 1, sizeof(job));
     if (!j) {
-        perror("execute_cmd: calloc");
-        kill(pid, SIGKILL);
-        waitpid(pid, NULL, 0);
-        return -1;
+        perror("fork_job: calloc");
+        goto fail;
     }
     j->id = -1;
-    j->procs = calloc(1, sizeof(process));
+    j->procs = mem_calloc(MEM_JOB, 1, sizeof(process));
     if (!j->procs) {
-        perror("execute_cmd: calloc");
-        kill(pid, SIGKILL);
-        waitpid(pid, NULL, 0);
-        free_job(j);
-        return -1;
+        perror("fork_job: calloc");
+        goto fail;
     }
 
     // Build job's process description
@@ -105,23 +338,81 @@ int execute_cmd(ast_node *node, int *status, int isbg) {
     j->procs[0].pid = pid;
     j->procs[0].exit_code = -1;
     j->procs[0].term_sig = -1;
+    j->procs[0].limits = rlimit_prefix_classes(cmd->argv);
 
     // Build job description
     j->id = getId();
     if (j->id == -1) {
-        fprintf(stderr, "execute_cmd: Job table full!\n");
-        kill(pid, SIGKILL);
-        waitpid(pid, NULL, 0);
-        free_job(j);
-        return -1;
+        fprintf(stderr, "fork_job: Job table full!\n");
+        goto fail;
     }
     j->isbg = isbg;
-    j->pgid = pid;
+    j->isqos = isqos;
+    j->pgid = is_subshell() ? getpgrp() : pid;
     j->isupd = 0;
     j->next = NULL;
     j->state = JOB_RUNNING;
 
     add_job(j);
+    if (spawn) *spawn = fds[0];
+    else if (fds[0] != -1) close(fds[0]);
+    return j;
+
+fail:
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    free_job(j);
+    if (fds[0] != -1) close(fds[0]);
+    return NULL;
+}
+
+int execute_cmd(flat_ast *f, uint32_t node, int *status, int isbg) {
+    // Invalid node
+    if (!node_is(f, node, NODE_CMD)) {
+        fprintf(stderr, "execute_cmd: Wrong node type!\n");
+        return -1;
+    }
+
+    // Expand words
+    cmd_node cmd;
+    unsigned long runs = subst_runs();
+    if (expand_cmd(&f->cmds[f->data[node]], &cmd)) {
+        if (status) *status = 1;
+        return -1;
+    }
+
+    // Empty command: only assignments to shell variables,
+    // its status is the one of the last command substitution (if any)
+    if (cmd.argv[0] == NULL) {
+        int ret = 0;
+        for (char **it = cmd.assigns; *it != NULL && !ret; ++it)
+            ret = var_assign(*it, VAR_LOCAL);
+        free_expanded_cmd(&cmd);
+        if (status) *status = ret ? 1 : (subst_runs() != runs ? get_last_status() : 0);
+        return ret;
+    }
+
+    // Shell functions take precedence over builtins and PATH (resolved once per generation)
+    const cmd_resolution *res = resolve_flat_cmd(f, f->data[node], cmd.argv[0]);
+    if (res->kind == RESOLVE_FUNC) {
+        int ret = run_assigned(&cmd, status, call_function, res->func);
+        free_expanded_cmd(&cmd);
+        return ret;
+    }
+
+    // Run if builtin function
+    if (res->kind == RESOLVE_BUILTIN) {
+        int ret = run_assigned(&cmd, status, call_builtin, res->builtin);
+        free_expanded_cmd(&cmd);
+        return ret;
+    }
+
+    int spawn = -1;
+    uint64_t spawn_ts = 0;
+    job *j = fork_job(&cmd, exec_path(res, &cmd), isbg, isbg ? NULL : &spawn, &spawn_ts);
+    free_expanded_cmd(&cmd);
+    if (!j) return -1;
+    pid_t pid = j->procs[0].pid;
 
     // dont want for finish if bg
     if (isbg) {
@@ -130,19 +421,23 @@ int execute_cmd(ast_node *node, int *status, int isbg) {
     }
 
     // Pass the terminal
-    if (isatty(STDIN_FILENO) && tcsetpgrp(STDIN_FILENO, pid) == -1)
-        perror("execute_cmd: tcsetpgrp");
+    set_terminal(pid, "execute_cmd: tcsetpgrp");
+    trace_spawn_wait(&spawn, &pid, &spawn_ts, 1);
 
     // Wait for child
     int wstatus;
+    uint64_t wait_ts = trace_now();
+    uint64_t fg_ts = stats_now();
     while (waitpid(pid, &wstatus, WUNTRACED) == -1) {
         if (errno == EINTR) continue;
         assert(!"execute_cmd: waitpid failed unexpectedly");
     }
+    stats_record(PHASE_FG_WAIT, fg_ts);
+    prof_wait(fg_ts);
+    trace_span("wait", wait_ts, pid, NULL, wstatus);
 
     // Reclaim the terminal
-    if (isatty(STDIN_FILENO) && tcsetpgrp(STDIN_FILENO, getpgrp()) == -1)
-        perror("execute_cmd: tcsetpgrp");
+    set_terminal(getpgrp(), "execute_cmd: tcsetpgrp");
 
     // Update jobs and processes
     if (update_proc(pid, wstatus) == -1) return -1; // No cleanup, ownership is for job.c
@@ -158,28 +453,66 @@ int execute_cmd(ast_node *node, int *status, int isbg) {
     return 0;
 }
 
-int execute_pipe(ast_node *node, int *status, int isbg) {
+int exec_timeout(cmd_node *cmd, const timeout_spec *spec, int *status) {
+    if (!cmd || !cmd->argv || !cmd->argv[0] || !spec) return -1;
+
+    int spawn = -1;
+    uint64_t spawn_ts = 0;
+    job *j = fork_job(cmd, NULL, 0, &spawn, &spawn_ts);
+    if (!j) {
+        if (status) *status = 125;
+        return -1;
+    }
+
+    // Pass the terminal
+    set_terminal(j->pgid, "exec_timeout: tcsetpgrp");
+    trace_spawn_wait(&spawn, &j->procs[0].pid, &spawn_ts, 1);
+
+    int expired = 0;
+    uint64_t wait_ts = trace_now();
+    uint64_t fg_ts = stats_now();
+    int ret = wait_job_timed(j, spec, &expired);
+    stats_record(PHASE_FG_WAIT, fg_ts);
+    prof_wait(fg_ts);
+    trace_span("wait", wait_ts, j->procs[0].pid, expired ? "timeout" : NULL, expired);
+
+    // Reclaim the terminal
+    set_terminal(getpgrp(), "exec_timeout: tcsetpgrp");
+
+    // Timed out: 124 like coreutils timeout, 128 + SIGKILL if it had to be killed
+    if (status) {
+        if (expired == 2) *status = 128 + SIGKILL;
+        else if (expired == 1) *status = 124;
+        else *status = job_status(j);
+    }
+    return ret;
+}
+
+int execute_pipe(flat_ast *f, uint32_t node, int *status, int isbg) {
     int **pipes = NULL;
     job *j = NULL;
+    place_plan *plan = NULL;
+    int *spawn = NULL;
+    uint64_t *spawn_ts = NULL;
+    pid_t *spawn_pids = NULL;
+    int cnt = 0;
 
-    if (!node || node->type != NODE_PIPE || !node->as.list.children) {
+    if (!node_is(f, node, NODE_PIPE)) {
         fprintf(stderr, "execute_pipe: Wrong node type!\n");
         goto cleanup;
     }
 
-    int cnt = 0;
-    for (ast_node **it = node->as.list.children; *it != NULL; ++it)
-        ++cnt;
+    cnt = (int) f->kid_count[node];
 
     if (cnt < 2) {
         fprintf(stderr, "execute_pipe: Children count should be >= 2");
         goto cleanup;
     }
 
-    pipes = calloc(cnt, sizeof(int *));
+    pipes = mem_calloc(MEM_EXEC, cnt, sizeof(int *));
     if (!pipes) goto cleanup;
 
-    j = calloc(1, sizeof(job));
+    j = mem_calloc(MEM_JOB, 1, sizeof(job));
     if (!j) {
         perror("execute_pipe: calloc");
         goto cleanup;
@@ -190,7 +523,7 @@ int execute_pipe(ast_node *node, int *status, int isbg) {
         goto cleanup;
     }
 
-    j->procs = calloc(cnt, sizeof(process));
+    j->procs = mem_calloc(MEM_JOB, cnt, sizeof(process));
     if (!j->procs) {
         perror("execute_pipe: calloc");
         goto cleanup;
@@ -198,7 +531,7 @@ int execute_pipe(ast_node *node, int *status, int isbg) {
     j->nproc = cnt;
     j->isbg = isbg;
     j->isupd = 0;
-    j->pgid = 0;
+    j->pgid = is_subshell() ? getpgrp() : 0;
     j->state = JOB_RUNNING;
 
     for (int i = 0; i < cnt; ++i) {
@@ -209,34 +542,76 @@ int execute_pipe(ast_node *node, int *status, int isbg) {
     }
 
     for (int i = 0; i < cnt - 1; ++i) {
-        pipes[i] = calloc(2, sizeof(int));
+        pipes[i] = mem_calloc(MEM_EXEC, 2, sizeof(int));
         if (!pipes[i]) goto cleanup;
         if (pipe(pipes[i]) == -1) {
             perror("execute_pipe: pipe");
             goto cleanup;
         }
+        stats_count(STAT_PIPES, 1);
     }
 
+    // CPU/NUMA placement of the stages (NULL unless configured)
+    plan = place_plan_new(cnt);
+
+    qos_policy qos;
+    j->isqos = isbg && qos_policy_get(&qos);
+
+    // Stage names that need no expansion are resolved here, so the children find them cached
     for (int i = 0; i < cnt; ++i) {
-        ast_node *child = node->as.list.children[i];
-        if (!child || child->type != NODE_CMD) {
-            fprintf(stderr, "execute_pipe: Invalid child!\n");
+        uint32_t child = kid(f, node, (uint32_t) i);
+        if (f->types[child] != NODE_CMD) continue;
+        const cmd_node *c = &f->cmds[f->data[child]];
+        if (c->argv && c->argv[0] && !strpbrk(c->argv[0], "$*?[~\\\001\002"))
+            resolve_flat_cmd(f, f->data[child], c->argv[0]);
+    }
+
+    // Tracer: per-stage fork-to-exec pipes (foreground only)
+    if (trace_on() && !isbg) {
+        spawn = mem_malloc(MEM_EXEC, cnt * sizeof(int));
+        spawn_ts = mem_calloc(MEM_EXEC, cnt, sizeof(uint64_t));
+        spawn_pids = mem_calloc(MEM_EXEC, cnt, sizeof(pid_t));
+        if (!spawn || !spawn_ts || !spawn_pids) {
+            perror("execute_pipe: malloc");
             goto cleanup;
         }
+        for (int i = 0; i < cnt; ++i) spawn[i] = -1;
+    }
+
+    // Environment of the external stages (only rebuilt after an exported variable changed)
+    char **envp = var_envp();
+
+    for (int i = 0; i < cnt; ++i) {
+        uint32_t child = kid(f, node, (uint32_t) i);
+        int fds[2] = {-1, -1};
+        if (spawn) trace_spawn_pipe(fds);
+        uint64_t fork_ts = trace_now();
+        uint64_t stat_ts = stats_now();
         j->procs[i].pid = fork();
         if (j->procs[i].pid == -1) {
             perror("execute_pipe: fork");
+            if (fds[0] != -1) close(fds[0]);
+            if (fds[1] != -1) close(fds[1]);
             goto cleanup;
         }
         if (j->procs[i].pid != 0) {
+            stats_record(PHASE_SPAWN, stat_ts);
+            stats_count(STAT_FORKS, 1);
+            trace_span("fork", fork_ts, j->procs[i].pid, NULL, i);
+            if (spawn) {
+                close(fds[1]);
+                spawn[i] = fds[0];
+                spawn_ts[i] = trace_now();
+                spawn_pids[i] = j->procs[i].pid;
+            }
+            if (is_subshell()) continue;
             if (i == 0) {
                 j->pgid = j->procs[0].pid;
                 if (setpgid(j->procs[0].pid, j->pgid) == -1 && errno != EACCES && errno != EINTR) {
                     perror("execute_pipe: setpgid");
                     goto cleanup;
                 }
-                if (!isbg && isatty(STDIN_FILENO) && tcsetpgrp(STDIN_FILENO, j->pgid) == -1)
-                    perror("execute_pipe: tcsetpgrp");
+                if (!isbg) set_terminal(j->pgid, "execute_pipe: tcsetpgrp");
             } else {
                 if (setpgid(j->procs[i].pid, j->pgid) == -1 && errno != EACCES && errno != EINTR) {
                     perror("execute_pipe: setpgid");
@@ -247,10 +622,13 @@ int execute_pipe(ast_node *node, int *status, int isbg) {
         }
 
         // child process
-        if (setpgid(0, j->pgid) == -1 && errno != EACCES && errno != EINTR) {
+        trace_spawn_child(fds);
+        if (!is_subshell() && setpgid(0, j->pgid) == -1 && errno != EACCES && errno != EINTR) {
             perror("execute_pipe: setpgid");
             _exit(127);
         }
+        place_apply(plan, i);
+        if (j->isqos) qos_background_self(&qos);
 
         if (
             (i > 0 && dup2(pipes[i - 1][0], STDIN_FILENO) == -1) ||
@@ -265,14 +643,37 @@ int execute_pipe(ast_node *node, int *status, int isbg) {
             close(pipes[k][1]);
         }
 
-        if (is_builtin(&child->as.cmd)) {
+        // Compound commands run in a subshell
+        if (f->types[child] != NODE_CMD) {
+            int st = 0;
+            trace_spawn_ready();
+            set_subshell();
+            forget_jobs();
+            reset_signals();
+            execute_node(f, child, &st, 0);
+            fflush(stdout);
+            _exit(st & 0xff);
+        }
+
+        cmd_node cmd;
+        if (expand_cmd(&f->cmds[f->data[child]], &cmd)) _exit(1);
+        if (cmd.argv[0] == NULL) _exit(0);
+
+        const cmd_resolution *res = resolve_flat_cmd(f, f->data[child], cmd.argv[0]);
+        if (res->kind != RESOLVE_EXTERNAL) {
             int st = 0;
+            trace_spawn_ready();
+            set_subshell();
+            forget_jobs();
             reset_signals();
-            run_builtin(&child->as.cmd, &st);
-            _exit(st);
+            if (export_assigns(&cmd)) _exit(1);
+            if (res->kind == RESOLVE_FUNC) run_function(res->func, &cmd, &st);
+            else run_builtin_cmd(res->builtin, &cmd, &st);
+            fflush(stdout);
+            _exit(st & 0xff);
         }
 
-        exec_child(&child->as.cmd);
+        exec_child(&cmd, exec_path(res, &cmd), envp);
         _exit(127);
     }
 
@@ -282,17 +683,28 @@ int execute_pipe(ast_node *node, int *status, int isbg) {
     }
 
     add_job(j);
+    place_plan_free(plan);
     if (isbg) {
-        free_ptrv((void **) pipes, free);
+        mem_free_ptrv((void **) pipes, mem_free);
         if (status) *status = 0;
         return 0;
     }
 
+    if (spawn) {
+        trace_spawn_wait(spawn, spawn_pids, spawn_ts, cnt);
+        mem_free(spawn);
+        mem_free(spawn_ts);
+        mem_free(spawn_pids);
+    }
+
+    uint64_t wait_ts = trace_now();
+    uint64_t fg_ts = stats_now();
     while (1) {
         pid_t pid = 0;
         int wstat;
         pid = waitpid(-j->pgid, &wstat, WUNTRACED);
         if (pid > 0) {
+            trace_span("wait", wait_ts, pid, NULL, wstat);
             update_proc(pid, wstat);
             update_job(j);
             if (j->state != JOB_RUNNING) break;
@@ -305,6 +717,8 @@ int execute_pipe(ast_node *node, int *status, int isbg) {
             break;
         }
     }
+    stats_record(PHASE_FG_WAIT, fg_ts);
+    prof_wait(fg_ts);
 
     // Set status
     process *last_proc = j->procs + j->nproc - 1;
@@ -314,23 +728,21 @@ int execute_pipe(ast_node *node, int *status, int isbg) {
     }
 
     // Reclaim the terminal
-    if (isatty(STDIN_FILENO) && tcsetpgrp(STDIN_FILENO, getpgrp()) == -1)
-        perror("execute_cmd: tcsetpgrp");
+    set_terminal(getpgrp(), "execute_pipe: tcsetpgrp");
 
-    free_ptrv((void **) pipes, free);
+    mem_free_ptrv((void **) pipes, mem_free);
     return 0;
 
 cleanup:
     // Reclaim the terminal
-    if (isatty(STDIN_FILENO) && tcsetpgrp(STDIN_FILENO, getpgrp()) == -1)
-        perror("execute_cmd: tcsetpgrp");
+    set_terminal(getpgrp(), "execute_pipe: tcsetpgrp");
 
     if (pipes) {
         for (int i = 0; i < cnt - 1; ++i) {
             if (pipes[i]) close(pipes[i][0]);
             if (pipes[i]) close(pipes[i][1]);
         }
-        free_ptrv((void **) pipes, free);
+        mem_free_ptrv((void **) pipes, mem_free);
     }
 
     if (j && j->procs) {
@@ -341,113 +753,382 @@ cleanup:
             }
     }
     if (j) free_job(j);
+    place_plan_free(plan);
+    if (spawn) for (int i = 0; i < cnt; ++i) if (spawn[i] != -1) close(spawn[i]);
+    mem_free(spawn);
+    mem_free(spawn_ts);
+    mem_free(spawn_pids);
 
     if (status) *status = 1;
     return -1;
 }
 
-int execute_seq(ast_node *node, int *status) {
-    if (!node || node->type != NODE_SEQ) {
+int execute_seq(flat_ast *f, uint32_t node, int *status) {
+    if (!node_is(f, node, NODE_SEQ)) {
         fprintf(stderr, "execute_seq: Wrong node type!\n");
         return -1;
     }
 
-    if (!node->as.list.children || node->as.list.children[0] == NULL) {
+    if (f->kid_count[node] == 0) {
         if (status) *status = 0;
         return 0;
     }
 
-    for (ast_node **it = node->as.list.children; *it != NULL; ++it) {
-        int ret = execute_ast(*it, status, 0);
+    for (uint32_t i = 0; i < f->kid_count[node]; ++i) {
+        int ret = execute_node(f, kid(f, node, i), status, 0);
         if (ret != 0) return ret;
+        if (exec_unwinding()) break;
     }
     return 0;
 }
 
-int execute_and(ast_node *node, int *status) {
-    if (!node || node->type != NODE_AND) {
+int execute_and(flat_ast *f, uint32_t node, int *status) {
+    if (!node_is(f, node, NODE_AND) || f->kid_count[node] != 2) {
         fprintf(stderr, "execute_and: Wrong node type!\n");
         return -1;
     }
-    if (!node->as.binary.left || !node->as.binary.right) {
-        fprintf(stderr, "execute_and: Wrong node data!\n");
-        return -1;
-    }
 
     int wstatus = 0;
-    int ret = execute_ast(node->as.binary.left, &wstatus, 0);
+    int ret = execute_node(f, kid(f, node, 0), &wstatus, 0);
     if (ret != 0)
         return ret;
 
-    if (wstatus != 0) {
+    if (wstatus != 0 || exec_unwinding()) {
         if (status) *status = wstatus;
         return 0;
     }
 
-    return execute_ast(node->as.binary.right, status, 0);
+    return execute_node(f, kid(f, node, 1), status, 0);
 }
 
-int execute_or(ast_node *node, int *status) {
-    if (!node || node->type != NODE_OR) {
+int execute_or(flat_ast *f, uint32_t node, int *status) {
+    if (!node_is(f, node, NODE_OR) || f->kid_count[node] != 2) {
         fprintf(stderr, "execute_or: Wrong node type!\n");
         return -1;
     }
-    if (!node->as.binary.left || !node->as.binary.right) {
-        fprintf(stderr, "execute_or: Wrong node data!\n");
-        return -1;
-    }
 
     int wstatus = 0;
-    int ret = execute_ast(node->as.binary.left, &wstatus, 0);
+    int ret = execute_node(f, kid(f, node, 0), &wstatus, 0);
     if (ret != 0)
         return ret;
 
-    if (wstatus == 0) {
+    if (wstatus == 0 || exec_unwinding()) {
         if (status) *status = wstatus;
         return 0;
     }
 
-    return execute_ast(node->as.binary.right, status, 0);
+    return execute_node(f, kid(f, node, 1), status, 0);
 }
 
-int execute_bg(ast_node *node, int *status) {
-    if (!node || node->type != NODE_BG) {
+int execute_bg(flat_ast *f, uint32_t node, int *status) {
+    if (!node_is(f, node, NODE_BG) || f->kid_count[node] != 1) {
         fprintf(stderr, "execute_bg: Wrong node type!\n");
         return -1;
     }
 
-    if (!node->as.bg.child) {
-        fprintf(stderr, "execute_bg: Wrong node data!\n");
+    uint32_t child = kid(f, node, 0);
+    if (f->types[child] != NODE_PIPE && f->types[child] != NODE_CMD) {
+        fprintf(stderr, "execute_bg: Only regular commands and pipes are allowed as background operation!\n");
+        if (status) *status = 1;
+        return 1;
+    }
+
+    return execute_node(f, child, status, 1);
+}
+
+int execute_arith(flat_ast *f, uint32_t node, int *status) {
+    if (!node_is(f, node, NODE_ARITH)) {
+        fprintf(stderr, "execute_arith: Wrong node type!\n");
         return -1;
     }
 
-    if (node->as.bg.child->type != NODE_PIPE && node->as.bg.child->type != NODE_CMD) {
-        fprintf(stderr, "execute_bg: Only regular commands and pipes are allowed as background operation!\n");
+    flat_arith *arith = &f->ariths[f->data[node]];
+    int64_t value = 0;
+    int ret;
+
+    if (strchr(arith->src, '$')) {
+        // Expansions first, then the (text-cached) expression
+        char *src = expand_word(arith->src);
+        if (!src) {
+            if (status) *status = 1;
+            return -1;
+        }
+        ret = arith_eval_str(src, strlen(src), &value);
+        free(src);
+    } else {
+        // Compiled once and kept in the flat AST
+        if (arith->expr.root < 0 && arith_compile(arith->src, strlen(arith->src), &arith->expr)) {
+            if (status) *status = 1;
+            return 0;
+        }
+        ret = arith_eval(&arith->expr, &value);
+    }
+
+    if (status) *status = ret ? 1 : value == 0;
+    return 0;
+}
+
+int exec_return(int status) {
+    if (func_depth == 0) return -1;
+    func_returning = 1;
+    func_status = status;
+    return 0;
+}
+
+int exec_loop_control(int levels, int cont) {
+    if (loop_depth == 0) return -1;
+    if (levels > loop_depth) levels = loop_depth;
+    loop_skip = levels;
+    loop_continue = cont;
+    return 0;
+}
+
+/**
+ * @brief Consume one level of a pending break/continue at the end of a loop iteration.
+ *
+ * @return 1 if the loop has to stop, 0 if it goes on.
+ */
+static int loop_unwind(void) {
+    if (func_returning) return 1;
+    if (!loop_skip) return 0;
+    --loop_skip;
+    return loop_skip > 0 || !loop_continue;
+}
+
+int execute_if(flat_ast *f, uint32_t node, int *status) {
+    if (!node_is(f, node, NODE_IF) || f->kid_count[node] != 3) {
+        fprintf(stderr, "execute_if: Wrong node type!\n");
+        return -1;
+    }
+
+    int wstatus = 0;
+    int ret = execute_node(f, kid(f, node, 0), &wstatus, 0);
+    if (ret != 0 || exec_unwinding()) {
+        if (status) *status = wstatus;
+        return ret;
+    }
+
+    if (wstatus == 0) return execute_node(f, kid(f, node, 1), status, 0);
+    if (kid(f, node, 2) != FLAT_NONE) return execute_node(f, kid(f, node, 2), status, 0);
+    if (status) *status = 0;
+    return 0;
+}
+
+int execute_while(flat_ast *f, uint32_t node, int *status) {
+    if (!node_is(f, node, NODE_WHILE) && !node_is(f, node, NODE_UNTIL)) {
+        fprintf(stderr, "execute_while: Wrong node type!\n");
+        return -1;
+    }
+
+    int until = f->types[node] == NODE_UNTIL;
+    uint32_t cond = kid(f, node, 0);
+    uint32_t body = kid(f, node, 1);
+    int last = 0;
+    int ret = 0;
+    ++loop_depth;
+    while (1) {
+        int wstatus = 0;
+        ret = execute_node(f, cond, &wstatus, 0);
+        if (ret != 0) break;
+        if (exec_unwinding()) {
+            if (loop_unwind()) break;
+            continue;
+        }
+        if ((wstatus == 0) == until) break;
+
+        ret = execute_node(f, body, &last, 0);
+        if (ret != 0) break;
+        if (loop_unwind()) break;
+    }
+    --loop_depth;
+
+    if (status) *status = last;
+    return ret;
+}
+
+int execute_for(flat_ast *f, uint32_t node, int *status) {
+    if (!node_is(f, node, NODE_FOR)) {
+        fprintf(stderr, "execute_for: Wrong node type!\n");
+        return -1;
+    }
+
+    flat_for *lf = &f->fors[f->data[node]];
+    uint32_t body = kid(f, node, 0);
+    char **words = expand_words(lf->words);
+    if (!words) {
         if (status) *status = 1;
-        return 1;
+        return -1;
     }
 
-    return execute_ast(node->as.bg.child, status, 1);
+    int last = 0;
+    int ret = 0;
+    ++loop_depth;
+    for (char **it = words; *it != NULL; ++it) {
+        if (var_set(lf->name, *it, VAR_LOCAL)) {
+            ret = -1;
+            break;
+        }
+        ret = execute_node(f, body, &last, 0);
+        if (ret != 0) break;
+        if (loop_unwind()) break;
+    }
+    --loop_depth;
+    free_ptrv((void **) words, free);
+
+    if (status) *status = last;
+    return ret;
 }
 
-int execute_ast(ast_node *node, int *status, int isbg) {
-    if (!node) return -1;
-    switch (node->type) {
+/**
+ * @brief Match an expanded word against one case pattern.
+ *
+ * @return 1 on match, 0 otherwise, -1 on error.
+ */
+static int case_match(const char *word, const char *pattern) {
+    char *field = expand_pattern(pattern);
+    if (!field) return -1;
+
+    wc_pattern pat;
+    int ret = -1;
+    if (!wc_compile(field, strlen(field), &pat)) {
+        ret = wc_match(&pat, word);
+        wc_free(&pat);
+    }
+    free(field);
+    return ret;
+}
+
+int execute_case(flat_ast *f, uint32_t node, int *status) {
+    if (!node_is(f, node, NODE_CASE)) {
+        fprintf(stderr, "execute_case: Wrong node type!\n");
+        return -1;
+    }
+
+    flat_case *fc = &f->cases[f->data[node]];
+    char *word = expand_word(fc->word);
+    if (!word) {
+        if (status) *status = 1;
+        return -1;
+    }
+
+    int ret = 0;
+    if (status) *status = 0;
+    for (uint32_t i = 0; i < fc->nitems; ++i) {
+        int matched = 0;
+        for (char **pat = fc->items[i].patterns; *pat != NULL && !matched; ++pat) {
+            matched = case_match(word, *pat);
+            if (matched == -1) {
+                free(word);
+                if (status) *status = 1;
+                return -1;
+            }
+        }
+        if (!matched) continue;
+
+        ret = execute_node(f, fc->items[i].body, status, 0);
+        break;
+    }
+
+    free(word);
+    return ret;
+}
+
+int execute_func(flat_ast *f, uint32_t node, int *status) {
+    if (!node_is(f, node, NODE_FUNC)) {
+        fprintf(stderr, "execute_func: Wrong node type!\n");
+        return -1;
+    }
+
+    flat_func *fn = &f->funcs[f->data[node]];
+    int ret = func_define(fn->name, fn->body);
+    if (status) *status = ret ? 1 : 0;
+    return ret;
+}
+
+int execute_node(flat_ast *f, uint32_t node, int *status, int isbg) {
+    if (!f || node >= f->nnodes) return -1;
+    int ret;
+    switch (f->types[node]) {
         case NODE_CMD:
-            return execute_cmd(node, status, isbg);
+            ret = execute_cmd(f, node, status, isbg);
+            break;
         case NODE_BG:
-            return execute_bg(node, status);
+            ret = execute_bg(f, node, status);
+            break;
         case NODE_PIPE:
-            return execute_pipe(node, status, isbg);
+            ret = execute_pipe(f, node, status, isbg);
+            break;
         case NODE_SEQ:
-            return execute_seq(node, status);
+            ret = execute_seq(f, node, status);
+            break;
         case NODE_AND:
-            return execute_and(node, status);
+            ret = execute_and(f, node, status);
+            break;
         case NODE_OR:
-            return execute_or(node, status);
+            ret = execute_or(f, node, status);
+            break;
+        case NODE_ARITH:
+            ret = execute_arith(f, node, status);
+            break;
+        case NODE_IF:
+            ret = execute_if(f, node, status);
+            break;
+        case NODE_WHILE:
+        case NODE_UNTIL:
+            ret = execute_while(f, node, status);
+            break;
+        case NODE_FOR:
+            ret = execute_for(f, node, status);
+            break;
+        case NODE_CASE:
+            ret = execute_case(f, node, status);
+            break;
+        case NODE_FUNC:
+            ret = execute_func(f, node, status);
+            break;
         default:
-            fprintf(stderr, "execute_ast: Wrong node type!\n");
+            fprintf(stderr, "execute_node: Wrong node type!\n");
             if (status) *status = 1;
             return -1;
     }
+
+    // Keep $? in sync after every executed node
+    if (status) set_last_status(*status);
+    return ret;
+}
+
+int execute_flat(flat_ast *f, int *status) {
+    if (!f) return -1;
+    if (!prof_on() || !f->line_first) return execute_node(f, f->root, status, 0);
+
+    // Profiled: every top-level command on its own
+    if (f->types[f->root] != NODE_SEQ) {
+        prof_enter(f->line_first, f->line_last, f->line_body, 0);
+        int ret = execute_node(f, f->root, status, 0);
+        prof_leave();
+        return ret;
+    }
+
+    if (status) *status = 0;
+    for (uint32_t i = 0; i < f->kid_count[f->root]; ++i) {
+        prof_enter(f->line_first, f->line_last, f->line_body, i);
+        int ret = execute_node(f, kid(f, f->root, i), status, 0);
+        prof_leave();
+        if (ret != 0) return ret;
+        if (exec_unwinding()) break;
+    }
+    if (status) set_last_status(*status);
+    return 0;
+}
+
+int execute_ast(ast_node *node, int *status, int isbg) {
+    if (!node) return -1;
+    flat_ast *f = flatten_ast(node);
+    if (!f) {
+        if (status) *status = 1;
+        return -1;
+    }
+    int ret = execute_node(f, f->root, status, isbg);
+    free_flat_ast(f);
+    return ret;
 }
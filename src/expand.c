@@ -0,0 +1,534 @@
+#include "expand.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arith.h"
+#include "lex.h"
+#include "subst.h"
+#include "utils.h"
+#include "vars.h"
+#include "wildcard.h"
+
+#define DEFAULT_IFS " \t\n"
+
+// Characters that stay escaped in fields so later stages treat them literally.
+static const char expand_specials[] = "*?[\001\002";
+
+/**
+ * @brief Field being built during expansion.
+ */
+typedef struct field_buf {
+    char *data; ///< Heap-allocated, Cstring buffer (LEX_CTLESC escapes kept).
+    size_t len; ///< Current length in use (excluding NUL).
+    size_t cap; ///< Allocated capacity of data.
+    int quoted; ///< Nonzero if any part was quoted ("" yields an empty field).
+    int at_empty; ///< Nonzero if a "$@" without parameters is part of the field.
+} field_buf;
+
+/**
+ * @brief Expansion state: finished fields and the field being built.
+ */
+typedef struct expand_ctx {
+    char **fields; ///< Heap-allocated, NULL-terminated finished fields.
+    size_t len; ///< Number of finished fields.
+    size_t cap; ///< Allocated capacity of fields.
+    field_buf cur; ///< Field being built.
+} expand_ctx;
+
+// Buffer Helpers
+
+static int field_push(field_buf *f, char c) {
+    if (f->len + 2 > f->cap) {
+        size_t cap = f->cap ? f->cap << 1 : 16;
+        char *temp = realloc(f->data, cap);
+        if (!temp) {
+            perror("field_push: realloc");
+            return -1;
+        }
+        f->data = temp;
+        f->cap = cap;
+    }
+    f->data[f->len++] = c;
+    f->data[f->len] = 0x00;
+    return 0;
+}
+
+/**
+ * @brief Appends a character that must not be interpreted by later stages.
+ */
+static int field_push_literal(field_buf *f, char c) {
+    if (strchr(expand_specials, c) && field_push(f, LEX_CTLESC)) return -1;
+    return field_push(f, c);
+}
+
+/**
+ * @brief Finish the current field and append it to the field list.
+ * Empty unquoted fields are dropped.
+ *
+ * @return non-zero if failed.
+ */
+static int field_end(expand_ctx *ctx) {
+    field_buf *f = &ctx->cur;
+    if (f->len == 0 && (!f->quoted || f->at_empty)) {
+        f->quoted = 0;
+        f->at_empty = 0;
+        return 0;
+    }
+
+    if (!f->data) {
+        f->data = calloc(1, sizeof(char));
+        if (!f->data) {
+            perror("field_end: calloc");
+            return -1;
+        }
+    }
+
+    if (ctx->len + 2 > ctx->cap) {
+        size_t cap = ctx->cap ? ctx->cap << 1 : 8;
+        char **temp = realloc(ctx->fields, cap * sizeof(char *));
+        if (!temp) {
+            perror("field_end: realloc");
+            return -1;
+        }
+        ctx->fields = temp;
+        ctx->cap = cap;
+    }
+    ctx->fields[ctx->len++] = f->data;
+    ctx->fields[ctx->len] = NULL;
+
+    f->data = NULL;
+    f->len = 0;
+    f->cap = 0;
+    f->quoted = 0;
+    f->at_empty = 0;
+    return 0;
+}
+
+static void free_ctx(expand_ctx *ctx) {
+    for (size_t i = 0; i < ctx->len; ++i) free(ctx->fields[i]);
+    free(ctx->fields);
+    free(ctx->cur.data);
+}
+
+/**
+ * @brief Remove LEX_CTLESC escapes from a field.
+ *
+ * @return Heap-allocated string (or NULL on error).
+ */
+static char *unescape(const char *field) {
+    char *out = malloc(strlen(field) + 1);
+    if (!out) {
+        perror("unescape: malloc");
+        return NULL;
+    }
+    char *o = out;
+    for (const char *c = field; *c; ++c) {
+        if (*c == LEX_CTLESC && c[1]) ++c;
+        *o++ = *c;
+    }
+    *o = 0x00;
+    return out;
+}
+
+// Parameter Expansion
+
+static int is_name_start(char c) {
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static int is_name_char(char c) {
+    return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+/**
+ * @brief Value of a parameter.
+ *
+ * @param name parameter name (not NUL-terminated)
+ * @param n name length
+ * @param tmp scratch buffer for numeric special parameters
+ * @param tmpsz size of tmp
+ * @return value, or NULL if unset
+ */
+static const char *param_value(const char *name, size_t n, char *tmp, size_t tmpsz) {
+    if (n == 1 && name[0] == '?') {
+        snprintf(tmp, tmpsz, "%d", get_last_status());
+        return tmp;
+    }
+    if (n == 1 && name[0] == '$') {
+        snprintf(tmp, tmpsz, "%ld", (long) getpid());
+        return tmp;
+    }
+    if (n == 1 && name[0] == '#') {
+        size_t cnt = 0;
+        for (char **it = var_positional(); *it != NULL; ++it) ++cnt;
+        snprintf(tmp, tmpsz, "%zu", cnt);
+        return tmp;
+    }
+    if (n == 1 && name[0] == '0') return "mini-shell";
+    if (name[0] >= '0' && name[0] <= '9') {
+        size_t idx = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (name[i] < '0' || name[i] > '9' || idx > 1000000) return NULL;
+            idx = idx * 10 + (size_t) (name[i] - '0');
+        }
+        char **pos = var_positional();
+        for (size_t i = 1; *pos != NULL && i < idx; ++i) ++pos;
+        return *pos;
+    }
+    if (!var_valid_name(name, n) || n >= tmpsz) return NULL;
+
+    memcpy(tmp, name, n);
+    tmp[n] = 0x00;
+    return var_get(tmp);
+}
+
+/**
+ * @brief Append an expansion result to the current field.
+ *
+ * Unquoted results are split on IFS when split is set.
+ *
+ * @return non-zero if failed.
+ */
+static int append_value(expand_ctx *ctx, const char *value, int quoted, int split) {
+    if (quoted || !split) {
+        for (const char *c = value; *c; ++c)
+            if (field_push_literal(&ctx->cur, *c)) return -1;
+        return 0;
+    }
+
+    const char *ifs = var_get("IFS");
+    if (!ifs) ifs = DEFAULT_IFS;
+
+    for (const char *c = value; *c; ++c) {
+        if (strchr(ifs, *c)) {
+            if (field_end(ctx)) return -1;
+            continue;
+        }
+        // Unquoted results stay subject to pattern matching, only markers are escaped.
+        if ((*c == LEX_CTLESC || *c == LEX_CTLQUOTE) && field_push(&ctx->cur, LEX_CTLESC))
+            return -1;
+        if (field_push(&ctx->cur, *c)) return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Append every positional parameter ($@ / $*).
+ *
+ * A quoted "$@" yields one field per parameter (none without parameters);
+ * otherwise the parameters are joined by a space, or by the first IFS
+ * character for a quoted "$*".
+ *
+ * @return non-zero if failed.
+ */
+static int expand_params(expand_ctx *ctx, int at, int quoted, int split) {
+    char **params = var_positional();
+
+    if (at && quoted && split) {
+        if (*params == NULL) ctx->cur.at_empty = 1;
+        for (char **it = params; *it != NULL; ++it) {
+            if (it != params && field_end(ctx)) return -1;
+            ctx->cur.quoted = 1;
+            if (append_value(ctx, *it, 1, split)) return -1;
+        }
+        return 0;
+    }
+
+    char sep[2] = { ' ', 0x00 };
+    if (!at && quoted) {
+        const char *ifs = var_get("IFS");
+        if (ifs) sep[0] = ifs[0];
+    }
+    for (char **it = params; *it != NULL; ++it) {
+        if (it != params && append_value(ctx, sep, quoted, split)) return -1;
+        if (append_value(ctx, *it, quoted, split)) return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Evaluate an arithmetic expansion and append its value.
+ *
+ * Parameter expansion and command substitution inside the expression run first.
+ *
+ * @return non-zero if failed.
+ */
+static int expand_arith(expand_ctx *ctx, const char *src, size_t n, int quoted, int split) {
+    int64_t value = 0;
+    int ret;
+
+    if (memchr(src, '$', n)) {
+        char *raw = strndup(src, n);
+        if (!raw) {
+            perror("expand_arith: strndup");
+            return -1;
+        }
+        char *text = expand_word(raw);
+        free(raw);
+        if (!text) return -1;
+        ret = arith_eval_str(text, strlen(text), &value);
+        free(text);
+    } else {
+        ret = arith_eval_str(src, n, &value);
+    }
+    if (ret) return -1;
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%" PRId64, value);
+    return append_value(ctx, buf, quoted, split);
+}
+
+/**
+ * @brief Expand one lexer word into the context.
+ *
+ * @param ctx expansion context
+ * @param word lexer word (with LEX_CTLESC / LEX_CTLQUOTE markers)
+ * @param split whether unquoted expansion results are field split
+ * @return non-zero if failed.
+ */
+static int expand_one(expand_ctx *ctx, const char *word, int split) {
+    int quoted = 0;
+
+    for (const char *c = word; *c; ++c) {
+        if (*c == LEX_CTLESC) {
+            if (c[1] == 0x00) break;
+            if (field_push(&ctx->cur, LEX_CTLESC) || field_push(&ctx->cur, c[1])) return -1;
+            ++c;
+            continue;
+        }
+        if (*c == LEX_CTLQUOTE) {
+            quoted = !quoted;
+            ctx->cur.quoted = 1;
+            continue;
+        }
+        if (*c != '$') {
+            if (field_push(&ctx->cur, *c)) return -1;
+            continue;
+        }
+
+        // Arithmetic expansion
+        if (c[1] == '(' && c[2] == '(') {
+            const char *close = lex_subst_end(c + 2);
+            const char *inner = lex_subst_end(c + 3);
+            if (close && inner && inner + 1 == close) {
+                if (expand_arith(ctx, c + 3, (size_t) (inner - c - 3), quoted, split)) return -1;
+                c = close;
+                continue;
+            }
+        }
+
+        // Command substitution
+        if (c[1] == '(') {
+            const char *close = lex_subst_end(c + 2);
+            if (close) {
+                char *src = strndup(c + 2, (size_t) (close - c - 2));
+                if (!src) {
+                    perror("expand_one: strndup");
+                    return -1;
+                }
+                char *value = command_subst(src);
+                free(src);
+                if (!value) return -1;
+                int ret = append_value(ctx, value, quoted, split);
+                free(value);
+                if (ret) return -1;
+                c = close;
+                continue;
+            }
+        }
+
+        // Every positional parameter
+        if (c[1] == '@' || c[1] == '*') {
+            if (expand_params(ctx, c[1] == '@', quoted, split)) return -1;
+            ++c;
+            continue;
+        }
+
+        // Find the parameter name
+        const char *name = NULL;
+        const char *end = NULL;
+        size_t n = 0;
+        if (c[1] == '{') {
+            const char *close = strchr(c + 2, '}');
+            if (close) {
+                name = c + 2;
+                n = (size_t) (close - name);
+                end = close;
+            }
+        } else if (is_name_start(c[1])) {
+            name = c + 1;
+            for (end = name; is_name_char(end[1]); ++end);
+            n = (size_t) (end - name) + 1;
+        } else if (c[1] != 0x00 && strchr("?$#0123456789", c[1])) {
+            name = c + 1;
+            n = 1;
+            end = name;
+        }
+
+        // Not a parameter, keep the '$' literally
+        if (!name || n == 0) {
+            if (field_push(&ctx->cur, *c)) return -1;
+            continue;
+        }
+
+        char tmp[256];
+        const char *value = param_value(name, n, tmp, sizeof(tmp));
+        if (value && append_value(ctx, value, quoted, split)) return -1;
+        c = end;
+    }
+    return 0;
+}
+
+// API Functions
+
+char **expand_words(char **words) {
+    expand_ctx ctx = { .fields = NULL, .len = 0, .cap = 0 };
+    ctx.cur = (field_buf){ .data = NULL, .len = 0, .cap = 0, .quoted = 0 };
+    char **out = NULL;
+
+    for (char **it = words; it && *it != NULL; ++it) {
+        if (expand_one(&ctx, *it, 1) || field_end(&ctx)) goto cleanup;
+    }
+
+    // Pathname expansion, or quote removal when nothing matches
+    size_t cap = ctx.len + 1;
+    size_t len = 0;
+    out = calloc(cap, sizeof(char *));
+    if (!out) {
+        perror("expand_words: calloc");
+        goto cleanup;
+    }
+    for (size_t i = 0; i < ctx.len; ++i) {
+        char **matches = has_wildcards(ctx.fields[i]) ? glob_field(ctx.fields[i]) : NULL;
+        size_t n = 0;
+        while (matches && matches[n]) ++n;
+
+        if (n == 0) {
+            free(matches);
+            out[len] = unescape(ctx.fields[i]);
+            if (!out[len++]) goto cleanup;
+            continue;
+        }
+
+        char **temp = realloc(out, (cap + n - 1) * sizeof(char *));
+        if (!temp) {
+            perror("expand_words: realloc");
+            free_ptrv((void **) matches, free);
+            goto cleanup;
+        }
+        out = temp;
+        cap += n - 1;
+        memcpy(out + len, matches, n * sizeof(char *));
+        len += n;
+        out[len] = NULL;
+        free(matches);
+    }
+    out[len] = NULL;
+
+    free_ctx(&ctx);
+    return out;
+
+cleanup:
+    free_ptrv((void **) out, free);
+    free_ctx(&ctx);
+    return NULL;
+}
+
+char *expand_word(const char *word) {
+    expand_ctx ctx = { .fields = NULL, .len = 0, .cap = 0 };
+    ctx.cur = (field_buf){ .data = NULL, .len = 0, .cap = 0, .quoted = 0 };
+    char *out = NULL;
+
+    if (expand_one(&ctx, word, 0) || field_end(&ctx)) goto cleanup;
+
+    out = unescape(ctx.len ? ctx.fields[0] : "");
+
+cleanup:
+    free_ctx(&ctx);
+    return out;
+}
+
+char *expand_pattern(const char *word) {
+    expand_ctx ctx = { .fields = NULL, .len = 0, .cap = 0 };
+    ctx.cur = (field_buf){ .data = NULL, .len = 0, .cap = 0, .quoted = 0 };
+    char *out = NULL;
+
+    if (expand_one(&ctx, word, 0) || field_end(&ctx)) goto cleanup;
+
+    out = strdup(ctx.len ? ctx.fields[0] : "");
+    if (!out) perror("expand_pattern: strdup");
+
+cleanup:
+    free_ctx(&ctx);
+    return out;
+}
+
+int expand_cmd(const cmd_node *cmd, cmd_node *out) {
+    out->argv = NULL;
+    out->io = NULL;
+    out->assigns = NULL;
+
+    out->argv = expand_words(cmd->argv);
+    if (!out->argv) goto cleanup;
+
+    // Without redirections io stays NULL, so nothing is applied or undone
+    int cnt = 0;
+    for (redir **it = cmd->io; it && *it != NULL; ++it) ++cnt;
+    if (cnt) out->io = calloc(cnt + 1, sizeof(redir *));
+    if (cnt && !out->io) {
+        perror("expand_cmd: calloc");
+        goto cleanup;
+    }
+    for (int i = 0; i < cnt; ++i) {
+        redir *io = calloc(1, sizeof(redir));
+        if (!io) {
+            perror("expand_cmd: calloc");
+            goto cleanup;
+        }
+        out->io[i] = io;
+        io->fd = cmd->io[i]->fd;
+        io->type = cmd->io[i]->type;
+        io->path = expand_word(cmd->io[i]->path);
+        if (!io->path) goto cleanup;
+    }
+
+    cnt = 0;
+    for (char **it = cmd->assigns; it && *it != NULL; ++it) ++cnt;
+    out->assigns = calloc(cnt + 1, sizeof(char *));
+    if (!out->assigns) {
+        perror("expand_cmd: calloc");
+        goto cleanup;
+    }
+    for (int i = 0; i < cnt; ++i) {
+        out->assigns[i] = expand_word(cmd->assigns[i]);
+        if (!out->assigns[i]) goto cleanup;
+    }
+    return 0;
+
+cleanup:
+    free_expanded_cmd(out);
+    return -1;
+}
+
+/**
+ * @brief Free an expanded redirection (parsed ones use free_redir).
+ */
+static void free_expanded_redir(void *p) {
+    redir *io = p;
+    free(io->path);
+    free(io);
+}
+
+void free_expanded_cmd(cmd_node *cmd) {
+    if (!cmd) return;
+    free_ptrv((void **) cmd->argv, free);
+    free_ptrv((void **) cmd->io, free_expanded_redir);
+    free_ptrv((void **) cmd->assigns, free);
+    cmd->argv = NULL;
+    cmd->io = NULL;
+    cmd->assigns = NULL;
+}
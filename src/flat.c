@@ -0,0 +1,676 @@
+#include "flat.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "resolve.h"
+
+/**
+ * @brief Header of a flat AST image (see flat_write_image).
+ */
+typedef struct flat_image_hdr {
+    uint32_t version; ///< FLAT_IMAGE_VERSION
+    uint32_t root; ///< Root node index.
+    uint32_t nnodes; ///< Number of nodes.
+    uint32_t abi; ///< Layout check: sizes of the payload structs.
+    flat_sizes sizes; ///< Element counts (the block layout derives from them).
+    uint64_t size; ///< Block size in bytes.
+} flat_image_hdr;
+
+#define FLAT_IMAGE_VERSION 1u
+#define FLAT_IMAGE_ABI ((uint32_t) (sizeof(flat_ast) << 16 | sizeof(cmd_node) << 8 | sizeof(flat_arith)))
+
+/**
+ * @brief Fill cursors while copying the tree into the arrays.
+ */
+typedef struct flat_builder {
+    flat_ast *f; ///< Flat AST being filled.
+    flat_sizes used; ///< Elements used so far in each array.
+    int failed; ///< Nonzero if a function body could not be flattened.
+} flat_builder;
+
+// Size Pass
+
+static size_t vec_len(char **v) {
+    size_t n = 0;
+    while (v && v[n]) ++n;
+    return n;
+}
+
+static void count_vec(flat_sizes *sz, char **v) {
+    size_t n = vec_len(v);
+    sz->ptrs += n + 1;
+    for (size_t i = 0; i < n; ++i) sz->pool += strlen(v[i]) + 1;
+}
+
+static void count_node(const ast_node *n, flat_sizes *sz) {
+    ++sz->nodes;
+    switch (n->type) {
+        case NODE_SEQ:
+        case NODE_PIPE:
+            for (ast_node **it = n->as.list.children; *it != NULL; ++it) {
+                ++sz->kids;
+                count_node(*it, sz);
+            }
+            break;
+        case NODE_BG:
+            sz->kids += 1;
+            count_node(n->as.bg.child, sz);
+            break;
+        case NODE_AND:
+        case NODE_OR:
+            sz->kids += 2;
+            count_node(n->as.binary.left, sz);
+            count_node(n->as.binary.right, sz);
+            break;
+        case NODE_IF:
+            sz->kids += 3;
+            count_node(n->as.cond.cond, sz);
+            count_node(n->as.cond.then_part, sz);
+            if (n->as.cond.else_part) count_node(n->as.cond.else_part, sz);
+            break;
+        case NODE_WHILE:
+        case NODE_UNTIL:
+            sz->kids += 2;
+            count_node(n->as.loop.cond, sz);
+            count_node(n->as.loop.body, sz);
+            break;
+        case NODE_FOR:
+            sz->kids += 1;
+            ++sz->fors;
+            sz->pool += strlen(n->as.loop_for.name) + 1;
+            count_vec(sz, n->as.loop_for.words);
+            count_node(n->as.loop_for.body, sz);
+            break;
+        case NODE_CASE:
+            ++sz->cases;
+            sz->pool += strlen(n->as.cases.word) + 1;
+            for (case_item **it = n->as.cases.items; *it != NULL; ++it) {
+                ++sz->items;
+                count_vec(sz, (*it)->patterns);
+                count_node((*it)->body, sz);
+            }
+            break;
+        case NODE_CMD: {
+            ++sz->cmds;
+            count_vec(sz, n->as.cmd.argv);
+            count_vec(sz, n->as.cmd.assigns);
+            size_t nio = 0;
+            for (redir **it = n->as.cmd.io; it && *it != NULL; ++it, ++nio)
+                sz->pool += strlen((*it)->path) + 1;
+            sz->redirs += nio;
+            sz->rptrs += nio + 1;
+            break;
+        }
+        case NODE_ARITH:
+            ++sz->ariths;
+            sz->pool += strlen(n->as.arith.src) + 1;
+            break;
+        case NODE_FUNC:
+            // The body is flattened separately
+            ++sz->funcs;
+            sz->pool += strlen(n->as.func.name) + 1;
+            break;
+    }
+}
+
+// Fill Pass
+
+static char *pool_str(flat_builder *b, const char *s) {
+    size_t n = strlen(s) + 1;
+    char *out = b->f->pool + b->used.pool;
+    memcpy(out, s, n);
+    b->used.pool += n;
+    return out;
+}
+
+static char **pool_vec(flat_builder *b, char **v) {
+    size_t n = vec_len(v);
+    char **out = b->f->ptrs + b->used.ptrs;
+    b->used.ptrs += n + 1;
+    for (size_t i = 0; i < n; ++i) out[i] = pool_str(b, v[i]);
+    out[n] = NULL;
+    return out;
+}
+
+/**
+ * @brief Reserve contiguous child slots for a node (before its children are filled).
+ */
+static uint32_t reserve_kids(flat_builder *b, size_t n) {
+    uint32_t start = (uint32_t) b->used.kids;
+    b->used.kids += n;
+    return start;
+}
+
+/**
+ * @brief Copy a subtree, children first.
+ *
+ * @return index of the node.
+ */
+static uint32_t fill_node(flat_builder *b, const ast_node *n) {
+    flat_ast *f = b->f;
+    uint32_t start = (uint32_t) b->used.kids;
+    uint32_t count = 0;
+    uint32_t data = FLAT_NONE;
+
+    switch (n->type) {
+        case NODE_SEQ:
+        case NODE_PIPE:
+            count = (uint32_t) vec_len((char **) n->as.list.children);
+            start = reserve_kids(b, count);
+            for (uint32_t i = 0; i < count; ++i)
+                f->kids[start + i] = fill_node(b, n->as.list.children[i]);
+            break;
+        case NODE_BG:
+            count = 1;
+            start = reserve_kids(b, count);
+            f->kids[start] = fill_node(b, n->as.bg.child);
+            break;
+        case NODE_AND:
+        case NODE_OR:
+            count = 2;
+            start = reserve_kids(b, count);
+            f->kids[start] = fill_node(b, n->as.binary.left);
+            f->kids[start + 1] = fill_node(b, n->as.binary.right);
+            break;
+        case NODE_IF:
+            count = 3;
+            start = reserve_kids(b, count);
+            f->kids[start] = fill_node(b, n->as.cond.cond);
+            f->kids[start + 1] = fill_node(b, n->as.cond.then_part);
+            f->kids[start + 2] = n->as.cond.else_part ? fill_node(b, n->as.cond.else_part) : FLAT_NONE;
+            break;
+        case NODE_WHILE:
+        case NODE_UNTIL:
+            count = 2;
+            start = reserve_kids(b, count);
+            f->kids[start] = fill_node(b, n->as.loop.cond);
+            f->kids[start + 1] = fill_node(b, n->as.loop.body);
+            break;
+        case NODE_FOR: {
+            count = 1;
+            start = reserve_kids(b, count);
+            data = (uint32_t) b->used.fors++;
+            flat_for *lf = &f->fors[data];
+            lf->name = pool_str(b, n->as.loop_for.name);
+            lf->words = pool_vec(b, n->as.loop_for.words);
+            f->kids[start] = fill_node(b, n->as.loop_for.body);
+            break;
+        }
+        case NODE_CASE: {
+            data = (uint32_t) b->used.cases++;
+            flat_case *fc = &f->cases[data];
+            fc->word = pool_str(b, n->as.cases.word);
+            fc->nitems = (uint32_t) vec_len((char **) n->as.cases.items);
+            fc->items = f->items + b->used.items;
+            b->used.items += fc->nitems;
+            for (uint32_t i = 0; i < fc->nitems; ++i) {
+                fc->items[i].patterns = pool_vec(b, n->as.cases.items[i]->patterns);
+                fc->items[i].body = fill_node(b, n->as.cases.items[i]->body);
+            }
+            break;
+        }
+        case NODE_CMD: {
+            data = (uint32_t) b->used.cmds++;
+            cmd_node *cmd = &f->cmds[data];
+            cmd->argv = pool_vec(b, n->as.cmd.argv);
+            cmd->assigns = pool_vec(b, n->as.cmd.assigns);
+            cmd->io = f->rptrs + b->used.rptrs;
+            size_t nio = 0;
+            for (redir **it = n->as.cmd.io; it && *it != NULL; ++it, ++nio) {
+                redir *io = &f->redirs[b->used.redirs++];
+                io->fd = (*it)->fd;
+                io->type = (*it)->type;
+                io->path = pool_str(b, (*it)->path);
+                cmd->io[nio] = io;
+            }
+            cmd->io[nio] = NULL;
+            b->used.rptrs += nio + 1;
+            break;
+        }
+        case NODE_ARITH: {
+            data = (uint32_t) b->used.ariths++;
+            flat_arith *fa = &f->ariths[data];
+            fa->src = pool_str(b, n->as.arith.src);
+            fa->expr = (arith_expr){ .nodes = NULL, .len = 0, .cap = 0, .root = -1 };
+            break;
+        }
+        case NODE_FUNC: {
+            data = (uint32_t) b->used.funcs++;
+            flat_func *fn = &f->funcs[data];
+            fn->name = pool_str(b, n->as.func.name);
+            fn->body = flatten_ast(n->as.func.body);
+            if (!fn->body) b->failed = 1;
+            break;
+        }
+    }
+
+    uint32_t idx = (uint32_t) b->used.nodes++;
+    f->types[idx] = (uint8_t) n->type;
+    f->kid_start[idx] = start;
+    f->kid_count[idx] = count;
+    f->data[idx] = data;
+    return idx;
+}
+
+/**
+ * @brief Reserve an aligned array inside the block.
+ *
+ * @return byte offset of the array.
+ */
+static size_t carve(size_t *off, size_t count, size_t size) {
+    size_t at = (*off + 7) & ~(size_t) 7;
+    *off = at + count * size;
+    return at;
+}
+
+/**
+ * @brief Allocate a flat AST whose arrays hold the given element counts.
+ *
+ * The block layout only depends on the counts, so an image can be loaded
+ * back into a block laid out the same way.
+ *
+ * @return Flat AST with uninitialized arrays (or NULL on error).
+ */
+static flat_ast *flat_alloc(const flat_sizes *counts) {
+    flat_sizes sz = *counts;
+    flat_ast *f = calloc(1, sizeof(flat_ast));
+    if (!f) {
+        perror("flat_alloc: calloc");
+        return NULL;
+    }
+
+    // Pointer-sized arrays first, then 32-bit ones, then bytes
+    size_t off = 0;
+    size_t o_cmds = carve(&off, sz.cmds, sizeof(cmd_node));
+    size_t o_fors = carve(&off, sz.fors, sizeof(flat_for));
+    size_t o_cases = carve(&off, sz.cases, sizeof(flat_case));
+    size_t o_items = carve(&off, sz.items, sizeof(flat_case_item));
+    size_t o_ariths = carve(&off, sz.ariths, sizeof(flat_arith));
+    size_t o_funcs = carve(&off, sz.funcs, sizeof(flat_func));
+    size_t o_ptrs = carve(&off, sz.ptrs, sizeof(char *));
+    size_t o_redirs = carve(&off, sz.redirs, sizeof(redir));
+    size_t o_rptrs = carve(&off, sz.rptrs, sizeof(redir *));
+    size_t o_start = carve(&off, sz.nodes, sizeof(uint32_t));
+    size_t o_count = carve(&off, sz.nodes, sizeof(uint32_t));
+    size_t o_data = carve(&off, sz.nodes, sizeof(uint32_t));
+    size_t o_kids = carve(&off, sz.kids, sizeof(uint32_t));
+    size_t o_types = carve(&off, sz.nodes, sizeof(uint8_t));
+    size_t o_pool = carve(&off, sz.pool, sizeof(char));
+
+    char *block = malloc(off ? off : 1);
+    if (!block) {
+        perror("flat_alloc: malloc");
+        free(f);
+        return NULL;
+    }
+    f->block = block;
+    f->cmds = (cmd_node *) (block + o_cmds);
+    f->fors = (flat_for *) (block + o_fors);
+    f->cases = (flat_case *) (block + o_cases);
+    f->items = (flat_case_item *) (block + o_items);
+    f->ariths = (flat_arith *) (block + o_ariths);
+    f->funcs = (flat_func *) (block + o_funcs);
+    f->ptrs = (char **) (block + o_ptrs);
+    f->redirs = (redir *) (block + o_redirs);
+    f->rptrs = (redir **) (block + o_rptrs);
+    f->kid_start = (uint32_t *) (block + o_start);
+    f->kid_count = (uint32_t *) (block + o_count);
+    f->data = (uint32_t *) (block + o_data);
+    f->kids = (uint32_t *) (block + o_kids);
+    f->types = (uint8_t *) (block + o_types);
+    f->pool = block + o_pool;
+    f->nnodes = (uint32_t) sz.nodes;
+    f->nariths = (uint32_t) sz.ariths;
+    f->nfuncs = (uint32_t) sz.funcs;
+    f->sizes = sz;
+    f->size = off;
+    f->refs = 1;
+    return f;
+}
+
+/**
+ * @brief Move every internal pointer of a block from one base address to another.
+ *
+ * Function bodies are separate blocks and are not touched.
+ */
+static void relocate(flat_ast *f, uintptr_t from, uintptr_t to) {
+#define RELOC(p) ((p) = (p) ? (void *) ((uintptr_t) (p) - from + to) : NULL)
+    for (size_t i = 0; i < f->sizes.cmds; ++i) {
+        RELOC(f->cmds[i].argv);
+        RELOC(f->cmds[i].io);
+        RELOC(f->cmds[i].assigns);
+    }
+    for (size_t i = 0; i < f->sizes.fors; ++i) {
+        RELOC(f->fors[i].name);
+        RELOC(f->fors[i].words);
+    }
+    for (size_t i = 0; i < f->sizes.cases; ++i) {
+        RELOC(f->cases[i].word);
+        RELOC(f->cases[i].items);
+    }
+    for (size_t i = 0; i < f->sizes.items; ++i) RELOC(f->items[i].patterns);
+    for (size_t i = 0; i < f->sizes.ariths; ++i) RELOC(f->ariths[i].src);
+    for (size_t i = 0; i < f->sizes.funcs; ++i) RELOC(f->funcs[i].name);
+    for (size_t i = 0; i < f->sizes.ptrs; ++i) RELOC(f->ptrs[i]);
+    for (size_t i = 0; i < f->sizes.redirs; ++i) RELOC(f->redirs[i].path);
+    for (size_t i = 0; i < f->sizes.rptrs; ++i) RELOC(f->rptrs[i]);
+#undef RELOC
+}
+
+/**
+ * @brief Index of the element an image pointer (offset + 1 from the block
+ * start, 0 for NULL) points to in one of the arrays of the block.
+ *
+ * @return Element index, or SIZE_MAX if NULL, outside the array or misaligned.
+ */
+static size_t image_index(const flat_ast *f, const void *p, const void *array, size_t count, size_t elem) {
+    uintptr_t v = (uintptr_t) p;
+    size_t at = (size_t) ((const char *) array - (const char *) f->block);
+    if (v == 0 || v - 1 < at) return SIZE_MAX;
+    size_t rel = (size_t) (v - 1 - at);
+    if (rel % elem || rel / elem >= count) return SIZE_MAX;
+    return rel / elem;
+}
+
+static int image_str(const flat_ast *f, const char *s) {
+    return image_index(f, s, f->pool, f->sizes.pool, 1) != SIZE_MAX;
+}
+
+/**
+ * @brief Check a NULL-terminated vector of an image, which must lie in
+ * ptrs (or rptrs) and end before the array does.
+ */
+static int image_vec(const flat_ast *f, const void *p, int redirs) {
+    size_t count = redirs ? f->sizes.rptrs : f->sizes.ptrs;
+    size_t i = image_index(f, p, redirs ? (const void *) f->rptrs : (const void *) f->ptrs, count,
+                           sizeof(void *));
+    if (i == SIZE_MAX) return 0;
+    while (i < count && (redirs ? (const void *) f->rptrs[i] : (const void *) f->ptrs[i])) ++i;
+    return i < count;
+}
+
+/**
+ * @brief Check every pointer and index of a loaded image before relocating it.
+ *
+ * Strings must lie in the pool (which must end with a NUL), vectors in ptrs
+ * or rptrs, payload indices below their counts, and children must come
+ * before their parent, so a corrupt image cannot send the executor out of
+ * the block or into a cycle.
+ *
+ * @return non-zero if the image is valid.
+ */
+static int image_valid(const flat_ast *f) {
+    const flat_sizes *sz = &f->sizes;
+    if (sz->pool && f->pool[sz->pool - 1] != 0x00) return 0;
+
+    for (size_t i = 0; i < sz->ptrs; ++i)
+        if (f->ptrs[i] && !image_str(f, f->ptrs[i])) return 0;
+    for (size_t i = 0; i < sz->redirs; ++i)
+        if (!image_str(f, f->redirs[i].path)) return 0;
+    for (size_t i = 0; i < sz->rptrs; ++i)
+        if (f->rptrs[i] && image_index(f, f->rptrs[i], f->redirs, sz->redirs, sizeof(redir)) == SIZE_MAX) return 0;
+    for (size_t i = 0; i < sz->cmds; ++i) {
+        const cmd_node *c = &f->cmds[i];
+        if (!image_vec(f, c->argv, 0) || !image_vec(f, c->assigns, 0) || !image_vec(f, c->io, 1)) return 0;
+    }
+    for (size_t i = 0; i < sz->fors; ++i)
+        if (!image_str(f, f->fors[i].name) || !image_vec(f, f->fors[i].words, 0)) return 0;
+    for (size_t i = 0; i < sz->items; ++i)
+        if (!image_vec(f, f->items[i].patterns, 0)) return 0;
+    for (size_t i = 0; i < sz->cases; ++i) {
+        const flat_case *c = &f->cases[i];
+        if (!image_str(f, c->word)) return 0;
+        size_t at = c->nitems ? image_index(f, c->items, f->items, sz->items, sizeof(flat_case_item)) : 0;
+        if (at == SIZE_MAX || c->nitems > sz->items - at) return 0;
+    }
+    for (size_t i = 0; i < sz->ariths; ++i)
+        if (!image_str(f, f->ariths[i].src)) return 0;
+    for (size_t i = 0; i < sz->funcs; ++i)
+        if (!image_str(f, f->funcs[i].name)) return 0;
+
+    for (uint32_t n = 0; n < f->nnodes; ++n) {
+        uint32_t start = f->kid_start[n], count = f->kid_count[n], data = f->data[n];
+        if ((uint64_t) start + count > sz->kids) return 0;
+        for (uint32_t k = 0; k < count; ++k) {
+            uint32_t kid = f->kids[start + k];
+            int optional = f->types[n] == NODE_IF && k == 2;
+            if (!(kid < n || (optional && kid == FLAT_NONE))) return 0;
+        }
+
+        size_t limit = SIZE_MAX, arity = count; // limit: payload count, if any
+        switch ((node_type) f->types[n]) {
+            case NODE_SEQ:
+            case NODE_PIPE:
+                break;
+            case NODE_BG:
+                arity = 1;
+                break;
+            case NODE_AND:
+            case NODE_OR:
+            case NODE_WHILE:
+            case NODE_UNTIL:
+                arity = 2;
+                break;
+            case NODE_IF:
+                arity = 3;
+                break;
+            case NODE_FOR:
+                arity = 1;
+                limit = sz->fors;
+                break;
+            case NODE_CASE:
+                arity = 0;
+                limit = sz->cases;
+                break;
+            case NODE_CMD:
+                arity = 0;
+                limit = sz->cmds;
+                break;
+            case NODE_ARITH:
+                arity = 0;
+                limit = sz->ariths;
+                break;
+            case NODE_FUNC:
+                arity = 0;
+                limit = sz->funcs;
+                break;
+            default:
+                return 0;
+        }
+        if (count != arity || (limit != SIZE_MAX && data >= limit)) return 0;
+
+        // Case item bodies are children too
+        if (f->types[n] == NODE_CASE) {
+            const flat_case *c = &f->cases[data];
+            size_t at = c->nitems ? image_index(f, c->items, f->items, sz->items, sizeof(flat_case_item)) : 0;
+            for (uint32_t k = 0; k < c->nitems; ++k)
+                if (f->items[at + k].body >= n) return 0;
+        }
+    }
+    return 1;
+}
+
+// API Functions
+
+flat_ast *flatten_ast(const ast_node *root) {
+    if (!root) return NULL;
+
+    flat_sizes sz;
+    memset(&sz, 0, sizeof(sz));
+    count_node(root, &sz);
+    if (sz.nodes >= FLAT_NONE || sz.kids >= FLAT_NONE) {
+        fprintf(stderr, "flatten_ast: Tree too large!\n");
+        return NULL;
+    }
+
+    flat_ast *f = flat_alloc(&sz);
+    if (!f) return NULL;
+
+    flat_builder b = { .f = f, .failed = 0 };
+    memset(&b.used, 0, sizeof(b.used));
+    f->root = fill_node(&b, root);
+    if (b.failed) {
+        // Only the payloads filled so far own anything
+        f->nariths = (uint32_t) b.used.ariths;
+        f->nfuncs = (uint32_t) b.used.funcs;
+        free_flat_ast(f);
+        return NULL;
+    }
+    return f;
+}
+
+flat_ast *parse_line_flat(const char *line) {
+    ast_node *root = parse_line(line);
+    if (!root) return NULL;
+    flat_ast *f = flatten_ast(root);
+    free_ast_node(root);
+    return f;
+}
+
+flat_ast *parse_tokens_flat(lex_token **tokens) {
+    ast_node *root = parse_tokens(tokens);
+    if (!root) return NULL;
+    flat_ast *f = flatten_ast(root);
+    free_ast_node(root);
+    return f;
+}
+
+/**
+ * @brief Tag function bodies in definition order (nested ones included).
+ */
+static void set_body_lines(flat_ast *f, uint32_t first, uint32_t last, uint32_t *body) {
+    for (uint32_t i = 0; i < f->nfuncs; ++i) {
+        flat_ast *b = f->funcs[i].body;
+        b->line_first = first;
+        b->line_last = last;
+        b->line_body = ++*body;
+        set_body_lines(b, first, last, body);
+    }
+}
+
+void flat_set_lines(flat_ast *f, uint32_t first, uint32_t last) {
+    if (!f) return;
+    uint32_t body = 0;
+    f->line_first = first;
+    f->line_last = last;
+    f->line_body = 0;
+    set_body_lines(f, first, last, &body);
+}
+
+flat_ast *flat_ref(flat_ast *f) {
+    if (f) ++f->refs;
+    return f;
+}
+
+void free_flat_ast(flat_ast *f) {
+    if (!f || --f->refs > 0) return;
+    for (uint32_t i = 0; i < f->nariths; ++i) arith_free(&f->ariths[i].expr);
+    for (uint32_t i = 0; i < f->nfuncs; ++i) free_flat_ast(f->funcs[i].body);
+    for (size_t i = 0; f->resolved && i < f->sizes.cmds; ++i) resolve_clear(&f->resolved[i]);
+    free(f->resolved);
+    free(f->block);
+    free(f);
+}
+
+int flat_write_image(const flat_ast *f, FILE *out) {
+    if (!f || !out) return -1;
+
+    flat_image_hdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.version = FLAT_IMAGE_VERSION;
+    hdr.root = f->root;
+    hdr.nnodes = f->nnodes;
+    hdr.abi = FLAT_IMAGE_ABI;
+    hdr.sizes = f->sizes;
+    hdr.size = f->size;
+
+    // Relocate a copy to base 1: offsets from the block start, NULL stays NULL
+    flat_ast copy = *f;
+    copy.block = malloc(f->size ? f->size : 1);
+    if (!copy.block) {
+        perror("flat_write_image: malloc");
+        return -1;
+    }
+    memcpy(copy.block, f->block, f->size);
+    ptrdiff_t delta = (char *) copy.block - (char *) f->block;
+    copy.cmds = (cmd_node *) ((char *) f->cmds + delta);
+    copy.fors = (flat_for *) ((char *) f->fors + delta);
+    copy.cases = (flat_case *) ((char *) f->cases + delta);
+    copy.items = (flat_case_item *) ((char *) f->items + delta);
+    copy.ariths = (flat_arith *) ((char *) f->ariths + delta);
+    copy.funcs = (flat_func *) ((char *) f->funcs + delta);
+    copy.ptrs = (char **) ((char *) f->ptrs + delta);
+    copy.redirs = (redir *) ((char *) f->redirs + delta);
+    copy.rptrs = (redir **) ((char *) f->rptrs + delta);
+    relocate(&copy, (uintptr_t) f->block, 1);
+
+    // Compiled expressions and bodies are not part of the block image
+    for (size_t i = 0; i < f->sizes.ariths; ++i)
+        copy.ariths[i].expr = (arith_expr){ .nodes = NULL, .len = 0, .cap = 0, .root = -1 };
+    for (size_t i = 0; i < f->sizes.funcs; ++i) copy.funcs[i].body = NULL;
+
+    int ret = 0;
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 || (f->size && fwrite(copy.block, f->size, 1, out) != 1)) {
+        perror("flat_write_image: fwrite");
+        ret = -1;
+    }
+    free(copy.block);
+
+    // Function bodies follow, in order
+    for (uint32_t i = 0; i < f->nfuncs && !ret; ++i)
+        ret = flat_write_image(f->funcs[i].body, out);
+    return ret;
+}
+
+flat_ast *flat_read_image(const void *data, size_t len, size_t *used) {
+    flat_image_hdr hdr;
+    if (!data || len < sizeof(hdr)) return NULL;
+    memcpy(&hdr, data, sizeof(hdr));
+    if (hdr.version != FLAT_IMAGE_VERSION || hdr.abi != FLAT_IMAGE_ABI) return NULL;
+    if (hdr.size > len - sizeof(hdr) || hdr.nnodes != hdr.sizes.nodes || hdr.root >= hdr.nnodes) return NULL;
+
+    // Every element takes at least a byte, so no count can exceed the block size
+    const size_t *counts = (const size_t *) &hdr.sizes;
+    for (size_t i = 0; i < sizeof(flat_sizes) / sizeof(size_t); ++i)
+        if (counts[i] > hdr.size) return NULL;
+    if (hdr.sizes.kids >= FLAT_NONE) return NULL;
+
+    flat_ast *f = flat_alloc(&hdr.sizes);
+    if (!f) return NULL;
+    f->nariths = 0;
+    f->nfuncs = 0;
+    if (f->size != hdr.size) {
+        free_flat_ast(f);
+        return NULL;
+    }
+    memcpy(f->block, (const char *) data + sizeof(hdr), f->size);
+    if (!image_valid(f)) {
+        free_flat_ast(f);
+        return NULL;
+    }
+    relocate(f, 1, (uintptr_t) f->block);
+
+    // Only the expression texts come from the image
+    for (size_t i = 0; i < hdr.sizes.ariths; ++i)
+        f->ariths[i].expr = (arith_expr){ .nodes = NULL, .len = 0, .cap = 0, .root = -1 };
+    f->nariths = (uint32_t) hdr.sizes.ariths;
+    f->nfuncs = (uint32_t) hdr.sizes.funcs;
+    f->root = hdr.root;
+
+    size_t off = sizeof(hdr) + f->size;
+    for (uint32_t i = 0; i < f->nfuncs; ++i) f->funcs[i].body = NULL;
+    for (uint32_t i = 0; i < f->nfuncs; ++i) {
+        size_t n = 0;
+        f->funcs[i].body = flat_read_image((const char *) data + off, len - off, &n);
+        if (!f->funcs[i].body) {
+            free_flat_ast(f);
+            return NULL;
+        }
+        off += n;
+    }
+
+    if (used) *used = off;
+    return f;
+}
@@ -0,0 +1,167 @@
+#include "func.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "resolve.h"
+
+#define FUNCS_INITIAL_BUCKETS 32
+
+/**
+ * @brief Function table entry.
+ */
+typedef struct shell_func shell_func;
+
+typedef struct shell_func {
+    char *name; ///< Heap-allocated function name.
+    uint32_t hash; ///< Hash of the name.
+    flat_ast *body; ///< Referenced flat body.
+    shell_func *next; ///< Next entry in the same bucket.
+} shell_func;
+
+/**
+ * @brief Hashed function table.
+ */
+typedef struct func_table {
+    shell_func **buckets; ///< Heap-allocated bucket array.
+    size_t nbuckets; ///< Bucket count (power of two).
+    size_t len; ///< Number of functions.
+} func_table;
+
+static func_table table = { .buckets = NULL, .nbuckets = 0, .len = 0 };
+
+/**
+ * @brief FNV-1a hash of a name.
+ */
+static uint32_t hash_name(const char *s) {
+    uint32_t h = 2166136261u;
+    for (; *s; ++s) {
+        h ^= (unsigned char) *s;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Grow the bucket array when the load factor exceeds 3/4.
+ *
+ * @return non-zero if failed.
+ */
+static int table_reserve(void) {
+    if (table.nbuckets && table.len + 1 <= table.nbuckets / 4 * 3) return 0;
+
+    size_t n = table.nbuckets ? table.nbuckets << 1 : FUNCS_INITIAL_BUCKETS;
+    shell_func **buckets = calloc(n, sizeof(shell_func *));
+    if (!buckets) {
+        perror("table_reserve: calloc");
+        return -1;
+    }
+
+    for (size_t i = 0; i < table.nbuckets; ++i) {
+        shell_func *it = table.buckets[i];
+        while (it) {
+            shell_func *next = it->next;
+            it->next = buckets[it->hash & (n - 1)];
+            buckets[it->hash & (n - 1)] = it;
+            it = next;
+        }
+    }
+    free(table.buckets);
+    table.buckets = buckets;
+    table.nbuckets = n;
+    return 0;
+}
+
+/**
+ * @brief Find the entry of a function.
+ *
+ * @param prev Optional output: slot pointing at the entry (for unlinking).
+ * @return entry, or NULL if not found.
+ */
+static shell_func *lookup(const char *name, shell_func ***prev) {
+    if (!table.nbuckets) return NULL;
+    uint32_t h = hash_name(name);
+    shell_func **slot = &table.buckets[h & (table.nbuckets - 1)];
+    for (; *slot; slot = &(*slot)->next) {
+        shell_func *it = *slot;
+        if (it->hash == h && strcmp(it->name, name) == 0) {
+            if (prev) *prev = slot;
+            return it;
+        }
+    }
+    return NULL;
+}
+
+// API Functions
+
+int func_define(const char *name, flat_ast *body) {
+    if (!name || !body) return -1;
+
+    // Cached resolutions may point at the old body, or at a builtin or program it now shadows
+    resolve_invalidate();
+
+    shell_func *fn = lookup(name, NULL);
+    if (fn) {
+        flat_ref(body);
+        free_flat_ast(fn->body);
+        fn->body = body;
+        return 0;
+    }
+
+    if (table_reserve()) return -1;
+    fn = malloc(sizeof(shell_func));
+    if (!fn) {
+        perror("func_define: malloc");
+        return -1;
+    }
+    fn->name = strdup(name);
+    if (!fn->name) {
+        perror("func_define: strdup");
+        free(fn);
+        return -1;
+    }
+    fn->hash = hash_name(name);
+    fn->body = flat_ref(body);
+    fn->next = table.buckets[fn->hash & (table.nbuckets - 1)];
+    table.buckets[fn->hash & (table.nbuckets - 1)] = fn;
+    ++table.len;
+    return 0;
+}
+
+flat_ast *func_lookup(const char *name) {
+    if (!name || !table.len) return NULL;
+    shell_func *fn = lookup(name, NULL);
+    return fn ? fn->body : NULL;
+}
+
+int func_unset(const char *name) {
+    shell_func **slot = NULL;
+    shell_func *fn = lookup(name, &slot);
+    if (!fn) return -1;
+    resolve_invalidate();
+    *slot = fn->next;
+    --table.len;
+    free_flat_ast(fn->body);
+    free(fn->name);
+    free(fn);
+    return 0;
+}
+
+void funcs_cleanup(void) {
+    for (size_t i = 0; i < table.nbuckets; ++i) {
+        shell_func *it = table.buckets[i];
+        while (it) {
+            shell_func *next = it->next;
+            free_flat_ast(it->body);
+            free(it->name);
+            free(it);
+            it = next;
+        }
+    }
+    free(table.buckets);
+    table.buckets = NULL;
+    table.nbuckets = 0;
+    table.len = 0;
+}
@@ -0,0 +1,308 @@
+#include "input.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "complete.h"
+#include "prompt.h"
+
+#define CTRL(c) ((c) & 0x1f)
+
+// Characters escaped with a backslash when inserted by completion.
+static const char input_specials[] = " \t\\'\";|&<>()$*?[]#";
+
+/**
+ * @brief Line buffer used by the editor.
+ */
+typedef struct line_buf {
+    char *data; ///< Heap-allocated, Cstring buffer.
+    size_t len; ///< Current length in use (excluding NUL).
+    size_t cap; ///< Allocated capacity of data.
+} line_buf;
+
+/**
+ * @brief Make room for n more characters (plus NUL).
+ *
+ * @return non-zero if failed.
+ */
+static int line_reserve(line_buf *buf, size_t n) {
+    if (buf->len + n + 1 <= buf->cap) return 0;
+    size_t cap = buf->cap ? buf->cap : 64;
+    while (buf->len + n + 1 > cap) cap <<= 1;
+    char *temp = realloc(buf->data, cap);
+    if (!temp) {
+        perror("line_reserve: realloc");
+        return -1;
+    }
+    buf->data = temp;
+    buf->cap = cap;
+    return 0;
+}
+
+static int line_push(line_buf *buf, char c) {
+    if (line_reserve(buf, 1)) return -1;
+    buf->data[buf->len++] = c;
+    buf->data[buf->len] = 0x00;
+    return 0;
+}
+
+/**
+ * @brief Redraw the last line of the prompt and the buffer.
+ */
+static void redraw(const char *prompt, const line_buf *buf) {
+    const char *nl = strrchr(prompt, '\n');
+    printf("\r%s%s\x1b[K", nl ? nl + 1 : prompt, buf->data);
+    fflush(stdout);
+}
+
+/**
+ * @brief Replace the prompt on the screen, which spans lines + 1 lines.
+ */
+static void replace_prompt(size_t lines, const char *prompt, const line_buf *buf) {
+    printf("\r");
+    while (lines-- > 0) printf("\x1b[A");
+    printf("\x1b[J%s%s", prompt, buf->data);
+    fflush(stdout);
+}
+
+/**
+ * @brief Replace buf[start..len) with the escaped form of text.
+ *
+ * @return non-zero if failed.
+ */
+static int replace_word(line_buf *buf, size_t start, const char *text) {
+    buf->len = start;
+    buf->data[buf->len] = 0x00;
+    for (const char *c = text; *c; ++c) {
+        if (strchr(input_specials, *c) && line_push(buf, '\\')) return -1;
+        if (line_push(buf, *c)) return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Print all candidates below the current line.
+ */
+static void list_candidates(char **cands) {
+    printf("\r\n");
+    size_t col = 0;
+    for (char **it = cands; *it != NULL; ++it) {
+        size_t n = strlen(*it);
+        if (col > 0 && col + n + 2 > 80) {
+            printf("\r\n");
+            col = 0;
+        }
+        printf("%s  ", *it);
+        col += n + 2;
+    }
+    printf("\r\n");
+}
+
+/**
+ * @brief Complete the word before the cursor.
+ *
+ * A unique match is inserted in full, otherwise the longest common prefix.
+ * When nothing can be added, a second Tab lists every candidate.
+ *
+ * @return non-zero if failed.
+ */
+static int do_complete(const char *prompt, line_buf *buf, int repeated) {
+    int ret = -1;
+    char *text = NULL;
+    char *old = NULL;
+    size_t start = 0;
+
+    char **cands = complete_line(buf->data, buf->len, &start);
+    if (!cands) return -1;
+
+    size_t n = 0;
+    while (cands[n]) ++n;
+
+    if (n == 0) {
+        putchar('\a');
+        fflush(stdout);
+        ret = 0;
+        goto cleanup;
+    }
+
+    size_t lcp = strlen(cands[0]);
+    for (size_t i = 1; i < n; ++i) {
+        size_t k = 0;
+        while (k < lcp && cands[i][k] == cands[0][k]) ++k;
+        lcp = k;
+    }
+
+    text = strndup(cands[0], lcp);
+    old = strdup(buf->data + start);
+    if (!text || !old) {
+        perror("do_complete: strdup");
+        goto cleanup;
+    }
+
+    if (replace_word(buf, start, text)) goto cleanup;
+    if (n == 1 && lcp > 0 && text[lcp - 1] != '/' && line_push(buf, ' ')) goto cleanup;
+
+    if (n > 1 && strcmp(old, buf->data + start) == 0) {
+        if (repeated) list_candidates(cands);
+        else putchar('\a');
+    }
+    redraw(prompt, buf);
+    ret = 0;
+
+cleanup:
+    free(text);
+    free(old);
+    for (char **it = cands; *it != NULL; ++it) free(*it);
+    free(cands);
+    return ret;
+}
+
+/**
+ * @brief Read a line from the terminal in raw mode.
+ *
+ * @return Heap-allocated line with trailing newline, or NULL at end of input
+ *         (errno == 0) or when canceled with Ctrl-C (errno == ECANCELED).
+ */
+static char *edit_line(const char *prompt) {
+    struct termios saved, raw;
+    if (tcgetattr(STDIN_FILENO, &saved) == -1) {
+        perror("edit_line: tcgetattr");
+        return NULL;
+    }
+    raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG | IEXTEN);
+    raw.c_iflag &= ~(IXON | ICRNL);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == -1) {
+        perror("edit_line: tcsetattr");
+        return NULL;
+    }
+
+    line_buf buf = { .data = NULL, .len = 0, .cap = 0 };
+    int eof = 0;
+    int canceled = 0;
+    int last_tab = 0;
+
+    if (line_reserve(&buf, 0)) goto cleanup;
+    buf.data[0] = 0x00;
+    printf("%s", prompt);
+    fflush(stdout);
+
+    while (1) {
+        // Background prompt segments are redrawn when ready, without blocking input
+        struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0}, {prompt_event_fd(), POLLIN, 0}};
+        if (poll(fds, fds[1].fd == -1 ? 1 : 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("edit_line: poll");
+            goto cleanup;
+        }
+        if (fds[1].fd != -1 && fds[1].revents & POLLIN) {
+            size_t lines = 0;
+            for (const char *nl = strchr(prompt, '\n'); nl; nl = strchr(nl + 1, '\n')) ++lines;
+            const char *next = prompt_refresh(prompt);
+            if (next) replace_prompt(lines, next, &buf);
+            if (next) prompt = next;
+            if (!(fds[0].revents & POLLIN)) continue;
+        }
+
+        char c;
+        ssize_t n = read(STDIN_FILENO, &c, 1);
+        if (n == -1) {
+            // SIGCHLD interrupts are expected; keep the partial line.
+            if (errno == EINTR) continue;
+            perror("edit_line: read");
+            goto cleanup;
+        }
+        if (n == 0) {
+            eof = 1;
+            break;
+        }
+
+        int tab = c == '\t';
+        if (c == '\r' || c == '\n') {
+            printf("\r\n");
+            break;
+        } else if (tab) {
+            if (do_complete(prompt, &buf, last_tab)) goto cleanup;
+        } else if (c == CTRL('d')) {
+            if (buf.len == 0) {
+                eof = 1;
+                break;
+            }
+        } else if (c == CTRL('c')) {
+            printf("^C\r\n");
+            canceled = 1;
+            break;
+        } else if (c == 0x7f || c == CTRL('h')) {
+            if (buf.len > 0) buf.data[--buf.len] = 0x00;
+            redraw(prompt, &buf);
+        } else if (c == CTRL('u')) {
+            buf.len = 0;
+            buf.data[0] = 0x00;
+            redraw(prompt, &buf);
+        } else if (c == CTRL('w')) {
+            while (buf.len > 0 && buf.data[buf.len - 1] == ' ') --buf.len;
+            while (buf.len > 0 && buf.data[buf.len - 1] != ' ') --buf.len;
+            buf.data[buf.len] = 0x00;
+            redraw(prompt, &buf);
+        } else if (c == CTRL('l')) {
+            printf("\x1b[H\x1b[2J");
+            redraw(prompt, &buf);
+        } else if (c == 0x1b) {
+            // Swallow escape sequences (arrow keys etc.), editing is append-only.
+            char seq;
+            if (read(STDIN_FILENO, &seq, 1) == 1 && seq == '[') {
+                while (read(STDIN_FILENO, &seq, 1) == 1 && !(seq >= 0x40 && seq <= 0x7e));
+            }
+        } else if ((unsigned char) c >= 0x20) {
+            if (line_push(&buf, c)) goto cleanup;
+            putchar(c);
+            fflush(stdout);
+        }
+        last_tab = tab;
+    }
+
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+    if (eof || canceled) {
+        free(buf.data);
+        errno = canceled ? ECANCELED : 0;
+        return NULL;
+    }
+    if (line_push(&buf, '\n')) {
+        free(buf.data);
+        return NULL;
+    }
+    return buf.data;
+
+cleanup:
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+    free(buf.data);
+    return NULL;
+}
+
+char *read_line(const char *prompt) {
+    if (isatty(STDIN_FILENO) && isatty(STDOUT_FILENO))
+        return edit_line(prompt);
+
+    printf("%s", prompt);
+    fflush(stdout);
+
+    char *line = NULL;
+    size_t cap = 0;
+    errno = 0;
+    ssize_t n = getline(&line, &cap, stdin);
+    if (n == -1) {
+        int err = errno;
+        free(line);
+        if (err == EINTR) clearerr(stdin);
+        errno = feof(stdin) ? 0 : err;
+        return NULL;
+    }
+    return line;
+}
@@ -1,11 +1,32 @@
+#define _GNU_SOURCE
 #include "job.h"
 
+#include <errno.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/wait.h>
 
+#include "mem.h"
+#include "prof.h"
+#include "rlimit.h"
+#include "stats.h"
+#include "trace.h"
+#include "utils.h"
+#include "vars.h"
+
+#define KILL_GRACE_DEFAULT_NS 500000000ull ///< Default grace period of kill_jobs
+#define KILL_POLL_MS 10 ///< Poll interval for processes without a pidfd
+#define KILL_WAIT_NS 1000000000ull ///< Longest wait of kill_jobs for killed processes
+
 static job *head = NULL;
 static int pool[MAX_JOBS];
 
@@ -19,11 +40,29 @@ int getId(void) {
     return -1;
 }
 
+/**
+ * @brief Resource limit that terminated a process (NULL if none).
+ */
+static const char *proc_reason(const process *p) {
+    if (p->state != PROC_DONE || p->term_sig == -1) return NULL;
+    return rlimit_reason(p->limits, p->term_sig);
+}
+
+/**
+ * @brief Print a "Done!" line, with the resource limit that ended the job if any.
+ */
+static void print_done(const job *j) {
+    const char *reason = NULL;
+    for (int i = 0; i < j->nproc && !reason; ++i) reason = proc_reason(j->procs + i);
+    if (reason) printf("[%d] Done! %d (%s)\n", j->id, j->pgid, reason);
+    else printf("[%d] Done! %d\n", j->id, j->pgid);
+}
+
 void free_job(job *j) {
     if (!j) return;
     if (j->id >= 0 && j->id < MAX_JOBS) pool[j->id] = 0;
-    free(j->procs);
-    free(j);
+    mem_free(j->procs);
+    mem_free(j);
 }
 
 int update_proc(pid_t pid, int status) {
@@ -35,18 +74,22 @@ int update_proc(pid_t pid, int status) {
                 it->procs[i].exit_code = WEXITSTATUS(status);
                 it->procs[i].term_sig = -1;
                 it->procs[i].state = PROC_DONE;
+                trace_instant("proc", pid, "exited", WEXITSTATUS(status));
             } else if (WIFSIGNALED(status)) {
                 it->procs[i].term_sig = WTERMSIG(status);
                 it->procs[i].exit_code = -1;
                 it->procs[i].state = PROC_DONE;
+                trace_instant("proc", pid, "signaled", WTERMSIG(status));
             } else if (WIFSTOPPED(status)) {
                 it->procs[i].state = PROC_STOP;
                 it->procs[i].exit_code = -1;
                 it->procs[i].term_sig = -1;
+                trace_instant("proc", pid, "stopped", WSTOPSIG(status));
             } else if (WIFCONTINUED(status)) {
                 it->procs[i].state = PROC_RUN;
                 it->procs[i].exit_code = -1;
                 it->procs[i].term_sig = -1;
+                trace_instant("proc", pid, "continued", 0);
             } else {
                 fprintf(stderr, "update_proc: Unknown process status!\n");
                 return -1;
@@ -81,6 +124,7 @@ int update_job(job *j) {
         }
     }
 
+    job_state old = j->state;
     if (running == 0 && stopped == 0)
         j->state = JOB_DONE;
     else if (stopped > 0)
@@ -88,6 +132,11 @@ int update_job(job *j) {
     else if (running > 0)
         j->state = JOB_RUNNING;
 
+    if (j->state != old) {
+        static const char *names[] = {"JOB_RUNNING", "JOB_STOPPED", "JOB_DONE"};
+        trace_instant("job", j->pgid, names[j->state], j->id);
+    }
+
     j->isupd = 0;
     return 0;
 }
@@ -113,7 +162,8 @@ void remove_zombies(void) {
     // Remove all done heads
     while (cur && cur->state == JOB_DONE) {
         head = cur->next;
-        if (cur->isbg) printf("[%d] Done! %d\n", cur->id, cur->pgid);
+        if (cur->isbg) print_done(cur);
+        stats_count(STAT_REAPED, 1);
         free_job(cur);
         cur = head;
     }
@@ -128,7 +178,8 @@ void remove_zombies(void) {
     while (cur) {
         if (cur->state == JOB_DONE) {
             prev->next = cur->next;
-            if (cur->isbg) printf("[%d] Done! %d\n", cur->id, cur->pgid);
+            if (cur->isbg) print_done(cur);
+            stats_count(STAT_REAPED, 1);
             free_job(cur);
             cur = prev->next;
         } else {
@@ -138,35 +189,352 @@ void remove_zombies(void) {
     }
 }
 
+/**
+ * @brief Grace period between SIGTERM and SIGKILL in kill_jobs, from
+ * MINISHELL_KILL_GRACE (seconds, default 0.5).
+ */
+static uint64_t kill_grace_ns(void) {
+    const char *grace = var_get("MINISHELL_KILL_GRACE");
+    if (!grace || !*grace) return KILL_GRACE_DEFAULT_NS;
+
+    char *end = NULL;
+    errno = 0;
+    double sec = strtod(grace, &end);
+    if (errno || *end != 0x00 || !(sec >= 0.0 && sec <= 3600.0)) {
+        fprintf(stderr, "kill_jobs: Invalid MINISHELL_KILL_GRACE '%s'!\n", grace);
+        return KILL_GRACE_DEFAULT_NS;
+    }
+    return (uint64_t) (sec * 1e9);
+}
+
+/**
+ * @brief Open a pidfd that becomes readable when the process exits.
+ * @return File descriptor, or -1 (unsupported kernel, gone, or out of descriptors).
+ */
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void) pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/**
+ * @brief Mark a process that is not our child anymore (reaped elsewhere) as done.
+ */
+static void forget_proc(job *j, int i) {
+    j->procs[i].state = PROC_DONE;
+    j->procs[i].exit_code = 127; // The status is lost
+    j->isupd = 1;
+}
+
+/**
+ * @brief Reap the processes of every job that exited, without blocking.
+ */
+static void reap_jobs(void) {
+    for (job *it = head; it; it = it->next) {
+        for (int i = 0; i < it->nproc; ++i) {
+            if (it->procs[i].state == PROC_DONE) continue;
+            int wstat;
+            pid_t pid = waitpid(it->procs[i].pid, &wstat, WNOHANG);
+            if (pid > 0) update_proc(pid, wstat);
+            else if (pid == -1 && errno == ECHILD) forget_proc(it, i);
+        }
+    }
+    update_jobs();
+}
+
 void kill_jobs(void) {
-    // Send SIGTERM
-    for (job *it = head; it; it = it->next)
+    if (!head) return;
+    size_t nprocs = 0;
+    for (job *it = head; it; it = it->next) nprocs += (size_t) it->nproc;
+
+    // pidfds of every running process
+    size_t nfds = 0;
+    int polling = 0, killed = 0;
+    struct pollfd *fds = mem_calloc(MEM_JOB, nprocs ? nprocs : 1, sizeof(struct pollfd));
+    if (!fds) {
+        perror("kill_jobs: calloc");
+        goto cleanup;
+    }
+
+    for (job *it = head; it; it = it->next) {
+        for (int i = 0; i < it->nproc; ++i) {
+            if (it->procs[i].state == PROC_DONE) continue;
+            fds[nfds].fd = open_pidfd(it->procs[i].pid);
+            fds[nfds].events = POLLIN;
+            if (fds[nfds].fd != -1) ++nfds;
+            else if (errno == ESRCH) forget_proc(it, i);
+            else polling = 1;
+        }
+
+        // Stopped jobs only act on SIGTERM once continued
         kill(-it->pgid, SIGTERM);
+        if (it->state == JOB_STOPPED) kill(-it->pgid, SIGCONT);
+    }
 
-    pid_t pid;
-    struct timespec ts;
-    ts.tv_nsec = (long) 1e7;
-    ts.tv_sec = 0;
+    // One grace period for every job, then a bounded wait for the killed ones
+    uint64_t deadline = stats_now() + kill_grace_ns();
+    uint64_t limit = deadline + KILL_WAIT_NS;
+    while (1) {
+        reap_jobs();
+        int running = 0;
+        for (job *it = head; it; it = it->next) running |= it->state != JOB_DONE;
+        if (!running) break;
+
+        uint64_t now = stats_now();
+        if (!killed && now >= deadline) {
+            for (job *it = head; it; it = it->next)
+                if (it->state != JOB_DONE) kill(-it->pgid, SIGKILL);
+            killed = 1;
+        }
+        if (now >= limit) {
+            fprintf(stderr, "kill_jobs: Jobs still running after SIGKILL!\n");
+            break;
+        }
 
-    // Wait ~50ms for them to clean up
-    for (int i = 0; i < 50; ++i) {
-        int status;
-        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) update_proc(pid, status);
-        update_jobs();
-        if (head == NULL) break;
-        nanosleep(&ts, NULL);
+        // Sleep until a process exits or the next step (processes without a pidfd are polled)
+        uint64_t until = killed ? limit : deadline;
+        int timeout = (int) ((until - now + 999999) / 1000000);
+        if (polling && timeout > KILL_POLL_MS) timeout = KILL_POLL_MS;
+        if (poll(fds, (nfds_t) nfds, timeout) == -1 && errno != EINTR) {
+            perror("kill_jobs: poll");
+            break;
+        }
+        for (size_t i = 0; i < nfds; ++i) {
+            if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            close(fds[i].fd);
+            fds[i].fd = -1;
+        }
     }
 
-    // No more mercy, KILL them :)
-    for (job *it = head; it; it = it->next)
-        kill(-it->pgid, SIGKILL);
+cleanup:
+    for (size_t i = 0; fds && i < nfds; ++i)
+        if (fds[i].fd >= 0) close(fds[i].fd);
+    mem_free(fds);
 
-    int status;
-    while ((pid = waitpid(-1, &status, 0)) > 0) update_proc(pid, status);
-    update_jobs();
+    // Whatever is left (allocation failure or poll error) is killed outright
+    for (job *it = head; it; it = it->next)
+        if (it->state != JOB_DONE) kill(-it->pgid, SIGKILL);
+    reap_jobs();
     remove_zombies();
 }
 
+void remove_job(job *j) {
+    if (!j) return;
+    for (job **slot = &head; *slot; slot = &(*slot)->next) {
+        if (*slot != j) continue;
+        *slot = j->next;
+        if (j->state == JOB_DONE) stats_count(STAT_REAPED, 1);
+        free_job(j);
+        return;
+    }
+}
+
+job *find_job_pid(pid_t pid, int *idx) {
+    for (job *it = head; it; it = it->next) {
+        for (int i = 0; i < it->nproc; ++i) {
+            if (it->procs[i].pid != pid) continue;
+            if (idx) *idx = i;
+            return it;
+        }
+    }
+    return NULL;
+}
+
+int proc_status(const process *p) {
+    if (p->state == PROC_STOP) return 128 + SIGTSTP;
+    if (p->exit_code != -1) return p->exit_code;
+    if (p->term_sig != -1) return 128 + p->term_sig;
+    return 0;
+}
+
+int job_status(const job *j) {
+    if (!j || j->nproc == 0) return 0;
+    if (j->state == JOB_STOPPED) return 128 + SIGTSTP;
+    return proc_status(j->procs + j->nproc - 1);
+}
+
+int wait_proc(job *j, int i) {
+    process *p = j->procs + i;
+    uint64_t t0 = stats_now();
+    while (p->state == PROC_RUN) {
+        int wstat;
+        pid_t pid = waitpid(p->pid, &wstat, WUNTRACED);
+        if (pid > 0) {
+            update_proc(pid, wstat);
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno == ECHILD) {
+            forget_proc(j, i);
+            break;
+        }
+        perror("wait_proc: waitpid");
+        prof_wait(t0);
+        return -1;
+    }
+    prof_wait(t0);
+    update_job(j);
+    return 0;
+}
+
+int wait_job(job *j) {
+    if (!j) return -1;
+    for (int i = 0; i < j->nproc && j->state != JOB_STOPPED; ++i)
+        if (wait_proc(j, i)) return -1;
+    update_job(j);
+    return 0;
+}
+
+/**
+ * @brief Send a signal to every process of a job.
+ *
+ * A subshell shares its process group with the rest of its pipeline (e.g. a
+ * stage running the timeout builtin), so there only the job's own pids are
+ * signaled.
+ */
+static void signal_job(job *j, int sig) {
+    if (!is_subshell()) {
+        kill(-j->pgid, sig);
+        return;
+    }
+
+    for (int i = 0; i < j->nproc; ++i)
+        if (j->procs[i].state != PROC_DONE) kill(j->procs[i].pid, sig);
+}
+
+int wait_job_timed(job *j, const timeout_spec *spec, int *expired) {
+    if (!j || !spec || !expired) return -1;
+    *expired = 0;
+
+    int ret = -1;
+    int sfd = -1, tfd = -1;
+
+    // SIGCHLD stays pending for the signalfd while blocked; stops must raise it too
+    struct sigaction stop_sa, orig_sa;
+    sigaction(SIGCHLD, NULL, &orig_sa);
+    stop_sa = orig_sa;
+    stop_sa.sa_flags &= ~SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &stop_sa, NULL);
+
+    sigset_t chld, orig;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &chld, &orig) == -1) {
+        perror("wait_job_timed: sigprocmask");
+        sigaction(SIGCHLD, &orig_sa, NULL);
+        return -1;
+    }
+
+    sfd = signalfd(-1, &chld, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (sfd == -1) {
+        perror("wait_job_timed: signalfd");
+        goto cleanup;
+    }
+    tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (tfd == -1) {
+        perror("wait_job_timed: timerfd_create");
+        goto cleanup;
+    }
+    struct itimerspec its = {.it_interval = {0, 0}, .it_value = spec->after};
+    if (timerfd_settime(tfd, 0, &its, NULL) == -1) {
+        perror("wait_job_timed: timerfd_settime");
+        goto cleanup;
+    }
+
+    while (1) {
+        // Reap every state change of the job's processes
+        for (int i = 0; i < j->nproc; ++i) {
+            process *p = j->procs + i;
+            if (p->state == PROC_DONE) continue;
+            int wstat;
+            pid_t pid = waitpid(p->pid, &wstat, WUNTRACED | WCONTINUED | WNOHANG);
+            if (pid > 0) update_proc(pid, wstat);
+            else if (pid == -1 && errno == ECHILD) forget_proc(j, i);
+        }
+        update_job(j);
+
+        // Without job control (subshell) a stopped job keeps its deadline
+        if (j->state == JOB_DONE || (j->state == JOB_STOPPED && !is_subshell())) break;
+
+        struct pollfd fds[2] = {{sfd, POLLIN, 0}, {tfd, POLLIN, 0}};
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("wait_job_timed: poll");
+            goto cleanup;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            struct signalfd_siginfo si;
+            while (read(sfd, &si, sizeof(si)) == sizeof(si));
+        }
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t ticks;
+            if (read(tfd, &ticks, sizeof(ticks)) != sizeof(ticks)) continue;
+
+            if (*expired) {
+                signal_job(j, SIGKILL);
+                *expired = 2;
+                continue;
+            }
+
+            signal_job(j, spec->sig);
+            if (spec->sig != SIGKILL && spec->sig != SIGCONT) signal_job(j, SIGCONT);
+            *expired = spec->sig == SIGKILL ? 2 : 1;
+
+            its.it_value = spec->kill_after;
+            if (*expired == 1 && timerfd_settime(tfd, 0, &its, NULL) == -1)
+                perror("wait_job_timed: timerfd_settime");
+        }
+    }
+    ret = 0;
+
+cleanup:
+    if (sfd != -1) close(sfd);
+    if (tfd != -1) close(tfd);
+    sigprocmask(SIG_SETMASK, &orig, NULL);
+    sigaction(SIGCHLD, &orig_sa, NULL);
+    return ret;
+}
+
+job *wait_any_job(void) {
+    while (1) {
+        int running = 0;
+        for (job *it = head; it; it = it->next) {
+            update_job(it);
+            if (!it->isbg) continue;
+            if (it->state == JOB_DONE) return it;
+            if (it->state == JOB_RUNNING) ++running;
+        }
+        if (!running) return NULL;
+
+        // Sleep until a child changes state (every child belongs to a job)
+        int wstat;
+        uint64_t t0 = stats_now();
+        pid_t pid = waitpid(-1, &wstat, WUNTRACED);
+        prof_wait(t0);
+        if (pid > 0) {
+            update_proc(pid, wstat);
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno != ECHILD) perror("wait_any_job: waitpid");
+        return NULL;
+    }
+}
+
+void forget_jobs(void) {
+    while (head) {
+        job *next = head->next;
+        free_job(head);
+        head = next;
+    }
+}
+
 void print_process_state(proc_state state) {
     switch (state) {
         case PROC_STOP:
@@ -203,6 +571,12 @@ job *get_job(int id) {
     return NULL;
 }
 
+int count_jobs(void) {
+    int n = 0;
+    for (job *it = head; it != NULL; it = it->next) ++n;
+    return n;
+}
+
 void print_jobs(void) {
     for (job *it = head; it != NULL; it = it->next) {
         printf("[%d] {%d, ", it->id, it->pgid);
@@ -211,6 +585,8 @@ void print_jobs(void) {
         for (int i = 0; i < it->nproc; ++i) {
             printf("{%d, ", it->procs[i].pid);
             print_process_state(it->procs[i].state);
+            const char *reason = proc_reason(it->procs + i);
+            if (reason) printf(", %s", reason);
             printf("} ");
         }
         printf("\n");
@@ -1,21 +1,28 @@
 #include "lex.h"
+#include "mem.h"
+#include "prof.h"
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 
 // Character set used.
 
-static const char lex_whitespaces[] = " \n\t";
-static const char lex_operators[] = ";|&<>";
+static const char lex_whitespaces[] = " \t";
+static const char lex_operators[] = ";|&<>()\n";
+static const char lex_specials[] = "$*?[\001\002";
 
 // Memory Management Functions
 
 void free_lex_token(lex_token *token) {
     if (!token) return;
-    free(token->data);
-    free(token);
+    mem_free(token->data);
+    mem_free(token);
 }
 
 void free_lex_token_adapter(void *p) {
@@ -24,6 +31,41 @@ void free_lex_token_adapter(void *p) {
 
 // Lexer Helper Functions
 
+const char *lex_subst_end(const char *s) {
+    int depth = 1;
+    for (const char *c = s; *c; ++c) {
+        switch (*c) {
+            case '\\':
+                if (c[1] == 0x00) return NULL;
+                ++c;
+                break;
+            case '\'':
+                c = strchr(c + 1, '\'');
+                if (!c) return NULL;
+                break;
+            case '\"':
+                for (++c; *c != '\"'; ++c) {
+                    if (*c == 0x00) return NULL;
+                    if (*c == '\\' && c[1] != 0x00) ++c;
+                    else if (*c == '$' && c[1] == '(') {
+                        c = lex_subst_end(c + 2);
+                        if (!c) return NULL;
+                    }
+                }
+                break;
+            case '(':
+                ++depth;
+                break;
+            case ')':
+                if (--depth == 0) return c;
+                break;
+            default:
+                break;
+        }
+    }
+    return NULL;
+}
+
 /**
  * @brief Appends a single lex_token to the lex_token_list
  *
@@ -37,7 +79,7 @@ static int token_push(lex_token_list *list, lex_token *token) {
         return -1;
     }
     if (list->cap == 0) {
-        lex_token **temp = realloc(list->data, 4 * sizeof(lex_token *));
+        lex_token **temp = mem_realloc(MEM_LEX, list->data, 4 * sizeof(lex_token *));
         if (!temp) {
             perror("token_push: realloc");
             return -1;
@@ -45,7 +87,7 @@ static int token_push(lex_token_list *list, lex_token *token) {
         list->data = temp;
         list->cap = 4;
     } else if (list->len + 2 > list->cap) {
-        lex_token **temp = realloc(list->data, 2 * list->cap * sizeof(lex_token *));
+        lex_token **temp = mem_realloc(MEM_LEX, list->data, 2 * list->cap * sizeof(lex_token *));
         if (!temp) {
             perror("token_push: realloc");
             return -1;
@@ -72,7 +114,7 @@ static int buf_push(lex_token_buf *buf, char c) {
         return -1;
     }
     if (buf->cap == 0) {
-        char *temp = realloc(buf->data, 4 * sizeof(char));
+        char *temp = mem_realloc(MEM_LEX, buf->data, 4 * sizeof(char));
         if (!temp) {
             perror("buf_push: realloc");
             return -1;
@@ -80,7 +122,7 @@ static int buf_push(lex_token_buf *buf, char c) {
         buf->data = temp;
         buf->cap = 4;
     } else if (buf->len + 2 > buf->cap) {
-        char *temp = realloc(buf->data, 2 * buf->cap * sizeof(char));
+        char *temp = mem_realloc(MEM_LEX, buf->data, 2 * buf->cap * sizeof(char));
         if (!temp) {
             perror("buf_push: realloc");
             return -1;
@@ -94,6 +136,35 @@ static int buf_push(lex_token_buf *buf, char c) {
     return 0;
 }
 
+/**
+ * @brief Copies a "$(...)" command substitution verbatim into the token buffer.
+ *
+ * @param buf token buffer being built
+ * @param c string pointer address, pointing at '$'; left at the closing ')'
+ * @return -1 if failed, 1 if the substitution is not closed yet (nothing pushed), 0 otherwise.
+ */
+static int buf_push_subst(lex_token_buf *buf, const char **c) {
+    const char *end = lex_subst_end(*c + 2);
+    if (!end) return 1;
+    for (const char *it = *c; it <= end; ++it)
+        if (buf_push(buf, *it)) return -1;
+    *c = end;
+    return 0;
+}
+
+/**
+ * @brief appends a quoted character to token buffer,
+ * escaping it with LEX_CTLESC when it is special to expansion.
+ *
+ * @param buf token buffer being built
+ * @param c character being pushed
+ * @return non-zero if failed.
+ */
+static int buf_push_quoted(lex_token_buf *buf, char c) {
+    if (c != 0x00 && strchr(lex_specials, c) && buf_push(buf, LEX_CTLESC)) return -1;
+    return buf_push(buf, c);
+}
+
 /**
  * @brief checks if the character is a valid whitespace.
  *
@@ -129,7 +200,7 @@ static int is_operator(char c) {
  */
 static lex_token *get_token(const char **c) {
     // Allocate operator token
-    lex_token *tok = malloc(sizeof(lex_token));
+    lex_token *tok = mem_malloc(MEM_LEX, sizeof(lex_token));
     if (!tok) {
         perror("get_token: malloc");
         goto cleanup;
@@ -140,6 +211,19 @@ static lex_token *get_token(const char **c) {
     switch (**c) {
         case ';':
             tok->type = TK_SEMICOLON;
+            if (*(*c + 1) == ';') {
+                tok->type = TK_DSEMI;
+                ++(*c);
+            }
+            break;
+        case '\n':
+            tok->type = TK_NEWLINE;
+            break;
+        case '(':
+            tok->type = TK_LPAREN;
+            break;
+        case ')':
+            tok->type = TK_RPAREN;
             break;
         case '|':
             tok->type = TK_PIPE;
@@ -175,152 +259,412 @@ static lex_token *get_token(const char **c) {
     return tok;
 
 cleanup:
-    free(tok);
+    mem_free(tok);
     return NULL;
 }
 
-lex_token **lex_line(const char *str) {
-    lex_token_list list = {
-        .data = calloc(1, sizeof(lex_token *)),
-        .cap = 1,
-        .len = 0
-    };
-
-    lex_state esc_from = LEX_DEFAULT;
-    lex_state state = LEX_DEFAULT;
-    lex_token_buf buf = {
-        .data = NULL,
-        .cap = 0,
-        .len = 0
-    };
-    lex_token *tok = NULL;
-
-    if (!list.data) {
-        perror("lex_line: malloc");
-        goto cleanup;
+/**
+ * @brief Append a token to the stream, keeping track of the compound
+ * commands still open.
+ *
+ * Only words in command position are checked against the reserved words;
+ * quoted words carry LEX_CTLQUOTE and never match. Parentheses count as
+ * well, except inside a case command whose patterns end with ')'.
+ *
+ * @param s lexer stream
+ * @param tok token being pushed (owned by the stream afterwards, even on error)
+ * @return non-zero if failed.
+ */
+static int stream_push(lex_stream *s, lex_token *tok) {
+    static const char *const openers[] = {"if", "while", "until", "{", "for", "case", NULL};
+    static const char *const closers[] = {"fi", "done", "}", "esac", NULL};
+    static const char *const keep[] = {"then", "do", "else", "elif", "!", NULL};
+
+    lex_token *last = s->list.len > 0 ? s->list.data[s->list.len - 1] : NULL;
+    int kw = -1;
+
+    switch (tok->type) {
+        case TK_DEFAULT:
+            if (s->skip_word) {
+                s->skip_word = 0;
+                break;
+            }
+            if (!s->cmd_pos) break;
+            for (kw = 0; openers[kw] && strcmp(openers[kw], tok->data) != 0; ++kw);
+            if (openers[kw]) {
+                ++s->depth;
+                if (strcmp(tok->data, "case") == 0) ++s->case_depth;
+                s->cmd_pos = kw < 4; // "for" and "case" are followed by a name
+                break;
+            }
+            for (kw = 0; closers[kw] && strcmp(closers[kw], tok->data) != 0; ++kw);
+            if (closers[kw]) {
+                --s->depth;
+                if (strcmp(tok->data, "esac") == 0) --s->case_depth;
+                s->cmd_pos = 0;
+                break;
+            }
+            for (kw = 0; keep[kw] && strcmp(keep[kw], tok->data) != 0; ++kw);
+            if (!keep[kw]) s->cmd_pos = 0;
+            break;
+        case TK_ARITH:
+            s->cmd_pos = 0;
+            break;
+        case TK_REDIR_IN:
+        case TK_REDIR_OUT:
+        case TK_REDIR_APPEND:
+            s->skip_word = 1;
+            break;
+        case TK_LPAREN:
+        case TK_RPAREN:
+            if (s->case_depth == 0) s->depth += tok->type == TK_LPAREN ? 1 : -1;
+            s->cmd_pos = 1;
+            break;
+        case TK_NEWLINE:
+            // A line ending with '|', "&&" or "||" goes on with the next one
+            if (last && (last->type == TK_PIPE || last->type == TK_AND || last->type == TK_OR)) {
+                free_lex_token(tok);
+                return 0;
+            }
+            s->cmd_pos = 1;
+            break;
+        default:
+            s->cmd_pos = 1;
+            break;
+    }
+
+    if (token_push(&s->list, tok)) {
+        free_lex_token(tok);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Emit the word in the token buffer (if any).
+ *
+ * @param s lexer stream
+ * @param next_adj adjacency of the word to the next token
+ * @return non-zero if failed.
+ */
+static int stream_flush(lex_stream *s, int next_adj) {
+    if (s->buf.len == 0) return 0;
+
+    // Allocate token
+    lex_token *tok = mem_malloc(MEM_LEX, sizeof(lex_token));
+    if (!tok) {
+        perror("lex_feed: malloc");
+        return -1;
     }
 
-    for (const char *c = str; 1; ++c) {
-        switch (state) {
+    // Emit token
+    tok->data = s->buf.data;
+    tok->next_adj = next_adj;
+    tok->type = TK_DEFAULT;
+
+    // Reset buffer (before pushing) to avoid double free on error.
+    s->buf.data = NULL;
+    s->buf.cap = 0;
+    s->buf.len = 0;
+
+    return stream_push(s, tok);
+}
+
+/**
+ * @brief Run the lexer state machine over a chunk of input, resuming in the
+ * state the previous chunk ended in.
+ *
+ * Nothing is reported as unterminated here: an open quote or escape, a
+ * partial word and an unfinished "$(...)" or "((...))" (saved in pending,
+ * re-read with the next chunk) are kept for the next call.
+ *
+ * @param s lexer stream
+ * @param str chunk of input
+ * @return non-zero if failed.
+ */
+static int lex_run(lex_stream *s, const char *str) {
+    const char *c = str;
+    for (; *c != 0x00; ++c) {
+        s->joined = 0;
+        switch (s->state) {
             case LEX_DEFAULT:
 
                 // State change
                 if (*c == '\'') {
-                    state = LEX_SINGLE_QUOTE;
+                    if (buf_push(&s->buf, LEX_CTLQUOTE)) return -1;
+                    s->state = LEX_SINGLE_QUOTE;
                     break;
                 }
                 if (*c == '\"') {
-                    state = LEX_DOUBLE_QUOTE;
+                    if (buf_push(&s->buf, LEX_CTLQUOTE)) return -1;
+                    s->state = LEX_DOUBLE_QUOTE;
                     break;
                 }
                 if (*c == '\\') {
-                    esc_from = LEX_DEFAULT;
-                    state = LEX_ESC;
-                    break;
-                }
-
-                if (!is_operator(*c) && !is_whitespace(*c) && *c != 0x00) {
-                    // Add character to token buffer
-                    if (buf_push(&buf, *c)) goto cleanup;
+                    s->esc_from = LEX_DEFAULT;
+                    s->state = LEX_ESC;
                     break;
                 }
 
-                if (buf.len > 0) {
-                    // Allocate token
-                    tok = malloc(sizeof(lex_token));
+                // Arithmetic command "((...))" at the start of a word
+                if (*c == '(' && c[1] == '(' && s->buf.len == 0) {
+                    const char *end = lex_subst_end(c + 2);
+                    if (!end || end[1] == 0x00) goto unfinished;
+                    if (end[1] != ')') {
+                        fprintf(stderr, "lex_feed: Unterminated arithmetic command.\n");
+                        return -1;
+                    }
+                    lex_token *tok = mem_malloc(MEM_LEX, sizeof(lex_token));
                     if (!tok) {
-                        perror("lex_line: malloc");
-                        goto cleanup;
+                        perror("lex_feed: malloc");
+                        return -1;
                     }
+                    tok->type = TK_ARITH;
+                    tok->next_adj = !is_whitespace(end[2]) && end[2] != 0x00;
+                    tok->data = mem_strndup(MEM_LEX, c + 2, (size_t) (end - c - 2));
+                    if (!tok->data) {
+                        perror("lex_feed: strndup");
+                        mem_free(tok);
+                        return -1;
+                    }
+                    if (stream_push(s, tok)) return -1;
+                    c = end + 1;
+                    break;
+                }
 
-                    // Emit token
-                    tok->data = buf.data;
-                    tok->next_adj = !is_whitespace(*c) && *c != 0x00;
-                    tok->type = TK_DEFAULT;
-
-                    // Reset buffer (before token_push) to avoid double free on error.
-                    buf.data = NULL;
-                    buf.cap = 0;
-                    buf.len = 0;
-
-                    if (token_push(&list, tok)) goto cleanup;
+                // Command substitution is kept raw and run at expansion time
+                if (*c == '$' && c[1] == '(') {
+                    int r = buf_push_subst(&s->buf, &c);
+                    if (r < 0) return -1;
+                    if (r > 0) goto unfinished;
+                    break;
+                }
 
-                    // Reset token and avoid double free
-                    tok = NULL;
+                if (!is_operator(*c) && !is_whitespace(*c)) {
+                    // Add character to token buffer (raw markers are escaped)
+                    if (*c == LEX_CTLESC || *c == LEX_CTLQUOTE) {
+                        if (buf_push_quoted(&s->buf, *c)) return -1;
+                    } else if (buf_push(&s->buf, *c)) return -1;
+                    break;
                 }
 
+                if (stream_flush(s, !is_whitespace(*c))) return -1;
+
                 // Emit operator token
                 if (is_operator(*c)) {
-                    tok = get_token(&c);
-                    if (!tok || token_push(&list, tok)) goto cleanup;
-
-                    // Reset token and avoid double free
-                    tok = NULL;
+                    lex_token *tok = get_token(&c);
+                    if (!tok || stream_push(s, tok)) return -1;
                 }
                 break;
             case LEX_SINGLE_QUOTE:
-                if (*c == 0x00) {
-                    fprintf(stderr, "lex_line: Unterminated single quotation.");
-                    goto cleanup;
-                }
                 if (*c == '\'') {
-                    state = LEX_DEFAULT;
+                    if (buf_push(&s->buf, LEX_CTLQUOTE)) return -1;
+                    s->state = LEX_DEFAULT;
                     break;
                 }
-                if (buf_push(&buf, *c)) goto cleanup;
+                if (buf_push_quoted(&s->buf, *c)) return -1;
                 break;
 
             case LEX_DOUBLE_QUOTE:
-                if (*c == 0x00) {
-                    fprintf(stderr, "lex_line: Unterminated double quotation.");
-                    goto cleanup;
-                }
                 if (*c == '\"') {
-                    state = LEX_DEFAULT;
+                    if (buf_push(&s->buf, LEX_CTLQUOTE)) return -1;
+                    s->state = LEX_DEFAULT;
                     break;
                 }
                 if (*c == '\\') {
-                    esc_from = LEX_DOUBLE_QUOTE;
-                    state = LEX_ESC;
+                    s->esc_from = LEX_DOUBLE_QUOTE;
+                    s->state = LEX_ESC;
                     break;
                 }
-                if (buf_push(&buf, *c)) goto cleanup;
+                // Parameter expansion and command substitution stay active inside double quotes
+                if (*c == '$' && c[1] == '(') {
+                    int r = buf_push_subst(&s->buf, &c);
+                    if (r < 0) return -1;
+                    if (r > 0) goto unfinished;
+                    break;
+                }
+                if (*c == '$') {
+                    if (buf_push(&s->buf, *c)) return -1;
+                    // Special parameters ("$?", "$*") keep their character unescaped
+                    if (c[1] == '?' || c[1] == '*') {
+                        if (buf_push(&s->buf, *++c)) return -1;
+                    }
+                    break;
+                }
+                if (buf_push_quoted(&s->buf, *c)) return -1;
                 break;
             case LEX_ESC:
-                if (*c == 0x00) {
-                    fprintf(stderr, "Unterminated escape character.");
-                    goto cleanup;
+                s->state = s->esc_from;
+
+                // Backslash-newline joins the lines
+                if (*c == '\n') {
+                    s->joined = 1;
+                    break;
                 }
-                switch (esc_from) {
+                switch (s->esc_from) {
                     case LEX_DEFAULT:
-                        if (buf_push(&buf, *c)) goto cleanup;
+                        if (buf_push_quoted(&s->buf, *c)) return -1;
                         break;
                     case LEX_DOUBLE_QUOTE:
-                        if (*c == '\\' || *c == '\"') {
-                            if (buf_push(&buf, *c)) goto cleanup;
+                        if (*c == '\\' || *c == '\"' || *c == '$') {
+                            if (buf_push_quoted(&s->buf, *c)) return -1;
                         } else {
-                            if (buf_push(&buf, '\\')) goto cleanup;
-                            if (buf_push(&buf, *c)) goto cleanup;
+                            if (buf_push(&s->buf, '\\')) return -1;
+                            if (buf_push_quoted(&s->buf, *c)) return -1;
                         }
                         break;
                     default:
-                        fprintf(stderr, "lex_line: invalid esc_from.");
-                        goto cleanup;
+                        fprintf(stderr, "lex_feed: invalid esc_from.\n");
+                        return -1;
                 }
-                state = esc_from;
                 break;
         }
+    }
+    return 0;
+
+unfinished:
+    // The rest of the chunk is lexed again together with the next one
+    s->pending = mem_strdup(MEM_LEX, c);
+    if (!s->pending) {
+        perror("lex_feed: strdup");
+        return -1;
+    }
+    return 0;
+}
+
+void lex_stream_init(lex_stream *s) {
+    memset(s, 0, sizeof(*s));
+    s->state = LEX_DEFAULT;
+    s->esc_from = LEX_DEFAULT;
+    s->cmd_pos = 1;
+}
+
+void lex_stream_free(lex_stream *s) {
+    mem_free_ptrv((void **) s->list.data, free_lex_token_adapter);
+    mem_free(s->buf.data);
+    mem_free(s->pending);
+    lex_stream_init(s);
+}
+
+int lex_feed(lex_stream *s, const char *chunk) {
+    if (!s || !chunk) {
+        fprintf(stderr, "lex_feed: NULL argument!\n");
+        return -1;
+    }
+
+    // Only an unfinished substitution is read again, never the whole command
+    char *text = NULL;
+    if (s->pending) {
+        size_t plen = strlen(s->pending), clen = strlen(chunk);
+        text = mem_realloc(MEM_LEX, s->pending, plen + clen + 1);
+        if (!text) {
+            perror("lex_feed: realloc");
+            goto cleanup;
+        }
+        memcpy(text + plen, chunk, clen + 1);
+        s->pending = NULL;
+    }
+
+    if (lex_run(s, text ? text : chunk)) goto cleanup;
+    mem_free(text);
+
+    if (s->state != LEX_DEFAULT || s->pending || s->joined || s->depth > 0) return 1;
+    lex_token *last = s->list.len > 0 ? s->list.data[s->list.len - 1] : NULL;
+    if (s->buf.len == 0 && last && (last->type == TK_PIPE || last->type == TK_AND || last->type == TK_OR))
+        return 1;
+    return 0;
+
+cleanup:
+    mem_free(text);
+    lex_stream_free(s);
+    return -1;
+}
+
+lex_token **lex_take(lex_stream *s) {
+    lex_token **out = NULL;
 
-        if (*c == 0x00) break;
+    if (s->pending) {
+        if (s->pending[0] == '$') fprintf(stderr, "lex_take: Unterminated command substitution.\n");
+        else fprintf(stderr, "lex_take: Unterminated arithmetic command.\n");
+        goto cleanup;
+    }
+    switch (s->state) {
+        case LEX_SINGLE_QUOTE:
+            fprintf(stderr, "lex_take: Unterminated single quotation.\n");
+            goto cleanup;
+        case LEX_DOUBLE_QUOTE:
+            fprintf(stderr, "lex_take: Unterminated double quotation.\n");
+            goto cleanup;
+        case LEX_ESC:
+            fprintf(stderr, "lex_take: Unterminated escape character.\n");
+            goto cleanup;
+        default:
+            break;
     }
 
-    return list.data;
+    if (stream_flush(s, 0)) goto cleanup;
+    if (!s->list.data) {
+        s->list.data = mem_calloc(MEM_LEX, 1, sizeof(lex_token *));
+        if (!s->list.data) {
+            perror("lex_take: calloc");
+            goto cleanup;
+        }
+    }
+    out = s->list.data;
+    s->list.data = NULL;
 
 cleanup:
-    free_lex_token(tok);
-    free(buf.data);
-    free_ptrv((void **) list.data, free_lex_token_adapter);
-    return NULL;
+    lex_stream_free(s);
+    return out;
+}
+
+lex_token **lex_line(const char *str) {
+    lex_stream s;
+    lex_stream_init(&s);
+    if (lex_feed(&s, str) < 0) return NULL;
+    return lex_take(&s);
+}
+
+int lex_read_command(lex_stream *ls, lex_line_fn next, void *ctx, uint32_t *lineno, lex_token ***tokens) {
+    *tokens = NULL;
+    int more = 0;
+    while (1) {
+        char *line = next(ctx, more);
+        if (!line) {
+            int err = errno;
+            if (err == EINTR && more) continue;
+            if (err == EINTR || err == ECANCELED) {
+                lex_stream_free(ls);
+                errno = err;
+                return 1;
+            }
+            if (err != 0) {
+                perror("lex_read_command: read");
+                lex_stream_free(ls);
+                errno = err;
+                return -1;
+            }
+            if (!more) return -1;
+
+            // End of input inside a command: lex_take reports it
+            *tokens = lex_take(ls);
+            return 0;
+        }
+
+        ++*lineno;
+        prof_source(*lineno, line);
+        uint64_t t0 = stats_now(), lex_ts = trace_now();
+        int r = lex_feed(ls, line);
+        stats_record(PHASE_LEX, t0);
+        trace_span("lex", lex_ts, 0, NULL, (long) strlen(line));
+        free(line);
+        if (r < 0) return 0;
+        if (r == 0) {
+            *tokens = lex_take(ls);
+            return 0;
+        }
+        more = 1;
+    }
 }
 
 
@@ -353,6 +697,21 @@ void print_token(lex_token *tok) {
         case TK_OR:
             printf("OR(adj=%d)", tok->next_adj);
             break;
+        case TK_ARITH:
+            printf("ARITH(%s, adj=%d)", tok->data, tok->next_adj);
+            break;
+        case TK_NEWLINE:
+            printf("NEWLINE(adj=%d)", tok->next_adj);
+            break;
+        case TK_DSEMI:
+            printf("DSEMI(adj=%d)", tok->next_adj);
+            break;
+        case TK_LPAREN:
+            printf("LPAREN(adj=%d)", tok->next_adj);
+            break;
+        case TK_RPAREN:
+            printf("RPAREN(adj=%d)", tok->next_adj);
+            break;
         default:
             fprintf(stderr, "print_token: Invalid token type!\n");
             break;
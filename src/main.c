@@ -2,11 +2,30 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
+#include <time.h>
 
+#include "arith.h"
+#include "builtin.h"
+#include "complete.h"
 #include "exec.h"
+#include "flat.h"
+#include "func.h"
+#include "input.h"
 #include "job.h"
+#include "mem.h"
 #include "parse.h"
+#include "prof.h"
+#include "prompt.h"
+#include "rc.h"
+#include "serve.h"
+#include "stats.h"
+#include "trace.h"
+#include "vars.h"
+#include "wildcard.h"
+
+extern char **environ;
 
 /**
  * @brief Dummy signal handler to cause syscalls fail with EINTR to reset shell.
@@ -15,19 +34,81 @@ static void on_sigchild(int signo) {
     (void) signo;
 }
 
-int main(void) {
+/**
+ * @brief Milliseconds elapsed since start (CLOCK_MONOTONIC).
+ */
+static double elapsed_ms(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) * 1e3 + (double) (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/**
+ * @brief Line source of the interactive loop: the prompt first, then PS2.
+ */
+static char *next_input_line(void *prompt, int more) {
+    const char *ps2 = var_get("PS2");
+    return read_line(more ? (ps2 ? ps2 : "> ") : (const char *) prompt);
+}
+
+int main(int argc, char **argv) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    const char *serve_path = NULL;
+    if (argc == 3 && strcmp(argv[1], "--serve") == 0) {
+        serve_path = argv[2];
+    } else if (argc != 1) {
+        fprintf(stderr, "Usage: %s [--serve SOCKET]\n", argv[0]);
+        return 2;
+    }
+
     struct sigaction sa = {0};
     sa.sa_handler = on_sigchild;
     sa.sa_flags = SA_NOCLDSTOP;
     sigemptyset(&sa.sa_mask);
     sigaction(SIGCHLD, &sa, NULL);
 
+    // Shared counters must exist before the first fork
+    stats_init();
+
+    // Registered first so the allocation report runs after every other cleanup
+    mem_init();
+
+    if (vars_init(environ)) return 1;
+    atexit(vars_cleanup);
+    pwd_init();
+
     signal(SIGINT, SIG_IGN);
     signal(SIGTSTP, SIG_IGN);
     signal(SIGTTOU, SIG_IGN);
     signal(SIGTTIN, SIG_IGN);
     atexit(kill_jobs);
+    atexit(complete_cleanup);
+    atexit(glob_cache_flush);
+    atexit(arith_cache_cleanup);
+    atexit(funcs_cleanup);
+    atexit(builtin_cleanup);
+    atexit(prompt_cleanup);
+
+    // Opt-in tracer (MINISHELL_TRACE=file.json) and profiler (MINISHELL_PROFILE=1)
+    trace_init();
+    prof_init();
+
+    // Startup file (replayed from its snapshot when possible)
+    rc_load();
 
+    // Command server: sessions are forked from the initialized shell
+    if (serve_path) return serve_run(serve_path) ? 1 : 0;
+
+    // Time from main() to the first prompt
+    if (getenv("MINISHELL_STARTUP_TIME"))
+        fprintf(stderr, "startup: %.3f ms\n", elapsed_ms(&start));
+
+    uint64_t line_ts = 0;
+    uint32_t lineno = 0;
+    lex_stream ls;
+    lex_stream_init(&ls);
     while (1) {
         // Update and cleanup job table
         pid_t pid = 0;
@@ -38,53 +119,47 @@ int main(void) {
         } while (pid > 0 || (pid == -1 && errno == EINTR));
         update_jobs();
         remove_zombies();
+        glob_cache_flush();
 
-        // Find CWD
-        char *cwd = getcwd(NULL, 0);
-        if (cwd == NULL) {
-            perror("main: getcwd");
-            return 1;
+        // Time from the previous line to this prompt
+        if (line_ts) {
+            stats_record(PHASE_PROMPT, line_ts);
+            prompt_set_duration(stats_now() - line_ts);
         }
 
-        // Print prompt
-        printf("%s> ", cwd);
-        fflush(stdout);
-        free(cwd);
-
-        // Get a line
-        char *line = NULL;
-        size_t cap = 0;
-        ssize_t n = getline(&line, &cap, stdin);
-        if (n == -1) {
-            free(line);
-            if (errno == EINTR) {
-                clearerr(stdin);
-                printf("\n");
-                continue;
-            }
-
-            if (feof(stdin)) {
-                printf("\n");
-                break;
-            }
-            perror("main: getline");
+        // Build prompt (from the logical $PWD, background segments filled in later)
+        const char *prompt = prompt_render();
+        if (!prompt) return 1;
+
+        // Get a command (one or more lines)
+        uint32_t first = lineno + 1;
+        lex_token **tokens = NULL;
+        int r = lex_read_command(&ls, next_input_line, (void *) prompt, &lineno, &tokens);
+        line_ts = r == 0 ? stats_now() : 0;
+        if (r > 0) {
+            if (errno == EINTR) printf("\n");
+            continue;
+        }
+        if (r < 0) {
+            if (errno == 0) printf("\n");
             break;
         }
 
-        // Parse input
-        ast_node *root = parse_line(line);
-
-        // Print the tree
-        // print_ast(root, 0);
+        // Parse it into its flat form
+        uint64_t parse_ts = trace_now();
+        flat_ast *root = parse_tokens_flat(tokens);
+        trace_span("parse_line", parse_ts, 0, NULL, (long) (lineno - first + 1));
+        mem_free_ptrv((void **) tokens, free_lex_token_adapter);
+        flat_set_lines(root, first, lineno);
 
         // Print exit code
         int status = 0;
-        execute_ast(root, &status, 0);
+        execute_flat(root, &status);
         if (status != 0) printf("Exit code: %d\n", status);
 
         // Cleanup
-        free_ast_node(root);
-        free(line);
+        free_flat_ast(root);
     }
+    lex_stream_free(&ls);
     return 0;
 }
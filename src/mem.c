@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+#include "mem.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Header in front of every accounted block (keeps max_align_t alignment).
+ */
+typedef union mem_hdr {
+    struct {
+        size_t size; ///< Requested size
+        mem_tag tag; ///< Owning subsystem
+    } info;
+    max_align_t align;
+} mem_hdr;
+
+/**
+ * @brief Accounting of one subsystem.
+ */
+typedef struct mem_stats {
+    size_t live; ///< Bytes in use
+    size_t peak; ///< Highest live value
+    size_t blocks; ///< Blocks in use
+    unsigned long long allocs; ///< Blocks allocated
+    unsigned long long reallocs; ///< Blocks resized
+    unsigned long long frees; ///< Blocks released
+} mem_stats;
+
+static const char *tag_names[MEM_NTAGS] = {"lex", "parse", "exec", "job", "redir"};
+static mem_stats stats[MEM_NTAGS];
+static size_t total_live = 0, total_peak = 0;
+static pid_t shell_pid = 0;
+
+static void account(mem_tag tag, size_t old_size, size_t new_size) {
+    mem_stats *s = stats + tag;
+    s->live = s->live - old_size + new_size;
+    if (s->live > s->peak) s->peak = s->live;
+    total_live = total_live - old_size + new_size;
+    if (total_live > total_peak) total_peak = total_live;
+}
+
+static void *tagged(mem_hdr *h, mem_tag tag, size_t size) {
+    h->info.size = size;
+    h->info.tag = tag;
+    account(tag, 0, size);
+    ++stats[tag].allocs;
+    ++stats[tag].blocks;
+    return h + 1;
+}
+
+static void mem_report(void) {
+    if (getpid() == shell_pid) mem_print(stderr);
+}
+
+// API Functions
+
+void *mem_malloc(mem_tag tag, size_t size) {
+    if (size > SIZE_MAX - sizeof(mem_hdr)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    mem_hdr *h = malloc(sizeof(mem_hdr) + size);
+    return h ? tagged(h, tag, size) : NULL;
+}
+
+void *mem_calloc(mem_tag tag, size_t n, size_t size) {
+    if (size && n > (SIZE_MAX - sizeof(mem_hdr)) / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    mem_hdr *h = calloc(1, sizeof(mem_hdr) + n * size);
+    return h ? tagged(h, tag, n * size) : NULL;
+}
+
+void *mem_realloc(mem_tag tag, void *p, size_t size) {
+    if (!p) return mem_malloc(tag, size);
+    if (size > SIZE_MAX - sizeof(mem_hdr)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    mem_hdr *h = (mem_hdr *) p - 1;
+    size_t old = h->info.size;
+    h = realloc(h, sizeof(mem_hdr) + size);
+    if (!h) return NULL;
+    h->info.size = size;
+    account(h->info.tag, old, size);
+    ++stats[h->info.tag].reallocs;
+    return h + 1;
+}
+
+char *mem_strdup(mem_tag tag, const char *s) {
+    return mem_strndup(tag, s, SIZE_MAX);
+}
+
+char *mem_strndup(mem_tag tag, const char *s, size_t n) {
+    size_t len = strnlen(s, n);
+    char *out = mem_malloc(tag, len + 1);
+    if (!out) return NULL;
+    memcpy(out, s, len);
+    out[len] = 0x00;
+    return out;
+}
+
+void mem_free(void *p) {
+    if (!p) return;
+    mem_hdr *h = (mem_hdr *) p - 1;
+    mem_stats *s = stats + h->info.tag;
+    s->live -= h->info.size;
+    total_live -= h->info.size;
+    --s->blocks;
+    ++s->frees;
+    free(h);
+}
+
+void mem_free_ptrv(void **arr, void (*destroy)(void *)) {
+    if (!arr) return;
+    for (void **it = arr; *it != NULL; ++it)
+        if (destroy) destroy(*it);
+    mem_free(arr);
+}
+
+void mem_print(FILE *out) {
+    mem_stats total;
+    memset(&total, 0, sizeof(total));
+    fprintf(out, "%-8s %12s %12s %10s %12s %12s %12s\n", "subsys", "live(B)", "peak(B)", "blocks", "allocs",
+            "reallocs", "frees");
+    for (int i = 0; i < MEM_NTAGS; ++i) {
+        const mem_stats *s = stats + i;
+        fprintf(out, "%-8s %12zu %12zu %10zu %12llu %12llu %12llu\n", tag_names[i], s->live, s->peak, s->blocks,
+                s->allocs, s->reallocs, s->frees);
+        total.blocks += s->blocks;
+        total.allocs += s->allocs;
+        total.reallocs += s->reallocs;
+        total.frees += s->frees;
+    }
+    fprintf(out, "%-8s %12zu %12zu %10zu %12llu %12llu %12llu\n", "total", total_live, total_peak, total.blocks,
+            total.allocs, total.reallocs, total.frees);
+}
+
+void mem_init(void) {
+    const char *on = getenv("MINISHELL_MEMSTATS");
+    if (!on || !*on) return;
+    shell_pid = getpid();
+    atexit(mem_report);
+}
@@ -4,7 +4,10 @@
 #include <limits.h>
 
 #include "lex.h"
+#include "mem.h"
+#include "stats.h"
 #include "utils.h"
+#include "vars.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,8 +16,8 @@
 // Memory Management Functions
 
 void free_redir(redir *io) {
-    free(io->path);
-    free(io);
+    mem_free(io->path);
+    mem_free(io);
 }
 
 void free_redir_adapter(void *p) {
@@ -22,6 +25,17 @@ void free_redir_adapter(void *p) {
 }
 
 
+void free_case_item(case_item *item) {
+    if (!item) return;
+    mem_free_ptrv((void **) item->patterns, mem_free);
+    free_ast_node(item->body);
+    mem_free(item);
+}
+
+void free_case_item_adapter(void *p) {
+    free_case_item((case_item *) p);
+}
+
 void free_ast_node(ast_node *node) {
     if (!node) return;
 
@@ -31,21 +45,48 @@ void free_ast_node(ast_node *node) {
             break;
         case NODE_SEQ:
         case NODE_PIPE:
-            free_ptrv((void **) node->as.list.children, free_ast_node_adapter);
+            mem_free_ptrv((void **) node->as.list.children, free_ast_node_adapter);
             break;
         case NODE_CMD:
-            free_ptrv((void **) node->as.cmd.argv, free);
-            free_ptrv((void **) node->as.cmd.io, free_redir_adapter);
+            mem_free_ptrv((void **) node->as.cmd.argv, mem_free);
+            mem_free_ptrv((void **) node->as.cmd.io, free_redir_adapter);
+            mem_free_ptrv((void **) node->as.cmd.assigns, mem_free);
             break;
         case NODE_AND:
         case NODE_OR:
             free_ast_node(node->as.binary.left);
             free_ast_node(node->as.binary.right);
             break;
+        case NODE_ARITH:
+            mem_free(node->as.arith.src);
+            break;
+        case NODE_IF:
+            free_ast_node(node->as.cond.cond);
+            free_ast_node(node->as.cond.then_part);
+            free_ast_node(node->as.cond.else_part);
+            break;
+        case NODE_WHILE:
+        case NODE_UNTIL:
+            free_ast_node(node->as.loop.cond);
+            free_ast_node(node->as.loop.body);
+            break;
+        case NODE_FOR:
+            mem_free(node->as.loop_for.name);
+            mem_free_ptrv((void **) node->as.loop_for.words, mem_free);
+            free_ast_node(node->as.loop_for.body);
+            break;
+        case NODE_CASE:
+            mem_free(node->as.cases.word);
+            mem_free_ptrv((void **) node->as.cases.items, free_case_item_adapter);
+            break;
+        case NODE_FUNC:
+            mem_free(node->as.func.name);
+            free_ast_node(node->as.func.body);
+            break;
         default:
             fprintf(stderr, "free_ast_node: Invalid node type!\n");
     }
-    free(node);
+    mem_free(node);
 }
 
 void free_ast_node_adapter(void *p) {
@@ -74,6 +115,18 @@ static int parse_fd(const char *data, int *out) {
     return 0;
 }
 
+/**
+ * @brief Checks whether a word is a "NAME=VALUE" assignment.
+ * The name part has to be unquoted.
+ *
+ * @param data token data
+ * @return 1 if assignment, 0 otherwise
+ */
+static int is_assignment(const char *data) {
+    const char *eq = strchr(data, '=');
+    return eq && var_valid_name(data, (size_t) (eq - data));
+}
+
 /**
  * @brief used to parse sequence of token pointers as valid NODE_CMD
  * from l to r. Inclusive at l but exclusive at r.
@@ -91,7 +144,27 @@ static ast_node *parse_cmd(lex_token **l, lex_token **r) {
         goto cleanup;
     }
 
-    leaf = calloc(1, sizeof(ast_node));
+    // Arithmetic command
+    if ((*l)->type == TK_ARITH) {
+        if (l + 1 != r) {
+            fprintf(stderr, "parse_cmd: Unexpected token after arithmetic command!\n");
+            goto cleanup;
+        }
+        leaf = mem_calloc(MEM_PARSE, 1, sizeof(ast_node));
+        if (!leaf) {
+            perror("parse_cmd: calloc");
+            goto cleanup;
+        }
+        leaf->type = NODE_ARITH;
+        leaf->as.arith.src = mem_strdup(MEM_PARSE, (*l)->data);
+        if (!leaf->as.arith.src) {
+            perror("parse_cmd: strdup");
+            goto cleanup;
+        }
+        return leaf;
+    }
+
+    leaf = mem_calloc(MEM_PARSE, 1, sizeof(ast_node));
     if (!leaf) {
         perror("parse_cmd: calloc");
         goto cleanup;
@@ -105,14 +178,14 @@ static ast_node *parse_cmd(lex_token **l, lex_token **r) {
                 (*it)->type == TK_REDIR_APPEND;
     }
 
-    leaf->as.cmd.io = calloc(iocnt + 1, sizeof(redir *));
+    leaf->as.cmd.io = mem_calloc(MEM_PARSE, iocnt + 1, sizeof(redir *));
     if (!leaf->as.cmd.io) {
         perror("parse_cmd: calloc");
         goto cleanup;
     }
     int i = 0;
 
-    consumed = calloc(r - l, sizeof(int));
+    consumed = mem_calloc(MEM_PARSE, r - l, sizeof(int));
     if (!consumed) {
         perror("parse_cmd: calloc");
         goto cleanup;
@@ -125,7 +198,7 @@ static ast_node *parse_cmd(lex_token **l, lex_token **r) {
             continue;
 
         // Allocate memory
-        redir *io = calloc(1, sizeof(redir));
+        redir *io = mem_calloc(MEM_PARSE, 1, sizeof(redir));
         if (!io) {
             perror("parse_cmd: calloc");
             goto cleanup;
@@ -151,7 +224,7 @@ static ast_node *parse_cmd(lex_token **l, lex_token **r) {
             fprintf(stderr, "parse_cmd: Invalid filename!\n");
             goto cleanup;
         }
-        io->path = strdup((*(it + 1))->data);
+        io->path = mem_strdup(MEM_PARSE, (*(it + 1))->data);
         if (!io->path) {
             perror("parse_cmd: strdup");
             goto cleanup;
@@ -171,24 +244,41 @@ static ast_node *parse_cmd(lex_token **l, lex_token **r) {
         }
     }
 
+    // Leading assignment words become prefix assignments
+    int nassign = 0;
+    for (lex_token **it = l; it != r; ++it) {
+        if (consumed[it - l]) continue;
+        if ((*it)->type != TK_DEFAULT || (*it)->data == NULL || !is_assignment((*it)->data)) break;
+        consumed[it - l] = 2; // mark as assignment
+        ++nassign;
+    }
+
     int argc = 0;
     for (lex_token **it = l; it != r; ++it)
         argc += !consumed[it - l];
 
-    leaf->as.cmd.argv = calloc(argc + 1, sizeof(char *));
-    if (!leaf->as.cmd.argv) {
+    leaf->as.cmd.argv = mem_calloc(MEM_PARSE, argc + 1, sizeof(char *));
+    leaf->as.cmd.assigns = mem_calloc(MEM_PARSE, nassign + 1, sizeof(char *));
+    if (!leaf->as.cmd.argv || !leaf->as.cmd.assigns) {
         perror("parse_cmd: calloc");
         goto cleanup;
     }
 
     int idx = 0;
+    int aidx = 0;
     for (lex_token **it = l; it != r; ++it) {
-        if (!consumed[it - l]) {
+        if (consumed[it - l] == 2) {
+            leaf->as.cmd.assigns[aidx++] = mem_strdup(MEM_PARSE, (*it)->data);
+            if (!leaf->as.cmd.assigns[aidx - 1]) {
+                perror("parse_cmd: strdup");
+                goto cleanup;
+            }
+        } else if (!consumed[it - l]) {
             if ((*it)->type != TK_DEFAULT || (*it)->data == NULL) {
                 fprintf(stderr, "parse_cmd: Invalid argv token!\n");
                 goto cleanup;
             }
-            leaf->as.cmd.argv[idx++] = strdup((*it)->data);
+            leaf->as.cmd.argv[idx++] = mem_strdup(MEM_PARSE, (*it)->data);
             if (!leaf->as.cmd.argv[idx - 1]) {
                 perror("parse_cmd: strdup");
                 goto cleanup;
@@ -196,117 +286,505 @@ static ast_node *parse_cmd(lex_token **l, lex_token **r) {
         }
     }
 
-    free(consumed);
+    mem_free(consumed);
     return leaf;
 
 cleanup:
-    free(consumed);
+    mem_free(consumed);
     free_ast_node(leaf);
     return NULL;
 }
 
 /**
- * @brief Used to parse a sequence of token pointers as a NODE_PIPE
- * from l to r. Inclusive at l but exclusive at r.
- * If no pipe operator found, it will parse as a command.
+ * @brief Token cursor shared by the recursive-descent parser.
+ */
+typedef struct parser {
+    lex_token **toks; ///< NULL-terminated token list.
+    size_t pos; ///< Index of the current token.
+} parser;
+
+static ast_node *parse_list(parser *p);
+
+static lex_token *peek(const parser *p) {
+    return p->toks[p->pos];
+}
+
+/**
+ * @brief Checks whether a token is the given (unquoted) word.
+ */
+static int is_word(const lex_token *tok, const char *word) {
+    return tok && tok->type == TK_DEFAULT && tok->data && strcmp(tok->data, word) == 0;
+}
+
+/**
+ * @brief Checks whether a token ends a list (reserved word closing a compound command,
+ * ')' or ';;').
+ */
+static int is_list_end(const lex_token *tok) {
+    static const char *const ends[] = {"then", "elif", "else", "fi", "do", "done", "esac", "}", NULL};
+    if (!tok) return 1;
+    if (tok->type == TK_RPAREN || tok->type == TK_DSEMI) return 1;
+    for (const char *const *it = ends; *it != NULL; ++it)
+        if (is_word(tok, *it)) return 1;
+    return 0;
+}
+
+/**
+ * @brief Checks whether a token ends a simple command.
+ */
+static int is_cmd_end(const lex_token *tok) {
+    if (!tok) return 1;
+    switch (tok->type) {
+        case TK_DEFAULT:
+        case TK_REDIR_IN:
+        case TK_REDIR_OUT:
+        case TK_REDIR_APPEND:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+static void skip_newlines(parser *p) {
+    while (peek(p) && peek(p)->type == TK_NEWLINE) ++p->pos;
+}
+
+/**
+ * @brief Consumes the expected reserved word.
  *
- * @param l first token pointer
- * @param r last token pointer (non-inclusive)
- * @return Heap-allocated parsed ast_node, or NULL on error.
+ * @return non-zero if the current token is not the word.
  */
-static ast_node *parse_pipe(lex_token **l, lex_token **r) {
-    ast_node *root = NULL;
+static int expect_word(parser *p, const char *word, const char *ctx) {
+    if (!is_word(peek(p), word)) {
+        fprintf(stderr, "%s: Expected '%s'!\n", ctx, word);
+        return -1;
+    }
+    ++p->pos;
+    return 0;
+}
 
-    if (l == r) {
-        fprintf(stderr, "parse_pipe: Empty segment not allowed!\n");
+/**
+ * @brief Parses a non-empty list (used for compound command parts).
+ */
+static ast_node *parse_body(parser *p, const char *ctx) {
+    ast_node *list = parse_list(p);
+    if (list && !list->as.list.children[0]) {
+        fprintf(stderr, "%s: Empty list not allowed!\n", ctx);
+        free_ast_node(list);
+        return NULL;
+    }
+    return list;
+}
+
+/**
+ * @brief Collects consecutive word tokens as a heap-allocated, NULL-terminated list.
+ */
+static char **parse_words(parser *p, const char *ctx) {
+    size_t n = 0;
+    while (p->toks[p->pos + n] && p->toks[p->pos + n]->type == TK_DEFAULT) ++n;
+
+    char **words = mem_calloc(MEM_PARSE, n + 1, sizeof(char *));
+    if (!words) {
+        perror(ctx);
+        return NULL;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        words[i] = mem_strdup(MEM_PARSE, peek(p)->data);
+        if (!words[i]) {
+            perror(ctx);
+            mem_free_ptrv((void **) words, mem_free);
+            return NULL;
+        }
+        ++p->pos;
+    }
+    return words;
+}
+
+/**
+ * @brief Parses "if list then list [elif list then list]... [else list] fi".
+ * The current token is "if" or "elif".
+ */
+static ast_node *parse_if(parser *p) {
+    ast_node *node = mem_calloc(MEM_PARSE, 1, sizeof(ast_node));
+    if (!node) {
+        perror("parse_if: calloc");
+        return NULL;
+    }
+    node->type = NODE_IF;
+    ++p->pos; // "if" / "elif"
+
+    node->as.cond.cond = parse_body(p, "parse_if");
+    if (!node->as.cond.cond || expect_word(p, "then", "parse_if")) goto cleanup;
+    node->as.cond.then_part = parse_body(p, "parse_if");
+    if (!node->as.cond.then_part) goto cleanup;
+
+    if (is_word(peek(p), "elif")) {
+        // The nested if consumes the closing "fi"
+        node->as.cond.else_part = parse_if(p);
+        if (!node->as.cond.else_part) goto cleanup;
+        return node;
+    }
+    if (is_word(peek(p), "else")) {
+        ++p->pos;
+        node->as.cond.else_part = parse_body(p, "parse_if");
+        if (!node->as.cond.else_part) goto cleanup;
+    }
+    if (expect_word(p, "fi", "parse_if")) goto cleanup;
+    return node;
+
+cleanup:
+    free_ast_node(node);
+    return NULL;
+}
+
+/**
+ * @brief Parses "while|until list do list done".
+ */
+static ast_node *parse_loop(parser *p) {
+    ast_node *node = mem_calloc(MEM_PARSE, 1, sizeof(ast_node));
+    if (!node) {
+        perror("parse_loop: calloc");
+        return NULL;
+    }
+    node->type = is_word(peek(p), "while") ? NODE_WHILE : NODE_UNTIL;
+    ++p->pos;
+
+    node->as.loop.cond = parse_body(p, "parse_loop");
+    if (!node->as.loop.cond || expect_word(p, "do", "parse_loop")) goto cleanup;
+    node->as.loop.body = parse_body(p, "parse_loop");
+    if (!node->as.loop.body || expect_word(p, "done", "parse_loop")) goto cleanup;
+    return node;
+
+cleanup:
+    free_ast_node(node);
+    return NULL;
+}
+
+/**
+ * @brief Parses "for name [in word...] ; do list done".
+ */
+static ast_node *parse_for(parser *p) {
+    ast_node *node = mem_calloc(MEM_PARSE, 1, sizeof(ast_node));
+    if (!node) {
+        perror("parse_for: calloc");
+        return NULL;
+    }
+    node->type = NODE_FOR;
+    ++p->pos; // "for"
+
+    lex_token *name = peek(p);
+    if (!name || name->type != TK_DEFAULT || !var_valid_name(name->data, strlen(name->data))) {
+        fprintf(stderr, "parse_for: Invalid loop variable!\n");
+        goto cleanup;
+    }
+    node->as.loop_for.name = mem_strdup(MEM_PARSE, name->data);
+    if (!node->as.loop_for.name) {
+        perror("parse_for: strdup");
         goto cleanup;
     }
+    ++p->pos;
+    skip_newlines(p);
+
+    if (is_word(peek(p), "in")) {
+        ++p->pos;
+        node->as.loop_for.words = parse_words(p, "parse_for");
+        if (!node->as.loop_for.words) goto cleanup;
+        if (!peek(p) || (peek(p)->type != TK_SEMICOLON && peek(p)->type != TK_NEWLINE)) {
+            fprintf(stderr, "parse_for: Expected ';' or newline after word list!\n");
+            goto cleanup;
+        }
+        ++p->pos;
+    } else if (peek(p) && peek(p)->type == TK_SEMICOLON) {
+        ++p->pos;
+    }
+    skip_newlines(p);
 
-    int cnt = 0;
-    for (lex_token **it = l; it != r; ++it)
-        cnt += (*it)->type == TK_PIPE;
+    if (expect_word(p, "do", "parse_for")) goto cleanup;
+    node->as.loop_for.body = parse_body(p, "parse_for");
+    if (!node->as.loop_for.body || expect_word(p, "done", "parse_for")) goto cleanup;
+    return node;
 
-    // not a pipe
-    if (!cnt)
-        return parse_cmd(l, r);
+cleanup:
+    free_ast_node(node);
+    return NULL;
+}
 
-    root = malloc(sizeof(ast_node));
-    if (!root) {
-        perror("parse_pipe: malloc");
+/**
+ * @brief Parses one "[(] pattern [| pattern]... ) list [;;]" case item.
+ */
+static case_item *parse_case_item(parser *p) {
+    case_item *item = mem_calloc(MEM_PARSE, 1, sizeof(case_item));
+    if (!item) {
+        perror("parse_case_item: calloc");
+        return NULL;
+    }
+    if (peek(p) && peek(p)->type == TK_LPAREN) ++p->pos;
+
+    size_t n = 0;
+    while (1) {
+        lex_token *tok = p->toks[p->pos + 2 * n];
+        if (!tok || tok->type != TK_DEFAULT) {
+            fprintf(stderr, "parse_case_item: Expected pattern!\n");
+            goto cleanup;
+        }
+        ++n;
+        tok = p->toks[p->pos + 2 * n - 1];
+        if (!tok || tok->type != TK_PIPE) break;
+    }
+
+    item->patterns = mem_calloc(MEM_PARSE, n + 1, sizeof(char *));
+    if (!item->patterns) {
+        perror("parse_case_item: calloc");
         goto cleanup;
     }
-    root->type = NODE_PIPE;
-    root->as.list.children = NULL; // safe cleanup
+    for (size_t i = 0; i < n; ++i) {
+        item->patterns[i] = mem_strdup(MEM_PARSE, p->toks[p->pos + 2 * i]->data);
+        if (!item->patterns[i]) {
+            perror("parse_case_item: strdup");
+            goto cleanup;
+        }
+    }
+    p->pos += 2 * n - 1;
 
-    // cnt+1 segment + 1 NULL terminator
-    root->as.list.children = calloc(cnt + 2, sizeof(ast_node *));
-    if (!root->as.list.children) {
-        perror("parse_pipe: calloc");
+    if (!peek(p) || peek(p)->type != TK_RPAREN) {
+        fprintf(stderr, "parse_case_item: Expected ')'!\n");
         goto cleanup;
     }
+    ++p->pos;
 
-    int i = 0;
-    lex_token **ll = l;
-    for (lex_token **rr = l; 1; ++rr) {
-        if (rr != r && (*rr)->type != TK_PIPE) continue;
+    item->body = parse_list(p);
+    if (!item->body) goto cleanup;
 
-        root->as.list.children[i] = parse_cmd(ll, rr);
-        if (!root->as.list.children[i]) goto cleanup;
-        ll = rr + 1;
-        ++i;
-        if (rr == r) break;
+    if (peek(p) && peek(p)->type == TK_DSEMI) {
+        ++p->pos;
+        skip_newlines(p);
+    } else if (!is_word(peek(p), "esac")) {
+        fprintf(stderr, "parse_case_item: Expected ';;' or 'esac'!\n");
+        goto cleanup;
     }
+    return item;
 
-    return root;
 cleanup:
-    free_ast_node(root);
+    free_case_item(item);
     return NULL;
 }
 
 /**
- * @brief Used to parse a sequence of token pointers as a NODE_AND/NODE_OR
- * from l to r. Inclusive at l but exclusive at r.
- * If no && or || operator found, it will parse as a pipe.
- *
- * @param l first token pointer
- * @param r last token pointer (non-inclusive)
- * @param result Heap allocated parsed ast_node, or NULL on error / empty segment.
- * @return 0: successful, 1: empty segment, -1: error
+ * @brief Parses "case word in [item]... esac".
  */
-static int parse_and_or(lex_token **l, lex_token **r, ast_node **result) {
-    // Predefine with NULL pointers to have safe cleanup
-    *result = NULL;
-    ast_node *head = NULL;
-
-    if (l == r) return 1; // Empty segment
-
-    // Check if it is and_or node
-    // if it is, parse first segment (perhaps pipe)
-    int is_and_or = 0;
-    lex_token **it;
-    for (it = l; it != r; ++it) {
-        if ((*it)->type == TK_AND || (*it)->type == TK_OR) {
-            is_and_or = 1;
-            head = parse_pipe(l, it);
-            if (!head) goto cleanup;
-            break;
+static ast_node *parse_case(parser *p) {
+    ast_node *node = mem_calloc(MEM_PARSE, 1, sizeof(ast_node));
+    if (!node) {
+        perror("parse_case: calloc");
+        return NULL;
+    }
+    node->type = NODE_CASE;
+    ++p->pos; // "case"
+
+    lex_token *word = peek(p);
+    if (!word || word->type != TK_DEFAULT) {
+        fprintf(stderr, "parse_case: Expected word!\n");
+        goto cleanup;
+    }
+    node->as.cases.word = mem_strdup(MEM_PARSE, word->data);
+    if (!node->as.cases.word) {
+        perror("parse_case: strdup");
+        goto cleanup;
+    }
+    ++p->pos;
+    skip_newlines(p);
+    if (expect_word(p, "in", "parse_case")) goto cleanup;
+    skip_newlines(p);
+
+    size_t len = 0;
+    size_t cap = 4;
+    node->as.cases.items = mem_calloc(MEM_PARSE, cap + 1, sizeof(case_item *));
+    if (!node->as.cases.items) {
+        perror("parse_case: calloc");
+        goto cleanup;
+    }
+    while (!is_word(peek(p), "esac")) {
+        if (len == cap) {
+            case_item **temp = mem_realloc(MEM_PARSE, node->as.cases.items, (2 * cap + 1) * sizeof(case_item *));
+            if (!temp) {
+                perror("parse_case: realloc");
+                goto cleanup;
+            }
+            node->as.cases.items = temp;
+            cap <<= 1;
         }
+        node->as.cases.items[len] = parse_case_item(p);
+        if (!node->as.cases.items[len]) goto cleanup;
+        node->as.cases.items[++len] = NULL;
+    }
+    ++p->pos; // "esac"
+    return node;
+
+cleanup:
+    free_ast_node(node);
+    return NULL;
+}
+
+/**
+ * @brief Parses "{ list; }". The group runs in the current shell, so it is just its list.
+ */
+static ast_node *parse_group(parser *p) {
+    ++p->pos; // "{"
+    ast_node *body = parse_body(p, "parse_group");
+    if (!body) return NULL;
+    if (expect_word(p, "}", "parse_group")) {
+        free_ast_node(body);
+        return NULL;
+    }
+    return body;
+}
+
+static ast_node *parse_command(parser *p);
+
+/**
+ * @brief Parses "name() compound-command". The body is parsed once, here.
+ */
+static ast_node *parse_func(parser *p) {
+    lex_token *name = peek(p);
+    if (strpbrk(name->data, "$=/\001\002")) {
+        fprintf(stderr, "parse_func: Invalid function name: %s\n", name->data);
+        return NULL;
+    }
+    if (!p->toks[p->pos + 2] || p->toks[p->pos + 2]->type != TK_RPAREN) {
+        fprintf(stderr, "parse_func: Expected ')'!\n");
+        return NULL;
+    }
+
+    ast_node *node = mem_calloc(MEM_PARSE, 1, sizeof(ast_node));
+    if (!node) {
+        perror("parse_func: calloc");
+        return NULL;
+    }
+    node->type = NODE_FUNC;
+    node->as.func.name = mem_strdup(MEM_PARSE, name->data);
+    if (!node->as.func.name) {
+        perror("parse_func: strdup");
+        goto cleanup;
+    }
+    p->pos += 3; // name ( )
+    skip_newlines(p);
+
+    // The body has to be a compound command
+    lex_token *tok = peek(p);
+    if (!is_word(tok, "{") && !is_word(tok, "if") && !is_word(tok, "while") &&
+        !is_word(tok, "until") && !is_word(tok, "for") && !is_word(tok, "case")) {
+        fprintf(stderr, "parse_func: Expected compound command!\n");
+        goto cleanup;
+    }
+    node->as.func.body = parse_command(p);
+    if (!node->as.func.body) goto cleanup;
+    return node;
+
+cleanup:
+    free_ast_node(node);
+    return NULL;
+}
+
+/**
+ * @brief Parses a command: a compound command, a function definition,
+ * an arithmetic command or a simple command.
+ */
+static ast_node *parse_command(parser *p) {
+    lex_token *tok = peek(p);
+    if (!tok || (is_cmd_end(tok) && tok->type != TK_ARITH)) {
+        fprintf(stderr, "parse_cmd: Empty segment not allowed!\n");
+        return NULL;
     }
 
-    // Not an and_or node
-    if (!is_and_or) {
-        *result = parse_pipe(l, r);
-        if (!(*result)) return -1;
-        return 0;
+    ast_node *node = NULL;
+    if (is_word(tok, "if")) node = parse_if(p);
+    else if (is_word(tok, "while") || is_word(tok, "until")) node = parse_loop(p);
+    else if (is_word(tok, "for")) node = parse_for(p);
+    else if (is_word(tok, "case")) node = parse_case(p);
+    else if (is_word(tok, "{")) node = parse_group(p);
+    else if (is_list_end(tok)) {
+        fprintf(stderr, "parse_cmd: Unexpected '%s'!\n", tok->data);
+        return NULL;
+    } else if (tok->type == TK_ARITH) {
+        node = parse_cmd(p->toks + p->pos, p->toks + p->pos + 1);
+        ++p->pos;
+    } else if (tok->type == TK_DEFAULT && p->toks[p->pos + 1] && p->toks[p->pos + 1]->type == TK_LPAREN) {
+        node = parse_func(p);
+    } else {
+        size_t r = p->pos;
+        while (!is_cmd_end(p->toks[r])) ++r;
+        node = parse_cmd(p->toks + p->pos, p->toks + r);
+        p->pos = r;
     }
+    if (!node) return NULL;
 
-    // Continue to parse the rest and store with left-associativity.
-    ++it;
-    lex_token **ll = it;
-    for (; ; ++it) {
-        if (it != r && (*it)->type != TK_AND && (*it)->type != TK_OR) continue;
+    // Redirections are only supported on simple commands
+    if (!is_cmd_end(peek(p))) {
+        fprintf(stderr, "parse_cmd: Unexpected token after command!\n");
+        free_ast_node(node);
+        return NULL;
+    }
+    return node;
+}
 
-        ast_node *new_head = calloc(1, sizeof(ast_node));
+/**
+ * @brief Parses commands separated by '|' as a NODE_PIPE.
+ * If no pipe operator found, it will return the command itself.
+ */
+static ast_node *parse_pipe(parser *p) {
+    ast_node *first = parse_command(p);
+    if (!first || !peek(p) || peek(p)->type != TK_PIPE) return first;
+
+    ast_node *root = mem_malloc(MEM_PARSE, sizeof(ast_node));
+    if (!root) {
+        perror("parse_pipe: malloc");
+        free_ast_node(first);
+        return NULL;
+    }
+    root->type = NODE_PIPE;
+    size_t len = 1;
+    size_t cap = 4;
+    root->as.list.children = mem_calloc(MEM_PARSE, cap + 1, sizeof(ast_node *));
+    if (!root->as.list.children) {
+        perror("parse_pipe: calloc");
+        free_ast_node(first);
+        goto cleanup;
+    }
+    root->as.list.children[0] = first;
+
+    while (peek(p) && peek(p)->type == TK_PIPE) {
+        ++p->pos;
+        skip_newlines(p);
+        if (len == cap) {
+            ast_node **temp = mem_realloc(MEM_PARSE, root->as.list.children, (2 * cap + 1) * sizeof(ast_node *));
+            if (!temp) {
+                perror("parse_pipe: realloc");
+                goto cleanup;
+            }
+            root->as.list.children = temp;
+            cap <<= 1;
+        }
+        root->as.list.children[len] = parse_command(p);
+        if (!root->as.list.children[len]) goto cleanup;
+        root->as.list.children[++len] = NULL;
+    }
+    return root;
+
+cleanup:
+    free_ast_node(root);
+    return NULL;
+}
+
+/**
+ * @brief Parses pipelines joined by && / || as left-associative NODE_AND/NODE_OR.
+ * If no && or || operator found, it will return the pipeline itself.
+ */
+static ast_node *parse_and_or(parser *p) {
+    ast_node *head = parse_pipe(p);
+    if (!head) return NULL;
+
+    while (peek(p) && (peek(p)->type == TK_AND || peek(p)->type == TK_OR)) {
+        ast_node *new_head = mem_calloc(MEM_PARSE, 1, sizeof(ast_node));
         if (!new_head) {
             perror("parse_and_or: calloc");
             goto cleanup;
@@ -315,102 +793,117 @@ static int parse_and_or(lex_token **l, lex_token **r, ast_node **result) {
         // Immediately switching to head.
         new_head->as.binary.left = head;
         head = new_head;
+        head->type = peek(p)->type == TK_AND ? NODE_AND : NODE_OR;
+        ++p->pos;
+        skip_newlines(p);
 
-        // This is the new head now
-        head->type = (*(ll - 1))->type == TK_AND ? NODE_AND : NODE_OR;
-        head->as.binary.right = parse_pipe(ll, it);
+        head->as.binary.right = parse_pipe(p);
         if (!head->as.binary.right) goto cleanup;
-
-        ll = it + 1;
-        if (it == r) break;
     }
-
-    *result = head;
-
-    return 0;
+    return head;
 
 cleanup:
     free_ast_node(head);
-    return -1;
+    return NULL;
 }
 
-// Parser
-
-ast_node *parse_line(const char *line) {
-    if (!line) return NULL;
-
-    // predefine to avoid ambiguity on cleanup
-    ast_node *root = NULL;
+/**
+ * @brief Parses and-or lists separated by ';', '&' or newlines as a NODE_SEQ,
+ * up to the end of input or a token closing the enclosing compound command.
+ */
+static ast_node *parse_list(parser *p) {
     ast_node *child = NULL;
-
-    // Tokenization
-    lex_token **tokens = lex_line(line);
-    if (!tokens) goto cleanup;
-
-    int mxcnt = 1;
-    for (lex_token **it = tokens; *it != NULL; ++it) {
-        mxcnt += (*it)->type == TK_SEMICOLON || (*it)->type == TK_BG;
-    }
-
-    // Allocate the root ( NODE_SEQ )
-    root = malloc(sizeof(ast_node));
+    ast_node *root = mem_malloc(MEM_PARSE, sizeof(ast_node));
     if (!root) {
-        perror("parse_line: malloc");
-        goto cleanup;
+        perror("parse_list: malloc");
+        return NULL;
     }
-
     root->type = NODE_SEQ;
-    root->as.list.children = calloc(mxcnt + 1, sizeof(ast_node *));
+
+    size_t len = 0;
+    size_t cap = 4;
+    root->as.list.children = mem_calloc(MEM_PARSE, cap + 1, sizeof(ast_node *));
     if (!root->as.list.children) {
-        perror("parse_line: calloc");
+        perror("parse_list: calloc");
         goto cleanup;
     }
 
-    int i = 0;
-    lex_token **l = tokens;
-    for (lex_token **r = tokens; 1; ++r) {
-        if (*r != NULL && (*r)->type != TK_SEMICOLON && (*r)->type != TK_BG) continue;
-
-        int res = parse_and_or(l, r, &child);
-        if (res == -1) goto cleanup;
-        if (res == 1) {
-            if (*r == NULL) break;
-            fprintf(stderr, "parse_line: Empty segment not allowed!\n");
-            goto cleanup;
-        }
+    while (1) {
+        skip_newlines(p);
+        if (is_list_end(peek(p))) break;
 
-        if (*r != NULL && (*r)->type == TK_BG) {
-            ast_node *bg = malloc(sizeof(ast_node));
+        child = parse_and_or(p);
+        if (!child) goto cleanup;
+
+        lex_token *sep = peek(p);
+        if (sep && sep->type == TK_BG) {
+            ast_node *bg = mem_malloc(MEM_PARSE, sizeof(ast_node));
             if (!bg) {
-                perror("parse_line: malloc");
+                perror("parse_list: malloc");
                 goto cleanup;
             }
             bg->type = NODE_BG;
             bg->as.bg.child = child;
-            root->as.list.children[i++] = bg;
-        } else {
-            root->as.list.children[i++] = child;
+            child = bg;
+        } else if (sep && sep->type != TK_SEMICOLON && sep->type != TK_NEWLINE && !is_list_end(sep)) {
+            fprintf(stderr, "parse_list: Unexpected token!\n");
+            goto cleanup;
         }
+        if (sep && (sep->type == TK_BG || sep->type == TK_SEMICOLON || sep->type == TK_NEWLINE)) ++p->pos;
 
+        if (len == cap) {
+            ast_node **temp = mem_realloc(MEM_PARSE, root->as.list.children, (2 * cap + 1) * sizeof(ast_node *));
+            if (!temp) {
+                perror("parse_list: realloc");
+                goto cleanup;
+            }
+            root->as.list.children = temp;
+            cap <<= 1;
+        }
+        root->as.list.children[len++] = child;
+        root->as.list.children[len] = NULL;
         child = NULL; // avoid double free on error
-
-        l = r + 1;
-
-        if (*r == NULL) break;
     }
-
-
-    free_ptrv((void **) tokens, free_lex_token_adapter);
-
     return root;
 
 cleanup:
-    free_ptrv((void **) tokens, free_lex_token_adapter);
     free_ast_node(child);
     free_ast_node(root);
     return NULL;
 }
 
+// Parser
+
+ast_node *parse_tokens(lex_token **tokens) {
+    if (!tokens) return NULL;
+
+    uint64_t t0 = stats_now();
+    parser p = { .toks = tokens, .pos = 0 };
+    ast_node *root = parse_list(&p);
+    if (root && peek(&p) != NULL) {
+        if (peek(&p)->type == TK_DEFAULT) fprintf(stderr, "parse_line: Unexpected '%s'!\n", peek(&p)->data);
+        else fprintf(stderr, "parse_line: Unexpected token!\n");
+        free_ast_node(root);
+        root = NULL;
+    }
+    stats_record(PHASE_PARSE, t0);
+    return root;
+}
+
+ast_node *parse_line(const char *line) {
+    if (!line) return NULL;
+
+    // Tokenization
+    uint64_t t0 = stats_now();
+    lex_token **tokens = lex_line(line);
+    stats_record(PHASE_LEX, t0);
+    if (!tokens) return NULL;
+
+    ast_node *root = parse_tokens(tokens);
+    mem_free_ptrv((void **) tokens, free_lex_token_adapter);
+    return root;
+}
+
 
 void print_ast(const ast_node *root, int depth) {
     if (!root) return;
@@ -448,7 +941,47 @@ void print_ast(const ast_node *root, int depth) {
             print_ast(root->as.bg.child, depth + 2);
             break;
 
+        case NODE_ARITH:
+            printf("NODE_ARITH (( %s ))\n", root->as.arith.src);
+            break;
+
+        case NODE_IF:
+            printf("NODE_IF\n");
+            print_ast(root->as.cond.cond, depth + 2);
+            print_ast(root->as.cond.then_part, depth + 2);
+            print_ast(root->as.cond.else_part, depth + 2);
+            break;
+
+        case NODE_WHILE:
+        case NODE_UNTIL:
+            printf("%s\n", root->type == NODE_WHILE ? "NODE_WHILE" : "NODE_UNTIL");
+            print_ast(root->as.loop.cond, depth + 2);
+            print_ast(root->as.loop.body, depth + 2);
+            break;
+
+        case NODE_FOR:
+            printf("NODE_FOR %s in [ ", root->as.loop_for.name);
+            for (char **it = root->as.loop_for.words; it && *it != NULL; ++it)
+                printf("\"%s\" ", *it);
+            printf("]\n");
+            print_ast(root->as.loop_for.body, depth + 2);
+            break;
+
+        case NODE_CASE:
+            printf("NODE_CASE \"%s\"\n", root->as.cases.word);
+            for (case_item **it = root->as.cases.items; *it != NULL; ++it) {
+                for (int i = 0; i < depth + 2; ++i) putchar('-');
+                printf(" [ ");
+                for (char **pat = (*it)->patterns; *pat != NULL; ++pat)
+                    printf("\"%s\" ", *pat);
+                printf("]\n");
+                print_ast((*it)->body, depth + 4);
+            }
+            break;
+
         case NODE_CMD:
+            for (char **it = root->as.cmd.assigns; *it != NULL; ++it)
+                printf("%s ", *it);
             printf("[ ");
             for (char **it = root->as.cmd.argv; *it != NULL; ++it)
                 printf("\"%s\" ", *it);
@@ -463,6 +996,11 @@ void print_ast(const ast_node *root, int depth) {
             printf("\n");
             break;
 
+        case NODE_FUNC:
+            printf("NODE_FUNC %s()\n", root->as.func.name);
+            print_ast(root->as.func.body, depth + 2);
+            break;
+
         default:
             fprintf(stderr, "print_ast: Invalid node type!\n");
     }
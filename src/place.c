@@ -0,0 +1,289 @@
+#define _GNU_SOURCE
+#include "place.h"
+
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "vars.h"
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+/**
+ * @brief Cached topology of one CPU (-1 when unknown).
+ */
+typedef struct cpu_topo {
+    int loaded; ///< Nonzero once read from sysfs.
+    int llc; ///< First CPU sharing the last-level cache (domain key).
+    int core; ///< First hardware thread of the physical core (core key).
+    int node; ///< NUMA node.
+} cpu_topo;
+
+/**
+ * @brief Placement of every stage of a pipeline.
+ */
+struct place_plan {
+    int nstages; ///< Number of stages.
+    cpu_set_t *sets; ///< CPU set of each stage.
+    int *nodes; ///< NUMA node of each stage (-1: no memory policy).
+    int mpol; ///< MPOL_PREFERRED, MPOL_BIND, or 0 for none.
+};
+
+static cpu_topo topo[CPU_SETSIZE];
+
+/**
+ * @brief Parse a kernel CPU list ("0-3,8") into a set.
+ * @return non-zero if invalid or empty.
+ */
+static int parse_cpu_list(const char *s, size_t len, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *end = s + len;
+    while (s < end) {
+        char *endptr = NULL;
+        long lo = strtol(s, &endptr, 10);
+        if (endptr == s || lo < 0 || lo >= CPU_SETSIZE) return -1;
+        long hi = lo;
+        s = endptr;
+        if (s < end && *s == '-') {
+            ++s;
+            hi = strtol(s, &endptr, 10);
+            if (endptr == s || hi < lo || hi >= CPU_SETSIZE) return -1;
+            s = endptr;
+        }
+        for (long c = lo; c <= hi; ++c) CPU_SET((int) c, set);
+        if (s < end && *s == ',') ++s;
+        else if (s < end && *s != '\n') return -1;
+        else break;
+    }
+    return CPU_COUNT(set) ? 0 : -1;
+}
+
+/**
+ * @brief First CPU of the list stored in a sysfs file (-1 if unreadable).
+ */
+static int read_first_cpu(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char buf[4096];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = 0x00;
+
+    cpu_set_t set;
+    if (parse_cpu_list(buf, n, &set)) return -1;
+    for (int c = 0; c < CPU_SETSIZE; ++c)
+        if (CPU_ISSET(c, &set)) return c;
+    return -1;
+}
+
+/**
+ * @brief Topology of a CPU, read from sysfs on first use.
+ */
+static const cpu_topo *get_topo(int cpu) {
+    cpu_topo *t = topo + cpu;
+    if (t->loaded) return t;
+    t->loaded = 1;
+    t->llc = t->core = t->node = -1;
+
+    char path[256];
+
+    // The highest cache level defines the domain
+    int best = -1;
+    for (int idx = 0;; ++idx) {
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/level", cpu, idx);
+        FILE *f = fopen(path, "r");
+        if (!f) break;
+        int level = -1;
+        if (fscanf(f, "%d", &level) != 1) level = -1;
+        fclose(f);
+        if (level < best) continue;
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/shared_cpu_list", cpu, idx);
+        int first = read_first_cpu(path);
+        if (first == -1) continue;
+        best = level;
+        t->llc = first;
+    }
+
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/thread_siblings_list", cpu);
+    t->core = read_first_cpu(path);
+
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (dir) {
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL) {
+            if (strncmp(ent->d_name, "node", 4) != 0) continue;
+            char *endptr = NULL;
+            long node = strtol(ent->d_name + 4, &endptr, 10);
+            if (endptr != ent->d_name + 4 && *endptr == 0x00) {
+                t->node = (int) node;
+                break;
+            }
+        }
+        closedir(dir);
+    }
+
+    // Without sysfs every CPU is its own core in a single domain
+    if (t->llc == -1) t->llc = 0;
+    if (t->core == -1) t->core = cpu;
+    return t;
+}
+
+/**
+ * @brief Pack the stages on distinct cores of one last-level-cache domain.
+ *
+ * The first domain (in CPU order) with at least one allowed core per stage is
+ * used, otherwise the one with the most cores; stages wrap around its cores.
+ *
+ * @return non-zero if failed.
+ */
+static int auto_pack(place_plan *plan) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+        perror("place_plan_new: sched_getaffinity");
+        return -1;
+    }
+
+    // First allowed thread of every core, in CPU order
+    static int cores[CPU_SETSIZE];
+    int ncores = 0;
+    for (int c = 0; c < CPU_SETSIZE; ++c) {
+        if (!CPU_ISSET(c, &allowed)) continue;
+        int seen = 0;
+        for (int k = 0; k < ncores && !seen; ++k) seen = get_topo(cores[k])->core == get_topo(c)->core;
+        if (!seen) cores[ncores++] = c;
+    }
+    if (ncores == 0) return -1;
+
+    // Pick the domain
+    int best = -1, best_cores = 0;
+    for (int i = 0; i < ncores; ++i) {
+        int d = get_topo(cores[i])->llc;
+        int first = 1;
+        for (int k = 0; k < i && first; ++k) first = get_topo(cores[k])->llc != d;
+        if (!first) continue;
+
+        int n = 0;
+        for (int k = i; k < ncores; ++k) n += get_topo(cores[k])->llc == d;
+        if (n > best_cores) {
+            best = d;
+            best_cores = n;
+        }
+        if (n >= plan->nstages) break;
+    }
+
+    // Each stage gets every allowed thread of its core
+    int stage = 0;
+    while (stage < plan->nstages) {
+        for (int i = 0; i < ncores && stage < plan->nstages; ++i) {
+            const cpu_topo *t = get_topo(cores[i]);
+            if (t->llc != best) continue;
+            CPU_ZERO(plan->sets + stage);
+            for (int c = 0; c < CPU_SETSIZE; ++c)
+                if (CPU_ISSET(c, &allowed) && get_topo(c)->core == t->core) CPU_SET(c, plan->sets + stage);
+            ++stage;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Use explicit per-stage CPU lists, reused cyclically.
+ *
+ * Every list is validated, whatever the number of stages.
+ *
+ * @return non-zero if invalid.
+ */
+static int explicit_sets(place_plan *plan, const char *spec) {
+    int nlists = 0;
+    for (const char *s = spec;; ++nlists) {
+        const char *end = strchr(s, ':');
+        size_t len = end ? (size_t) (end - s) : strlen(s);
+        cpu_set_t set;
+        if (parse_cpu_list(s, len, &set)) return -1;
+        if (nlists < plan->nstages) plan->sets[nlists] = set;
+        if (!end) break;
+        s = end + 1;
+    }
+    ++nlists;
+
+    for (int i = nlists; i < plan->nstages; ++i) plan->sets[i] = plan->sets[i % nlists];
+    return 0;
+}
+
+// API Functions
+
+place_plan *place_plan_new(int nstages) {
+    const char *cpus = var_get("MINISHELL_PIPE_CPUS");
+    if (!cpus || !*cpus || nstages <= 0) return NULL;
+
+    place_plan *plan = calloc(1, sizeof(place_plan));
+    if (!plan) {
+        perror("place_plan_new: calloc");
+        return NULL;
+    }
+    plan->nstages = nstages;
+    plan->sets = calloc(nstages, sizeof(cpu_set_t));
+    plan->nodes = calloc(nstages, sizeof(int));
+    if (!plan->sets || !plan->nodes) {
+        perror("place_plan_new: calloc");
+        goto cleanup;
+    }
+
+    if (strcmp(cpus, "auto") == 0) {
+        if (auto_pack(plan)) goto cleanup;
+    } else if (explicit_sets(plan, cpus)) {
+        fprintf(stderr, "place_plan_new: Invalid MINISHELL_PIPE_CPUS: %s\n", cpus);
+        goto cleanup;
+    }
+
+    const char *numa = var_get("MINISHELL_PIPE_NUMA");
+    if (numa && strcmp(numa, "preferred") == 0) plan->mpol = MPOL_PREFERRED;
+    else if (numa && strcmp(numa, "bind") == 0) plan->mpol = MPOL_BIND;
+    else if (numa && *numa) fprintf(stderr, "place_plan_new: Invalid MINISHELL_PIPE_NUMA: %s\n", numa);
+
+    // Memory follows the node of the stage's first CPU
+    for (int i = 0; i < nstages; ++i) {
+        plan->nodes[i] = -1;
+        for (int c = 0; c < CPU_SETSIZE && plan->nodes[i] == -1; ++c)
+            if (CPU_ISSET(c, plan->sets + i)) plan->nodes[i] = get_topo(c)->node;
+    }
+    return plan;
+
+cleanup:
+    place_plan_free(plan);
+    return NULL;
+}
+
+int place_apply(const place_plan *plan, int stage) {
+    if (!plan || stage < 0 || stage >= plan->nstages) return 0;
+
+    int ret = 0;
+    if (sched_setaffinity(0, sizeof(cpu_set_t), plan->sets + stage) == -1) {
+        perror("place_apply: sched_setaffinity");
+        ret = -1;
+    }
+
+    int node = plan->nodes[stage];
+    if (plan->mpol && node >= 0 && node < 256) {
+        unsigned long mask[256 / (8 * sizeof(unsigned long))] = {0};
+        mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_set_mempolicy, plan->mpol, mask, (unsigned long) (sizeof(mask) * 8)) == -1) {
+            perror("place_apply: set_mempolicy");
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+void place_plan_free(place_plan *plan) {
+    if (!plan) return;
+    free(plan->sets);
+    free(plan->nodes);
+    free(plan);
+}
@@ -0,0 +1,307 @@
+#define _GNU_SOURCE
+#include "prof.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+#define PROF_LABEL_MAX 48
+
+/**
+ * @brief Accumulated times of one top-level command (nanoseconds).
+ *
+ * Every time but total excludes nested entries (commands of called functions).
+ */
+typedef struct prof_entry {
+    uint32_t first; ///< First source line
+    uint32_t last; ///< Last source line
+    uint32_t body; ///< Function body number (0: the lines themselves)
+    uint32_t idx; ///< Index among the top-level commands of the lines or body
+    uint64_t calls; ///< Number of runs
+    uint64_t total; ///< Wall time, nested entries included
+    uint64_t self; ///< Wall time spent in the shell
+    uint64_t child; ///< Wall time spent waiting for children
+    uint64_t user; ///< User CPU time of reaped children
+    uint64_t sys; ///< System CPU time of reaped children
+} prof_entry;
+
+/**
+ * @brief A running entry.
+ */
+typedef struct prof_frame {
+    size_t entry; ///< Index in entries
+    uint64_t start; ///< Start timestamp
+    uint64_t wait; ///< Child wait total at the start
+    uint64_t user; ///< Children user time at the start
+    uint64_t sys; ///< Children system time at the start
+    uint64_t nested[4]; ///< Wall, wait, user and sys time of nested entries
+} prof_frame;
+
+static int enabled = 0;
+static pid_t shell_pid = 0;
+
+static prof_entry *entries = NULL;
+static size_t nentries = 0, entries_cap = 0;
+static size_t *index_tab = NULL; ///< Open addressing table of entry index + 1
+static size_t index_cap = 0;
+
+static prof_frame *frames = NULL;
+static size_t nframes = 0, frames_cap = 0;
+
+static char **texts = NULL; ///< Line texts, indexed by line number
+static size_t ntexts = 0;
+
+static uint64_t wait_total = 0; ///< Time spent waiting for children so far
+
+static size_t slot_of(uint32_t first, uint32_t body, uint32_t idx) {
+    uint64_t h = (uint64_t) first * 0x9E3779B97F4A7C15ull ^ ((uint64_t) body << 32 | idx) * 0xC2B2AE3D27D4EB4Full;
+    return (size_t) (h ^ h >> 29) & (index_cap - 1);
+}
+
+/**
+ * @brief Rebuild the index with twice the capacity.
+ * @return non-zero if failed.
+ */
+static int index_grow(void) {
+    size_t cap = index_cap ? index_cap * 2 : 256;
+    size_t *tab = calloc(cap, sizeof(size_t));
+    if (!tab) {
+        perror("prof_enter: calloc");
+        return -1;
+    }
+    free(index_tab);
+    index_tab = tab;
+    index_cap = cap;
+    for (size_t i = 0; i < nentries; ++i) {
+        size_t s = slot_of(entries[i].first, entries[i].body, entries[i].idx);
+        while (index_tab[s]) s = (s + 1) & (index_cap - 1);
+        index_tab[s] = i + 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Find or create the entry of a command.
+ * @return Entry index, or (size_t) -1 if failed.
+ */
+static size_t get_entry(uint32_t first, uint32_t last, uint32_t body, uint32_t idx) {
+    if (nentries * 2 >= index_cap && index_grow()) return (size_t) -1;
+
+    size_t s = slot_of(first, body, idx);
+    for (; index_tab[s]; s = (s + 1) & (index_cap - 1)) {
+        const prof_entry *e = entries + index_tab[s] - 1;
+        if (e->first == first && e->body == body && e->idx == idx) return index_tab[s] - 1;
+    }
+
+    if (nentries == entries_cap) {
+        size_t cap = entries_cap ? entries_cap * 2 : 64;
+        prof_entry *tmp = realloc(entries, cap * sizeof(prof_entry));
+        if (!tmp) {
+            perror("prof_enter: realloc");
+            return (size_t) -1;
+        }
+        entries = tmp;
+        entries_cap = cap;
+    }
+    prof_entry *e = entries + nentries;
+    memset(e, 0, sizeof(*e));
+    e->first = first;
+    e->last = last;
+    e->body = body;
+    e->idx = idx;
+    index_tab[s] = ++nentries;
+    return nentries - 1;
+}
+
+/**
+ * @brief CPU time of every reaped child so far.
+ */
+static void children_times(uint64_t *user, uint64_t *sys) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_CHILDREN, &ru) == -1) {
+        *user = *sys = 0;
+        return;
+    }
+    *user = (uint64_t) ru.ru_utime.tv_sec * 1000000000ull + (uint64_t) ru.ru_utime.tv_usec * 1000ull;
+    *sys = (uint64_t) ru.ru_stime.tv_sec * 1000000000ull + (uint64_t) ru.ru_stime.tv_usec * 1000ull;
+}
+
+static int by_wall(const void *a, const void *b) {
+    const prof_entry *x = *(prof_entry *const *) a, *y = *(prof_entry *const *) b;
+    uint64_t wx = x->self + x->child, wy = y->self + y->child;
+    if (wx != wy) return wx < wy ? 1 : -1;
+    if (x->first != y->first) return x->first < y->first ? -1 : 1;
+    if (x->body != y->body) return x->body < y->body ? -1 : 1;
+    return x->idx < y->idx ? -1 : x->idx > y->idx;
+}
+
+static double ms(uint64_t ns) {
+    return (double) ns / 1e6;
+}
+
+/**
+ * @brief Print the report (registered with atexit).
+ */
+static void prof_report(void) {
+    if (!enabled || getpid() != shell_pid) return;
+
+    // Commands still running (e.g. the one that called exit) end here
+    while (nframes > 0) prof_leave();
+    enabled = 0;
+
+    FILE *out = stderr;
+    const char *path = getenv("MINISHELL_PROFILE_OUT");
+    if (path && *path && !(out = fopen(path, "w"))) {
+        perror("prof_report: fopen");
+        goto cleanup;
+    }
+
+    prof_entry **sorted = malloc((nentries ? nentries : 1) * sizeof(prof_entry *));
+    if (!sorted) {
+        perror("prof_report: malloc");
+        goto cleanup;
+    }
+    uint64_t self = 0, child = 0, user = 0, sys = 0;
+    for (size_t i = 0; i < nentries; ++i) {
+        sorted[i] = entries + i;
+        self += entries[i].self;
+        child += entries[i].child;
+        user += entries[i].user;
+        sys += entries[i].sys;
+    }
+    qsort(sorted, nentries, sizeof(prof_entry *), by_wall);
+
+    fprintf(out, "profile: %zu commands, %.3f ms wall (shell %.3f ms, children %.3f ms), "
+            "children cpu %.3f ms user %.3f ms sys\n", nentries, ms(self + child), ms(self), ms(child),
+            ms(user), ms(sys));
+    fprintf(out, "%12s %12s %12s %12s %12s %8s  %-10s %s\n", "total(ms)", "self(ms)", "child(ms)", "user(ms)",
+            "sys(ms)", "calls", "line", "source");
+    for (size_t i = 0; i < nentries; ++i) {
+        const prof_entry *e = sorted[i];
+        char where[48];
+        int n = e->first == e->last
+                    ? snprintf(where, sizeof(where), "%u", e->first)
+                    : snprintf(where, sizeof(where), "%u-%u", e->first, e->last);
+        if (e->body && n > 0 && (size_t) n < sizeof(where))
+            n += snprintf(where + n, sizeof(where) - (size_t) n, "/f%u", e->body);
+        if (e->idx && n > 0 && (size_t) n < sizeof(where))
+            snprintf(where + n, sizeof(where) - (size_t) n, "#%u", e->idx);
+        const char *text = e->first < ntexts && texts[e->first] ? texts[e->first] : "";
+        fprintf(out, "%12.3f %12.3f %12.3f %12.3f %12.3f %8llu  %-10s %s\n", ms(e->total), ms(e->self),
+                ms(e->child), ms(e->user), ms(e->sys), (unsigned long long) e->calls, where, text);
+    }
+    free(sorted);
+
+cleanup:
+    if (out && out != stderr && fclose(out) == EOF) perror("prof_report: fclose");
+    for (size_t i = 0; i < ntexts; ++i) free(texts[i]);
+    free(texts);
+    free(entries);
+    free(index_tab);
+    free(frames);
+    texts = NULL;
+    entries = NULL;
+    index_tab = NULL;
+    frames = NULL;
+    ntexts = nentries = entries_cap = index_cap = frames_cap = 0;
+}
+
+// API Functions
+
+int prof_on(void) {
+    return enabled;
+}
+
+int prof_init(void) {
+    const char *on = getenv("MINISHELL_PROFILE");
+    if (!on || !*on) return 0;
+
+    shell_pid = getpid();
+    enabled = 1;
+    atexit(prof_report);
+    return 0;
+}
+
+void prof_source(uint32_t line, const char *text) {
+    if (!enabled || !text) return;
+
+    if (line >= ntexts) {
+        size_t cap = ntexts ? ntexts : 64;
+        while (cap <= line) cap *= 2;
+        char **tmp = realloc(texts, cap * sizeof(char *));
+        if (!tmp) {
+            perror("prof_source: realloc");
+            return;
+        }
+        memset(tmp + ntexts, 0, (cap - ntexts) * sizeof(char *));
+        texts = tmp;
+        ntexts = cap;
+    }
+
+    // Label: the line up to its newline, shortened
+    size_t len = strcspn(text, "\n");
+    if (len > PROF_LABEL_MAX) len = PROF_LABEL_MAX;
+    free(texts[line]);
+    texts[line] = strndup(text, len);
+}
+
+void prof_enter(uint32_t first, uint32_t last, uint32_t body, uint32_t idx) {
+    if (!enabled) return;
+
+    if (nframes == frames_cap) {
+        size_t cap = frames_cap ? frames_cap * 2 : 16;
+        prof_frame *tmp = realloc(frames, cap * sizeof(prof_frame));
+        if (!tmp) {
+            perror("prof_enter: realloc");
+            return;
+        }
+        frames = tmp;
+        frames_cap = cap;
+    }
+
+    // An entry that cannot be allocated still gets a frame, so leaves stay balanced
+    prof_frame *fr = frames + nframes++;
+    memset(fr, 0, sizeof(*fr));
+    fr->entry = get_entry(first, last, body, idx);
+    fr->wait = wait_total;
+    children_times(&fr->user, &fr->sys);
+    fr->start = stats_now();
+}
+
+void prof_leave(void) {
+    if (!enabled || nframes == 0) return;
+
+    prof_frame *fr = frames + --nframes;
+    uint64_t wall = stats_now() - fr->start;
+    uint64_t user, sys;
+    children_times(&user, &sys);
+    uint64_t incl[4] = {wall, wait_total - fr->wait, user - fr->user, sys - fr->sys};
+
+    if (nframes > 0)
+        for (int k = 0; k < 4; ++k) frames[nframes - 1].nested[k] += incl[k];
+    if (fr->entry == (size_t) -1) return;
+
+    uint64_t ex[4];
+    for (int k = 0; k < 4; ++k) ex[k] = incl[k] > fr->nested[k] ? incl[k] - fr->nested[k] : 0;
+
+    prof_entry *e = entries + fr->entry;
+    ++e->calls;
+    e->self += ex[0] > ex[1] ? ex[0] - ex[1] : 0;
+    e->child += ex[1] < ex[0] ? ex[1] : ex[0];
+    e->user += ex[2];
+    e->sys += ex[3];
+
+    // Recursive calls count once in the inclusive time
+    int outer = 0;
+    for (size_t i = 0; i < nframes && !outer; ++i) outer = frames[i].entry == fr->entry;
+    if (!outer) e->total += wall;
+}
+
+void prof_wait(uint64_t start) {
+    if (!enabled) return;
+    wait_total += stats_now() - start;
+}
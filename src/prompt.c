@@ -0,0 +1,421 @@
+#define _GNU_SOURCE
+#include "prompt.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+#include "job.h"
+#include "vars.h"
+
+#define PROMPT_HEAD_MAX 256 ///< Bytes read from a HEAD or .git file
+
+/**
+ * @brief Prompt being built.
+ */
+typedef struct prompt_buf {
+    char *data; ///< Heap-allocated, Cstring buffer
+    size_t len; ///< Length in use (excluding NUL)
+    size_t cap; ///< Allocated capacity of data
+} prompt_buf;
+
+static char *current = NULL; ///< Last rendered prompt
+static uint64_t last_duration = 0;
+
+// Worker state, guarded by lock
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_t worker;
+static pid_t worker_pid = 0; ///< Process that owns the worker (0: not started)
+static int worker_failed = 0;
+static int stopping = 0;
+static int event_fd = -1;
+static char *want_dir = NULL; ///< Directory queued for the worker
+static char *vcs_dir = NULL; ///< Directory of the last result
+static char *vcs_branch = NULL; ///< Last result ("" outside a repository)
+
+static int put(prompt_buf *buf, const char *s, size_t n) {
+    if (buf->len + n + 1 > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 64;
+        while (buf->len + n + 1 > cap) cap <<= 1;
+        char *tmp = realloc(buf->data, cap);
+        if (!tmp) {
+            perror("prompt_render: realloc");
+            return -1;
+        }
+        buf->data = tmp;
+        buf->cap = cap;
+    }
+    memcpy(buf->data + buf->len, s, n);
+    buf->len += n;
+    buf->data[buf->len] = 0x00;
+    return 0;
+}
+
+static int puts_buf(prompt_buf *buf, const char *s) {
+    return put(buf, s, strlen(s));
+}
+
+/**
+ * @brief Read a small file into buf (NUL-terminated, trailing newline removed).
+ *
+ * @return non-zero if failed.
+ */
+static int read_small(const char *path, char *buf, size_t cap) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    ssize_t n = read(fd, buf, cap - 1);
+    close(fd);
+    if (n < 0) return -1;
+    buf[n] = 0x00;
+    buf[strcspn(buf, "\n")] = 0x00;
+    return 0;
+}
+
+/**
+ * @brief Branch named by the HEAD file of a git directory.
+ *
+ * @return Heap-allocated branch (short hash if detached), or NULL if failed.
+ */
+static char *read_head(const char *gitdir) {
+    char path[PATH_MAX], head[PROMPT_HEAD_MAX];
+    if (snprintf(path, sizeof(path), "%s/HEAD", gitdir) >= (int) sizeof(path)) return NULL;
+    if (read_small(path, head, sizeof(head))) return NULL;
+
+    if (strncmp(head, "ref: ", 5) == 0) {
+        const char *ref = head + 5;
+        if (strncmp(ref, "refs/heads/", 11) == 0) ref += 11;
+        return strdup(ref);
+    }
+    return strndup(head, 7);
+}
+
+/**
+ * @brief Look up the git branch of a directory (run by the worker).
+ *
+ * @return Heap-allocated branch, "" outside a repository, or NULL if failed.
+ */
+static char *find_branch(const char *dir) {
+    char path[PATH_MAX], gitfile[PROMPT_HEAD_MAX];
+    size_t len = strlen(dir);
+    if (len + sizeof("/.git") > sizeof(path)) return strdup("");
+    memcpy(path, dir, len + 1);
+    if (len == 1) len = 0; // "/"
+
+    while (1) {
+        struct stat st;
+        memcpy(path + len, "/.git", sizeof("/.git"));
+        if (stat(path, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) return read_head(path);
+
+            // Worktrees and submodules: "gitdir: <path>", relative to the .git file
+            if (read_small(path, gitfile, sizeof(gitfile)) || strncmp(gitfile, "gitdir: ", 8)) return strdup("");
+            const char *gitdir = gitfile + 8;
+            if (*gitdir != '/') {
+                path[len + 1] = 0x00;
+                if (len + 1 + strlen(gitdir) + 1 > sizeof(path)) return strdup("");
+                strcat(path, gitdir);
+                gitdir = path;
+            }
+            char *branch = read_head(gitdir);
+            return branch ? branch : strdup("");
+        }
+        if (len == 0) break;
+        while (len > 0 && path[len - 1] != '/') --len;
+        if (len > 0) --len;
+    }
+    return strdup("");
+}
+
+static void *vcs_worker(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&lock);
+    while (1) {
+        while (!want_dir && !stopping) pthread_cond_wait(&wake, &lock);
+        if (stopping) break;
+        char *dir = want_dir;
+        want_dir = NULL;
+        pthread_mutex_unlock(&lock);
+
+        char *branch = find_branch(dir);
+
+        pthread_mutex_lock(&lock);
+        if (!branch) {
+            free(dir);
+            continue;
+        }
+        int changed = !vcs_dir || strcmp(vcs_dir, dir) != 0 || strcmp(vcs_branch, branch) != 0;
+        free(vcs_dir);
+        free(vcs_branch);
+        vcs_dir = dir;
+        vcs_branch = branch;
+        if (changed) {
+            uint64_t one = 1;
+            ssize_t n = write(event_fd, &one, sizeof(one));
+            (void) n;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/**
+ * @brief Start the worker in this process if not running.
+ *
+ * @return non-zero if failed.
+ */
+static int start_worker(void) {
+    if (worker_pid == getpid()) return 0;
+    if (worker_failed) return -1;
+
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd == -1) {
+        perror("prompt_render: eventfd");
+        goto fail;
+    }
+
+    // Signals (SIGCHLD) must interrupt the shell thread, never the worker
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    int err = pthread_create(&worker, NULL, vcs_worker, NULL);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (err) {
+        fprintf(stderr, "prompt_render: pthread_create: %s\n", strerror(err));
+        goto fail;
+    }
+    worker_pid = getpid();
+    return 0;
+
+fail:
+    if (event_fd != -1) close(event_fd);
+    event_fd = -1;
+    worker_failed = 1;
+    return -1;
+}
+
+/**
+ * @brief Append the git branch of dir, queueing a lookup if asked.
+ */
+static int put_branch(prompt_buf *buf, const char *dir, int queue) {
+    if (start_worker()) return 0;
+
+    int ret = 0;
+    pthread_mutex_lock(&lock);
+    if (vcs_dir && strcmp(vcs_dir, dir) == 0) ret = puts_buf(buf, vcs_branch);
+    if (queue) {
+        char *copy = strdup(dir);
+        if (copy) {
+            free(want_dir);
+            want_dir = copy;
+            pthread_cond_signal(&wake);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+static int put_duration(prompt_buf *buf, uint64_t ns) {
+    char text[32];
+    uint64_t ms = ns / 1000000ull;
+    if (ms < 1000) snprintf(text, sizeof(text), "%llums", (unsigned long long) ms);
+    else if (ms < 60000) snprintf(text, sizeof(text), "%.1fs", (double) ms / 1e3);
+    else snprintf(text, sizeof(text), "%llum%02llus", (unsigned long long) (ms / 60000),
+                  (unsigned long long) (ms / 1000 % 60));
+    return puts_buf(buf, text);
+}
+
+static const char *user_name(void) {
+    static char *cached = NULL;
+    const char *user = var_get("USER");
+    if (user && *user) return user;
+    if (!cached) {
+        const struct passwd *pw = getpwuid(geteuid());
+        cached = strdup(pw ? pw->pw_name : "?");
+    }
+    return cached ? cached : "?";
+}
+
+static const char *host_name(void) {
+    static char host[256] = {0};
+    if (!host[0]) {
+        if (gethostname(host, sizeof(host) - 1)) strcpy(host, "?");
+        host[strcspn(host, ".")] = 0x00;
+    }
+    return host;
+}
+
+/**
+ * @brief Expand a PS1 format.
+ *
+ * @param queue Queue background lookups for the segments used.
+ * @return Heap-allocated prompt, or NULL if failed.
+ */
+static char *expand(const char *fmt, const char *pwd, int queue) {
+    prompt_buf buf = {NULL, 0, 0};
+    if (put(&buf, "", 0)) return NULL;
+
+    if (!fmt) {
+        if (puts_buf(&buf, pwd) || puts_buf(&buf, "> ")) goto fail;
+        return buf.data;
+    }
+
+    const char *home = var_get("HOME");
+    size_t hlen = home ? strlen(home) : 0;
+    int in_home = hlen > 1 && strncmp(pwd, home, hlen) == 0 && (pwd[hlen] == '/' || !pwd[hlen]);
+
+    for (const char *c = fmt; *c; ++c) {
+        if (*c != '\\' || !c[1]) {
+            if (put(&buf, c, 1)) goto fail;
+            continue;
+        }
+
+        char num[32], clock[16];
+        int r = 0;
+        switch (*++c) {
+            case 'w':
+                r = in_home ? puts_buf(&buf, "~") || puts_buf(&buf, pwd + hlen) : puts_buf(&buf, pwd);
+                break;
+            case 'W': {
+                const char *base = strrchr(pwd, '/');
+                if (in_home && !pwd[hlen]) r = puts_buf(&buf, "~");
+                else r = puts_buf(&buf, base && base[1] ? base + 1 : pwd);
+                break;
+            }
+            case 'u':
+                r = puts_buf(&buf, user_name());
+                break;
+            case 'h':
+                r = puts_buf(&buf, host_name());
+                break;
+            case '$':
+                r = puts_buf(&buf, geteuid() == 0 ? "#" : "$");
+                break;
+            case '?':
+                snprintf(num, sizeof(num), "%d", get_last_status());
+                r = puts_buf(&buf, num);
+                break;
+            case 'j':
+                snprintf(num, sizeof(num), "%d", count_jobs());
+                r = puts_buf(&buf, num);
+                break;
+            case 'D':
+                r = put_duration(&buf, last_duration);
+                break;
+            case 't': {
+                time_t now = time(NULL);
+                struct tm tm;
+                if (!localtime_r(&now, &tm) || !strftime(clock, sizeof(clock), "%H:%M:%S", &tm)) clock[0] = 0x00;
+                r = puts_buf(&buf, clock);
+                break;
+            }
+            case 'g':
+                r = put_branch(&buf, pwd, queue);
+                break;
+            case 'n':
+                r = puts_buf(&buf, "\n");
+                break;
+            case 'e':
+                r = puts_buf(&buf, "\x1b");
+                break;
+            case 'a':
+                r = puts_buf(&buf, "\a");
+                break;
+            case '\\':
+                r = puts_buf(&buf, "\\");
+                break;
+            default:
+                r = put(&buf, c - 1, 2);
+                break;
+        }
+        if (r) goto fail;
+    }
+    return buf.data;
+
+fail:
+    free(buf.data);
+    return NULL;
+}
+
+/**
+ * @brief Expand PS1 in the current directory.
+ */
+static char *render(int queue) {
+    const char *pwd = var_get("PWD");
+    char *cwd = NULL;
+    if (!pwd || *pwd != '/') {
+        if (!(cwd = getcwd(NULL, 0))) {
+            perror("prompt_render: getcwd");
+            return NULL;
+        }
+        pwd = cwd;
+    }
+    char *out = expand(var_get("PS1"), pwd, queue);
+    free(cwd);
+    return out;
+}
+
+// API Functions
+
+const char *prompt_render(void) {
+    char *out = render(1);
+    if (!out) return NULL;
+    free(current);
+    current = out;
+    return current;
+}
+
+const char *prompt_refresh(const char *shown) {
+    uint64_t events;
+    if (event_fd != -1) {
+        ssize_t n = read(event_fd, &events, sizeof(events));
+        (void) n;
+    }
+    if (!shown || shown != current) return NULL;
+
+    char *out = render(0);
+    if (!out) return NULL;
+    if (strcmp(out, current) == 0) {
+        free(out);
+        return NULL;
+    }
+    free(current);
+    current = out;
+    return current;
+}
+
+int prompt_event_fd(void) {
+    return worker_pid == getpid() ? event_fd : -1;
+}
+
+void prompt_set_duration(uint64_t ns) {
+    last_duration = ns;
+}
+
+void prompt_cleanup(void) {
+    if (worker_pid && worker_pid == getpid()) {
+        pthread_mutex_lock(&lock);
+        stopping = 1;
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&lock);
+        pthread_join(worker, NULL);
+        close(event_fd);
+        event_fd = -1;
+        worker_pid = 0;
+    }
+    free(want_dir);
+    free(vcs_dir);
+    free(vcs_branch);
+    free(current);
+    want_dir = vcs_dir = vcs_branch = current = NULL;
+}
@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include "qos.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <linux/ioprio.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "vars.h"
+
+#define KEEP_NICE INT_MIN
+
+/**
+ * @brief Apply (part of) a policy to one thread.
+ * @param tid Thread ID (0: the calling thread).
+ * @param nice Nice value (KEEP_NICE: unchanged).
+ * @param policy SCHED_OTHER or SCHED_BATCH (-1: unchanged).
+ * @param ioprio ioprio value (-1: unchanged).
+ * @return non-zero if a setting failed.
+ */
+static int apply_thread(pid_t tid, int nice, int policy, int ioprio) {
+    int ret = 0;
+    if (nice != KEEP_NICE && setpriority(PRIO_PROCESS, (id_t) tid, nice) == -1) ret = -1;
+    if (policy != -1) {
+        struct sched_param param = {.sched_priority = 0};
+        if (sched_setscheduler(tid, policy, &param) == -1) ret = -1;
+    }
+    if (ioprio != -1 && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, ioprio) == -1) ret = -1;
+    return ret;
+}
+
+/**
+ * @brief Apply settings to every thread of a process (via /proc/PID/task).
+ */
+static void apply_process(pid_t pid, int nice, int policy, int ioprio) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", (int) pid);
+    DIR *dir = opendir(path);
+    if (!dir) {
+        apply_thread(pid, nice, policy, ioprio);
+        return;
+    }
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        char *endptr = NULL;
+        long tid = strtol(ent->d_name, &endptr, 10);
+        if (endptr == ent->d_name || *endptr != 0x00) continue;
+        apply_thread((pid_t) tid, nice, policy, ioprio);
+    }
+    closedir(dir);
+}
+
+// API Functions
+
+int qos_policy_get(qos_policy *out) {
+    out->nice = -1;
+    out->batch = 0;
+    out->ioprio = -1;
+
+    const char *spec = var_get("MINISHELL_BG_QOS");
+    if (!spec || !*spec) return 0;
+
+    char *copy = strdup(spec);
+    if (!copy) {
+        perror("qos_policy_get: strdup");
+        return 0;
+    }
+
+    char *save = NULL;
+    for (char *tok = strtok_r(copy, " ,", &save); tok; tok = strtok_r(NULL, " ,", &save)) {
+        char *endptr = NULL;
+        if (strncmp(tok, "nice=", 5) == 0) {
+            long n = strtol(tok + 5, &endptr, 10);
+            if (endptr != tok + 5 && *endptr == 0x00 && n >= 0 && n <= 19) {
+                out->nice = (int) n;
+                continue;
+            }
+        } else if (strcmp(tok, "batch") == 0) {
+            out->batch = 1;
+            continue;
+        } else if (strcmp(tok, "ioprio=idle") == 0) {
+            out->ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0);
+            continue;
+        } else if (strncmp(tok, "ioprio=be:", 10) == 0) {
+            long n = strtol(tok + 10, &endptr, 10);
+            if (endptr != tok + 10 && *endptr == 0x00 && n >= 0 && n <= 7) {
+                out->ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, n);
+                continue;
+            }
+        }
+        fprintf(stderr, "qos_policy_get: Invalid MINISHELL_BG_QOS setting: %s\n", tok);
+    }
+    free(copy);
+
+    return out->nice != -1 || out->batch || out->ioprio != -1;
+}
+
+int qos_background_self(const qos_policy *policy) {
+    if (!policy) return 0;
+    int nice = policy->nice == -1 ? KEEP_NICE : policy->nice;
+    return apply_thread(0, nice, policy->batch ? SCHED_BATCH : -1, policy->ioprio);
+}
+
+void qos_set_job(job *j, int background) {
+    if (!j) return;
+
+    int nice, policy, ioprio;
+    if (background) {
+        qos_policy p;
+        if (!qos_policy_get(&p)) return;
+        nice = p.nice == -1 ? KEEP_NICE : p.nice;
+        policy = p.batch ? SCHED_BATCH : -1;
+        ioprio = p.ioprio;
+        j->isqos = 1;
+    } else {
+        if (!j->isqos) return;
+
+        // Back to the shell's own priorities
+        errno = 0;
+        nice = getpriority(PRIO_PROCESS, 0);
+        if (nice == -1 && errno) nice = KEEP_NICE;
+        policy = SCHED_OTHER;
+        ioprio = (int) syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+        if (ioprio == -1) ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_NONE, 0);
+        j->isqos = 0;
+    }
+
+    for (int i = 0; i < j->nproc; ++i)
+        if (j->procs[i].state != PROC_DONE) apply_process(j->procs[i].pid, nice, policy, ioprio);
+}
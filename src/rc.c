@@ -0,0 +1,435 @@
+#include "rc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "exec.h"
+#include "expand.h"
+#include "flat.h"
+#include "func.h"
+#include "lex.h"
+#include "mem.h"
+#include "vars.h"
+
+#define RC_FILE ".minishellrc"
+#define SNAP_SUFFIX ".snap"
+#define SNAP_MAGIC "MSHSNAP"
+#define SNAP_VERSION 1u
+
+/**
+ * @brief Effect of one declarative rc command.
+ */
+typedef enum rc_op_kind {
+    RC_SET, ///< "NAME=VALUE" shell variable
+    RC_EXPORT, ///< "NAME" or "NAME=VALUE" exported
+    RC_FUNC ///< function definition
+} rc_op_kind;
+
+/**
+ * @brief Recorded rc effect.
+ */
+typedef struct rc_op {
+    rc_op_kind kind; ///< Effect type
+    char *text; ///< Heap-allocated assignment, name or function name.
+    flat_ast *body; ///< Function body reference (RC_FUNC only).
+} rc_op;
+
+/**
+ * @brief Growable list of recorded effects.
+ */
+typedef struct rc_ops {
+    rc_op *data; ///< Heap-allocated ops.
+    size_t len; ///< Number of ops.
+    size_t cap; ///< Allocated capacity of data.
+} rc_ops;
+
+/**
+ * @brief Snapshot file header, followed by nops records.
+ *
+ * A record is a uint32_t kind, a uint32_t text length (including the NUL),
+ * the text, and for RC_FUNC the flat image of the body.
+ */
+typedef struct snap_hdr {
+    char magic[8]; ///< SNAP_MAGIC
+    uint32_t version; ///< SNAP_VERSION
+    uint32_t nops; ///< Number of records.
+    uint64_t dev; ///< Device of the rc file.
+    uint64_t ino; ///< Inode of the rc file.
+    uint64_t size; ///< Size of the rc file.
+    int64_t mtime_sec; ///< Modification time of the rc file.
+    int64_t mtime_nsec;
+} snap_hdr;
+
+// Effect List
+
+static int ops_push(rc_ops *ops, rc_op_kind kind, char *text, flat_ast *body) {
+    if (ops->len == ops->cap) {
+        size_t cap = ops->cap ? ops->cap << 1 : 16;
+        rc_op *temp = realloc(ops->data, cap * sizeof(rc_op));
+        if (!temp) {
+            perror("ops_push: realloc");
+            return -1;
+        }
+        ops->data = temp;
+        ops->cap = cap;
+    }
+    ops->data[ops->len++] = (rc_op){ .kind = kind, .text = text, .body = body };
+    return 0;
+}
+
+static void ops_free(rc_ops *ops) {
+    for (size_t i = 0; i < ops->len; ++i) {
+        free(ops->data[i].text);
+        free_flat_ast(ops->data[i].body);
+    }
+    free(ops->data);
+    ops->data = NULL;
+    ops->len = 0;
+    ops->cap = 0;
+}
+
+/**
+ * @brief Apply recorded effects to the shell.
+ */
+static int ops_apply(const rc_ops *ops) {
+    for (size_t i = 0; i < ops->len; ++i) {
+        const rc_op *op = &ops->data[i];
+        int ret = 0;
+        switch (op->kind) {
+            case RC_SET:
+                ret = var_assign(op->text, VAR_LOCAL);
+                break;
+            case RC_EXPORT:
+                ret = strchr(op->text, '=') ? var_assign(op->text, VAR_EXPORT) : var_export(op->text);
+                break;
+            case RC_FUNC:
+                ret = func_define(op->text, op->body);
+                break;
+        }
+        if (ret) return -1;
+    }
+    return 0;
+}
+
+// Recording
+
+/**
+ * @brief Check that a word needs no expansion beyond quote removal.
+ */
+static int is_literal(const char *word) {
+    return strpbrk(word, "$*?[") == NULL;
+}
+
+static int all_literal(char **words) {
+    for (char **it = words; *it != NULL; ++it)
+        if (!is_literal(*it)) return 0;
+    return 1;
+}
+
+/**
+ * @brief Record the effects of a declarative line.
+ *
+ * @return 1 if recorded, 0 if the line is not declarative, -1 on error.
+ */
+static int record_line(flat_ast *f, rc_ops *ops) {
+    if (f->types[f->root] != NODE_SEQ) return 0;
+
+    // Check the whole line first
+    for (uint32_t i = 0; i < f->kid_count[f->root]; ++i) {
+        uint32_t node = f->kids[f->kid_start[f->root] + i];
+        if (f->types[node] == NODE_FUNC) continue;
+        if (f->types[node] != NODE_CMD) return 0;
+
+        cmd_node *cmd = &f->cmds[f->data[node]];
+        if (cmd->io[0] || !all_literal(cmd->argv) || !all_literal(cmd->assigns)) return 0;
+        if (cmd->argv[0] && (strcmp(cmd->argv[0], "export") != 0 || cmd->assigns[0])) return 0;
+    }
+
+    for (uint32_t i = 0; i < f->kid_count[f->root]; ++i) {
+        uint32_t node = f->kids[f->kid_start[f->root] + i];
+        if (f->types[node] == NODE_FUNC) {
+            flat_func *fn = &f->funcs[f->data[node]];
+            char *name = strdup(fn->name);
+            if (!name) {
+                perror("record_line: strdup");
+                return -1;
+            }
+            if (ops_push(ops, RC_FUNC, name, flat_ref(fn->body))) {
+                free(name);
+                free_flat_ast(fn->body);
+                return -1;
+            }
+            continue;
+        }
+
+        cmd_node *cmd = &f->cmds[f->data[node]];
+        rc_op_kind kind = cmd->argv[0] ? RC_EXPORT : RC_SET;
+        for (char **it = cmd->argv[0] ? cmd->argv + 1 : cmd->assigns; *it != NULL; ++it) {
+            char *text = expand_word(*it);
+            if (!text) return -1;
+            if (ops_push(ops, kind, text, NULL)) {
+                free(text);
+                return -1;
+            }
+        }
+    }
+    return 1;
+}
+
+// Snapshot
+
+/**
+ * @brief Fill the parts of a header that identify the rc file.
+ */
+static void snap_key(snap_hdr *hdr, const struct stat *st) {
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+    hdr->version = SNAP_VERSION;
+    hdr->dev = (uint64_t) st->st_dev;
+    hdr->ino = (uint64_t) st->st_ino;
+    hdr->size = (uint64_t) st->st_size;
+    hdr->mtime_sec = (int64_t) st->st_mtim.tv_sec;
+    hdr->mtime_nsec = (int64_t) st->st_mtim.tv_nsec;
+}
+
+/**
+ * @brief Read the records of a mapped snapshot.
+ *
+ * @return non-zero if the snapshot is invalid.
+ */
+static int snap_parse(const char *data, size_t len, uint32_t nops, rc_ops *ops) {
+    size_t off = sizeof(snap_hdr);
+    for (uint32_t i = 0; i < nops; ++i) {
+        uint32_t rec[2];
+        if (len - off < sizeof(rec)) return -1;
+        memcpy(rec, data + off, sizeof(rec));
+        off += sizeof(rec);
+        if (rec[0] > RC_FUNC || rec[1] == 0 || len - off < rec[1] || data[off + rec[1] - 1] != 0x00) return -1;
+
+        char *text = strdup(data + off);
+        if (!text) {
+            perror("snap_parse: strdup");
+            return -1;
+        }
+        off += rec[1];
+
+        flat_ast *body = NULL;
+        if (rec[0] == RC_FUNC) {
+            size_t used = 0;
+            body = flat_read_image(data + off, len - off, &used);
+            if (!body) {
+                free(text);
+                return -1;
+            }
+            off += used;
+        }
+        if (ops_push(ops, (rc_op_kind) rec[0], text, body)) {
+            free(text);
+            free_flat_ast(body);
+            return -1;
+        }
+    }
+    return off == len ? 0 : -1;
+}
+
+/**
+ * @brief Replay a snapshot if it matches the rc file.
+ *
+ * @return 0 if replayed, non-zero if missing, stale or invalid.
+ */
+static int snap_load(const char *snap, const struct stat *rc_st) {
+    int fd = open(snap, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(snap_hdr)) {
+        close(fd);
+        return -1;
+    }
+    size_t len = (size_t) st.st_size;
+    void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    int ret = -1;
+    rc_ops ops = { .data = NULL, .len = 0, .cap = 0 };
+    snap_hdr key;
+    snap_hdr hdr;
+    snap_key(&key, rc_st);
+    memcpy(&hdr, map, sizeof(hdr));
+    key.nops = hdr.nops;
+    if (memcmp(&key, &hdr, sizeof(hdr)) == 0 && !snap_parse(map, len, hdr.nops, &ops))
+        ret = ops_apply(&ops) ? -1 : 0;
+
+    ops_free(&ops);
+    munmap(map, len);
+    return ret;
+}
+
+/**
+ * @brief Write a snapshot (through a temporary file renamed into place).
+ */
+static void snap_write(const char *snap, const struct stat *rc_st, const rc_ops *ops) {
+    size_t n = strlen(snap) + 8;
+    char *tmp = malloc(n);
+    if (!tmp) {
+        perror("snap_write: malloc");
+        return;
+    }
+    snprintf(tmp, n, "%s.XXXXXX", snap);
+    int fd = mkstemp(tmp);
+    if (fd == -1) {
+        free(tmp);
+        return; // read-only location: keep sourcing the rc file
+    }
+    FILE *out = fdopen(fd, "wb");
+    if (!out) {
+        perror("snap_write: fdopen");
+        close(fd);
+        unlink(tmp);
+        free(tmp);
+        return;
+    }
+
+    snap_hdr hdr;
+    snap_key(&hdr, rc_st);
+    hdr.nops = (uint32_t) ops->len;
+    int ret = fwrite(&hdr, sizeof(hdr), 1, out) == 1 ? 0 : -1;
+    for (size_t i = 0; i < ops->len && !ret; ++i) {
+        uint32_t rec[2] = { (uint32_t) ops->data[i].kind, (uint32_t) strlen(ops->data[i].text) + 1 };
+        if (fwrite(rec, sizeof(rec), 1, out) != 1 || fwrite(ops->data[i].text, rec[1], 1, out) != 1) ret = -1;
+        else if (ops->data[i].kind == RC_FUNC) ret = flat_write_image(ops->data[i].body, out);
+    }
+    if (fclose(out) != 0) ret = -1;
+
+    if (ret || rename(tmp, snap) == -1) {
+        if (!ret) perror("snap_write: rename");
+        unlink(tmp);
+    }
+    free(tmp);
+}
+
+// Sourcing
+
+/**
+ * @brief Line source for lex_read_command: the next line of the rc file,
+ * skipping blank lines and comments between commands.
+ */
+static char *next_rc_line(void *in, int more) {
+    char *line = NULL;
+    size_t cap = 0;
+    while (1) {
+        errno = 0;
+        if (getline(&line, &cap, in) == -1) {
+            int err = ferror(in) ? errno : 0;
+            free(line);
+            errno = err;
+            return NULL;
+        }
+        const char *c = line + strspn(line, " \t");
+        if (more || (*c != '\n' && *c != 0x00 && *c != '#')) return line;
+    }
+}
+
+/**
+ * @brief Run every command of the rc file, recording declarative effects.
+ *
+ * Lines go through a lexer stream, so a command may span several lines
+ * (function bodies, if/while blocks, quotes); it runs once it is complete.
+ *
+ * @return 1 if the whole file was declarative, 0 otherwise, -1 on error.
+ */
+static int rc_source(const char *path, rc_ops *ops) {
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        perror("rc_load: fopen");
+        return -1;
+    }
+
+    int declarative = 1;
+    uint32_t lineno = 0;
+    lex_stream ls;
+    lex_stream_init(&ls);
+    lex_token **tokens;
+    while (lex_read_command(&ls, next_rc_line, in, &lineno, &tokens) == 0) {
+        flat_ast *f = tokens ? parse_tokens_flat(tokens) : NULL;
+        mem_free_ptrv((void **) tokens, free_lex_token_adapter);
+        if (!f) {
+            declarative = 0;
+            continue;
+        }
+        if (declarative) {
+            int rec = record_line(f, ops);
+            if (rec == -1) {
+                free_flat_ast(f);
+                declarative = -1;
+                break;
+            }
+            if (rec == 0) declarative = 0;
+        }
+
+        int status = 0;
+        execute_flat(f, &status);
+        free_flat_ast(f);
+    }
+
+    lex_stream_free(&ls);
+    fclose(in);
+    return declarative;
+}
+
+// API Functions
+
+int rc_load(void) {
+    char *path = NULL;
+    const char *env = getenv("MINISHELLRC");
+    const char *home = getenv("HOME");
+    if (env && *env) path = strdup(env);
+    else if (home && *home) {
+        size_t n = strlen(home) + sizeof(RC_FILE) + 1;
+        path = malloc(n);
+        if (path) snprintf(path, n, "%s/%s", home, RC_FILE);
+    } else return 0;
+    if (!path) {
+        perror("rc_load: malloc");
+        return -1;
+    }
+
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        int missing = errno == ENOENT;
+        if (!missing) perror("rc_load: stat");
+        free(path);
+        return missing ? 0 : -1;
+    }
+
+    size_t n = strlen(path) + sizeof(SNAP_SUFFIX);
+    char *snap = malloc(n);
+    if (!snap) {
+        perror("rc_load: malloc");
+        free(path);
+        return -1;
+    }
+    snprintf(snap, n, "%s%s", path, SNAP_SUFFIX);
+
+    int ret = 0;
+    if (snap_load(snap, &st) != 0) {
+        rc_ops ops = { .data = NULL, .len = 0, .cap = 0 };
+        int declarative = rc_source(path, &ops);
+        if (declarative == 1) snap_write(snap, &st, &ops);
+        else unlink(snap);
+        if (declarative == -1) ret = -1;
+        ops_free(&ops);
+    }
+
+    free(snap);
+    free(path);
+    return ret;
+}
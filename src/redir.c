@@ -6,13 +6,28 @@
 #include <errno.h>
 #include <stdio.h>
 
+#include "mem.h"
+#include "stats.h"
+
 typedef struct backup {
     int saved_fd;
     int fd;
 } fd_pair;
 
-static fd_pair *backup = NULL;
-static int cnt = 0;
+/**
+ * @brief Saved descriptors of one apply_redir(REDIR_TEMPORARY) call.
+ *
+ * Frames nest (a function call with redirections runs builtins with their own).
+ */
+typedef struct redir_frame redir_frame;
+
+typedef struct redir_frame {
+    fd_pair *backup; ///< Heap-allocated saved descriptors.
+    int cnt; ///< Number of entries in backup.
+    redir_frame *prev; ///< Enclosing frame.
+} redir_frame;
+
+static redir_frame *frames = NULL;
 
 int apply_redir(cmd_node *node, apply_redir_mode mode) {
     // Validate node
@@ -24,37 +39,38 @@ int apply_redir(cmd_node *node, apply_redir_mode mode) {
     // No redir to apply
     if (!node->io) return 0;
 
-    // Make backup table if REDIR_TEMPORARY
+    // Push a backup frame if REDIR_TEMPORARY
+    fd_pair *backup = NULL;
     if (mode == REDIR_TEMPORARY) {
-        // If previous redir not undone yet, error
-        if (backup != NULL) {
-            fprintf(stderr, "apply_redir: Previous redir not undo yet!\n");
-            return -1;
-        }
-
         // Count redirections;
-        cnt = 0;
+        int cnt = 0;
         for (redir **it = node->io; *it != NULL; ++it) ++cnt;
 
-        if (!cnt) return 0;
-
-        // Allocate array
-        backup = malloc(cnt * sizeof(fd_pair));
-        if (!backup) {
-            perror("apply_redir: malloc");
+        // Allocate frame (pushed even if empty, undo_redir pops it)
+        redir_frame *frame = mem_calloc(MEM_REDIR, 1, sizeof(redir_frame));
+        backup = mem_calloc(MEM_REDIR, cnt ? cnt : 1, sizeof(fd_pair));
+        if (!frame || !backup) {
+            perror("apply_redir: calloc");
+            mem_free(frame);
+            mem_free(backup);
             return -1;
         }
         for (int i = 0; i < cnt; ++i) {
             backup[i].saved_fd = -1;
             backup[i].fd = -1;
         }
+        frame->backup = backup;
+        frame->cnt = cnt;
+        frame->prev = frames;
+        frames = frame;
     }
 
     // Backup fd
     for (redir **it = node->io; *it != NULL; ++it) {
         // Fill backup table if REDIR_TEMPORARY
         if (mode == REDIR_TEMPORARY) {
-            int saved_fd = dup((*it)->fd);
+            // Kept away from children started while the redirection is active
+            int saved_fd = fcntl((*it)->fd, F_DUPFD_CLOEXEC, 10);
             if (saved_fd == -1 && errno != EBADF) {
                 perror("apply_redir: dup");
                 goto cleanup;
@@ -88,6 +104,7 @@ int apply_redir(cmd_node *node, apply_redir_mode mode) {
 
         // Close file
         if (file != (*it)->fd) close(file);
+        stats_count(STAT_REDIRS, 1);
     }
 
     return 0;
@@ -99,9 +116,11 @@ cleanup:
 }
 
 void undo_redir(void) {
-    if (!backup) return;
+    redir_frame *frame = frames;
+    if (!frame) return;
+    fd_pair *backup = frame->backup;
 
-    for (int i = cnt - 1; i >= 0; --i) {
+    for (int i = frame->cnt - 1; i >= 0; --i) {
         if (backup[i].saved_fd != -1) {
             if (dup2(backup[i].saved_fd, backup[i].fd) == -1)
                 perror("undo_redir: dup2");
@@ -110,7 +129,7 @@ void undo_redir(void) {
             close(backup[i].fd);
         }
     }
-    free(backup);
-    backup = NULL;
-    cnt = 0;
+    frames = frame->prev;
+    mem_free(backup);
+    mem_free(frame);
 }
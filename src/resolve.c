@@ -0,0 +1,90 @@
+#include "resolve.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "func.h"
+#include "vars.h"
+
+static uint64_t generation = 1;
+
+/**
+ * @brief Entry used when a flat AST's cache cannot be allocated.
+ */
+static cmd_resolution scratch;
+
+/**
+ * @brief Search PATH for an executable regular file, like execvp.
+ *
+ * @param name Command name (without '/').
+ * @param cacheable Set to 0 if the result depends on the working directory.
+ * @return Heap-allocated path, or NULL if not found.
+ */
+static char *path_search(const char *name, int *cacheable) {
+    const char *path = var_get("PATH");
+    if (!path) path = "/usr/local/bin:/usr/bin:/bin";
+
+    size_t nlen = strlen(name);
+    for (const char *dir = path; 1; ) {
+        const char *end = strchr(dir, ':');
+        size_t dlen = end ? (size_t) (end - dir) : strlen(dir);
+
+        // Empty or relative entries follow the working directory
+        if (dlen == 0 || dir[0] != '/') *cacheable = 0;
+
+        char *full = malloc(dlen + nlen + 3);
+        if (!full) {
+            perror("resolve_cmd: malloc");
+            return NULL;
+        }
+        if (dlen == 0) snprintf(full, dlen + nlen + 3, "./%s", name);
+        else snprintf(full, dlen + nlen + 3, "%.*s/%s", (int) dlen, dir, name);
+
+        struct stat st;
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0) return full;
+        free(full);
+
+        if (!end) return NULL;
+        dir = end + 1;
+    }
+}
+
+// API Functions
+
+void resolve_invalidate(void) {
+    ++generation;
+}
+
+void resolve_clear(cmd_resolution *r) {
+    free(r->name);
+    free(r->path);
+    memset(r, 0, sizeof(*r));
+}
+
+const cmd_resolution *resolve_cmd(cmd_resolution *r, const char *name) {
+    if (r->gen == generation && r->name && strcmp(r->name, name) == 0) return r;
+
+    resolve_clear(r);
+    int cacheable = 1;
+    if ((r->func = func_lookup(name))) r->kind = RESOLVE_FUNC;
+    else if ((r->builtin = builtin_lookup(name))) r->kind = RESOLVE_BUILTIN;
+    else {
+        r->kind = RESOLVE_EXTERNAL;
+        if (strchr(name, '/')) cacheable = 0;
+        else r->path = path_search(name, &cacheable);
+        if (!r->path) cacheable = 0;
+    }
+
+    // A failed copy only costs the next lookup
+    if (cacheable && (r->name = strdup(name))) r->gen = generation;
+    return r;
+}
+
+const cmd_resolution *resolve_flat_cmd(flat_ast *f, uint32_t cmd, const char *name) {
+    if (!f->resolved && f->sizes.cmds > 0) f->resolved = calloc(f->sizes.cmds, sizeof(cmd_resolution));
+    if (!f->resolved || cmd >= f->sizes.cmds) return resolve_cmd(&scratch, name);
+    return resolve_cmd(&f->resolved[cmd], name);
+}
@@ -0,0 +1,150 @@
+#include "rlimit.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const rlimit_info table[] = {
+    {'c', RLIMIT_CORE, 1024, LIMIT_OTHER, "core file size (KiB, -c)"},
+    {'d', RLIMIT_DATA, 1024, LIMIT_MEM, "data seg size (KiB, -d)"},
+    {'f', RLIMIT_FSIZE, 1024, LIMIT_FSIZE, "file size (KiB, -f)"},
+    {'n', RLIMIT_NOFILE, 1, LIMIT_OTHER, "open files (-n)"},
+    {'s', RLIMIT_STACK, 1024, LIMIT_MEM, "stack size (KiB, -s)"},
+    {'t', RLIMIT_CPU, 1, LIMIT_CPU, "cpu time (seconds, -t)"},
+    {'u', RLIMIT_NPROC, 1, LIMIT_OTHER, "max user processes (-u)"},
+    {'v', RLIMIT_AS, 1024, LIMIT_MEM, "virtual memory (KiB, -v)"},
+    {0, 0, 0, 0, NULL}
+};
+
+// API Functions
+
+const rlimit_info *rlimit_table(void) {
+    return table;
+}
+
+const rlimit_info *rlimit_find(char opt) {
+    for (const rlimit_info *it = table; it->opt; ++it)
+        if (it->opt == opt) return it;
+    return NULL;
+}
+
+int rlimit_parse_value(const char *str, rlim_t unit, rlim_t *out) {
+    if (!str || !out) return -1;
+    if (strcmp(str, "unlimited") == 0) {
+        *out = RLIM_INFINITY;
+        return 0;
+    }
+    if (!isdigit((unsigned char) str[0])) return -1;
+
+    char *endptr = NULL;
+    errno = 0;
+    unsigned long long n = strtoull(str, &endptr, 10);
+    if (errno) return -1;
+
+    rlim_t mul = unit;
+    if (*endptr != 0x00) {
+        const char *suffixes = "KMGT";
+        const char *at = strchr(suffixes, toupper((unsigned char) *endptr));
+        if (!at || endptr[1] != 0x00) return -1;
+        mul = (rlim_t) 1 << (10 * (at - suffixes + 1));
+    }
+
+    if (mul && n > (unsigned long long) (RLIM_INFINITY - 1) / mul) return -1;
+    *out = (rlim_t) n * mul;
+    return 0;
+}
+
+int rlimit_is_prefix(char **argv) {
+    return argv && argv[0] && strcmp(argv[0], "limit") == 0;
+}
+
+int rlimit_parse_prefix(char **argv, rlimit_set *set, char ***cmd) {
+    if (!rlimit_is_prefix(argv) || !set || !cmd) return -1;
+    set->n = 0;
+
+    char **it = argv + 1;
+    for (; *it != NULL && (*it)[0] == '-'; ++it) {
+        if (strcmp(*it, "--") == 0) {
+            ++it;
+            break;
+        }
+
+        const rlimit_info *info = (*it)[1] && !(*it)[2] ? rlimit_find((*it)[1]) : NULL;
+        if (!info || !it[1]) {
+            fprintf(stderr, "limit: Invalid option: %s\n", *it);
+            return -1;
+        }
+        if (set->n == RLIMIT_SET_MAX) {
+            fprintf(stderr, "limit: Too many limits!\n");
+            return -1;
+        }
+
+        // Sizes are given in bytes here (ulimit uses KiB)
+        if (rlimit_parse_value(it[1], info->unit == 1024 ? 1 : info->unit, &set->value[set->n])) {
+            fprintf(stderr, "limit: Invalid value: %s\n", it[1]);
+            return -1;
+        }
+        set->info[set->n++] = info;
+        ++it;
+    }
+
+    if (*it == NULL) {
+        fprintf(stderr, "limit: Usage: \"limit [-cdfnstuv VALUE]... command...\"\n");
+        return -1;
+    }
+    *cmd = it;
+    return 0;
+}
+
+unsigned rlimit_prefix_classes(char **argv) {
+    if (!rlimit_is_prefix(argv)) return 0;
+
+    unsigned cls = 0;
+    for (char **it = argv + 1; it[0] && it[1] && it[0][0] == '-'; it += 2) {
+        const rlimit_info *info = it[0][1] && !it[0][2] ? rlimit_find(it[0][1]) : NULL;
+        if (!info) break;
+        cls |= info->cls;
+    }
+    return cls;
+}
+
+int rlimit_apply(const rlimit_set *set) {
+    for (int i = 0; set && i < set->n; ++i) {
+        struct rlimit rl;
+        if (getrlimit(set->info[i]->resource, &rl) == -1) {
+            perror("rlimit_apply: getrlimit");
+            return -1;
+        }
+        rl.rlim_cur = set->value[i];
+        if (rl.rlim_max != RLIM_INFINITY && (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > rl.rlim_max)) {
+            fprintf(stderr, "limit: -%c: Exceeds the hard limit!\n", set->info[i]->opt);
+            return -1;
+        }
+        if (setrlimit(set->info[i]->resource, &rl) == -1) {
+            perror("rlimit_apply: setrlimit");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+const char *rlimit_reason(unsigned classes, int term_sig) {
+    switch (term_sig) {
+        case SIGXCPU:
+            return "CPU time limit";
+        case SIGXFSZ:
+            return "file size limit";
+        case SIGKILL:
+            return classes & LIMIT_CPU ? "CPU time limit" : NULL;
+        case SIGSEGV:
+        case SIGBUS:
+        case SIGABRT:
+            return classes & LIMIT_MEM ? "memory limit" : NULL;
+        default:
+            return NULL;
+    }
+}
@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+#include "serve.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "exec.h"
+#include "flat.h"
+#include "job.h"
+#include "lex.h"
+#include "mem.h"
+#include "parse.h"
+#include "stats.h"
+#include "wildcard.h"
+
+#define SERVE_CHUNK 4096 ///< Bytes relayed per output frame
+
+static volatile sig_atomic_t stop = 0;
+
+// Session state: the connection and the read ends of its stdout/stderr pipes
+static pthread_mutex_t conn_lock = PTHREAD_MUTEX_INITIALIZER;
+static pid_t session_pid = 0;
+static int conn_fd = -1;
+static int conn_broken = 0; ///< Client gone: output is drained and dropped
+static int out_fds[2] = {-1, -1};
+
+static void on_stop(int signo) {
+    (void) signo;
+    stop = 1;
+}
+
+/**
+ * @brief Write all of buf to the connection (caller holds conn_lock).
+ *
+ * @return non-zero if failed (the connection is marked broken).
+ */
+static int send_all(const void *buf, size_t n) {
+    const char *p = buf;
+    while (n > 0 && !conn_broken) {
+        ssize_t w = send(conn_fd, p, n, MSG_NOSIGNAL);
+        if (w == -1 && errno == EINTR) continue;
+        if (w == -1) conn_broken = 1;
+        else {
+            p += w;
+            n -= (size_t) w;
+        }
+    }
+    return conn_broken ? -1 : 0;
+}
+
+static int send_frame(char type, const void *payload, uint32_t len) {
+    unsigned char hdr[5] = {(unsigned char) type, len >> 24, len >> 16 & 0xff, len >> 8 & 0xff, len & 0xff};
+    if (send_all(hdr, sizeof(hdr))) return -1;
+    return send_all(payload, len);
+}
+
+/**
+ * @brief Relay what is buffered in a pipe (caller holds conn_lock).
+ *
+ * @return 0 if the pipe is empty for now, 1 at its end.
+ */
+static int relay(int idx) {
+    char buf[SERVE_CHUNK];
+    while (1) {
+        ssize_t n = read(out_fds[idx], buf, sizeof(buf));
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return n == 0;
+        send_frame(idx ? SERVE_ERR : SERVE_OUT, buf, (uint32_t) n);
+    }
+}
+
+/**
+ * @brief Relay stdout and stderr of the session (and its jobs) while it runs.
+ */
+static void *relay_worker(void *arg) {
+    (void) arg;
+    int open_fds = 2;
+    struct pollfd fds[2] = {{out_fds[0], POLLIN, 0}, {out_fds[1], POLLIN, 0}};
+    while (open_fds > 0) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        pthread_mutex_lock(&conn_lock);
+        for (int i = 0; i < 2; ++i) {
+            if (fds[i].fd == -1 || !fds[i].revents) continue;
+            if (relay(i)) {
+                fds[i].fd = -1;
+                --open_fds;
+            }
+        }
+        pthread_mutex_unlock(&conn_lock);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Send what the session wrote so far (and exit from it, registered with atexit).
+ */
+static void flush_output(void) {
+    if (getpid() != session_pid) return;
+    fflush(stdout);
+    fflush(stderr);
+    pthread_mutex_lock(&conn_lock);
+    relay(0);
+    relay(1);
+    pthread_mutex_unlock(&conn_lock);
+}
+
+/**
+ * @brief Read exactly n bytes from the connection.
+ *
+ * @return 0 if read, 1 at end of input (or on SIGTERM), -1 if failed.
+ */
+static int read_all(void *buf, size_t n) {
+    char *p = buf;
+    while (n > 0) {
+        ssize_t r = read(conn_fd, p, n);
+        if (r == -1 && errno == EINTR && !stop) continue;
+        if (r == -1 && errno == EINTR) return 1;
+        if (r == -1) {
+            perror("serve: read");
+            return -1;
+        }
+        if (r == 0) return 1;
+        p += r;
+        n -= (size_t) r;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read a command frame.
+ *
+ * @return Heap-allocated newline-terminated command, or NULL at end of the
+ *         session (end of input, SIGTERM or protocol error).
+ */
+static char *read_command(void) {
+    unsigned char hdr[5];
+    if (read_all(hdr, sizeof(hdr))) return NULL;
+    uint32_t len = (uint32_t) hdr[1] << 24 | (uint32_t) hdr[2] << 16 | (uint32_t) hdr[3] << 8 | hdr[4];
+    if (hdr[0] != SERVE_CMD || len > SERVE_MAX_CMD) {
+        fprintf(stderr, "serve: Bad frame!\n");
+        return NULL;
+    }
+
+    char *text = malloc(len + 2);
+    if (!text) {
+        perror("serve: malloc");
+        return NULL;
+    }
+    if (read_all(text, len)) {
+        free(text);
+        return NULL;
+    }
+    if (len == 0 || text[len - 1] != '\n') text[len++] = '\n';
+    text[len] = 0x00;
+    return text;
+}
+
+/**
+ * @brief Run one command like an input line of the shell.
+ *
+ * @return Exit status.
+ */
+static int run_command(lex_stream *ls, const char *text, uint32_t *lineno) {
+    // Update and cleanup job table
+    pid_t pid;
+    int wstat;
+    do {
+        pid = waitpid(-1, &wstat, WNOHANG | WUNTRACED | WCONTINUED);
+        if (pid > 0) update_proc(pid, wstat);
+    } while (pid > 0 || (pid == -1 && errno == EINTR));
+    update_jobs();
+    remove_zombies();
+    glob_cache_flush();
+
+    uint32_t first = *lineno + 1;
+    for (const char *c = text; *c; ++c) *lineno += *c == '\n';
+
+    int r = lex_feed(ls, text);
+    if (r < 0) return 2;
+    if (r > 0) {
+        lex_stream_free(ls);
+        fprintf(stderr, "serve: Incomplete command!\n");
+        return 2;
+    }
+
+    lex_token **tokens = lex_take(ls);
+    if (!tokens) return 2;
+    flat_ast *root = parse_tokens_flat(tokens);
+    mem_free_ptrv((void **) tokens, free_lex_token_adapter);
+    if (!root) return 2;
+    flat_set_lines(root, first, *lineno);
+
+    int status = 0;
+    execute_flat(root, &status);
+    free_flat_ast(root);
+    return status;
+}
+
+/**
+ * @brief Run a session on an accepted connection (in its own process).
+ */
+static _Noreturn void session(int fd) {
+    conn_fd = fd;
+    session_pid = getpid();
+    signal(SIGINT, SIG_IGN);
+    setpgid(0, 0);
+
+    // shellstats reports the activity of this session only
+    stats_init();
+    stats_reset();
+
+    // Commands write into pipes relayed to the client, and read nothing
+    int out[2], err[2];
+    if (pipe2(out, O_CLOEXEC) == -1 || pipe2(err, O_CLOEXEC) == -1) {
+        perror("serve: pipe2");
+        _exit(1);
+    }
+    int null = open("/dev/null", O_RDONLY);
+    fflush(stdout);
+    fflush(stderr);
+    if (null == -1 || dup2(null, STDIN_FILENO) == -1 || dup2(out[1], STDOUT_FILENO) == -1 ||
+        dup2(err[1], STDERR_FILENO) == -1) {
+        perror("serve: dup2");
+        _exit(1);
+    }
+    close(null);
+    close(out[1]);
+    close(err[1]);
+    out_fds[0] = out[0];
+    out_fds[1] = err[0];
+    fcntl(out_fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(out_fds[1], F_SETFL, O_NONBLOCK);
+
+    // Signals (SIGCHLD) must interrupt the shell thread, never the relay
+    pthread_t relay_thread;
+    sigset_t all, saved;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    int e = pthread_create(&relay_thread, NULL, relay_worker, NULL);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (e) {
+        fprintf(stderr, "serve: pthread_create: %s\n", strerror(e));
+        _exit(1);
+    }
+    pthread_detach(relay_thread);
+    atexit(flush_output);
+
+    uint32_t lineno = 0;
+    lex_stream ls;
+    lex_stream_init(&ls);
+    char *text;
+    while (!stop && (text = read_command())) {
+        int status = run_command(&ls, text, &lineno);
+        free(text);
+
+        // Everything the command wrote goes out before its status
+        flush_output();
+        unsigned char st[4] = {(uint32_t) status >> 24, (uint32_t) status >> 16 & 0xff,
+                               (uint32_t) status >> 8 & 0xff, (uint32_t) status & 0xff};
+        pthread_mutex_lock(&conn_lock);
+        send_frame(SERVE_STATUS, st, sizeof(st));
+        pthread_mutex_unlock(&conn_lock);
+    }
+    lex_stream_free(&ls);
+    exit(0);
+}
+
+/**
+ * @brief Reap finished sessions.
+ */
+static void reap_sessions(pid_t *pids, size_t *n) {
+    for (size_t i = 0; i < *n;) {
+        pid_t r = waitpid(pids[i], NULL, WNOHANG);
+        if (r == pids[i] || (r == -1 && errno == ECHILD)) pids[i] = pids[--*n];
+        else ++i;
+    }
+}
+
+// API Functions
+
+int serve_run(const char *path) {
+    int ret = -1, lfd = -1, bound = 0;
+    pid_t *pids = NULL;
+    size_t npids = 0, cap = 0;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "serve: Socket path too long!\n");
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    struct sigaction sa = {0};
+    sa.sa_handler = on_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+
+    lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd == -1) {
+        perror("serve: socket");
+        goto cleanup;
+    }
+
+    // Replace a socket left by a previous server, never another file
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+    if (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        perror("serve: bind");
+        goto cleanup;
+    }
+    bound = 1;
+    if (listen(lfd, SOMAXCONN) == -1) {
+        perror("serve: listen");
+        goto cleanup;
+    }
+
+    while (!stop) {
+        reap_sessions(pids, &npids);
+        int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) {
+            // SIGCHLD (a session ended) or SIGTERM
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("serve: accept4");
+            goto cleanup;
+        }
+
+        if (npids == cap) {
+            size_t ncap = cap ? cap * 2 : 16;
+            pid_t *tmp = realloc(pids, ncap * sizeof(pid_t));
+            if (!tmp) {
+                perror("serve: realloc");
+                close(fd);
+                continue;
+            }
+            pids = tmp;
+            cap = ncap;
+        }
+
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("serve: fork");
+            close(fd);
+            continue;
+        }
+        if (pid == 0) {
+            close(lfd);
+            free(pids);
+            session(fd);
+        }
+        close(fd);
+        pids[npids++] = pid;
+    }
+    ret = 0;
+
+cleanup:
+    if (lfd != -1) close(lfd);
+    if (bound) unlink(path);
+
+    // Sessions stop after their current command (their jobs are shut down at exit)
+    for (size_t i = 0; i < npids; ++i) kill(pids[i], SIGTERM);
+    for (size_t i = 0; i < npids; ++i)
+        while (waitpid(pids[i], NULL, 0) == -1 && errno == EINTR);
+    free(pids);
+    return ret;
+}
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include "stats.h"
+
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+// Log-linear buckets (HDR histogram style): values below HIST_SUB are exact,
+// every power of two above is split in HIST_SUB buckets (~6% precision)
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+/**
+ * @brief Latency histogram of one phase (nanoseconds).
+ */
+typedef struct stat_hist {
+    uint64_t count; ///< Number of samples
+    uint64_t sum; ///< Sum of the samples
+    uint64_t min; ///< Smallest sample
+    uint64_t max; ///< Largest sample
+    uint64_t buckets[HIST_BUCKETS]; ///< Samples per bucket
+} stat_hist;
+
+static const char *counter_names[STAT_NCOUNTERS] = {
+    "forks", "execs", "builtins", "pipes", "redirections", "jobs_reaped",
+};
+
+static const char *phase_names[PHASE_COUNT] = {
+    "lex", "parse", "spawn", "fg_wait", "prompt",
+};
+
+static atomic_uint_least64_t local_counters[STAT_NCOUNTERS];
+static atomic_uint_least64_t *counters = local_counters;
+static stat_hist hists[PHASE_COUNT];
+
+static int bucket_of(uint64_t v) {
+    if (v < HIST_SUB) return (int) v;
+    int e = 63 - __builtin_clzll(v);
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB + (int) ((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/**
+ * @brief Highest value that falls in a bucket.
+ */
+static uint64_t bucket_high(int idx) {
+    if (idx < HIST_SUB) return (uint64_t) idx;
+    int shift = idx / HIST_SUB - 1;
+    uint64_t low = (uint64_t) (HIST_SUB + idx % HIST_SUB) << shift;
+    return low + ((uint64_t) 1 << shift) - 1;
+}
+
+/**
+ * @brief Value at a percentile (0-100), clamped to the observed range.
+ */
+static uint64_t percentile(const stat_hist *h, double pct) {
+    if (h->count == 0) return 0;
+    uint64_t rank = (uint64_t) (pct / 100.0 * (double) h->count + 0.5);
+    if (rank < 1) rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+        seen += h->buckets[i];
+        if (seen < rank) continue;
+        uint64_t v = bucket_high(i);
+        if (v < h->min) v = h->min;
+        if (v > h->max) v = h->max;
+        return v;
+    }
+    return h->max;
+}
+
+// API Functions
+
+int stats_init(void) {
+    atomic_uint_least64_t *shared = mmap(NULL, sizeof(local_counters), PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("stats_init: mmap");
+        return -1;
+    }
+    for (int i = 0; i < STAT_NCOUNTERS; ++i) atomic_init(shared + i, atomic_load(counters + i));
+    if (counters != local_counters) munmap(counters, sizeof(local_counters));
+    counters = shared;
+    return 0;
+}
+
+void stats_count(stat_counter c, uint64_t n) {
+    atomic_fetch_add_explicit(counters + c, n, memory_order_relaxed);
+}
+
+uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+void stats_record(stat_phase p, uint64_t start) {
+    uint64_t v = stats_now() - start;
+    stat_hist *h = hists + p;
+    if (h->count == 0 || v < h->min) h->min = v;
+    if (v > h->max) h->max = v;
+    ++h->count;
+    h->sum += v;
+    ++h->buckets[bucket_of(v)];
+}
+
+void stats_reset(void) {
+    for (int i = 0; i < STAT_NCOUNTERS; ++i) atomic_store(counters + i, 0);
+    memset(hists, 0, sizeof(hists));
+}
+
+void stats_print(FILE *out, int json) {
+    static const double pcts[] = {50.0, 90.0, 99.0};
+
+    if (json) {
+        fprintf(out, "{\"counters\":{");
+        for (int i = 0; i < STAT_NCOUNTERS; ++i)
+            fprintf(out, "%s\"%s\":%llu", i ? "," : "", counter_names[i],
+                    (unsigned long long) atomic_load(counters + i));
+        fprintf(out, "},\"latency_us\":{");
+        for (int p = 0; p < PHASE_COUNT; ++p) {
+            const stat_hist *h = hists + p;
+            fprintf(out, "%s\"%s\":{\"count\":%llu,\"min\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,"
+                    "\"max\":%.3f,\"mean\":%.3f}", p ? "," : "", phase_names[p], (unsigned long long) h->count,
+                    (double) h->min / 1e3, (double) percentile(h, pcts[0]) / 1e3,
+                    (double) percentile(h, pcts[1]) / 1e3, (double) percentile(h, pcts[2]) / 1e3,
+                    (double) h->max / 1e3, h->count ? (double) h->sum / (double) h->count / 1e3 : 0.0);
+        }
+        fprintf(out, "}}\n");
+        return;
+    }
+
+    for (int i = 0; i < STAT_NCOUNTERS; ++i)
+        fprintf(out, "%-12s %llu\n", counter_names[i], (unsigned long long) atomic_load(counters + i));
+    fprintf(out, "\n%-12s %8s %10s %10s %10s %10s %10s %10s\n", "latency(us)", "count", "min", "p50", "p90",
+            "p99", "max", "mean");
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        const stat_hist *h = hists + p;
+        fprintf(out, "%-12s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", phase_names[p],
+                (unsigned long long) h->count, (double) h->min / 1e3, (double) percentile(h, pcts[0]) / 1e3,
+                (double) percentile(h, pcts[1]) / 1e3, (double) percentile(h, pcts[2]) / 1e3,
+                (double) h->max / 1e3, h->count ? (double) h->sum / (double) h->count / 1e3 : 0.0);
+    }
+}
@@ -0,0 +1,255 @@
+#define _GNU_SOURCE
+#include "subst.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "builtin.h"
+#include "exec.h"
+#include "func.h"
+#include "job.h"
+#include "parse.h"
+#include "prof.h"
+#include "stats.h"
+#include "utils.h"
+#include "vars.h"
+
+#define SUBST_PIPE_SIZE (1 << 20)
+#define SUBST_READ_SIZE (64 * 1024)
+
+static unsigned long runs = 0;
+
+/**
+ * @brief Captured output buffer.
+ */
+typedef struct subst_buf {
+    char *data; ///< Heap-allocated output.
+    size_t len; ///< Bytes in use.
+    size_t cap; ///< Allocated capacity of data.
+} subst_buf;
+
+// Pure Builtin Detection
+
+/**
+ * @brief Check whether a command word is statically a pure builtin name
+ * (no expansion could change it).
+ */
+static int is_pure_word(const char *word) {
+    if (!word) return 0;
+    for (const char *c = word; *c; ++c)
+        if (strchr("$*?[\001\002", *c)) return 0;
+    return is_pure_builtin(word) && !func_lookup(word);
+}
+
+/**
+ * @brief Check whether a tree only runs pure builtins.
+ *
+ * @return 1 if it can run inside the shell, 0 otherwise.
+ */
+static int is_pure_ast(const ast_node *node) {
+    if (!node) return 0;
+    switch (node->type) {
+        case NODE_CMD:
+            return node->as.cmd.argv && is_pure_word(node->as.cmd.argv[0]);
+        case NODE_SEQ:
+            for (ast_node **it = node->as.list.children; it && *it != NULL; ++it)
+                if (!is_pure_ast(*it)) return 0;
+            return 1;
+        case NODE_AND:
+        case NODE_OR:
+            return is_pure_ast(node->as.binary.left) && is_pure_ast(node->as.binary.right);
+        default:
+            return 0;
+    }
+}
+
+// Capture
+
+/**
+ * @brief Run pure builtins inside the shell with stdout redirected to a memfd.
+ *
+ * @return non-zero if failed.
+ */
+static int capture_inline(ast_node *root, subst_buf *out, int *status) {
+    int ret = -1;
+    int saved = -1;
+
+    fflush(stdout);
+    int mfd = memfd_create("subst", MFD_CLOEXEC);
+    if (mfd == -1) {
+        perror("command_subst: memfd_create");
+        return -1;
+    }
+    saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (saved == -1) {
+        perror("command_subst: fcntl");
+        goto cleanup;
+    }
+    if (dup2(mfd, STDOUT_FILENO) == -1) {
+        perror("command_subst: dup2");
+        goto cleanup;
+    }
+
+    execute_ast(root, status, 0);
+    fflush(stdout);
+
+    if (dup2(saved, STDOUT_FILENO) == -1) {
+        perror("command_subst: dup2");
+        goto cleanup;
+    }
+
+    struct stat st;
+    if (fstat(mfd, &st) == -1) {
+        perror("command_subst: fstat");
+        goto cleanup;
+    }
+    out->cap = (size_t) st.st_size + 1;
+    out->data = malloc(out->cap);
+    if (!out->data) {
+        perror("command_subst: malloc");
+        goto cleanup;
+    }
+    while (out->len < (size_t) st.st_size) {
+        ssize_t n = pread(mfd, out->data + out->len, (size_t) st.st_size - out->len, (off_t) out->len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == -1) perror("command_subst: pread");
+            goto cleanup;
+        }
+        out->len += (size_t) n;
+    }
+    ret = 0;
+
+cleanup:
+    if (saved != -1) close(saved);
+    close(mfd);
+    return ret;
+}
+
+/**
+ * @brief Run the tree in a forked subshell and read its output over a pipe.
+ *
+ * @return non-zero if failed.
+ */
+static int capture_fork(ast_node *root, subst_buf *out, int *status) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("command_subst: pipe2");
+        return -1;
+    }
+    stats_count(STAT_PIPES, 1);
+    // Fewer wakeups for large outputs (best effort, capped by pipe-max-size)
+    fcntl(fds[0], F_SETPIPE_SZ, SUBST_PIPE_SIZE);
+
+    fflush(stdout);
+    uint64_t fork_ts = stats_now();
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("command_subst: fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        // Subshell: jobs belong to the parent shell
+        set_subshell();
+        forget_jobs();
+        close(fds[0]);
+        if (dup2(fds[1], STDOUT_FILENO) == -1) {
+            perror("command_subst: dup2");
+            _exit(127);
+        }
+        close(fds[1]);
+        int st = 0;
+        execute_ast(root, &st, 0);
+        fflush(stdout);
+        _exit(st & 0xff);
+    }
+
+    stats_record(PHASE_SPAWN, fork_ts);
+    stats_count(STAT_FORKS, 1);
+    uint64_t wait_ts = stats_now();
+    close(fds[1]);
+    int ret = 0;
+    while (1) {
+        if (out->cap - out->len < SUBST_READ_SIZE) {
+            size_t cap = out->cap ? out->cap << 1 : SUBST_READ_SIZE << 1;
+            char *temp = realloc(out->data, cap);
+            if (!temp) {
+                perror("command_subst: realloc");
+                ret = -1;
+                break;
+            }
+            out->data = temp;
+            out->cap = cap;
+        }
+        ssize_t n = read(fds[0], out->data + out->len, out->cap - out->len - 1);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) {
+            perror("command_subst: read");
+            ret = -1;
+            break;
+        }
+        if (n == 0) break;
+        out->len += (size_t) n;
+    }
+    close(fds[0]);
+
+    int wstatus = 0;
+    while (waitpid(pid, &wstatus, 0) == -1) {
+        if (errno == EINTR) continue;
+        perror("command_subst: waitpid");
+        return -1;
+    }
+    prof_wait(wait_ts);
+    if (WIFEXITED(wstatus)) *status = WEXITSTATUS(wstatus);
+    else if (WIFSIGNALED(wstatus)) *status = 128 + WTERMSIG(wstatus);
+    return ret;
+}
+
+// API Functions
+
+char *command_subst(const char *src) {
+    subst_buf out = { .data = NULL, .len = 0, .cap = 0 };
+    int status = 0;
+    ++runs;
+
+    ast_node *root = parse_line(src);
+    if (!root) {
+        set_last_status(1);
+        return strdup("");
+    }
+
+    int ret = is_pure_ast(root) ? capture_inline(root, &out, &status) : capture_fork(root, &out, &status);
+    free_ast_node(root);
+    if (ret) {
+        free(out.data);
+        return NULL;
+    }
+
+    // Trailing newlines are removed
+    while (out.len > 0 && out.data[out.len - 1] == '\n') --out.len;
+    if (!out.data) {
+        out.data = malloc(1);
+        if (!out.data) {
+            perror("command_subst: malloc");
+            return NULL;
+        }
+    }
+    out.data[out.len] = 0x00;
+
+    set_last_status(status);
+    return out.data;
+}
+
+unsigned long subst_runs(void) {
+    return runs;
+}
@@ -0,0 +1,198 @@
+#define _GNU_SOURCE
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_DEFAULT_EVENTS (1 << 16)
+
+/**
+ * @brief One recorded event.
+ */
+typedef struct trace_event {
+    uint64_t ts; ///< Start timestamp (ns)
+    uint64_t dur; ///< Duration (ns), for spans
+    const char *name; ///< Static event name
+    const char *detail; ///< Static detail text, or NULL
+    long value; ///< Numeric argument
+    pid_t pid; ///< Process the event is about (0: the shell)
+    char ph; ///< Chrome trace phase ('X' span, 'i' instant)
+} trace_event;
+
+static int enabled = 0;
+static char *out_path = NULL;
+static trace_event *ring = NULL;
+static size_t ring_cap = 0;
+static size_t ring_next = 0; ///< Total number of events recorded
+static uint64_t origin = 0; ///< Timestamp of trace_init
+static pid_t shell_pid = 0;
+static int child_fd = -1; ///< Write end of the spawn pipe in a child
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static void record(char ph, const char *name, uint64_t ts, uint64_t dur, pid_t pid, const char *detail, long value) {
+    trace_event *e = ring + (ring_next++ % ring_cap);
+    e->ts = ts;
+    e->dur = dur;
+    e->name = name;
+    e->detail = detail;
+    e->value = value;
+    e->pid = pid ? pid : shell_pid;
+    e->ph = ph;
+}
+
+/**
+ * @brief Write the buffered events as Chrome trace JSON (registered with atexit).
+ */
+static void trace_flush(void) {
+    if (!enabled || getpid() != shell_pid) return;
+    enabled = 0;
+
+    FILE *f = fopen(out_path, "w");
+    if (!f) {
+        perror("trace_flush: fopen");
+        goto cleanup;
+    }
+
+    size_t n = ring_next < ring_cap ? ring_next : ring_cap;
+    size_t first = ring_next - n;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"mini-shell\"}}",
+            (int) shell_pid);
+    for (size_t i = first; i < ring_next; ++i) {
+        const trace_event *e = ring + (i % ring_cap);
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,", e->name, e->ph,
+                (double) (e->ts - origin) / 1e3);
+        if (e->ph == 'X') fprintf(f, "\"dur\":%.3f,", (double) e->dur / 1e3);
+        else fprintf(f, "\"s\":\"t\",");
+        fprintf(f, "\"pid\":%d,\"tid\":%d,\"args\":{\"value\":%ld", (int) shell_pid, (int) e->pid, e->value);
+        if (e->detail) fprintf(f, ",\"detail\":\"%s\"", e->detail);
+        fprintf(f, "}}");
+    }
+    fprintf(f, "\n]}\n");
+    if (ring_next > ring_cap)
+        fprintf(stderr, "trace: %zu oldest events were overwritten\n", ring_next - ring_cap);
+    if (fclose(f) == EOF) perror("trace_flush: fclose");
+
+cleanup:
+    free(ring);
+    free(out_path);
+    ring = NULL;
+    out_path = NULL;
+}
+
+// API Functions
+
+int trace_on(void) {
+    return enabled;
+}
+
+int trace_init(void) {
+    const char *path = getenv("MINISHELL_TRACE");
+    if (!path || !*path) return 0;
+
+    ring_cap = TRACE_DEFAULT_EVENTS;
+    const char *events = getenv("MINISHELL_TRACE_EVENTS");
+    if (events) {
+        char *endptr = NULL;
+        long long n = strtoll(events, &endptr, 10);
+        if (*endptr == 0x00 && n > 0) ring_cap = (size_t) n;
+    }
+
+    ring = malloc(ring_cap * sizeof(trace_event));
+    out_path = strdup(path);
+    if (!ring || !out_path) {
+        perror("trace_init: malloc");
+        free(ring);
+        free(out_path);
+        ring = NULL;
+        out_path = NULL;
+        return -1;
+    }
+
+    origin = now_ns();
+    shell_pid = getpid();
+    enabled = 1;
+    atexit(trace_flush);
+    return 0;
+}
+
+uint64_t trace_now(void) {
+    return enabled ? now_ns() : 0;
+}
+
+void trace_span(const char *name, uint64_t start, pid_t pid, const char *detail, long value) {
+    if (!enabled || !start) return;
+    uint64_t end = now_ns();
+    record('X', name, start, end - start, pid, detail, value);
+}
+
+void trace_instant(const char *name, pid_t pid, const char *detail, long value) {
+    if (!enabled) return;
+    record('i', name, now_ns(), 0, pid, detail, value);
+}
+
+void trace_spawn_pipe(int fds[2]) {
+    fds[0] = fds[1] = -1;
+    if (enabled && pipe2(fds, O_CLOEXEC) == -1) {
+        perror("trace_spawn_pipe: pipe2");
+        fds[0] = fds[1] = -1;
+    }
+}
+
+void trace_spawn_child(int fds[2]) {
+    if (fds[0] != -1) close(fds[0]);
+    child_fd = fds[1];
+}
+
+void trace_spawn_ready(void) {
+    if (child_fd == -1) return;
+    close(child_fd);
+    child_fd = -1;
+}
+
+void trace_spawn_wait(int *fds, const pid_t *pids, const uint64_t *starts, int n) {
+    if (!enabled) return;
+
+    int left = 0;
+    struct pollfd *pfds = calloc((size_t) n, sizeof(struct pollfd));
+    if (!pfds) {
+        perror("trace_spawn_wait: calloc");
+        for (int i = 0; i < n; ++i) if (fds[i] != -1) close(fds[i]);
+        return;
+    }
+    for (int i = 0; i < n; ++i) {
+        pfds[i].fd = fds[i];
+        pfds[i].events = POLLIN;
+        if (fds[i] != -1) ++left;
+    }
+
+    // Each read end hangs up when its child execs (or exits)
+    while (left > 0) {
+        if (poll(pfds, (nfds_t) n, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("trace_spawn_wait: poll");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (pfds[i].fd == -1 || !pfds[i].revents) continue;
+            trace_span("spawn", starts[i], pids[i], NULL, i);
+            close(pfds[i].fd);
+            pfds[i].fd = -1;
+            --left;
+        }
+    }
+
+    for (int i = 0; i < n; ++i) if (pfds[i].fd != -1) close(pfds[i].fd);
+    free(pfds);
+}
@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+static int subshell = 0;
+
 void free_ptrv(void **arr, void (*destroy)(void *)) {
     if (arr) {
         for (void **i = arr; *i != NULL; ++i)
@@ -22,4 +24,24 @@ void reset_signals(void) {
     signal(SIGTTOU, SIG_DFL);
     signal(SIGTTIN, SIG_DFL);
     signal(SIGCHLD, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+}
+
+void set_subshell(void) {
+    subshell = 1;
+}
+
+int is_subshell(void) {
+    return subshell;
+}
+
+_Noreturn void shell_exit(int code) {
+    // Forked subshells share stdin's offset and the job table with the shell:
+    // skip atexit handlers and stdio cleanup that would disturb them.
+    if (subshell) {
+        fflush(stdout);
+        fflush(stderr);
+        _exit(code);
+    }
+    exit(code);
 }
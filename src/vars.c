@@ -0,0 +1,338 @@
+#include "vars.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "resolve.h"
+
+#define VARS_INITIAL_BUCKETS 64
+
+/**
+ * @brief Variable table entry.
+ *
+ * The name and value share one "NAME=VALUE" allocation so the environment
+ * vector can point at entries directly without copying strings.
+ */
+typedef struct shell_var shell_var;
+
+typedef struct shell_var {
+    char *entry; ///< Heap-allocated "NAME=VALUE" string.
+    size_t nlen; ///< Length of the name part.
+    uint32_t hash; ///< Hash of the name.
+    int flags; ///< var_flags
+    shell_var *next; ///< Next entry in the same bucket.
+} shell_var;
+
+/**
+ * @brief Hashed variable table with a cached environment vector.
+ */
+typedef struct var_table {
+    shell_var **buckets; ///< Heap-allocated bucket array.
+    size_t nbuckets; ///< Bucket count (power of two).
+    size_t len; ///< Number of variables.
+    size_t nexport; ///< Number of exported variables.
+    char **envp; ///< Cached NULL-terminated environment vector.
+    int env_dirty; ///< Nonzero when envp has to be rebuilt.
+} var_table;
+
+static var_table table = {
+    .buckets = NULL,
+    .nbuckets = 0,
+    .len = 0,
+    .nexport = 0,
+    .envp = NULL,
+    .env_dirty = 1
+};
+
+static int last_status = 0;
+
+static char *no_params[] = { NULL };
+static char **positional = no_params; ///< NULL-terminated $1, $2, ... (not owned).
+
+// Hashing
+
+/**
+ * @brief FNV-1a hash of the first n characters of s.
+ */
+static uint32_t hash_name(const char *s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (unsigned char) s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Grow the bucket array when the load factor exceeds 3/4.
+ *
+ * @return non-zero if failed.
+ */
+static int table_reserve(void) {
+    if (table.nbuckets && table.len + 1 <= table.nbuckets / 4 * 3) return 0;
+
+    size_t n = table.nbuckets ? table.nbuckets << 1 : VARS_INITIAL_BUCKETS;
+    shell_var **buckets = calloc(n, sizeof(shell_var *));
+    if (!buckets) {
+        perror("table_reserve: calloc");
+        return -1;
+    }
+
+    for (size_t i = 0; i < table.nbuckets; ++i) {
+        shell_var *it = table.buckets[i];
+        while (it) {
+            shell_var *next = it->next;
+            it->next = buckets[it->hash & (n - 1)];
+            buckets[it->hash & (n - 1)] = it;
+            it = next;
+        }
+    }
+    free(table.buckets);
+    table.buckets = buckets;
+    table.nbuckets = n;
+    return 0;
+}
+
+/**
+ * @brief Find the entry for the first n characters of name.
+ *
+ * @param prev Optional output: slot pointing at the entry (for unlinking).
+ * @return entry, or NULL if not found.
+ */
+static shell_var *lookup(const char *name, size_t n, shell_var ***prev) {
+    if (!table.nbuckets) return NULL;
+    uint32_t h = hash_name(name, n);
+    shell_var **slot = &table.buckets[h & (table.nbuckets - 1)];
+    for (; *slot; slot = &(*slot)->next) {
+        shell_var *it = *slot;
+        if (it->hash == h && it->nlen == n && memcmp(it->entry, name, n) == 0) {
+            if (prev) *prev = slot;
+            return it;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Build a "NAME=VALUE" string.
+ */
+static char *make_entry(const char *name, size_t nlen, const char *value) {
+    size_t vlen = strlen(value);
+    char *entry = malloc(nlen + vlen + 2);
+    if (!entry) {
+        perror("make_entry: malloc");
+        return NULL;
+    }
+    memcpy(entry, name, nlen);
+    entry[nlen] = '=';
+    memcpy(entry + nlen + 1, value, vlen + 1);
+    return entry;
+}
+
+/**
+ * @brief Set the variable named by the first nlen characters of name.
+ *
+ * @return non-zero if failed.
+ */
+static int set_n(const char *name, size_t nlen, const char *value, int flags) {
+    shell_var *v = lookup(name, nlen, NULL);
+    char *entry = make_entry(name, nlen, value);
+    if (!entry) return -1;
+
+    // Cached command paths follow PATH
+    if (nlen == 4 && strncmp(name, "PATH", 4) == 0) resolve_invalidate();
+
+    if (v) {
+        free(v->entry);
+        v->entry = entry;
+        if ((flags & VAR_EXPORT) && !(v->flags & VAR_EXPORT)) ++table.nexport;
+        v->flags |= flags;
+        if (v->flags & VAR_EXPORT) table.env_dirty = 1;
+        return 0;
+    }
+
+    if (table_reserve()) {
+        free(entry);
+        return -1;
+    }
+    v = malloc(sizeof(shell_var));
+    if (!v) {
+        perror("set_n: malloc");
+        free(entry);
+        return -1;
+    }
+    v->entry = entry;
+    v->nlen = nlen;
+    v->hash = hash_name(name, nlen);
+    v->flags = flags;
+    v->next = table.buckets[v->hash & (table.nbuckets - 1)];
+    table.buckets[v->hash & (table.nbuckets - 1)] = v;
+    ++table.len;
+    if (flags & VAR_EXPORT) {
+        ++table.nexport;
+        table.env_dirty = 1;
+    }
+    return 0;
+}
+
+// API Functions
+
+int vars_init(char **envp) {
+    if (!envp) return 0;
+    for (char **it = envp; *it != NULL; ++it) {
+        char *eq = strchr(*it, '=');
+        if (!eq || !var_valid_name(*it, (size_t) (eq - *it))) continue;
+        if (set_n(*it, (size_t) (eq - *it), eq + 1, VAR_EXPORT)) return -1;
+    }
+    return 0;
+}
+
+void vars_cleanup(void) {
+    for (size_t i = 0; i < table.nbuckets; ++i) {
+        shell_var *it = table.buckets[i];
+        while (it) {
+            shell_var *next = it->next;
+            free(it->entry);
+            free(it);
+            it = next;
+        }
+    }
+    free(table.buckets);
+    free(table.envp);
+    table.buckets = NULL;
+    table.nbuckets = 0;
+    table.len = 0;
+    table.nexport = 0;
+    table.envp = NULL;
+    table.env_dirty = 1;
+}
+
+const char *var_get(const char *name) {
+    shell_var *v = lookup(name, strlen(name), NULL);
+    return v ? v->entry + v->nlen + 1 : NULL;
+}
+
+int var_set(const char *name, const char *value, int flags) {
+    return set_n(name, strlen(name), value, flags);
+}
+
+int var_export(const char *name) {
+    shell_var *v = lookup(name, strlen(name), NULL);
+    if (!v) return var_set(name, "", VAR_EXPORT);
+    if (!(v->flags & VAR_EXPORT)) {
+        v->flags |= VAR_EXPORT;
+        ++table.nexport;
+        table.env_dirty = 1;
+    }
+    return 0;
+}
+
+void var_unset(const char *name) {
+    shell_var **slot = NULL;
+    shell_var *v = lookup(name, strlen(name), &slot);
+    if (!v) return;
+    if (strcmp(name, "PATH") == 0) resolve_invalidate();
+    *slot = v->next;
+    if (v->flags & VAR_EXPORT) {
+        --table.nexport;
+        table.env_dirty = 1;
+    }
+    --table.len;
+    free(v->entry);
+    free(v);
+}
+
+int var_flags_of(const char *name) {
+    shell_var *v = lookup(name, strlen(name), NULL);
+    return v ? v->flags : -1;
+}
+
+int var_assign(const char *assign, int flags) {
+    const char *eq = strchr(assign, '=');
+    if (!eq || !var_valid_name(assign, (size_t) (eq - assign))) {
+        fprintf(stderr, "var_assign: Invalid assignment!\n");
+        return -1;
+    }
+    return set_n(assign, (size_t) (eq - assign), eq + 1, flags);
+}
+
+int var_valid_name(const char *s, size_t n) {
+    if (n == 0) return 0;
+    if (!(s[0] == '_' || (s[0] >= 'a' && s[0] <= 'z') || (s[0] >= 'A' && s[0] <= 'Z')))
+        return 0;
+    for (size_t i = 1; i < n; ++i) {
+        char c = s[i];
+        if (!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+            return 0;
+    }
+    return 1;
+}
+
+char **var_envp(void) {
+    if (!table.env_dirty && table.envp) return table.envp;
+
+    char **envp = realloc(table.envp, (table.nexport + 1) * sizeof(char *));
+    if (!envp) {
+        perror("var_envp: realloc");
+        return NULL;
+    }
+    table.envp = envp;
+
+    size_t i = 0;
+    for (size_t b = 0; b < table.nbuckets; ++b)
+        for (shell_var *it = table.buckets[b]; it; it = it->next)
+            if (it->flags & VAR_EXPORT) envp[i++] = it->entry;
+    envp[i] = NULL;
+
+    table.env_dirty = 0;
+    return envp;
+}
+
+static int cmp_entry(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+void print_exports(void) {
+    char **envp = var_envp();
+    if (!envp) return;
+
+    // Sort a copy so the cached vector keeps its layout.
+    char **sorted = malloc((table.nexport + 1) * sizeof(char *));
+    if (!sorted) {
+        perror("print_exports: malloc");
+        return;
+    }
+    memcpy(sorted, envp, (table.nexport + 1) * sizeof(char *));
+    qsort(sorted, table.nexport, sizeof(char *), cmp_entry);
+    for (char **it = sorted; *it != NULL; ++it)
+        printf("export %s\n", *it);
+    free(sorted);
+}
+
+void set_last_status(int status) {
+    last_status = status;
+}
+
+int get_last_status(void) {
+    return last_status;
+}
+
+char **var_positional(void) {
+    return positional;
+}
+
+char **var_swap_positional(char **params) {
+    char **old = positional;
+    positional = params ? params : no_params;
+    return old;
+}
+
+int var_shift(size_t n) {
+    size_t len = 0;
+    while (positional[len]) ++len;
+    if (n > len) return -1;
+    positional += n;
+    return 0;
+}
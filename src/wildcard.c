@@ -0,0 +1,1043 @@
+#define _GNU_SOURCE
+#include "wildcard.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lex.h"
+#include "utils.h"
+
+#define GETDENTS_BUF_SIZE (64 * 1024)
+#define DIR_CACHE_BUCKETS 64
+#define PATTERN_CACHE_SIZE 64
+
+// Globstar walker pool size bounds (the walk is I/O latency bound, so the
+// pool may be larger than the CPU count).
+#define WALK_MIN_THREADS 2
+#define WALK_MAX_THREADS 8
+
+// Queued walk items beyond this count carry a path instead of an open fd.
+#define WALK_MAX_OPEN_ITEMS 256
+
+// A listing read less than this long after the directory's mtime may have
+// missed an update made within the same timestamp tick; such entries are
+// re-read instead of trusted.
+#define RACY_NSEC (20L * 1000 * 1000)
+
+/**
+ * @brief Kernel directory entry returned by getdents64.
+ */
+struct linux_dirent64 {
+    uint64_t d_ino; ///< inode number
+    int64_t d_off; ///< offset to the next entry
+    unsigned short d_reclen; ///< length of this record
+    unsigned char d_type; ///< file type (DT_*)
+    char d_name[]; ///< NUL-terminated file name
+};
+
+/**
+ * @brief Cached listing of one directory.
+ */
+typedef struct dir_listing dir_listing;
+
+typedef struct dir_listing {
+    char *path; ///< Heap-allocated directory path (cache key).
+    dev_t dev; ///< Device of the directory when read.
+    ino_t ino; ///< Inode of the directory when read.
+    struct timespec mtime; ///< Directory mtime when read.
+    struct timespec read_at; ///< Wall-clock time of the read.
+    char *pool; ///< Heap-allocated name pool (NUL-separated names).
+    size_t pool_len; ///< Bytes used in pool.
+    size_t pool_cap; ///< Allocated capacity of pool.
+    size_t *offs; ///< Heap-allocated offsets of each name in pool.
+    unsigned char *types; ///< Heap-allocated d_type of each entry.
+    size_t n; ///< Number of entries.
+    size_t cap; ///< Allocated capacity of offs / types.
+    dir_listing *next; ///< Next listing in the same bucket.
+} dir_listing;
+
+/**
+ * @brief One compiled path component.
+ */
+typedef struct wc_comp {
+    char *lit; ///< Heap-allocated literal text, or NULL if the component has wildcards.
+    wc_pattern pat; ///< Compiled pattern (valid when lit == NULL).
+    int globstar; ///< Nonzero for an unquoted "**" component.
+} wc_comp;
+
+/**
+ * @brief Compiled pathname pattern.
+ */
+typedef struct wc_path {
+    char *key; ///< Heap-allocated source field (cache key).
+    int absolute; ///< Nonzero if the pattern starts with '/'.
+    int dironly; ///< Nonzero if the pattern ends with '/'.
+    wc_comp *comps; ///< Heap-allocated component list.
+    size_t n; ///< Number of components.
+} wc_path;
+
+/**
+ * @brief Growable list of matched paths.
+ */
+typedef struct match_list {
+    char **data; ///< Heap-allocated, NULL-terminated list.
+    size_t len; ///< Number of matches.
+    size_t cap; ///< Allocated capacity of data.
+} match_list;
+
+static dir_listing *dir_cache[DIR_CACHE_BUCKETS];
+static wc_path *pattern_cache[PATTERN_CACHE_SIZE];
+
+// Pattern Compilation and Matching
+
+static void set_bit(unsigned char *set, unsigned char c) {
+    set[c >> 3] |= (unsigned char) (1u << (c & 7));
+}
+
+static int has_bit(const unsigned char *set, unsigned char c) {
+    return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+/**
+ * @brief Parse a bracket expression starting at s[i] == '['.
+ *
+ * @param s pattern text
+ * @param len pattern length
+ * @param i index of '['
+ * @param op output operation
+ * @return index just past the closing ']', or 0 if the bracket is not closed.
+ */
+static size_t parse_class(const char *s, size_t len, size_t i, wc_op *op) {
+    size_t j = i + 1;
+    int neg = 0;
+    if (j < len && (s[j] == '!' || s[j] == '^')) {
+        neg = 1;
+        ++j;
+    }
+
+    memset(op->set, 0, sizeof(op->set));
+    int first = 1;
+    while (j < len) {
+        unsigned char lo = (unsigned char) s[j];
+        if (s[j] == LEX_CTLESC && j + 1 < len) {
+            lo = (unsigned char) s[++j];
+        } else if (s[j] == ']' && !first) {
+            break;
+        }
+        ++j;
+        first = 0;
+
+        // Range "a-z" (a trailing '-' is literal)
+        unsigned char hi = lo;
+        if (j + 1 < len && s[j] == '-' && s[j + 1] != ']') {
+            ++j;
+            if (s[j] == LEX_CTLESC && j + 1 < len) ++j;
+            hi = (unsigned char) s[j++];
+        }
+        for (unsigned c = lo; c <= hi; ++c) set_bit(op->set, (unsigned char) c);
+    }
+    if (j >= len) return 0;
+
+    if (neg)
+        for (size_t k = 0; k < sizeof(op->set); ++k) op->set[k] = (unsigned char) ~op->set[k];
+    op->type = WC_CLASS;
+    return j + 1;
+}
+
+int wc_compile(const char *s, size_t len, wc_pattern *out) {
+    out->ops = NULL;
+    out->nops = 0;
+    out->wild = 0;
+    if (len == 0) return 0;
+
+    out->ops = calloc(len, sizeof(wc_op));
+    if (!out->ops) {
+        perror("wc_compile: calloc");
+        return -1;
+    }
+
+    for (size_t i = 0; i < len;) {
+        wc_op *op = &out->ops[out->nops];
+        if (s[i] == LEX_CTLESC && i + 1 < len) {
+            op->type = WC_LIT;
+            op->c = s[i + 1];
+            i += 2;
+        } else if (s[i] == '*') {
+            // Consecutive stars are the same as one
+            if (out->nops == 0 || out->ops[out->nops - 1].type != WC_STAR) {
+                op->type = WC_STAR;
+            } else {
+                ++i;
+                continue;
+            }
+            out->wild = 1;
+            ++i;
+        } else if (s[i] == '?') {
+            op->type = WC_ANY;
+            out->wild = 1;
+            ++i;
+        } else if (s[i] == '[') {
+            size_t next = parse_class(s, len, i, op);
+            if (next) {
+                out->wild = 1;
+                i = next;
+            } else {
+                op->type = WC_LIT;
+                op->c = '[';
+                ++i;
+            }
+        } else {
+            op->type = WC_LIT;
+            op->c = s[i];
+            ++i;
+        }
+        ++out->nops;
+    }
+    return 0;
+}
+
+void wc_free(wc_pattern *pat) {
+    if (!pat) return;
+    free(pat->ops);
+    pat->ops = NULL;
+    pat->nops = 0;
+}
+
+static int op_match(const wc_op *op, char c) {
+    switch (op->type) {
+        case WC_LIT:
+            return op->c == c;
+        case WC_ANY:
+            return 1;
+        case WC_CLASS:
+            return has_bit(op->set, (unsigned char) c);
+        default:
+            return 0;
+    }
+}
+
+int wc_match(const wc_pattern *pat, const char *s) {
+    size_t pi = 0;
+    size_t star = (size_t) -1;
+    const char *retry = NULL;
+
+    // Greedy matching, backtracking to the last '*' on mismatch
+    while (*s) {
+        if (pi < pat->nops && pat->ops[pi].type == WC_STAR) {
+            star = pi++;
+            retry = s;
+            continue;
+        }
+        if (pi < pat->nops && op_match(&pat->ops[pi], *s)) {
+            ++pi;
+            ++s;
+            continue;
+        }
+        if (star == (size_t) -1) return 0;
+        pi = star + 1;
+        s = ++retry;
+    }
+    while (pi < pat->nops && pat->ops[pi].type == WC_STAR) ++pi;
+    return pi == pat->nops;
+}
+
+int has_wildcards(const char *field) {
+    for (const char *c = field; *c; ++c) {
+        if (*c == LEX_CTLESC) {
+            if (c[1] == 0x00) break;
+            ++c;
+            continue;
+        }
+        if (*c == '*' || *c == '?') return 1;
+        if (*c == '[' && strchr(c + 1, ']')) return 1;
+    }
+    return 0;
+}
+
+// Path Patterns
+
+static void free_path(wc_path *p) {
+    if (!p) return;
+    for (size_t i = 0; i < p->n; ++i) {
+        free(p->comps[i].lit);
+        wc_free(&p->comps[i].pat);
+    }
+    free(p->comps);
+    free(p->key);
+    free(p);
+}
+
+/**
+ * @brief Copy a component without its LEX_CTLESC escapes.
+ */
+static char *unescape_n(const char *s, size_t len) {
+    char *out = malloc(len + 1);
+    if (!out) {
+        perror("unescape_n: malloc");
+        return NULL;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < len; ++i) {
+        if (s[i] == LEX_CTLESC && i + 1 < len) ++i;
+        out[n++] = s[i];
+    }
+    out[n] = 0x00;
+    return out;
+}
+
+/**
+ * @brief Split a field on '/' and compile each component.
+ *
+ * @return Heap-allocated compiled path (or NULL on error).
+ */
+static wc_path *compile_path(const char *field) {
+    wc_path *p = calloc(1, sizeof(wc_path));
+    if (!p) {
+        perror("compile_path: calloc");
+        return NULL;
+    }
+    p->key = strdup(field);
+    if (!p->key) {
+        perror("compile_path: strdup");
+        goto cleanup;
+    }
+
+    size_t len = strlen(field);
+    size_t cnt = 1;
+    for (size_t i = 0; i < len; ++i) cnt += field[i] == '/';
+
+    p->comps = calloc(cnt, sizeof(wc_comp));
+    if (!p->comps) {
+        perror("compile_path: calloc");
+        goto cleanup;
+    }
+    p->absolute = field[0] == '/';
+    p->dironly = len > 0 && field[len - 1] == '/';
+
+    size_t l = 0;
+    for (size_t r = 0; r <= len; ++r) {
+        if (r < len && field[r] != '/') continue;
+        if (r > l) {
+            // Consecutive "**" components are the same as one
+            if (r - l == 2 && field[l] == '*' && field[l + 1] == '*') {
+                if (p->n == 0 || !p->comps[p->n - 1].globstar) p->comps[p->n++].globstar = 1;
+                l = r + 1;
+                continue;
+            }
+
+            wc_comp *comp = &p->comps[p->n++];
+            if (wc_compile(field + l, r - l, &comp->pat)) goto cleanup;
+            if (!comp->pat.wild) {
+                wc_free(&comp->pat);
+                comp->lit = unescape_n(field + l, r - l);
+                if (!comp->lit) goto cleanup;
+            }
+        }
+        l = r + 1;
+    }
+    return p;
+
+cleanup:
+    free_path(p);
+    return NULL;
+}
+
+static uint32_t hash_str(const char *s) {
+    uint32_t h = 2166136261u;
+    for (; *s; ++s) {
+        h ^= (unsigned char) *s;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Compiled pattern for a field, compiling it once per cache lifetime.
+ */
+static wc_path *get_path(const char *field) {
+    wc_path **slot = &pattern_cache[hash_str(field) % PATTERN_CACHE_SIZE];
+    if (*slot && strcmp((*slot)->key, field) == 0) return *slot;
+
+    wc_path *p = compile_path(field);
+    if (!p) return NULL;
+    free_path(*slot);
+    *slot = p;
+    return p;
+}
+
+// Directory Listing Cache
+
+static void free_listing(dir_listing *dl) {
+    if (!dl) return;
+    free(dl->path);
+    free(dl->pool);
+    free(dl->offs);
+    free(dl->types);
+    free(dl);
+}
+
+/**
+ * @brief Append one entry to a listing.
+ *
+ * @return non-zero if failed.
+ */
+static int listing_push(dir_listing *dl, const char *name, unsigned char type) {
+    size_t n = strlen(name) + 1;
+    if (dl->pool_len + n > dl->pool_cap) {
+        size_t cap = dl->pool_cap ? dl->pool_cap : 1024;
+        while (dl->pool_len + n > cap) cap <<= 1;
+        char *temp = realloc(dl->pool, cap);
+        if (!temp) {
+            perror("listing_push: realloc");
+            return -1;
+        }
+        dl->pool = temp;
+        dl->pool_cap = cap;
+    }
+    if (dl->n + 1 > dl->cap) {
+        size_t cap = dl->cap ? dl->cap << 1 : 64;
+        size_t *offs = realloc(dl->offs, cap * sizeof(size_t));
+        if (!offs) {
+            perror("listing_push: realloc");
+            return -1;
+        }
+        dl->offs = offs;
+        unsigned char *types = realloc(dl->types, cap);
+        if (!types) {
+            perror("listing_push: realloc");
+            return -1;
+        }
+        dl->types = types;
+        dl->cap = cap;
+    }
+    memcpy(dl->pool + dl->pool_len, name, n);
+    dl->offs[dl->n] = dl->pool_len;
+    dl->types[dl->n] = type;
+    dl->pool_len += n;
+    ++dl->n;
+    return 0;
+}
+
+/**
+ * @brief Read every entry of an open directory with large getdents64 batches.
+ *
+ * "." and ".." are skipped.
+ *
+ * @param fd directory file descriptor
+ * @param fn callback for each entry (non-zero return stops the read)
+ * @param arg callback argument
+ * @return non-zero if failed.
+ */
+static int read_dir_fd(int fd, int (*fn)(void *, const char *, unsigned char), void *arg) {
+    char *buf = malloc(GETDENTS_BUF_SIZE);
+    if (!buf) {
+        perror("read_dir_fd: malloc");
+        return -1;
+    }
+
+    int ret = 0;
+    while (!ret) {
+        long n = syscall(SYS_getdents64, fd, buf, GETDENTS_BUF_SIZE);
+        if (n <= 0) {
+            ret = n == 0 ? 0 : -1;
+            break;
+        }
+
+        for (long off = 0; off < n && !ret;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *) (buf + off);
+            off += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+            ret = fn(arg, d->d_name, d->d_type);
+        }
+    }
+
+    free(buf);
+    return ret;
+}
+
+static int listing_entry(void *arg, const char *name, unsigned char type) {
+    return listing_push((dir_listing *) arg, name, type);
+}
+
+/**
+ * @brief (Re)read a directory into a listing with large getdents64 batches.
+ *
+ * @return non-zero if the directory could not be read.
+ */
+static int read_listing(dir_listing *dl) {
+    dl->pool_len = 0;
+    dl->n = 0;
+
+    int fd = open(dl->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    dl->dev = st.st_dev;
+    dl->ino = st.st_ino;
+    dl->mtime = st.st_mtim;
+    clock_gettime(CLOCK_REALTIME, &dl->read_at);
+
+    int ret = read_dir_fd(fd, listing_entry, dl);
+    close(fd);
+    return ret;
+}
+
+/**
+ * @brief Checks whether a cached listing may still be used.
+ */
+static int listing_valid(const dir_listing *dl) {
+    struct stat st;
+    if (stat(dl->path, &st) == -1) return 0;
+    if (st.st_dev != dl->dev || st.st_ino != dl->ino) return 0;
+    if (st.st_mtim.tv_sec != dl->mtime.tv_sec || st.st_mtim.tv_nsec != dl->mtime.tv_nsec) return 0;
+
+    long long gap = (long long) (dl->read_at.tv_sec - dl->mtime.tv_sec) * 1000000000LL +
+                    (dl->read_at.tv_nsec - dl->mtime.tv_nsec);
+    return gap >= RACY_NSEC;
+}
+
+/**
+ * @brief Listing of a directory, read only if not cached or changed.
+ *
+ * @param path directory path
+ * @return listing owned by the cache, or NULL if unreadable.
+ */
+static dir_listing *get_listing(const char *path) {
+    dir_listing **slot = &dir_cache[hash_str(path) % DIR_CACHE_BUCKETS];
+    for (dir_listing *it = *slot; it; it = it->next) {
+        if (strcmp(it->path, path) != 0) continue;
+        if (listing_valid(it)) return it;
+        return read_listing(it) ? NULL : it;
+    }
+
+    dir_listing *dl = calloc(1, sizeof(dir_listing));
+    if (!dl) {
+        perror("get_listing: calloc");
+        return NULL;
+    }
+    dl->path = strdup(path);
+    if (!dl->path) {
+        perror("get_listing: strdup");
+        free_listing(dl);
+        return NULL;
+    }
+    if (read_listing(dl)) {
+        free_listing(dl);
+        return NULL;
+    }
+    dl->next = *slot;
+    *slot = dl;
+    return dl;
+}
+
+// Expansion
+
+static int match_push(match_list *out, char *s) {
+    if (!s) {
+        perror("match_push: malloc");
+        return -1;
+    }
+    if (out->len + 2 > out->cap) {
+        size_t cap = out->cap ? out->cap << 1 : 16;
+        char **temp = realloc(out->data, cap * sizeof(char *));
+        if (!temp) {
+            perror("match_push: realloc");
+            free(s);
+            return -1;
+        }
+        out->data = temp;
+        out->cap = cap;
+    }
+    out->data[out->len++] = s;
+    out->data[out->len] = NULL;
+    return 0;
+}
+
+/**
+ * @brief Concatenate prefix, name and an optional suffix.
+ */
+static char *join(const char *prefix, const char *name, const char *suffix) {
+    size_t n = strlen(prefix) + strlen(name) + strlen(suffix) + 1;
+    char *out = malloc(n);
+    if (out) snprintf(out, n, "%s%s%s", prefix, name, suffix);
+    return out;
+}
+
+static int is_dir_entry(const char *path, unsigned char type) {
+    if (type == DT_DIR) return 1;
+    if (type != DT_UNKNOWN && type != DT_LNK) return 0;
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static int globstar_walk(const wc_path *p, size_t ci, const char *prefix, match_list *out);
+
+/**
+ * @brief Match components [ci, n) below prefix and collect results.
+ *
+ * @param p compiled path
+ * @param ci component index
+ * @param prefix path matched so far ("" or ending with '/')
+ * @param out result list
+ * @return non-zero if failed.
+ */
+static int glob_walk(const wc_path *p, size_t ci, const char *prefix, match_list *out) {
+    const wc_comp *comp = &p->comps[ci];
+    int last = ci + 1 == p->n;
+
+    if (comp->globstar) return globstar_walk(p, ci, prefix, out);
+
+    if (comp->lit) {
+        char *path = join(prefix, comp->lit, "");
+        if (!path) return match_push(out, NULL);
+
+        int ret = 0;
+        if (!last) {
+            char *next = join(path, "/", "");
+            ret = next ? glob_walk(p, ci + 1, next, out) : match_push(out, NULL);
+            free(next);
+        } else {
+            struct stat st;
+            if (lstat(path, &st) == 0 && (!p->dironly || is_dir_entry(path, DT_UNKNOWN)))
+                ret = match_push(out, join(path, p->dironly ? "/" : "", ""));
+        }
+        free(path);
+        return ret;
+    }
+
+    dir_listing *dl = get_listing(*prefix ? prefix : ".");
+    if (!dl) return 0;
+
+    int dotok = comp->pat.nops > 0 && comp->pat.ops[0].type == WC_LIT && comp->pat.ops[0].c == '.';
+
+    // Collect matches first: recursion may re-read this listing.
+    match_list names = { .data = NULL, .len = 0, .cap = 0 };
+    for (size_t i = 0; i < dl->n; ++i) {
+        const char *name = dl->pool + dl->offs[i];
+        if (name[0] == '.' && !dotok) continue;
+        if (!wc_match(&comp->pat, name)) continue;
+
+        char *path = join(prefix, name, "");
+        if (!path) {
+            free_ptrv((void **) names.data, free);
+            return match_push(out, NULL);
+        }
+        if ((last && !p->dironly) || is_dir_entry(path, dl->types[i])) {
+            if (match_push(&names, path)) {
+                free_ptrv((void **) names.data, free);
+                return -1;
+            }
+        } else {
+            free(path);
+        }
+    }
+
+    int ret = 0;
+    for (size_t i = 0; i < names.len && !ret; ++i) {
+        if (last) {
+            ret = match_push(out, join(names.data[i], p->dironly ? "/" : "", ""));
+        } else {
+            char *next = join(names.data[i], "/", "");
+            ret = next ? glob_walk(p, ci + 1, next, out) : match_push(out, NULL);
+            free(next);
+        }
+    }
+    free_ptrv((void **) names.data, free);
+    return ret;
+}
+
+// Parallel Globstar Walker
+
+/**
+ * @brief Directory waiting to be read by the walker.
+ */
+typedef struct walk_item {
+    int fd; ///< Directory fd opened relative to its parent, or -1 to open by path.
+    char *rel; ///< Heap-allocated path prefix of the directory ("" or ending with '/').
+} walk_item;
+
+/**
+ * @brief Per-thread work deque: the owner pushes and pops at the bottom,
+ * thieves take from the top.
+ */
+typedef struct walk_deque {
+    pthread_mutex_t lock; ///< Protects the fields below.
+    walk_item *items; ///< Heap-allocated ring of items.
+    size_t top; ///< Index of the oldest item.
+    size_t len; ///< Number of items.
+    size_t cap; ///< Allocated capacity of items.
+} walk_deque;
+
+typedef struct walk_pool walk_pool;
+
+/**
+ * @brief Worker thread state.
+ */
+typedef struct walk_worker {
+    walk_pool *pool; ///< Owning pool.
+    size_t id; ///< Worker index (its deque).
+    match_list out; ///< Thread-local results.
+    int err; ///< Nonzero if an internal error occurred.
+} walk_worker;
+
+/**
+ * @brief Shared state of one globstar walk.
+ */
+typedef struct walk_pool {
+    walk_deque *deques; ///< One deque per worker.
+    walk_worker *workers; ///< Worker states.
+    size_t n; ///< Number of workers.
+    const wc_comp *match; ///< Component matched against entries, or NULL to collect directories.
+    int dironly; ///< Only directories match (entries get a trailing '/').
+    atomic_long pending; ///< Items queued or being processed.
+    atomic_long queued; ///< Items sitting in deques.
+    pthread_mutex_t idle_lock; ///< Guards sleeping on idle_cond.
+    pthread_cond_t idle_cond; ///< Signaled when work is queued or the walk ends.
+} walk_pool;
+
+/**
+ * @brief Queue a directory on a worker's deque.
+ *
+ * @return non-zero if failed.
+ */
+static int walk_push(walk_pool *pool, size_t id, int fd, char *rel) {
+    walk_deque *dq = &pool->deques[id];
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->len == dq->cap) {
+        size_t cap = dq->cap ? dq->cap << 1 : 64;
+        walk_item *items = malloc(cap * sizeof(walk_item));
+        if (!items) {
+            pthread_mutex_unlock(&dq->lock);
+            perror("walk_push: malloc");
+            return -1;
+        }
+        for (size_t i = 0; i < dq->len; ++i) items[i] = dq->items[(dq->top + i) % dq->cap];
+        free(dq->items);
+        dq->items = items;
+        dq->top = 0;
+        dq->cap = cap;
+    }
+    dq->items[(dq->top + dq->len) % dq->cap] = (walk_item){ .fd = fd, .rel = rel };
+    ++dq->len;
+    atomic_fetch_add(&pool->pending, 1);
+    atomic_fetch_add(&pool->queued, 1);
+    pthread_mutex_unlock(&dq->lock);
+
+    pthread_mutex_lock(&pool->idle_lock);
+    pthread_cond_signal(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+    return 0;
+}
+
+/**
+ * @brief Take an item: newest from the own deque, else oldest from another one.
+ *
+ * @return 1 if an item was taken, 0 otherwise.
+ */
+static int walk_take(walk_pool *pool, size_t id, walk_item *item) {
+    for (size_t k = 0; k < pool->n; ++k) {
+        walk_deque *dq = &pool->deques[(id + k) % pool->n];
+        pthread_mutex_lock(&dq->lock);
+        if (dq->len > 0) {
+            if (k == 0) {
+                *item = dq->items[(dq->top + dq->len - 1) % dq->cap];
+            } else {
+                *item = dq->items[dq->top];
+                dq->top = (dq->top + 1) % dq->cap;
+            }
+            --dq->len;
+            atomic_fetch_sub(&pool->queued, 1);
+            pthread_mutex_unlock(&dq->lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&dq->lock);
+    }
+    return 0;
+}
+
+static int comp_match(const wc_comp *comp, const char *name) {
+    if (comp->lit) return strcmp(comp->lit, name) == 0;
+    return wc_match(&comp->pat, name);
+}
+
+static int comp_dotok(const wc_comp *comp) {
+    if (comp->lit) return comp->lit[0] == '.';
+    return comp->pat.nops > 0 && comp->pat.ops[0].type == WC_LIT && comp->pat.ops[0].c == '.';
+}
+
+/**
+ * @brief Entry callback state while reading one directory.
+ */
+typedef struct walk_visit {
+    walk_worker *w; ///< Worker reading the directory.
+    int fd; ///< Directory being read.
+    const char *rel; ///< Its path prefix.
+} walk_visit;
+
+static int walk_entry(void *arg, const char *name, unsigned char type) {
+    walk_visit *v = arg;
+    walk_worker *w = v->w;
+    walk_pool *pool = w->pool;
+
+    // Symlinks are not followed, like other shells' globstar
+    if (type == DT_UNKNOWN) {
+        struct stat st;
+        if (fstatat(v->fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode)) type = DT_DIR;
+    }
+    int isdir = type == DT_DIR;
+
+    if (pool->match) {
+        if ((name[0] != '.' || comp_dotok(pool->match)) && (isdir || !pool->dironly) &&
+            comp_match(pool->match, name) &&
+            match_push(&w->out, join(v->rel, name, pool->dironly ? "/" : "")))
+            return -1;
+    } else if (isdir && name[0] != '.' && match_push(&w->out, join(v->rel, name, "/"))) {
+        return -1;
+    }
+
+    // Hidden directories are not descended into
+    if (!isdir || name[0] == '.') return 0;
+
+    char *rel = join(v->rel, name, "/");
+    if (!rel) {
+        perror("walk_entry: malloc");
+        return -1;
+    }
+    int fd = -1;
+    if (atomic_load(&pool->queued) < WALK_MAX_OPEN_ITEMS)
+        fd = openat(v->fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (walk_push(pool, w->id, fd, rel)) {
+        if (fd != -1) close(fd);
+        free(rel);
+        return -1;
+    }
+    return 0;
+}
+
+static void *walk_thread(void *arg) {
+    walk_worker *w = arg;
+    walk_pool *pool = w->pool;
+
+    while (1) {
+        walk_item item;
+        if (!walk_take(pool, w->id, &item)) {
+            pthread_mutex_lock(&pool->idle_lock);
+            while (atomic_load(&pool->pending) > 0 && atomic_load(&pool->queued) == 0)
+                pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+            int done = atomic_load(&pool->pending) == 0;
+            pthread_mutex_unlock(&pool->idle_lock);
+            if (done) break;
+            continue;
+        }
+
+        int fd = item.fd;
+        if (fd == -1)
+            fd = open(*item.rel ? item.rel : ".", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd != -1) {
+            walk_visit v = { .w = w, .fd = fd, .rel = item.rel };
+            // Unreadable directories are skipped, only allocation failures count
+            if (read_dir_fd(fd, walk_entry, &v) && errno == ENOMEM) w->err = 1;
+            close(fd);
+        }
+        free(item.rel);
+
+        if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+            pthread_mutex_lock(&pool->idle_lock);
+            pthread_cond_broadcast(&pool->idle_cond);
+            pthread_mutex_unlock(&pool->idle_lock);
+        }
+    }
+    return NULL;
+}
+
+static size_t walk_threads(void) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    long n = ncpu > 0 ? ncpu * 2 : WALK_MIN_THREADS;
+    if (n < WALK_MIN_THREADS) n = WALK_MIN_THREADS;
+    if (n > WALK_MAX_THREADS) n = WALK_MAX_THREADS;
+    return (size_t) n;
+}
+
+/**
+ * @brief Walk every directory below root on a thread pool.
+ *
+ * With a match component, entries matching it are collected; otherwise every
+ * directory (not including root) is collected.
+ *
+ * @param root path prefix ("" or ending with '/')
+ * @param match component to match, or NULL
+ * @param dironly only directories match
+ * @param out result list (unsorted)
+ * @return non-zero if failed.
+ */
+static int walk_tree(const char *root, const wc_comp *match, int dironly, match_list *out) {
+    int ret = -1;
+    walk_pool pool = {
+        .deques = NULL,
+        .workers = NULL,
+        .n = walk_threads(),
+        .match = match,
+        .dironly = dironly
+    };
+    atomic_init(&pool.pending, 0);
+    atomic_init(&pool.queued, 0);
+    pthread_mutex_init(&pool.idle_lock, NULL);
+    pthread_cond_init(&pool.idle_cond, NULL);
+
+    pthread_t *threads = calloc(pool.n, sizeof(pthread_t));
+    pool.deques = calloc(pool.n, sizeof(walk_deque));
+    pool.workers = calloc(pool.n, sizeof(walk_worker));
+    if (!threads || !pool.deques || !pool.workers) {
+        perror("walk_tree: calloc");
+        goto cleanup;
+    }
+    for (size_t i = 0; i < pool.n; ++i) {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.workers[i].pool = &pool;
+        pool.workers[i].id = i;
+    }
+
+    int fd = open(*root ? root : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        ret = 0; // nothing to walk
+        goto cleanup;
+    }
+    char *rel = strdup(root);
+    if (!rel || walk_push(&pool, 0, fd, rel)) {
+        close(fd);
+        free(rel);
+        goto cleanup;
+    }
+
+    size_t started = 0;
+    for (; started < pool.n; ++started)
+        if (pthread_create(&threads[started], NULL, walk_thread, &pool.workers[started])) break;
+    if (started == 0) {
+        // No threads available: walk on the calling thread
+        walk_thread(&pool.workers[0]);
+    }
+    for (size_t i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+
+    // Merge thread-local results
+    ret = 0;
+    for (size_t i = 0; i < pool.n; ++i) {
+        walk_worker *w = &pool.workers[i];
+        if (w->err) ret = -1;
+        for (size_t k = 0; k < w->out.len; ++k) {
+            if (!ret && match_push(out, w->out.data[k])) ret = -1;
+            else if (ret) free(w->out.data[k]);
+        }
+        free(w->out.data);
+        w->out.data = NULL;
+    }
+
+cleanup:
+    if (pool.deques) {
+        for (size_t i = 0; i < pool.n; ++i) {
+            walk_deque *dq = &pool.deques[i];
+            for (size_t k = 0; k < dq->len; ++k) {
+                walk_item *it = &dq->items[(dq->top + k) % dq->cap];
+                if (it->fd != -1) close(it->fd);
+                free(it->rel);
+            }
+            free(dq->items);
+            pthread_mutex_destroy(&dq->lock);
+        }
+    }
+    if (pool.workers)
+        for (size_t i = 0; i < pool.n; ++i) free_ptrv((void **) pool.workers[i].out.data, free);
+    free(pool.deques);
+    free(pool.workers);
+    free(threads);
+    pthread_mutex_destroy(&pool.idle_lock);
+    pthread_cond_destroy(&pool.idle_cond);
+    return ret;
+}
+
+/**
+ * @brief Match a "**" component (zero or more directories) at index ci.
+ *
+ * A trailing "** /name" is matched by the walker threads directly; other
+ * tails are matched below every directory the walker found.
+ */
+static int globstar_walk(const wc_path *p, size_t ci, const char *prefix, match_list *out) {
+    // "**" last: every file and directory below prefix
+    if (ci + 1 == p->n) {
+        wc_comp all = { .lit = NULL, .pat = { .ops = NULL, .nops = 0, .wild = 1 }, .globstar = 0 };
+        wc_op star = { .type = WC_STAR };
+        all.pat.ops = &star;
+        all.pat.nops = 1;
+        return walk_tree(prefix, &all, p->dironly, out);
+    }
+
+    // "** /tail": match entries while walking
+    if (ci + 2 == p->n) return walk_tree(prefix, &p->comps[ci + 1], p->dironly, out);
+
+    // General case: prefix itself and every directory below it
+    match_list dirs = { .data = NULL, .len = 0, .cap = 0 };
+    if (walk_tree(prefix, NULL, 0, &dirs)) {
+        free_ptrv((void **) dirs.data, free);
+        return -1;
+    }
+    int ret = glob_walk(p, ci + 1, prefix, out);
+    for (size_t i = 0; i < dirs.len && !ret; ++i)
+        ret = glob_walk(p, ci + 1, dirs.data[i], out);
+    free_ptrv((void **) dirs.data, free);
+    return ret;
+}
+
+static int cmp_str(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+char **glob_field(const char *field) {
+    match_list out = { .data = NULL, .len = 0, .cap = 0 };
+
+    wc_path *p = get_path(field);
+    if (!p) return NULL;
+
+    if (p->n > 0 && glob_walk(p, 0, p->absolute ? "/" : "", &out)) {
+        free_ptrv((void **) out.data, free);
+        return NULL;
+    }
+
+    if (!out.data) {
+        out.data = calloc(1, sizeof(char *));
+        if (!out.data) perror("glob_field: calloc");
+        return out.data;
+    }
+    qsort(out.data, out.len, sizeof(char *), cmp_str);
+    return out.data;
+}
+
+void glob_cache_flush(void) {
+    for (size_t i = 0; i < DIR_CACHE_BUCKETS; ++i) {
+        dir_listing *it = dir_cache[i];
+        while (it) {
+            dir_listing *next = it->next;
+            free_listing(it);
+            it = next;
+        }
+        dir_cache[i] = NULL;
+    }
+    for (size_t i = 0; i < PATTERN_CACHE_SIZE; ++i) {
+        free_path(pattern_cache[i]);
+        pattern_cache[i] = NULL;
+    }
+}
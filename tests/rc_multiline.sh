@@ -0,0 +1,71 @@
+#!/usr/bin/env bash
+# Startup file with multi-line commands: a function body and an if block
+# spread over several lines must run as whole commands, both when the file
+# is sourced and when its functions are replayed from the snapshot.
+#
+# Usage: tests/rc_multiline.sh [shell]
+
+SHELL_BIN=${1:-build/mini-shell}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+if [ ! -x "$SHELL_BIN" ]; then
+    echo "rc_multiline: $SHELL_BIN not found (run make first)" >&2
+    exit 1
+fi
+
+fail=0
+check() {
+    local name=$1 expected=$2 actual=$3
+    if [ "$actual" != "$expected" ]; then
+        echo "FAIL $name"
+        echo "  expected: $(printf '%q' "$expected")"
+        echo "  actual:   $(printf '%q' "$actual")"
+        fail=1
+    else
+        echo "ok   $name"
+    fi
+}
+
+# Only declarative commands: snapshotted after the first launch
+cat > "$TMP/rc_func" <<'RC'
+# greeting
+greet() {
+    echo "hi $1"
+    if [ "$1" = root ]
+    then
+        echo admin
+    fi
+}
+
+NAME="multi
+line"
+RC
+
+# An if block run while the file loads: sourced on every launch
+cat > "$TMP/rc_if" <<'RC'
+if true
+then
+    echo loaded
+else
+    echo wrong
+fi
+RC
+
+run() {
+    MINISHELLRC=$1 "$SHELL_BIN" 2>&1 | grep -v '> $' | sed 's/^[^>]*> //'
+}
+
+for launch in sourced snapshot; do
+    out=$(printf 'greet you\ngreet root\necho "$NAME"\n' | run "$TMP/rc_func")
+    check "function ($launch)" $'hi you\nhi root\nadmin\nmulti\nline' "$out"
+done
+[ -f "$TMP/rc_func.snap" ]
+check "function snapshot written" 0 "$?"
+
+out=$(run "$TMP/rc_if" < /dev/null)
+check "if block" "loaded" "$out"
+[ ! -f "$TMP/rc_if.snap" ]
+check "if block not snapshotted" 0 "$?"
+
+exit $fail
@@ -0,0 +1,127 @@
+#!/usr/bin/env bash
+# Regenerate the perfect hash of the compiled-in builtin names in
+# src/builtin.c: the coefficients and slot table between the
+# "BEGIN builtin hash" and "END builtin hash" markers. The names are read
+# from builtins[]; the current coefficients are kept while they still work.
+#
+# Usage: tools/gen_builtin_hash.sh [--check] [src/builtin.c]
+#   --check  only verify the table, exit 1 if it is out of date
+
+CHECK=0
+if [ "$1" = "--check" ]; then
+    CHECK=1
+    shift
+fi
+SRC=${1:-src/builtin.c}
+
+if [ ! -f "$SRC" ]; then
+    echo "gen_builtin_hash: $SRC not found" >&2
+    exit 1
+fi
+
+mapfile -t names < <(awk '
+    /^static builtin_cmd builtins\[\] = \{/ { on = 1; next }
+    on && /\{NULL, NULL, 0\}/ { exit }
+    on && match($0, /\{"[^"]*"/) { print substr($0, RSTART + 2, RLENGTH - 3) }
+' "$SRC")
+n=${#names[@]}
+if ((n == 0 || n > 255)); then
+    echo "gen_builtin_hash: Cannot read builtins[] from $SRC" >&2
+    exit 1
+fi
+
+# Hash inputs of every name: length, first, second (0 if none) and last byte
+lens=() firsts=() seconds=() lasts=()
+for name in "${names[@]}"; do
+    len=${#name}
+    lens+=("$len")
+    firsts+=("$(printf '%d' "'${name:0:1}")")
+    if ((len > 1)); then seconds+=("$(printf '%d' "'${name:1:1}")"); else seconds+=(0); fi
+    lasts+=("$(printf '%d' "'${name:len-1:1}")")
+done
+
+current() {
+    sed -n "s/^#define $1 \([0-9]*\).*/\1/p" "$SRC"
+}
+
+# Fill slots[] for the given coefficients; fails on a collision
+slots=()
+try() {
+    local size=$1 a=$2 b=$3 c=$4 i h
+    slots=()
+    for ((i = 0; i < size; ++i)); do slots[i]=0; done
+    for ((i = 0; i < n; ++i)); do
+        h=$(((a * lens[i] + b * firsts[i] + c * lasts[i] + seconds[i]) % size))
+        ((slots[h])) && return 1
+        slots[h]=$((i + 1))
+    done
+    return 0
+}
+
+size=$(current BUILTIN_SLOTS) a=$(current BUILTIN_HASH_LEN)
+b=$(current BUILTIN_HASH_FIRST) c=$(current BUILTIN_HASH_LAST)
+found=0
+if [ -n "$size" ] && [ -n "$a" ] && [ -n "$b" ] && [ -n "$c" ] && ((size >= n)) && try "$size" "$a" "$b" "$c"; then
+    found=1
+fi
+
+if ((CHECK)); then
+    table=$(sed -n '/^static const uint8_t builtin_slots\[/,/^};/{//!p}' "$SRC" | tr -cs '0-9' ' ')
+    if ((!found)) || [ "$(echo $table)" != "${slots[*]}" ]; then
+        echo "gen_builtin_hash: The builtin hash table of $SRC is out of date (run tools/gen_builtin_hash.sh)" >&2
+        exit 1
+    fi
+    exit 0
+fi
+
+# Smallest power of two table first, then the smallest coefficients
+if ((!found)); then
+    for ((size = 16; size < n; size *= 2)); do :; done
+    while ((!found && size <= 256)); do
+        for ((a = 1; a < 32 && !found; ++a)); do
+            for ((b = 1; b < 32 && !found; ++b)); do
+                for ((c = 1; c < 32 && !found; ++c)); do
+                    try "$size" "$a" "$b" "$c" && found=1
+                done
+            done
+        done
+        ((found)) || ((size *= 2))
+    done
+    # The loops increment once more after a hit
+    ((a--, b--, c--))
+    if ((!found)); then
+        echo "gen_builtin_hash: No perfect hash found" >&2
+        exit 1
+    fi
+fi
+
+block=$(
+    echo "// BEGIN builtin hash (generated by tools/gen_builtin_hash.sh, do not edit)"
+    echo "#define BUILTIN_SLOTS $size"
+    echo "#define BUILTIN_HASH_LEN $a"
+    echo "#define BUILTIN_HASH_FIRST $b"
+    echo "#define BUILTIN_HASH_LAST $c"
+    echo
+    echo "static const uint8_t builtin_slots[BUILTIN_SLOTS] = {"
+    for ((i = 0; i < size; i += 16)); do
+        line="   "
+        for ((k = i; k < i + 16 && k < size; ++k)); do line+=" ${slots[k]},"; done
+        echo "$line"
+    done
+    echo "};"
+    echo "// END builtin hash"
+)
+
+tmp=$(mktemp)
+trap 'rm -f "$tmp"' EXIT
+BLOCK=$block awk '
+    /BEGIN builtin hash/ { print ENVIRON["BLOCK"]; skip = 1; next }
+    skip && /END builtin hash/ { skip = 0; next }
+    !skip
+' "$SRC" > "$tmp"
+if ! grep -q "BEGIN builtin hash" "$tmp"; then
+    echo "gen_builtin_hash: No BEGIN/END builtin hash markers in $SRC" >&2
+    exit 1
+fi
+cat "$tmp" > "$SRC"
+echo "gen_builtin_hash: $n builtins, $size slots, hash ($a * len + $b * name[0] + $c * name[len - 1] + name[1]) % $size"